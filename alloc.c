@@ -30,8 +30,30 @@ struct alloc_state {
 	int count; /* total number of nodes allocated */
 	int nr;    /* number of nodes left in current allocation */
 	void *p;   /* first free node in current allocation */
+
+	/* all allocations, so that a pool can be freed */
+	void **slabs;
+	int slab_nr, slab_alloc;
+};
+
+/*
+ * Nodes come from the innermost object pool.  The global pool is never
+ * freed; pools pushed on top of it can be, together with every object
+ * allocated from them.
+ */
+struct object_pool {
+	const char *name;
+	struct object_pool *prev;
+	struct alloc_state blob_state;
+	struct alloc_state tree_state;
+	struct alloc_state commit_state;
+	struct alloc_state tag_state;
+	struct alloc_state object_state;
 };
 
+static struct object_pool global_pool = { "global" };
+static struct object_pool *current_pool = &global_pool;
+
 static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 {
 	void *ret;
@@ -39,6 +61,8 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	if (!s->nr) {
 		s->nr = BLOCKING;
 		s->p = xmalloc(BLOCKING * node_size);
+		ALLOC_GROW(s->slabs, s->slab_nr + 1, s->slab_alloc);
+		s->slabs[s->slab_nr++] = s->p;
 	}
 	s->nr--;
 	s->count++;
@@ -48,39 +72,34 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	return ret;
 }
 
-static struct alloc_state blob_state;
 void *alloc_blob_node(void)
 {
-	struct blob *b = alloc_node(&blob_state, sizeof(struct blob));
+	struct blob *b = alloc_node(&current_pool->blob_state, sizeof(struct blob));
 	b->object.type = OBJ_BLOB;
 	return b;
 }
 
-static struct alloc_state tree_state;
 void *alloc_tree_node(void)
 {
-	struct tree *t = alloc_node(&tree_state, sizeof(struct tree));
+	struct tree *t = alloc_node(&current_pool->tree_state, sizeof(struct tree));
 	t->object.type = OBJ_TREE;
 	return t;
 }
 
-static struct alloc_state tag_state;
 void *alloc_tag_node(void)
 {
-	struct tag *t = alloc_node(&tag_state, sizeof(struct tag));
+	struct tag *t = alloc_node(&current_pool->tag_state, sizeof(struct tag));
 	t->object.type = OBJ_TAG;
 	return t;
 }
 
-static struct alloc_state object_state;
 void *alloc_object_node(void)
 {
-	struct object *obj = alloc_node(&object_state, sizeof(union any_object));
+	struct object *obj = alloc_node(&current_pool->object_state, sizeof(union any_object));
 	obj->type = OBJ_NONE;
 	return obj;
 }
 
-static struct alloc_state commit_state;
 
 unsigned int alloc_commit_index(void)
 {
@@ -90,12 +109,175 @@ unsigned int alloc_commit_index(void)
 
 void *alloc_commit_node(void)
 {
-	struct commit *c = alloc_node(&commit_state, sizeof(struct commit));
+	struct commit *c = alloc_node(&current_pool->commit_state, sizeof(struct commit));
 	c->object.type = OBJ_COMMIT;
 	c->index = alloc_commit_index();
+	c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+	c->generation = GENERATION_NUMBER_INFINITY;
 	return c;
 }
 
+struct object_pool *push_object_pool(const char *name)
+{
+	struct object_pool *pool = xcalloc(1, sizeof(*pool));
+
+	pool->name = name;
+	pool->prev = current_pool;
+	current_pool = pool;
+	return pool;
+}
+
+struct slab_range {
+	const char *start, *end;
+};
+
+static int slab_range_cmp(const void *a_, const void *b_)
+{
+	const struct slab_range *a = a_, *b = b_;
+
+	if (a->start < b->start)
+		return -1;
+	return a->start > b->start;
+}
+
+struct pool_slabs {
+	struct slab_range *range;
+	int nr, alloc;
+};
+
+static void add_slabs(struct pool_slabs *ps, struct alloc_state *s,
+		      size_t node_size)
+{
+	int i;
+
+	ALLOC_GROW(ps->range, ps->nr + s->slab_nr, ps->alloc);
+	for (i = 0; i < s->slab_nr; i++) {
+		ps->range[ps->nr].start = s->slabs[i];
+		ps->range[ps->nr].end = (char *)s->slabs[i] + BLOCKING * node_size;
+		ps->nr++;
+	}
+}
+
+static void free_slabs(struct alloc_state *s)
+{
+	int i;
+
+	for (i = 0; i < s->slab_nr; i++)
+		free(s->slabs[i]);
+	free(s->slabs);
+}
+
+static int in_pool(const struct pool_slabs *ps, const void *p)
+{
+	int lo = 0, hi = ps->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if ((const char *)p < ps->range[mi].start)
+			hi = mi;
+		else if ((const char *)p >= ps->range[mi].end)
+			lo = mi + 1;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+static void release_pool_object(struct object *obj)
+{
+	switch (obj->type) {
+	case OBJ_COMMIT: {
+		struct commit *c = (struct commit *)obj;
+		free_commit_buffer(c);
+		free_commit_list(c->parents);
+		break;
+	}
+	case OBJ_TREE:
+		free_tree_buffer((struct tree *)obj);
+		break;
+	case OBJ_TAG:
+		free(((struct tag *)obj)->tag);
+		break;
+	}
+}
+
+/*
+ * An object that outlives the pool may have been parsed while the pool
+ * was active and point into it; make it parse itself again instead.
+ */
+static void unparse_if_pointing_into(struct object *obj,
+				     const struct pool_slabs *ps)
+{
+	struct commit_list *p;
+
+	if (!obj->parsed)
+		return;
+	switch (obj->type) {
+	case OBJ_COMMIT: {
+		struct commit *c = (struct commit *)obj;
+		int dangling = c->tree && in_pool(ps, c->tree);
+		for (p = c->parents; p && !dangling; p = p->next)
+			dangling = in_pool(ps, p->item);
+		if (dangling) {
+			free_commit_list(c->parents);
+			c->parents = NULL;
+			c->tree = NULL;
+			obj->parsed = 0;
+		}
+		break;
+	}
+	case OBJ_TAG: {
+		struct tag *t = (struct tag *)obj;
+		if (t->tagged && in_pool(ps, t->tagged)) {
+			free(t->tag);
+			t->tag = NULL;
+			t->tagged = NULL;
+			obj->parsed = 0;
+		}
+		break;
+	}
+	}
+}
+
+static int keep_outside_pool(struct object *obj, void *data)
+{
+	const struct pool_slabs *ps = data;
+
+	if (in_pool(ps, obj)) {
+		release_pool_object(obj);
+		return 0;
+	}
+	unparse_if_pointing_into(obj, ps);
+	return 1;
+}
+
+void pop_object_pool(struct object_pool *pool)
+{
+	struct pool_slabs ps = { NULL };
+
+	if (pool != current_pool || pool == &global_pool)
+		die("BUG: object pools must be popped innermost first");
+
+	add_slabs(&ps, &pool->blob_state, sizeof(struct blob));
+	add_slabs(&ps, &pool->tree_state, sizeof(struct tree));
+	add_slabs(&ps, &pool->commit_state, sizeof(struct commit));
+	add_slabs(&ps, &pool->tag_state, sizeof(struct tag));
+	add_slabs(&ps, &pool->object_state, sizeof(union any_object));
+	qsort(ps.range, ps.nr, sizeof(*ps.range), slab_range_cmp);
+
+	object_hash_filter(keep_outside_pool, &ps);
+
+	free_slabs(&pool->blob_state);
+	free_slabs(&pool->tree_state);
+	free_slabs(&pool->commit_state);
+	free_slabs(&pool->tag_state);
+	free_slabs(&pool->object_state);
+	free(ps.range);
+
+	current_pool = pool->prev;
+	free(pool);
+}
+
 static void report(const char *name, unsigned int count, size_t size)
 {
 	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)\n",
@@ -103,13 +285,19 @@ static void report(const char *name, unsigned int count, size_t size)
 }
 
 #define REPORT(name, type)	\
-    report(#name, name##_state.count, name##_state.count * sizeof(type) >> 10)
+    report(#name, pool->name##_state.count, \
+	   pool->name##_state.count * sizeof(type) >> 10)
 
 void alloc_report(void)
 {
-	REPORT(blob, struct blob);
-	REPORT(tree, struct tree);
-	REPORT(commit, struct commit);
-	REPORT(tag, struct tag);
-	REPORT(object, union any_object);
+	struct object_pool *pool;
+
+	for (pool = current_pool; pool; pool = pool->prev) {
+		fprintf(stderr, "%s pool:\n", pool->name);
+		REPORT(blob, struct blob);
+		REPORT(tree, struct tree);
+		REPORT(commit, struct commit);
+		REPORT(tag, struct tag);
+		REPORT(object, union any_object);
+	}
 }
@@ -19,6 +19,8 @@
 #include "column.h"
 #include "utf8.h"
 #include "wt-status.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 static const char * const builtin_branch_usage[] = {
 	N_("git branch [options] [-r | -a] [--merged | --no-merged]"),
@@ -322,6 +324,22 @@ static int match_patterns(const char **pattern, const char *refname)
 	return 0;
 }
 
+/*
+ * Like is_descendant_of(), but answered from the bitmap index when there
+ * is one.
+ */
+static int branch_contains(struct commit *commit, struct commit_list *with_commit)
+{
+	int ret;
+
+	if (!with_commit)
+		return 1;
+	ret = bitmap_commit_contains(commit, with_commit);
+	if (ret < 0)
+		ret = is_descendant_of(commit, with_commit);
+	return ret;
+}
+
 static int append_ref(const char *refname, const unsigned char *sha1, int flags, void *cb_data)
 {
 	struct append_ref_cb *cb = (struct append_ref_cb *)(cb_data);
@@ -368,7 +386,7 @@ static int append_ref(const char *refname, const unsigned char *sha1, int flags,
 		}
 
 		/* Filter with with_commit if specified */
-		if (!is_descendant_of(commit, ref_list->with_commit))
+		if (!branch_contains(commit, ref_list->with_commit))
 			return 0;
 
 		if (merge_filter != NO_FILTER)
@@ -611,7 +629,7 @@ static void show_detached(struct ref_list *ref_list)
 {
 	struct commit *head_commit = lookup_commit_reference_gently(head_sha1, 1);
 
-	if (head_commit && is_descendant_of(head_commit, ref_list->with_commit)) {
+	if (head_commit && branch_contains(head_commit, ref_list->with_commit)) {
 		struct ref_item item;
 		item.name = get_head_description();
 		item.width = utf8_strwidth(item.name);
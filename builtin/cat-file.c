@@ -230,14 +230,29 @@ static void print_object_or_die(int fd, struct expand_data *data)
 struct batch_options {
 	int enabled;
 	int print_contents;
+	int unordered;
 	const char *format;
 };
 
-static int batch_one_object(const char *obj_name, struct batch_options *opt,
-			    struct expand_data *data)
+static void batch_object_write(struct batch_options *opt,
+			       struct expand_data *data)
 {
 	struct strbuf buf = STRBUF_INIT;
 
+	strbuf_expand(&buf, opt->format, expand_format, data);
+	strbuf_addch(&buf, '\n');
+	write_or_die(1, buf.buf, buf.len);
+	strbuf_release(&buf);
+
+	if (opt->print_contents) {
+		print_object_or_die(1, data);
+		write_or_die(1, "\n", 1);
+	}
+}
+
+static int batch_one_object(const char *obj_name, struct batch_options *opt,
+			    struct expand_data *data)
+{
 	if (!obj_name)
 	   return 1;
 
@@ -253,22 +268,92 @@ static int batch_one_object(const char *obj_name, struct batch_options *opt,
 		return 0;
 	}
 
-	strbuf_expand(&buf, opt->format, expand_format, data);
-	strbuf_addch(&buf, '\n');
-	write_or_die(1, buf.buf, buf.len);
-	strbuf_release(&buf);
+	batch_object_write(opt, data);
+	return 0;
+}
 
-	if (opt->print_contents) {
-		print_object_or_die(1, data);
-		write_or_die(1, "\n", 1);
+/*
+ * With --unordered, we read all of the input first and then show the
+ * objects in the order they are stored in, which saves a lot of
+ * seeking when asking about many objects of a large pack.
+ */
+struct batch_queue {
+	unsigned char (*sha1)[20];
+	char **name;
+	char **rest;
+	int nr, alloc;
+};
+
+struct batch_queue_cb {
+	struct batch_queue *queue;
+	struct batch_options *opt;
+	struct expand_data *data;
+};
+
+static int batch_queued_object(int nr, int ret, void *vcb)
+{
+	struct batch_queue_cb *cb = vcb;
+	struct batch_queue *queue = cb->queue;
+
+	if (ret < 0) {
+		printf("%s missing\n", queue->name[nr]);
+		fflush(stdout);
+		return 0;
 	}
+	hashcpy(cb->data->sha1, queue->sha1[nr]);
+	cb->data->rest = queue->rest[nr];
+	batch_object_write(cb->opt, cb->data);
 	return 0;
 }
 
+static void batch_queue_object(struct batch_queue *queue, const char *obj_name,
+			       const char *rest, struct expand_data *data)
+{
+	int nr = queue->nr;
+
+	if (get_sha1(obj_name, data->sha1)) {
+		printf("%s missing\n", obj_name);
+		fflush(stdout);
+		return;
+	}
+	ALLOC_GROW(queue->sha1, nr + 1, queue->alloc);
+	queue->name = xrealloc(queue->name, queue->alloc * sizeof(*queue->name));
+	queue->rest = xrealloc(queue->rest, queue->alloc * sizeof(*queue->rest));
+	hashcpy(queue->sha1[nr], data->sha1);
+	queue->name[nr] = xstrdup(obj_name);
+	queue->rest[nr] = rest ? xstrdup(rest) : NULL;
+	queue->nr++;
+}
+
+static void batch_queue_flush(struct batch_queue *queue,
+			      struct batch_options *opt,
+			      struct expand_data *data)
+{
+	struct batch_queue_cb cb;
+	int i;
+
+	cb.queue = queue;
+	cb.opt = opt;
+	cb.data = data;
+	sha1_object_info_batch((const unsigned char (*)[20])queue->sha1,
+			       queue->nr, &data->info, LOOKUP_REPLACE_OBJECT,
+			       1, batch_queued_object, &cb);
+
+	for (i = 0; i < queue->nr; i++) {
+		free(queue->name[i]);
+		free(queue->rest[i]);
+	}
+	free(queue->sha1);
+	free(queue->name);
+	free(queue->rest);
+	memset(queue, 0, sizeof(*queue));
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct expand_data data;
+	struct batch_queue queue = { NULL };
 	int save_warning;
 	int retval = 0;
 
@@ -317,11 +402,19 @@ static int batch_objects(struct batch_options *opt)
 			data.rest = p;
 		}
 
+		if (opt->unordered) {
+			batch_queue_object(&queue, buf.buf, data.rest, &data);
+			continue;
+		}
+
 		retval = batch_one_object(buf.buf, opt, &data);
 		if (retval)
 			break;
 	}
 
+	if (opt->unordered)
+		batch_queue_flush(&queue, opt, &data);
+
 	strbuf_release(&buf);
 	warn_on_object_refname_ambiguity = save_warning;
 	return retval;
@@ -329,7 +422,7 @@ static int batch_objects(struct batch_options *opt)
 
 static const char * const cat_file_usage[] = {
 	N_("git cat-file (-t|-s|-e|-p|<type>|--textconv) <object>"),
-	N_("git cat-file (--batch|--batch-check) < <list_of_objects>"),
+	N_("git cat-file (--batch|--batch-check) [--unordered] < <list_of_objects>"),
 	NULL
 };
 
@@ -348,7 +441,9 @@ static int batch_option_callback(const struct option *opt,
 	struct batch_options *bo = opt->value;
 
 	if (unset) {
+		int unordered = bo->unordered;
 		memset(bo, 0, sizeof(*bo));
+		bo->unordered = unordered;
 		return 0;
 	}
 
@@ -380,6 +475,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 0, "batch-check", &batch, "format",
 			N_("show info about objects fed from the standard input"),
 			PARSE_OPT_OPTARG, batch_option_callback },
+		OPT_BOOL(0, "unordered", &batch.unordered,
+			 N_("with --batch or --batch-check, show objects in storage order")),
 		OPT_END()
 	};
 
@@ -406,6 +503,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	if (batch.enabled && (opt || argc)) {
 		usage_with_options(cat_file_usage, options);
 	}
+	if (batch.unordered && !batch.enabled)
+		usage_with_options(cat_file_usage, options);
 
 	if (batch.enabled)
 		return batch_objects(&batch);
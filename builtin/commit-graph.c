@@ -0,0 +1,31 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "commit-graph.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph write [--reachable]"),
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	int reachable = 0;
+	const struct option builtin_commit_graph_options[] = {
+		OPT_BOOL(0, "reachable", &reachable,
+			 N_("start walk at all refs instead of all packed commits")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_commit_graph_options,
+			     builtin_commit_graph_usage, 0);
+
+	if (argc == 1 && !strcmp(argv[0], "write"))
+		return write_commit_graph(reachable);
+
+	usage_with_options(builtin_commit_graph_usage,
+			   builtin_commit_graph_options);
+}
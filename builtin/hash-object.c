@@ -9,6 +9,8 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec_cmd.h"
+#include "bulk-checkin.h"
+#include "sha1-multi.h"
 
 static void hash_fd(int fd, const char *type, int write_object, const char *path)
 {
@@ -38,20 +40,90 @@ static void hash_object(const char *path, const char *type, int write_object,
 
 static int no_filters;
 
+/*
+ * Small blobs that are only hashed are read in batches and hashed
+ * together by sha1_multi().
+ */
+#define HASH_BATCH 64
+#define HASH_BATCH_FILE_SIZE (64 * 1024)
+
+static struct hash_batch {
+	struct sha1_multi_msg msg[HASH_BATCH];
+	struct strbuf data[HASH_BATCH];
+	char hdr[HASH_BATCH][32];
+	unsigned char sha1[HASH_BATCH][20];
+	int nr;
+} batch;
+
+static void flush_hash_batch(void)
+{
+	int i;
+
+	if (!batch.nr)
+		return;
+	sha1_multi(batch.msg, batch.nr);
+	for (i = 0; i < batch.nr; i++) {
+		printf("%s\n", sha1_to_hex(batch.sha1[i]));
+		strbuf_release(&batch.data[i]);
+	}
+	maybe_flush_or_die(stdout, "hash to stdout");
+	batch.nr = 0;
+}
+
+static int batch_hash_object(const char *path, const char *vpath)
+{
+	struct strbuf *data = &batch.data[batch.nr];
+	struct sha1_multi_msg *msg = &batch.msg[batch.nr];
+	struct stat st;
+
+	if (stat(path, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_size > HASH_BATCH_FILE_SIZE)
+		return -1;
+
+	strbuf_init(data, st.st_size);
+	if (strbuf_read_file(data, path, st.st_size) < 0)
+		die_errno("Cannot open '%s'", path);
+	if (vpath) {
+		struct strbuf nbuf = STRBUF_INIT;
+		if (convert_to_git(vpath, data->buf, data->len, &nbuf,
+				   SAFE_CRLF_FALSE))
+			strbuf_swap(data, &nbuf);
+		strbuf_release(&nbuf);
+	}
+
+	msg->hdr = batch.hdr[batch.nr];
+	msg->hdrlen = sprintf(batch.hdr[batch.nr], "%s %lu",
+			      blob_type, (unsigned long)data->len) + 1;
+	msg->buf = data->buf;
+	msg->len = data->len;
+	msg->sha1 = batch.sha1[batch.nr];
+	if (++batch.nr == HASH_BATCH)
+		flush_hash_batch();
+	return 0;
+}
+
 static void hash_stdin_paths(const char *type, int write_objects)
 {
 	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
+	int batched = !write_objects && !strcmp(type, blob_type);
 
 	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		const char *vpath;
+
 		if (buf.buf[0] == '"') {
 			strbuf_reset(&nbuf);
 			if (unquote_c_style(&nbuf, buf.buf, NULL))
 				die("line is badly quoted");
 			strbuf_swap(&buf, &nbuf);
 		}
-		hash_object(buf.buf, type, write_objects,
-		    no_filters ? NULL : buf.buf);
+		vpath = no_filters ? NULL : buf.buf;
+		if (batched && !batch_hash_object(buf.buf, vpath))
+			continue;
+		/* keep the output in input order */
+		flush_hash_batch();
+		hash_object(buf.buf, type, write_objects, vpath);
 	}
+	flush_hash_batch();
 	strbuf_release(&buf);
 	strbuf_release(&nbuf);
 }
@@ -118,6 +190,9 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 		usage_with_options(hash_object_usage, hash_object_options);
 	}
 
+	if (write_object)
+		plug_bulk_checkin();
+
 	if (hashstdin)
 		hash_fd(0, type, write_object, vpath);
 
@@ -133,5 +208,7 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 	if (stdin_paths)
 		hash_stdin_paths(type, write_object);
 
+	if (write_object)
+		unplug_bulk_checkin();
 	return 0;
 }
@@ -11,13 +11,15 @@
 #include "exec_cmd.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "sha1-multi.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--[no-]rev-index] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
 	unsigned long size;
+	unsigned long real_size;
 	unsigned int hdr_size;
 	enum object_type type;
 	enum object_type real_type;
@@ -418,6 +420,16 @@ static int is_delta_type(enum object_type type)
 	return (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA);
 }
 
+static void object_entry_info(struct pack_idx_entry *idx, enum object_type *type,
+			      unsigned long *size, int *is_delta)
+{
+	struct object_entry *obj = (struct object_entry *)idx;
+
+	*type = obj->real_type;
+	*is_delta = is_delta_type(obj->type);
+	*size = *is_delta ? obj->real_size : obj->size;
+}
+
 static void *unpack_entry_data(unsigned long offset, unsigned long size,
 			       enum object_type type, unsigned char *sha1)
 {
@@ -429,16 +441,21 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (type == OBJ_BLOB && size > big_file_threshold)
+		buf = fixed_buf;
+	else
+		buf = xmalloc(size);
+
+	/*
+	 * Objects we keep in core are hashed by the caller, in batches;
+	 * only a large blob has to be hashed as it streams past.
+	 */
+	if (!is_delta_type(type) && buf == fixed_buf) {
 		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
 		git_SHA1_Init(&c);
 		git_SHA1_Update(&c, hdr, hdrlen);
 	} else
 		sha1 = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
-	else
-		buf = xmalloc(size);
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -721,7 +738,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	assert(data || obj_entry);
 
 	read_lock();
-	collision_test_needed = has_sha1_file(sha1);
+	collision_test_needed = has_sha1_file_with_flags(sha1, HAS_SHA1_QUICK);
 	read_unlock();
 
 	if (collision_test_needed && !data) {
@@ -879,6 +896,7 @@ static void resolve_delta(struct object_entry *delta_obj,
 	free(delta_data);
 	if (!result->data)
 		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
+	delta_obj->real_size = result->size;
 	hash_sha1_file(result->data, result->size,
 		       typename(delta_obj->real_type), delta_obj->idx.sha1);
 	sha1_object(result->data, NULL, result->size, delta_obj->real_type,
@@ -1005,6 +1023,54 @@ static void *threaded_second_pass(void *data)
 }
 #endif
 
+/*
+ * Non-delta objects read in the first pass, waiting to be hashed
+ * together by sha1_multi() and then checked.
+ */
+#define HASH_QUEUE_MAX 64
+#define HASH_QUEUE_BYTES (4 * 1024 * 1024)
+
+static struct hash_queue {
+	struct sha1_multi_msg msg[HASH_QUEUE_MAX];
+	char hdr[HASH_QUEUE_MAX][32];
+	struct object_entry *obj[HASH_QUEUE_MAX];
+	int nr;
+	unsigned long bytes;
+} hash_queue;
+
+static void flush_hash_queue(void)
+{
+	struct hash_queue *q = &hash_queue;
+	int i;
+
+	sha1_multi(q->msg, q->nr);
+	for (i = 0; i < q->nr; i++) {
+		struct object_entry *obj = q->obj[i];
+		void *data = (void *)q->msg[i].buf;
+		sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
+		free(data);
+	}
+	q->nr = 0;
+	q->bytes = 0;
+}
+
+static void queue_hash(struct object_entry *obj, void *data)
+{
+	struct hash_queue *q = &hash_queue;
+	struct sha1_multi_msg *msg = &q->msg[q->nr];
+
+	msg->hdr = q->hdr[q->nr];
+	msg->hdrlen = sprintf(q->hdr[q->nr], "%s %lu",
+			      typename(obj->type), obj->size) + 1;
+	msg->buf = data;
+	msg->len = obj->size;
+	msg->sha1 = obj->idx.sha1;
+	q->obj[q->nr++] = obj;
+	q->bytes += obj->size;
+	if (q->nr == HASH_QUEUE_MAX || q->bytes >= HASH_QUEUE_BYTES)
+		flush_hash_queue();
+}
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1033,11 +1099,14 @@ static void parse_pack_objects(unsigned char *sha1)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
+		} else {
+			queue_hash(obj, data);
+			data = NULL;
+		}
 		free(data);
 		display_progress(progress, i+1);
 	}
+	flush_hash_queue();
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
@@ -1276,6 +1345,7 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1327,6 +1397,19 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_name) {
+		if (final_rev_name != curr_rev_name) {
+			if (!final_rev_name) {
+				snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+					 get_object_directory(), sha1_to_hex(sha1));
+				final_rev_name = name;
+			}
+			if (move_temp_to_file(curr_rev_name, final_rev_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_name, 0444);
+	}
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1366,10 +1449,17 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 
 	if (!strcmp(k, "pack.indexversion")) {
 		opts->version = git_config_int(k, v);
-		if (opts->version > 2)
+		if (opts->version > 3)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1442,7 +1532,7 @@ static void read_idx_option(struct pack_idx_option *opts, const char *pack_name)
 	/* Read the attributes from the existing idx file */
 	opts->version = p->index_version;
 
-	if (opts->version == 2)
+	if (opts->version >= 2)
 		read_v2_anomalous_offsets(p, opts);
 
 	/*
@@ -1502,10 +1592,11 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_index, *curr_rev = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1518,6 +1609,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	check_replace_refs = 0;
 
 	reset_pack_idx_option(&opts);
+	opts.object_info = object_entry_info;
 	git_config(git_index_pack_config, &opts);
 	if (prefix && chdir(prefix))
 		die(_("Cannot come back to cwd"));
@@ -1573,6 +1665,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				if (*c)
 					die(_("bad %s"), arg);
 				input_len = sizeof(*hdr);
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (!strcmp(arg, "-v")) {
 				verbose = 1;
 			} else if (!strcmp(arg, "-o")) {
@@ -1582,7 +1678,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (starts_with(arg, "--index-version=")) {
 				char *c;
 				opts.version = strtoul(arg + 16, &c, 10);
-				if (opts.version > 2)
+				if (opts.version > 3)
 					die(_("bad %s"), arg);
 				if (*c == ',')
 					opts.off32_limit = strtoul(c+1, &c, 0);
@@ -1611,6 +1707,15 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		strbuf_addstr(&index_name_buf, ".idx");
 		index_name = index_name_buf.buf;
 	}
+	if (index_name && (opts.flags & WRITE_REV)) {
+		size_t len;
+		if (strip_suffix(index_name, ".idx", &len)) {
+			strbuf_add(&rev_name_buf, index_name, len);
+			strbuf_addstr(&rev_name_buf, ".rev");
+			rev_name = rev_name_buf.buf;
+		} else
+			opts.flags &= ~WRITE_REV;
+	}
 	if (keep_msg && !keep_name && pack_name) {
 		size_t len;
 		if (!strip_suffix(pack_name, ".pack", &len))
@@ -1656,22 +1761,28 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (!verify && (opts.flags & WRITE_REV))
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects, pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
 
 	/*
 	 * Let the caller know this pack is not self contained
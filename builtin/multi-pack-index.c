@@ -0,0 +1,34 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir=<dir>] write"),
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	const char *object_dir = NULL;
+	const struct option builtin_multi_pack_index_options[] = {
+		OPT_FILENAME(0, "object-dir", &object_dir,
+			     N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage, 0);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (argc == 1 && !strcmp(argv[0], "write"))
+		return write_multi_pack_index(object_dir);
+
+	usage_with_options(builtin_multi_pack_index_usage,
+			   builtin_multi_pack_index_options);
+}
@@ -9,6 +9,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-mtimes.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -20,6 +21,9 @@
 #include "streaming.h"
 #include "thread-utils.h"
 #include "pack-bitmap.h"
+#include "sha1-array.h"
+#include "string-list.h"
+#include "sha1-lookup.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -33,6 +37,19 @@ static const char *pack_usage[] = {
  * that can resolve SHA1s to their position in the array.
  */
 static struct packing_data to_pack;
+static struct trace_key trace_to_pack = TRACE_KEY_INIT(PERFORMANCE);
+
+#define IN_PACK(obj) oe_in_pack(&to_pack, obj)
+#define SIZE(obj) oe_size(&to_pack, obj)
+#define SET_SIZE(obj, size) oe_set_size(&to_pack, obj, size)
+#define DELTA_SIZE(obj) oe_delta_size(&to_pack, obj)
+#define SET_DELTA_SIZE(obj, size) oe_set_delta_size(&to_pack, obj, size)
+#define DELTA(obj) oe_delta(&to_pack, obj)
+#define DELTA_CHILD(obj) oe_delta_child(&to_pack, obj)
+#define DELTA_SIBLING(obj) oe_delta_sibling(&to_pack, obj)
+#define SET_DELTA(obj, val) oe_set_delta(&to_pack, obj, val)
+#define SET_DELTA_CHILD(obj, val) oe_set_delta_child(&to_pack, obj, val)
+#define SET_DELTA_SIBLING(obj, val) oe_set_delta_sibling(&to_pack, obj, val)
 
 static struct pack_idx_entry **written_list;
 static uint32_t nr_result, nr_written;
@@ -41,6 +58,8 @@ static int non_empty;
 static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static unsigned long unpack_unreachable_expiration;
+static int cruft;
+static unsigned long cruft_expiration;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
@@ -64,11 +83,14 @@ static off_t reuse_packfile_offset;
 
 static int use_bitmap_index = 1;
 static int write_bitmap_index;
-static uint16_t write_bitmap_options;
+static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
+static enum bitmap_format write_bitmap_format = BITMAP_FORMAT_EWAH;
+static int bitmap_threads = -1;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 256 * 1024 * 1024;
 static unsigned long cache_max_small_delta_size = 1000;
+static unsigned long deflate_ahead_limit = 64 * 1024 * 1024;
 
 static unsigned long window_memory_limit = 0;
 
@@ -96,27 +118,35 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
-static void *get_delta(struct object_entry *entry)
+static void *compute_delta(const unsigned char *sha1,
+			   const unsigned char *base_sha1,
+			   unsigned long expect_size)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
-	buf = read_sha1_file(entry->idx.sha1, &type, &size);
+	buf = read_sha1_file(sha1, &type, &size);
 	if (!buf)
-		die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-	base_buf = read_sha1_file(entry->delta->idx.sha1, &type, &base_size);
+		die("unable to read %s", sha1_to_hex(sha1));
+	base_buf = read_sha1_file(base_sha1, &type, &base_size);
 	if (!base_buf)
-		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
+		die("unable to read %s", sha1_to_hex(base_sha1));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
-	if (!delta_buf || delta_size != entry->delta_size)
+	if (!delta_buf || delta_size != expect_size)
 		die("delta size changed");
 	free(buf);
 	free(base_buf);
 	return delta_buf;
 }
 
+static void *get_delta(struct object_entry *entry)
+{
+	return compute_delta(entry->idx.sha1, DELTA(entry)->idx.sha1,
+			     DELTA_SIZE(entry));
+}
+
 static unsigned long do_compress(void **pptr, unsigned long size)
 {
 	git_zstream stream;
@@ -232,6 +262,299 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+/* Can the in-pack representation of entry be copied as is? */
+static int want_reuse(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA || oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+#ifndef NO_PTHREADS
+
+static void try_to_free_from_threads(size_t size)
+{
+	obj_read_lock();
+	release_pack_memory(size);
+	obj_read_unlock();
+}
+
+static try_to_free_t old_try_to_free_routine;
+
+/*
+ * Deflating ahead of the writer.  The writer publishes the objects it
+ * is about to write, in write order, into a ring of jobs; worker
+ * threads read and compress those that will not be copied from an
+ * existing pack, and the writer picks up the compressed data when it
+ * gets to the object.  The header is still made by the writer, which
+ * alone knows the offsets, so the pack comes out the same as when
+ * everything is done by the writer itself.
+ *
+ * Workers only look at what was copied into the job when it was
+ * published, never at the object_entry, which the writer keeps
+ * changing.  While they run, the writer takes the object read lock
+ * around its own use of pack windows.
+ */
+#define DEFLATE_AHEAD_JOBS 1024
+
+enum deflate_job_state {
+	DEFLATE_PENDING,	/* to be done by a worker */
+	DEFLATE_RUNNING,
+	DEFLATE_DONE,
+	DEFLATE_SKIP		/* nothing to do, or result taken */
+};
+
+struct deflate_job {
+	struct object_entry *entry;
+	const unsigned char *sha1;
+	const unsigned char *base_sha1;	/* NULL unless a delta */
+	unsigned long delta_size;
+	unsigned long cost;		/* counted against the limit */
+	enum deflate_job_state state;
+
+	void *buf;
+	unsigned long size, datalen;
+	enum object_type type;
+};
+
+static struct deflate_ahead {
+	struct deflate_job job[DEFLATE_AHEAD_JOBS];
+	struct object_entry **list;
+	uint32_t nr;
+	/* positions in list; written <= claimed <= published */
+	uint32_t written, claimed, published;
+	unsigned long in_flight;
+	int stop;
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} *deflate_ahead;
+
+/* Called by the writer, with the mutex held */
+static void deflate_ahead_publish(struct deflate_ahead *da)
+{
+	struct object_entry *entry = da->list[da->published];
+	struct deflate_job *job = &da->job[da->published++ % DEFLATE_AHEAD_JOBS];
+
+	memset(job, 0, sizeof(*job));
+	job->entry = entry;
+	job->sha1 = entry->idx.sha1;
+	job->state = DEFLATE_SKIP;
+
+	/* the same choices write_object() is going to make */
+	if (entry->preferred_base || entry->idx.offset ||
+	    want_reuse(entry, !!DELTA(entry)))
+		return;
+	if (!DELTA(entry)) {
+		if (oe_type(entry) == OBJ_BLOB && SIZE(entry) > big_file_threshold)
+			return; /* streamed by the writer */
+	} else {
+		if (entry->delta_data)
+			return; /* already in memory */
+		job->base_sha1 = DELTA(entry)->idx.sha1;
+		job->delta_size = DELTA_SIZE(entry);
+	}
+	job->cost = SIZE(entry);
+	job->state = DEFLATE_PENDING;
+}
+
+static void deflate_job_run(struct deflate_job *job)
+{
+	if (job->base_sha1) {
+		job->buf = compute_delta(job->sha1, job->base_sha1,
+					 job->delta_size);
+		job->size = job->delta_size;
+	} else {
+		job->buf = read_sha1_file(job->sha1, &job->type, &job->size);
+		if (!job->buf)
+			die(_("unable to read %s"), sha1_to_hex(job->sha1));
+	}
+	job->datalen = do_compress(&job->buf, job->size);
+}
+
+static void *deflate_ahead_worker(void *data)
+{
+	struct deflate_ahead *da = data;
+
+	pthread_mutex_lock(&da->mutex);
+	while (!da->stop) {
+		struct deflate_job *job;
+
+		if (da->claimed == da->published ||
+		    (da->in_flight && da->in_flight >= deflate_ahead_limit)) {
+			pthread_cond_wait(&da->cond, &da->mutex);
+			continue;
+		}
+		job = &da->job[da->claimed++ % DEFLATE_AHEAD_JOBS];
+		if (job->state != DEFLATE_PENDING)
+			continue;
+		job->state = DEFLATE_RUNNING;
+		da->in_flight += job->cost;
+		pthread_mutex_unlock(&da->mutex);
+
+		deflate_job_run(job);
+
+		pthread_mutex_lock(&da->mutex);
+		job->state = DEFLATE_DONE;
+		pthread_cond_broadcast(&da->cond);
+	}
+	pthread_mutex_unlock(&da->mutex);
+	return NULL;
+}
+
+static void deflate_ahead_start(struct object_entry **list, uint32_t nr)
+{
+	struct deflate_ahead *da;
+	int i, ret;
+
+	if (!delta_search_threads)
+		delta_search_threads = online_cpus();
+	if (delta_search_threads <= 1 || !deflate_ahead_limit || !nr)
+		return;
+
+	da = xcalloc(1, sizeof(*da));
+	da->list = list;
+	da->nr = nr;
+	pthread_mutex_init(&da->mutex, NULL);
+	pthread_cond_init(&da->cond, NULL);
+	while (da->published < nr && da->published < DEFLATE_AHEAD_JOBS)
+		deflate_ahead_publish(da);
+
+	enable_obj_read_lock();
+	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+	da->threads = xcalloc(delta_search_threads, sizeof(*da->threads));
+	for (i = 0; i < delta_search_threads; i++) {
+		ret = pthread_create(&da->threads[i], NULL,
+				     deflate_ahead_worker, da);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+		da->nr_threads++;
+	}
+	deflate_ahead = da;
+}
+
+/*
+ * The writer is about to write entry; hand it the compressed data if
+ * a worker has it (or is working on it) in the form the writer needs.
+ */
+static int deflate_ahead_take(struct object_entry *entry, int usable_delta,
+			      void **buf, unsigned long *size,
+			      unsigned long *datalen, enum object_type *type)
+{
+	struct deflate_ahead *da = deflate_ahead;
+	struct deflate_job *job = NULL;
+	uint32_t pos;
+
+	if (!da)
+		return 0;
+	pthread_mutex_lock(&da->mutex);
+	for (pos = da->written; pos < da->published; pos++) {
+		job = &da->job[pos % DEFLATE_AHEAD_JOBS];
+		if (job->entry == entry)
+			break;
+	}
+	if (pos == da->published || job->state == DEFLATE_SKIP ||
+	    !!job->base_sha1 != usable_delta) {
+		pthread_mutex_unlock(&da->mutex);
+		return 0;
+	}
+	if (job->state == DEFLATE_PENDING) {
+		/* no worker got to it yet; do it ourselves */
+		job->state = DEFLATE_SKIP;
+		pthread_mutex_unlock(&da->mutex);
+		return 0;
+	}
+	while (job->state == DEFLATE_RUNNING)
+		pthread_cond_wait(&da->cond, &da->mutex);
+
+	*buf = job->buf;
+	*size = job->size;
+	*datalen = job->datalen;
+	*type = job->type;
+	job->buf = NULL;
+	job->state = DEFLATE_SKIP;
+	da->in_flight -= job->cost;
+	pthread_cond_broadcast(&da->cond);
+	pthread_mutex_unlock(&da->mutex);
+	return 1;
+}
+
+/* The writer is done with the next object in write order */
+static void deflate_ahead_advance(void)
+{
+	struct deflate_ahead *da = deflate_ahead;
+	struct deflate_job *job;
+
+	if (!da)
+		return;
+	pthread_mutex_lock(&da->mutex);
+	job = &da->job[da->written % DEFLATE_AHEAD_JOBS];
+	while (job->state == DEFLATE_RUNNING)
+		pthread_cond_wait(&da->cond, &da->mutex);
+	if (job->state == DEFLATE_DONE) {
+		/* written some other way after all */
+		free(job->buf);
+		da->in_flight -= job->cost;
+	}
+	job->state = DEFLATE_SKIP;
+	da->written++;
+	if (da->claimed < da->written)
+		da->claimed = da->written;
+	if (da->published < da->nr)
+		deflate_ahead_publish(da);
+	pthread_cond_broadcast(&da->cond);
+	pthread_mutex_unlock(&da->mutex);
+}
+
+static void deflate_ahead_stop(void)
+{
+	struct deflate_ahead *da = deflate_ahead;
+	int i;
+
+	if (!da)
+		return;
+	pthread_mutex_lock(&da->mutex);
+	da->stop = 1;
+	pthread_cond_broadcast(&da->cond);
+	pthread_mutex_unlock(&da->mutex);
+	for (i = 0; i < da->nr_threads; i++)
+		pthread_join(da->threads[i], NULL);
+
+	for (i = 0; i < DEFLATE_AHEAD_JOBS; i++)
+		if (da->job[i].state == DEFLATE_DONE)
+			free(da->job[i].buf);
+	set_try_to_free_routine(old_try_to_free_routine);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&da->cond);
+	pthread_mutex_destroy(&da->mutex);
+	free(da->threads);
+	free(da);
+	deflate_ahead = NULL;
+}
+
+#else
+
+#define deflate_ahead_start(list, nr)	(void)0
+#define deflate_ahead_take(entry, usable_delta, buf, size, datalen, type) 0
+#define deflate_ahead_advance()		(void)0
+#define deflate_ahead_stop()		(void)0
+
+#endif
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -242,13 +565,22 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	enum object_type type;
 	void *buf;
 	struct git_istream *st = NULL;
+	int deflated;
 
+	deflated = deflate_ahead_take(entry, usable_delta,
+				      &buf, &size, &datalen, &type);
 	if (!usable_delta) {
-		if (entry->type == OBJ_BLOB &&
-		    entry->size > big_file_threshold &&
-		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
-			buf = NULL;
-		else {
+		if (!deflated && oe_type(entry) == OBJ_BLOB &&
+		    SIZE(entry) > big_file_threshold) {
+			/* held until the stream is closed */
+			obj_read_lock();
+			st = open_istream(entry->idx.sha1, &type, &size, NULL);
+			if (st)
+				buf = NULL;
+			else
+				obj_read_unlock();
+		}
+		if (!deflated && !st) {
 			buf = read_sha1_file(entry->idx.sha1, &type, &size);
 			if (!buf)
 				die(_("unable to read %s"), sha1_to_hex(entry->idx.sha1));
@@ -260,20 +592,25 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		free(entry->delta_data);
 		entry->delta_data = NULL;
 		entry->z_delta_size = 0;
+	} else if (deflated) {
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else if (entry->delta_data) {
-		size = entry->delta_size;
+		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
 		entry->delta_data = NULL;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
 		buf = get_delta(entry);
-		size = entry->delta_size;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		size = DELTA_SIZE(entry);
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (deflated)
+		; /* datalen is set */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -292,14 +629,16 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 * encoding of the relative offset for the delta
 		 * base from this object's position in the pack.
 		 */
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
-			if (st)
+			if (st) {
 				close_istream(st);
+				obj_read_unlock();
+			}
 			free(buf);
 			return 0;
 		}
@@ -312,18 +651,22 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 * an additional 20 bytes for the base sha1.
 		 */
 		if (limit && hdrlen + 20 + datalen + 20 >= limit) {
-			if (st)
+			if (st) {
 				close_istream(st);
+				obj_read_unlock();
+			}
 			free(buf);
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
-			if (st)
+			if (st) {
 				close_istream(st);
+				obj_read_unlock();
+			}
 			free(buf);
 			return 0;
 		}
@@ -332,6 +675,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	if (st) {
 		datalen = write_large_blob_data(st, f, entry->idx.sha1);
 		close_istream(st);
+		obj_read_unlock();
 	} else {
 		sha1write(f, buf, datalen);
 		free(buf);
@@ -344,27 +688,33 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 static unsigned long write_reuse_object(struct sha1file *f, struct object_entry *entry,
 					unsigned long limit, int usable_delta)
 {
-	struct packed_git *p = entry->in_pack;
+	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	struct pack_revindex *rix;
+	uint32_t nr;
+	int pos;
 	off_t offset;
-	enum object_type type = entry->type;
+	enum object_type type = oe_type(entry);
 	unsigned long datalen;
 	unsigned char header[10], dheader[10];
 	unsigned hdrlen;
 
-	if (entry->delta)
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+	if (DELTA(entry))
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
-	hdrlen = encode_in_pack_object_header(type, entry->size, header);
+	hdrlen = encode_in_pack_object_header(type, SIZE(entry), header);
 
+	/* deflate_ahead workers may be using the pack windows */
+	obj_read_lock();
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	pos = find_pack_revindex(p, offset, &rix);
+	nr = pack_pos_to_index(rix, pos);
+	datalen = pack_pos_to_offset(rix, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen, nr)) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
+		obj_read_unlock();
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
@@ -372,20 +722,22 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	datalen -= entry->in_pack_header_size;
 
 	if (!pack_to_stdout && p->index_version == 1 &&
-	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
+	    check_pack_inflate(p, &w_curs, offset, datalen, SIZE(entry))) {
 		error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
+		obj_read_unlock();
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
@@ -395,21 +747,24 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	} else if (type == OBJ_REF_DELTA) {
 		if (limit && hdrlen + 20 + datalen + 20 >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 		reused_delta++;
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
 			unuse_pack(&w_curs);
+			obj_read_unlock();
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
 	}
 	copy_pack_data(f, p, &w_curs, offset, datalen);
 	unuse_pack(&w_curs);
+	obj_read_unlock();
 	reused++;
 	return hdrlen + datalen;
 }
@@ -437,34 +792,18 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		limit = pack_size_limit - write_offset;
 
-	if (!entry->delta)
+	if (!DELTA(entry))
 		usable_delta = 0;	/* no delta */
 	else if (!pack_size_limit)
 	       usable_delta = 1;	/* unlimited packfile */
-	else if (entry->delta->idx.offset == (off_t)-1)
+	else if (DELTA(entry)->idx.offset == (off_t)-1)
 		usable_delta = 0;	/* base was written to another pack */
-	else if (entry->delta->idx.offset)
+	else if (DELTA(entry)->idx.offset)
 		usable_delta = 1;	/* base already exists in this pack */
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
+	to_reuse = want_reuse(entry, usable_delta);
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
 	else
@@ -475,6 +814,7 @@ static unsigned long write_object(struct sha1file *f,
 	if (usable_delta)
 		written_delta++;
 	written++;
+	entry->written_as_delta = usable_delta;
 	if (!pack_to_stdout)
 		entry->idx.crc32 = crc32_end(f);
 	return len;
@@ -510,12 +850,12 @@ static enum write_one_status write_one(struct sha1file *f,
 	}
 
 	/* if we are deltified, write out base object first. */
-	if (e->delta) {
+	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
-		switch (write_one(f, e->delta, offset)) {
+		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
-			e->delta = NULL;
+			SET_DELTA(e, NULL);
 			break;
 		default:
 			break;
@@ -577,34 +917,34 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 			/* add this node... */
 			add_to_write_order(wo, endp, e);
 			/* all its siblings... */
-			for (s = e->delta_sibling; s; s = s->delta_sibling) {
+			for (s = DELTA_SIBLING(e); s; s = DELTA_SIBLING(s)) {
 				add_to_write_order(wo, endp, s);
 			}
 		}
 		/* drop down a level to add left subtree nodes if possible */
-		if (e->delta_child) {
+		if (DELTA_CHILD(e)) {
 			add_to_order = 1;
-			e = e->delta_child;
+			e = DELTA_CHILD(e);
 		} else {
 			add_to_order = 0;
 			/* our sibling might have some children, it is next */
-			if (e->delta_sibling) {
-				e = e->delta_sibling;
+			if (DELTA_SIBLING(e)) {
+				e = DELTA_SIBLING(e);
 				continue;
 			}
 			/* go back to our parent node */
-			e = e->delta;
-			while (e && !e->delta_sibling) {
+			e = DELTA(e);
+			while (e && !DELTA_SIBLING(e)) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				e = e->delta;
+				e = DELTA(e);
 			}
 			if (!e) {
 				/* done- we hit our original root node */
 				return;
 			}
 			/* pass it off to sibling at this level */
-			e = e->delta_sibling;
+			e = DELTA_SIBLING(e);
 		}
 	};
 }
@@ -615,7 +955,7 @@ static void add_family_to_write_order(struct object_entry **wo,
 {
 	struct object_entry *root;
 
-	for (root = e; root->delta; root = root->delta)
+	for (root = e; DELTA(root); root = DELTA(root))
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
@@ -630,8 +970,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		objects[i].tagged = 0;
 		objects[i].filled = 0;
-		objects[i].delta_child = NULL;
-		objects[i].delta_sibling = NULL;
+		SET_DELTA_CHILD(&objects[i], NULL);
+		SET_DELTA_SIBLING(&objects[i], NULL);
 	}
 
 	/*
@@ -641,11 +981,11 @@ static struct object_entry **compute_write_order(void)
 	 */
 	for (i = to_pack.nr_objects; i > 0;) {
 		struct object_entry *e = &objects[--i];
-		if (!e->delta)
+		if (!DELTA(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling = e->delta->delta_child;
-		e->delta->delta_child = e;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
+		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
 	/*
@@ -676,8 +1016,8 @@ static struct object_entry **compute_write_order(void)
 	 * And then all remaining commits and tags.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_COMMIT &&
-		    objects[i].type != OBJ_TAG)
+		if (oe_type(&objects[i]) != OBJ_COMMIT &&
+		    oe_type(&objects[i]) != OBJ_TAG)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -686,7 +1026,7 @@ static struct object_entry **compute_write_order(void)
 	 * And then all the trees.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_TREE)
+		if (oe_type(&objects[i]) != OBJ_TREE)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -758,6 +1098,46 @@ static off_t write_reused_pack(struct sha1file *f)
 	return reuse_packfile_offset - sizeof(struct pack_header);
 }
 
+/* What a version 3 .idx records about each written object */
+static void written_object_info(struct pack_idx_entry *idx, enum object_type *type,
+				unsigned long *size, int *is_delta)
+{
+	struct object_entry *entry = (struct object_entry *)idx;
+	struct object_entry *base = entry;
+	struct pack_window *w_curs = NULL;
+
+	*is_delta = entry->written_as_delta;
+	if (oe_type(entry) != OBJ_OFS_DELTA && oe_type(entry) != OBJ_REF_DELTA) {
+		*type = oe_type(entry);
+		*size = SIZE(entry);
+		return;
+	}
+
+	/*
+	 * A delta reused from another pack: check_object() only looked
+	 * at the delta data, and its base may be such a delta as well.
+	 */
+	while (base && (oe_type(base) == OBJ_OFS_DELTA ||
+			oe_type(base) == OBJ_REF_DELTA))
+		base = DELTA(base);
+	*size = get_size_from_delta(IN_PACK(entry), &w_curs,
+			entry->in_pack_offset + entry->in_pack_header_size);
+	unuse_pack(&w_curs);
+	if (base && *size)
+		*type = oe_type(base);
+	else
+		*type = sha1_object_info(entry->idx.sha1, size);
+	if (*type < 0)
+		die(_("unable to get type of object %s"),
+		    sha1_to_hex(entry->idx.sha1));
+}
+
+/* What the .mtimes file of a cruft pack records about each object */
+static uint32_t written_object_mtime(struct pack_idx_entry *idx)
+{
+	return oe_cruft_mtime(&to_pack, (struct object_entry *)idx);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -792,12 +1172,16 @@ static void write_pack_file(void)
 		}
 
 		nr_written = 0;
+		if (!pack_size_limit)
+			deflate_ahead_start(write_order, to_pack.nr_objects);
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			deflate_ahead_advance();
 			display_progress(progress_state, written);
 		}
+		deflate_ahead_stop();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -843,6 +1227,10 @@ static void write_pack_file(void)
 
 			if (write_bitmap_index) {
 				bitmap_writer_set_checksum(sha1);
+				bitmap_writer_set_format(write_bitmap_format);
+				bitmap_writer_set_threads(bitmap_threads < 0 ?
+							  delta_search_threads :
+							  bitmap_threads);
 				bitmap_writer_build_type_index(written_list, nr_written);
 			}
 
@@ -995,13 +1383,13 @@ static void create_object_entry(const unsigned char *sha1,
 	entry = packlist_alloc(&to_pack, sha1, index_pos);
 	entry->hash = hash;
 	if (type)
-		entry->type = type;
+		oe_set_type(entry, type);
 	if (exclude)
 		entry->preferred_base = 1;
 	else
 		nr_result++;
 	if (found_pack) {
-		entry->in_pack = found_pack;
+		oe_set_in_pack(&to_pack, entry, found_pack);
 		entry->in_pack_offset = found_offset;
 	}
 
@@ -1326,8 +1714,10 @@ static void cleanup_preferred_base(void)
 
 static void check_object(struct object_entry *entry)
 {
-	if (entry->in_pack) {
-		struct packed_git *p = entry->in_pack;
+	unsigned long size;
+
+	if (IN_PACK(entry)) {
+		struct packed_git *p = IN_PACK(entry);
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
@@ -1335,6 +1725,7 @@ static void check_object(struct object_entry *entry)
 		unsigned long avail;
 		off_t ofs;
 		unsigned char *buf, c;
+		enum object_type type;
 
 		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
 
@@ -1342,11 +1733,11 @@ static void check_object(struct object_entry *entry)
 		 * We want in_pack_type even if we do not reuse delta
 		 * since non-delta representations could still be reused.
 		 */
-		used = unpack_object_header_buffer(buf, avail,
-						   &entry->in_pack_type,
-						   &entry->size);
+		used = unpack_object_header_buffer(buf, avail, &type, &size);
 		if (used == 0)
 			goto give_up;
+		entry->in_pack_type = type;
+		SET_SIZE(entry, size);
 
 		/*
 		 * Determine if this is a delta and if so whether we can
@@ -1356,9 +1747,9 @@ static void check_object(struct object_entry *entry)
 		switch (entry->in_pack_type) {
 		default:
 			/* Not a delta hence we've already got all we need. */
-			entry->type = entry->in_pack_type;
+			oe_set_type(entry, entry->in_pack_type);
 			entry->in_pack_header_size = used;
-			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
+			if (type < OBJ_COMMIT || type > OBJ_BLOB)
 				goto give_up;
 			unuse_pack(&w_curs);
 			return;
@@ -1391,11 +1782,12 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				struct pack_revindex *rix;
+				int pos = find_pack_revindex(p, ofs, &rix);
+				if (pos < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(rix, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -1412,25 +1804,26 @@ static void check_object(struct object_entry *entry)
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
 			 */
-			entry->type = entry->in_pack_type;
-			entry->delta = base_entry;
-			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			oe_set_type(entry, entry->in_pack_type);
+			SET_DELTA(entry, base_entry);
+			SET_DELTA_SIZE(entry, size);
+			SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
+			SET_DELTA_CHILD(base_entry, entry);
 			unuse_pack(&w_curs);
 			return;
 		}
 
-		if (entry->type) {
+		if (oe_type(entry)) {
 			/*
 			 * This must be a delta and we already know what the
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
-			entry->size = get_size_from_delta(p, &w_curs,
+			size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
-			if (entry->size == 0)
+			if (size == 0)
 				goto give_up;
+			SET_SIZE(entry, size);
 			unuse_pack(&w_curs);
 			return;
 		}
@@ -1444,7 +1837,9 @@ static void check_object(struct object_entry *entry)
 		unuse_pack(&w_curs);
 	}
 
-	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+	oe_set_type(entry, sha1_object_info(entry->idx.sha1, &size));
+	if (oe_type(entry) >= 0)
+		SET_SIZE(entry, size);
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1459,12 +1854,12 @@ static int pack_offset_sort(const void *_a, const void *_b)
 	const struct object_entry *b = *(struct object_entry **)_b;
 
 	/* avoid filesystem trashing with loose objects */
-	if (!a->in_pack && !b->in_pack)
+	if (!IN_PACK(a) && !IN_PACK(b))
 		return hashcmp(a->idx.sha1, b->idx.sha1);
 
-	if (a->in_pack < b->in_pack)
+	if (IN_PACK(a) < IN_PACK(b))
 		return -1;
-	if (a->in_pack > b->in_pack)
+	if (IN_PACK(a) > IN_PACK(b))
 		return 1;
 	return a->in_pack_offset < b->in_pack_offset ? -1 :
 			(a->in_pack_offset > b->in_pack_offset);
@@ -1483,7 +1878,7 @@ static void get_object_details(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
 		check_object(entry);
-		if (big_file_threshold < entry->size)
+		if (big_file_threshold < SIZE(entry))
 			entry->no_try_delta = 1;
 	}
 
@@ -1504,9 +1899,9 @@ static int type_size_sort(const void *_a, const void *_b)
 	const struct object_entry *a = *(struct object_entry **)_a;
 	const struct object_entry *b = *(struct object_entry **)_b;
 
-	if (a->type > b->type)
+	if (oe_type(a) > oe_type(b))
 		return -1;
-	if (a->type < b->type)
+	if (oe_type(a) < oe_type(b))
 		return 1;
 	if (a->hash > b->hash)
 		return -1;
@@ -1516,9 +1911,9 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
-	if (a->size > b->size)
+	if (SIZE(a) > SIZE(b))
 		return -1;
-	if (a->size < b->size)
+	if (SIZE(a) < SIZE(b))
 		return 1;
 	return a < b ? -1 : (a > b);  /* newest first */
 }
@@ -1548,10 +1943,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 
 #ifndef NO_PTHREADS
 
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
 static pthread_mutex_t cache_mutex;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
 #define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
@@ -1562,8 +1953,6 @@ static pthread_mutex_t progress_mutex;
 
 #else
 
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
 #define cache_lock()		(void)0
 #define cache_unlock()		(void)0
 #define progress_lock()		(void)0
@@ -1582,7 +1971,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	void *delta_buf;
 
 	/* Don't bother doing diffs between different types */
-	if (trg_entry->type != src_entry->type)
+	if (oe_type(trg_entry) != oe_type(src_entry))
 		return -1;
 
 	/*
@@ -1593,8 +1982,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * it, we will still save the transfer cost, as we already know
 	 * the other side has it and we won't send src_entry at all.
 	 */
-	if (reuse_delta && trg_entry->in_pack &&
-	    trg_entry->in_pack == src_entry->in_pack &&
+	if (reuse_delta && IN_PACK(trg_entry) &&
+	    IN_PACK(trg_entry) == IN_PACK(src_entry) &&
 	    !src_entry->preferred_base &&
 	    trg_entry->in_pack_type != OBJ_REF_DELTA &&
 	    trg_entry->in_pack_type != OBJ_OFS_DELTA)
@@ -1605,19 +1994,19 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		return 0;
 
 	/* Now some size filtering heuristics. */
-	trg_size = trg_entry->size;
-	if (!trg_entry->delta) {
+	trg_size = SIZE(trg_entry);
+	if (!DELTA(trg_entry)) {
 		max_size = trg_size/2 - 20;
 		ref_depth = 1;
 	} else {
-		max_size = trg_entry->delta_size;
+		max_size = DELTA_SIZE(trg_entry);
 		ref_depth = trg->depth;
 	}
 	max_size = (uint64_t)max_size * (max_depth - src->depth) /
 						(max_depth - ref_depth + 1);
 	if (max_size == 0)
 		return 0;
-	src_size = src_entry->size;
+	src_size = SIZE(src_entry);
 	sizediff = src_size < trg_size ? trg_size - src_size : 0;
 	if (sizediff >= max_size)
 		return 0;
@@ -1626,9 +2015,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		read_lock();
 		trg->data = read_sha1_file(trg_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!trg->data)
 			die("object %s cannot be read",
 			    sha1_to_hex(trg_entry->idx.sha1));
@@ -1638,9 +2025,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		read_lock();
 		src->data = read_sha1_file(src_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!src->data) {
 			if (src_entry->preferred_base) {
 				static int warned = 0;
@@ -1678,9 +2063,9 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (!delta_buf)
 		return 0;
 
-	if (trg_entry->delta) {
+	if (DELTA(trg_entry)) {
 		/* Prefer only shallower same-sized deltas. */
-		if (delta_size == trg_entry->delta_size &&
+		if (delta_size == DELTA_SIZE(trg_entry) &&
 		    src->depth + 1 >= trg->depth) {
 			free(delta_buf);
 			return 0;
@@ -1695,7 +2080,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	free(trg_entry->delta_data);
 	cache_lock();
 	if (trg_entry->delta_data) {
-		delta_cache_size -= trg_entry->delta_size;
+		delta_cache_size -= DELTA_SIZE(trg_entry);
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
@@ -1707,8 +2092,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		free(delta_buf);
 	}
 
-	trg_entry->delta = src_entry;
-	trg_entry->delta_size = delta_size;
+	SET_DELTA(trg_entry, src_entry);
+	SET_DELTA_SIZE(trg_entry, delta_size);
 	trg->depth = src->depth + 1;
 
 	return 1;
@@ -1716,13 +2101,13 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 {
-	struct object_entry *child = me->delta_child;
+	struct object_entry *child = DELTA_CHILD(me);
 	unsigned int m = n;
 	while (child) {
 		unsigned int c = check_delta_limit(child, n + 1);
 		if (m < c)
 			m = c;
-		child = child->delta_sibling;
+		child = DELTA_SIBLING(child);
 	}
 	return m;
 }
@@ -1733,7 +2118,7 @@ static unsigned long free_unpacked(struct unpacked *n)
 	free_delta_index(n->index);
 	n->index = NULL;
 	if (n->data) {
-		freed_mem += n->entry->size;
+		freed_mem += SIZE(n->entry);
 		free(n->data);
 		n->data = NULL;
 	}
@@ -1792,7 +2177,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * otherwise they would become too deep.
 		 */
 		max_depth = depth;
-		if (entry->delta_child) {
+		if (DELTA_CHILD(entry)) {
 			max_depth -= check_delta_limit(entry, 0);
 			if (max_depth <= 0)
 				goto next;
@@ -1830,19 +2215,28 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * between writes at that moment.
 		 */
 		if (entry->delta_data && !pack_to_stdout) {
-			entry->z_delta_size = do_compress(&entry->delta_data,
-							  entry->delta_size);
+			unsigned long size;
+
+			size = do_compress(&entry->delta_data, DELTA_SIZE(entry));
 			cache_lock();
-			delta_cache_size -= entry->delta_size;
-			delta_cache_size += entry->z_delta_size;
+			delta_cache_size -= DELTA_SIZE(entry);
+			if (oe_z_delta_size_fits(size)) {
+				entry->z_delta_size = size;
+				delta_cache_size += size;
+			}
 			cache_unlock();
+			if (!entry->z_delta_size) {
+				/* too large to remember; done again when writing */
+				free(entry->delta_data);
+				entry->delta_data = NULL;
+			}
 		}
 
 		/* if we made n a delta, and if n is already at max
 		 * depth, leaving it in the window is pointless.  we
 		 * should evict it first.
 		 */
-		if (entry->delta && max_depth <= n->depth)
+		if (DELTA(entry) && max_depth <= n->depth)
 			continue;
 
 		/*
@@ -1850,7 +2244,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * currently deltified object, to keep it longer.  It will
 		 * be the first base object to be attempted next.
 		 */
-		if (entry->delta) {
+		if (DELTA(entry)) {
 			struct unpacked swap = array[best_base];
 			int dist = (window + idx - best_base) % window;
 			int dst = best_base;
@@ -1879,15 +2273,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 #ifndef NO_PTHREADS
 
-static void try_to_free_from_threads(size_t size)
-{
-	read_lock();
-	release_pack_memory(size);
-	read_unlock();
-}
-
-static try_to_free_t old_try_to_free_routine;
-
 /*
  * The main thread waits on the condition that (at least) one of the workers
  * has stopped working (which is indicated in the .working member of
@@ -1918,7 +2303,7 @@ static pthread_cond_t progress_cond;
  */
 static void init_threaded_search(void)
 {
-	init_recursive_mutex(&read_mutex);
+	enable_obj_read_lock();
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
 	pthread_cond_init(&progress_cond, NULL);
@@ -1929,7 +2314,7 @@ static void cleanup_threaded_search(void)
 {
 	set_try_to_free_routine(old_try_to_free_routine);
 	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
+	disable_obj_read_lock();
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
@@ -2138,13 +2523,13 @@ static void prepare_pack(int window, int depth)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = to_pack.objects + i;
 
-		if (entry->delta)
+		if (DELTA(entry))
 			/* This happens if we decided to reuse existing
 			 * delta from a pack.  "reuse_delta &&" is implied.
 			 */
 			continue;
 
-		if (entry->size < 50)
+		if (SIZE(entry) < 50)
 			continue;
 
 		if (entry->no_try_delta)
@@ -2152,11 +2537,11 @@ static void prepare_pack(int window, int depth)
 
 		if (!entry->preferred_base) {
 			nr_deltas++;
-			if (entry->type < 0)
+			if (oe_type(entry) < 0)
 				die("unable to get type of object %s",
 				    sha1_to_hex(entry->idx.sha1));
 		} else {
-			if (entry->type < 0) {
+			if (oe_type(entry) < 0) {
 				/*
 				 * This object is not found, but we
 				 * don't have to include it anyway.
@@ -2210,6 +2595,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		max_delta_cache_size = git_config_int(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.deflateaheadlimit")) {
+		deflate_ahead_limit = git_config_ulong(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.deltacachelimit")) {
 		cache_max_small_delta_size = git_config_int(k, v);
 		return 0;
@@ -2219,6 +2608,25 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			write_bitmap_options |= BITMAP_OPT_HASH_CACHE;
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
+	}
+	if (!strcmp(k, "pack.bitmapformat")) {
+		if (!v)
+			return config_error_nonbool(k);
+		if (!strcmp(v, "ewah"))
+			write_bitmap_format = BITMAP_FORMAT_EWAH;
+		else if (!strcmp(v, "roaring"))
+			write_bitmap_format = BITMAP_FORMAT_ROARING;
+		else
+			return error("unknown bitmap format '%s'", v);
+		return 0;
 	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index = git_config_bool(k, v);
@@ -2232,16 +2640,34 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #ifdef NO_PTHREADS
 		if (delta_search_threads != 1)
 			warning("no threads support, ignoring %s", k);
+#endif
+		return 0;
+	}
+	if (!strcmp(k, "pack.bitmapthreads")) {
+		bitmap_threads = git_config_int(k, v);
+		if (bitmap_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    bitmap_threads);
+#ifdef NO_PTHREADS
+		if (bitmap_threads != 1)
+			warning("no threads support, ignoring %s", k);
 #endif
 		return 0;
 	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
-		if (pack_idx_opts.version > 2)
+		if (pack_idx_opts.version > 3)
 			die("bad pack.indexversion=%"PRIu32,
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2344,45 +2770,136 @@ static int ofscmp(const void *a_, const void *b_)
 		return hashcmp(a->object->sha1, b->object->sha1);
 }
 
+static void collect_objects_in_pack(struct packed_git *p,
+				    struct in_pack *in_pack)
+{
+	const unsigned char *sha1;
+	struct object *o;
+	uint32_t i;
+
+	if (open_pack_index(p))
+		die("cannot open pack index");
+
+	ALLOC_GROW(in_pack->array,
+		   in_pack->nr + p->num_objects,
+		   in_pack->alloc);
+
+	for (i = 0; i < p->num_objects; i++) {
+		sha1 = nth_packed_object_sha1(p, i);
+		o = lookup_unknown_object(sha1);
+		if (!(o->flags & OBJECT_ADDED))
+			mark_in_pack_object(o, p, in_pack);
+		o->flags |= OBJECT_ADDED;
+	}
+}
+
+static void add_in_pack_objects(struct in_pack *in_pack)
+{
+	uint32_t i;
+
+	if (in_pack->nr) {
+		qsort(in_pack->array, in_pack->nr, sizeof(in_pack->array[0]),
+		      ofscmp);
+		for (i = 0; i < in_pack->nr; i++) {
+			struct object *o = in_pack->array[i].object;
+			add_object_entry(o->sha1, o->type, "", 0);
+		}
+	}
+	free(in_pack->array);
+}
+
 static void add_objects_in_unpacked_packs(struct rev_info *revs)
 {
 	struct packed_git *p;
 	struct in_pack in_pack;
-	uint32_t i;
 
 	memset(&in_pack, 0, sizeof(in_pack));
 
 	for (p = packed_git; p; p = p->next) {
-		const unsigned char *sha1;
-		struct object *o;
-
 		if (!p->pack_local || p->pack_keep)
 			continue;
-		if (open_pack_index(p))
-			die("cannot open pack index");
+		collect_objects_in_pack(p, &in_pack);
+	}
 
-		ALLOC_GROW(in_pack.array,
-			   in_pack.nr + p->num_objects,
-			   in_pack.alloc);
+	add_in_pack_objects(&in_pack);
+}
 
-		for (i = 0; i < p->num_objects; i++) {
-			sha1 = nth_packed_object_sha1(p, i);
-			o = lookup_unknown_object(sha1);
-			if (!(o->flags & OBJECT_ADDED))
-				mark_in_pack_object(o, p, &in_pack);
-			o->flags |= OBJECT_ADDED;
+static void add_cruft_objects(struct string_list *include);
+
+/*
+ * With --stdin-packs, pack the objects of the packs named on the
+ * standard input, except those also found in a pack named with a
+ * leading '^', which are treated as if the pack had a .keep file.
+ * With --unpacked, add all the loose objects as well.  With --cruft,
+ * see add_cruft_objects().
+ */
+static void read_packs_list_from_stdin(int include_loose)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include = STRING_LIST_INIT_DUP;
+	struct string_list exclude = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+	struct in_pack in_pack;
+	int i;
+
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		if (!buf.len)
+			continue;
+		if (buf.buf[0] == '^')
+			string_list_append(&exclude, buf.buf + 1);
+		else
+			string_list_append(&include, buf.buf);
+	}
+	sort_string_list(&include);
+	sort_string_list(&exclude);
+
+	for (p = packed_git; p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		if ((item = string_list_lookup(&include, name)))
+			item->util = p;
+		if ((item = string_list_lookup(&exclude, name))) {
+			item->util = p;
+			p->pack_keep = 1;
+			ignore_packed_keep = 1;
 		}
 	}
 
-	if (in_pack.nr) {
-		qsort(in_pack.array, in_pack.nr, sizeof(in_pack.array[0]),
-		      ofscmp);
-		for (i = 0; i < in_pack.nr; i++) {
-			struct object *o = in_pack.array[i].object;
-			add_object_entry(o->sha1, o->type, "", 0);
+	for_each_string_list_item(item, &exclude)
+		if (!item->util)
+			die("could not find pack '%s'", item->string);
+
+	if (cruft) {
+		add_cruft_objects(&include);
+		goto out;
+	}
+
+	memset(&in_pack, 0, sizeof(in_pack));
+	for_each_string_list_item(item, &include) {
+		p = item->util;
+		if (!p)
+			die("could not find pack '%s'", item->string);
+		if (p->pack_keep && ignore_packed_keep)
+			continue;
+		collect_objects_in_pack(p, &in_pack);
+	}
+	add_in_pack_objects(&in_pack);
+
+	if (include_loose) {
+		for (i = 0; i < 256; i++) {
+			struct sha1_array *loose = odb_loose_cache(NULL, i);
+			int j;
+
+			for (j = 0; j < loose->nr; j++)
+				add_object_entry(loose->sha1[j], 0, "", 0);
 		}
 	}
-	free(in_pack.array);
+
+out:
+	strbuf_release(&buf);
+	string_list_clear(&include, 0);
+	string_list_clear(&exclude, 0);
 }
 
 static int has_sha1_pack_kept_or_nonlocal(const unsigned char *sha1)
@@ -2408,6 +2925,190 @@ static int has_sha1_pack_kept_or_nonlocal(const unsigned char *sha1)
 	return 0;
 }
 
+/*
+ * The candidates for a cruft pack: the objects of the packs it
+ * replaces and the loose objects, each with the most recent time it
+ * was written.
+ */
+struct cruft_object {
+	unsigned char sha1[20];
+	uint32_t mtime;
+	unsigned keep:1;
+};
+
+static struct cruft_object *cruft_objects;
+static int cruft_objects_nr, cruft_objects_alloc;
+
+static void add_cruft_candidate(const unsigned char *sha1, uint32_t mtime)
+{
+	struct cruft_object *c;
+
+	if (has_sha1_pack_kept_or_nonlocal(sha1))
+		return;
+	ALLOC_GROW(cruft_objects, cruft_objects_nr + 1, cruft_objects_alloc);
+	c = &cruft_objects[cruft_objects_nr++];
+	hashcpy(c->sha1, sha1);
+	c->mtime = mtime;
+	c->keep = !cruft_expiration || mtime > cruft_expiration;
+}
+
+/* By SHA-1, and the most recent first */
+static int cruft_object_cmp(const void *a_, const void *b_)
+{
+	const struct cruft_object *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->mtime > b->mtime)
+		return -1;
+	return a->mtime < b->mtime;
+}
+
+static const unsigned char *cruft_object_access(size_t pos, void *table)
+{
+	struct cruft_object *c = table;
+	return c[pos].sha1;
+}
+
+static void rescue_cruft_object(const unsigned char *sha1, int *stack, int *nr)
+{
+	int pos = sha1_pos(sha1, cruft_objects, cruft_objects_nr,
+			   cruft_object_access);
+
+	if (pos < 0 || cruft_objects[pos].keep)
+		return;
+	cruft_objects[pos].keep = 1;
+	stack[(*nr)++] = pos;
+}
+
+/*
+ * Keep the expired candidates that a kept one refers to, however old
+ * they are: a recent unreachable commit may well be made reachable
+ * again, and it must not come back without its trees and blobs.
+ * Objects that cannot be read are skipped; the cruft pack does not
+ * promise any closure beyond what was there to begin with.
+ */
+static void rescue_cruft_objects(void)
+{
+	int *stack = xmalloc(sizeof(*stack) * (cruft_objects_nr + 1));
+	int nr = 0, i;
+
+	for (i = 0; i < cruft_objects_nr; i++)
+		if (cruft_objects[i].keep)
+			stack[nr++] = i;
+
+	while (nr) {
+		const unsigned char *sha1 = cruft_objects[stack[--nr]].sha1;
+
+		switch (sha1_object_info(sha1, NULL)) {
+		case OBJ_COMMIT: {
+			struct commit *commit = lookup_commit(sha1);
+			struct commit_list *parent;
+
+			if (!commit || parse_commit(commit))
+				break;
+			rescue_cruft_object(commit->tree->object.sha1, stack, &nr);
+			for (parent = commit->parents; parent; parent = parent->next)
+				rescue_cruft_object(parent->item->object.sha1,
+						    stack, &nr);
+			break;
+		}
+		case OBJ_TREE: {
+			struct tree *tree = lookup_tree(sha1);
+			struct tree_desc desc;
+			struct name_entry entry;
+
+			if (!tree || parse_tree(tree))
+				break;
+			init_tree_desc(&desc, tree->buffer, tree->size);
+			while (tree_entry(&desc, &entry))
+				if (!S_ISGITLINK(entry.mode))
+					rescue_cruft_object(entry.sha1, stack, &nr);
+			free_tree_buffer(tree);
+			break;
+		}
+		case OBJ_TAG: {
+			struct tag *tag = lookup_tag(sha1);
+
+			if (!tag || parse_tag(tag) || !tag->tagged)
+				break;
+			rescue_cruft_object(tag->tagged->sha1, stack, &nr);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	free(stack);
+}
+
+/*
+ * With --cruft, pack the objects of the packs in include and all the
+ * loose objects, except those in kept and excluded packs, recording
+ * for each the last time it was written: its own mtime from an
+ * earlier cruft pack, or the mtime of the pack or of the loose file.
+ * With --cruft-expiration, leave out the objects that have not been
+ * written since, unless a more recent one refers to them.
+ */
+static void add_cruft_objects(struct string_list *include)
+{
+	struct string_list_item *item;
+	int i, j;
+
+	for_each_string_list_item(item, include) {
+		struct packed_git *p = item->util;
+		int use_mtimes;
+
+		if (p->pack_keep && ignore_packed_keep)
+			continue;
+		if (open_pack_index(p))
+			die("cannot open pack index");
+		use_mtimes = p->is_cruft && !load_pack_mtimes(p);
+		for (j = 0; j < p->num_objects; j++)
+			add_cruft_candidate(nth_packed_object_sha1(p, j),
+					    use_mtimes ? nth_packed_mtime(p, j)
+						       : p->mtime);
+	}
+
+	for (i = 0; i < 256; i++) {
+		struct sha1_array *loose = odb_loose_cache(NULL, i);
+
+		for (j = 0; j < loose->nr; j++) {
+			struct stat st;
+
+			if (stat(sha1_file_name(loose->sha1[j]), &st))
+				continue; /* pruned under us */
+			add_cruft_candidate(loose->sha1[j], st.st_mtime);
+		}
+	}
+
+	qsort(cruft_objects, cruft_objects_nr, sizeof(*cruft_objects),
+	      cruft_object_cmp);
+	for (i = j = 0; i < cruft_objects_nr; i++)
+		if (!j || hashcmp(cruft_objects[j - 1].sha1,
+				  cruft_objects[i].sha1))
+			cruft_objects[j++] = cruft_objects[i];
+	cruft_objects_nr = j;
+
+	if (cruft_expiration)
+		rescue_cruft_objects();
+
+	for (i = 0; i < cruft_objects_nr; i++) {
+		struct cruft_object *c = &cruft_objects[i];
+
+		if (!c->keep || !add_object_entry(c->sha1, 0, "", 0))
+			continue;
+		oe_set_cruft_mtime(&to_pack,
+				   &to_pack.objects[to_pack.nr_objects - 1],
+				   c->mtime);
+	}
+
+	free(cruft_objects);
+	cruft_objects = NULL;
+	cruft_objects_nr = cruft_objects_alloc = 0;
+}
+
 static void loosen_unused_packed_objects(struct rev_info *revs)
 {
 	struct packed_git *p;
@@ -2522,7 +3223,7 @@ static int option_parse_index_version(const struct option *opt,
 	char *c;
 	const char *val = arg;
 	pack_idx_opts.version = strtoul(val, &c, 10);
-	if (pack_idx_opts.version > 2)
+	if (pack_idx_opts.version > 3)
 		die(_("unsupported index version %s"), val);
 	if (*c == ',' && c[1])
 		pack_idx_opts.off32_limit = strtoul(c+1, &c, 0);
@@ -2571,6 +3272,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	const char *rp_av[6];
 	int rp_ac = 0;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
+	int stdin_packs = 0;
 	struct option pack_objects_options[] = {
 		OPT_SET_INT('q', "quiet", &progress,
 			    N_("do not show progress meter"), 0),
@@ -2608,6 +3310,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from standard input")),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("pack the unreachable objects of the packs on standard input and the loose ones, with their mtimes")),
+		OPT_EXPIRY_DATE(0, "cruft-expiration", &cruft_expiration,
+				N_("leave out cruft objects older than <time>")),
 		{ OPTION_SET_INT, 0, "unpacked", &rev_list_unpacked, NULL,
 		  N_("limit the objects to those that are not yet packed"),
 		  PARSE_OPT_NOARG | PARSE_OPT_NONEG, NULL, 1 },
@@ -2644,6 +3352,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	check_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	pack_idx_opts.object_info = written_object_info;
 	git_config(git_pack_config, NULL);
 	if (!pack_compression_seen && core_compression_seen)
 		pack_compression_level = core_compression_level;
@@ -2659,6 +3368,20 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (pack_to_stdout != !base_name || argc)
 		usage_with_options(pack_usage, pack_objects_options);
 
+	if (stdin_packs && (use_internal_rev_list || rev_list_all ||
+			    rev_list_reflog || thin))
+		die("--stdin-packs cannot be used with --revs, --all, --reflog or --thin");
+
+	if (cruft) {
+		if (use_internal_rev_list || rev_list_all || rev_list_reflog ||
+		    thin || pack_to_stdout)
+			die("--cruft cannot be used with --revs, --all, --reflog, --thin or --stdout");
+		stdin_packs = 1;
+		ignore_packed_keep = 1;
+		pack_idx_opts.flags |= WRITE_MTIMES;
+		pack_idx_opts.object_mtime = written_object_mtime;
+	}
+
 	rp_av[rp_ac++] = "pack-objects";
 	if (thin) {
 		use_internal_rev_list = 1;
@@ -2704,7 +3427,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
-	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow())
+	if (!use_internal_rev_list || stdin_packs || !pack_to_stdout ||
+	    is_repository_shallow())
 		use_bitmap_index = 0;
 
 	if (pack_to_stdout || !rev_list_all)
@@ -2714,10 +3438,18 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	prepare_packed_git();
+	prepare_packing_data(&to_pack);
+	if (cruft) {
+		/* grown along with the objects by packlist_alloc() */
+		to_pack.cruft_mtime = xcalloc(1, sizeof(*to_pack.cruft_mtime));
+		save_commit_buffer = 0;
+	}
 
 	if (progress)
 		progress_state = start_progress(_("Counting objects"), 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs)
+		read_packs_list_from_stdin(rev_list_unpacked);
+	else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		rp_av[rp_ac] = NULL;
@@ -2737,5 +3469,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
 			written, written_delta, reused, reused_delta);
+	trace_printf_key(&trace_to_pack,
+			 "to_pack: %"PRIu32" objects, %lu bytes each, "
+			 "%lu bytes peak\n", to_pack.nr_objects,
+			 (unsigned long)sizeof(struct object_entry),
+			 (unsigned long)to_pack.peak_memory);
 	return 0;
 }
@@ -7,6 +7,10 @@
 #include "parse-options.h"
 #include "progress.h"
 #include "dir.h"
+#include "blob.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "pack-mtimes.h"
 
 static const char * const prune_usage[] = {
 	N_("git prune [-n] [-v] [--expire <time>] [--] [<head>...]"),
@@ -112,6 +116,88 @@ static void prune_object_dir(const char *path)
 	}
 }
 
+static struct object *lookup_cruft_object(const unsigned char *sha1)
+{
+	struct blob *blob;
+
+	if (sha1_object_info(sha1, NULL) != OBJ_BLOB)
+		return parse_object(sha1);
+	blob = lookup_blob(sha1);
+	return blob ? &blob->object : NULL;
+}
+
+static void mark_cruft_object(struct object *obj, struct object_array *pending)
+{
+	if (!obj || (obj->flags & SEEN))
+		return;
+	obj->flags |= SEEN;
+	add_object_array(obj, "", pending);
+}
+
+/*
+ * "repack --cruft" keeps the unreachable objects that are recent by
+ * the mtimes of the cruft pack, together with everything they refer
+ * to; do not prune the loose copies of the latter either.
+ */
+static void mark_recent_cruft_objects(void)
+{
+	struct object_array pending = OBJECT_ARRAY_INIT;
+	struct packed_git *p;
+	uint32_t i;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->is_cruft || load_pack_mtimes(p))
+			continue;
+		for (i = 0; i < p->num_objects; i++)
+			if (nth_packed_mtime(p, i) > expire)
+				mark_cruft_object(lookup_cruft_object(
+					nth_packed_object_sha1(p, i)), &pending);
+	}
+
+	while (pending.nr) {
+		struct object *obj = pending.objects[--pending.nr].item;
+
+		if (obj->type == OBJ_COMMIT) {
+			struct commit *commit = (struct commit *)obj;
+			struct commit_list *parent;
+
+			if (parse_commit(commit))
+				continue;
+			mark_cruft_object((struct object *)commit->tree, &pending);
+			for (parent = commit->parents; parent; parent = parent->next)
+				mark_cruft_object(&parent->item->object, &pending);
+		} else if (obj->type == OBJ_TREE) {
+			struct tree *tree = (struct tree *)obj;
+			struct tree_desc desc;
+			struct name_entry entry;
+
+			if (parse_tree(tree))
+				continue;
+			init_tree_desc(&desc, tree->buffer, tree->size);
+			while (tree_entry(&desc, &entry)) {
+				if (S_ISGITLINK(entry.mode))
+					continue;
+				if (S_ISDIR(entry.mode))
+					mark_cruft_object((struct object *)
+							  lookup_tree(entry.sha1),
+							  &pending);
+				else
+					mark_cruft_object((struct object *)
+							  lookup_blob(entry.sha1),
+							  &pending);
+			}
+			free_tree_buffer(tree);
+		} else if (obj->type == OBJ_TAG) {
+			struct tag *tag = (struct tag *)obj;
+
+			if (!parse_tag(tag))
+				mark_cruft_object(tag->tagged, &pending);
+		}
+	}
+	free(pending.objects);
+}
+
 /*
  * Write errors (particularly out of space) can result in
  * failed temporary packs (and more rarely indexes and other
@@ -173,6 +259,7 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 
 	mark_reachable_objects(&revs, 1, progress);
 	stop_progress(&progress);
+	mark_recent_cruft_objects();
 	prune_object_dir(get_object_directory());
 
 	prune_packed_objects(show_only ? PRUNE_PACKED_DRY_RUN : 0);
@@ -7,6 +7,8 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
+#include "sha1-array.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
@@ -104,7 +106,8 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".rev",
+			      ".mtimes"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -120,6 +123,169 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	strbuf_release(&buf);
 }
 
+/*
+ * With --geometric, the local packs without a .keep file, other than
+ * cruft packs, sorted by
+ * their number of objects, are split so that the packs from "split"
+ * on each have at least "factor" times as many objects as the one
+ * before them.  The packs before the split are rolled up into one new
+ * pack, together with the loose objects.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static uint32_t geometry_pack_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die(_("cannot open index for %s"), p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t a = geometry_pack_weight(*(struct packed_git **)va),
+		 b = geometry_pack_weight(*(struct packed_git **)vb);
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry)
+{
+	struct packed_git *p;
+
+	memset(geometry, 0, sizeof(*geometry));
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		/* a cruft pack keeps the mtimes of its objects; leave it be */
+		if (!p->pack_local || p->pack_keep || p->is_cruft)
+			continue;
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	qsort(geometry->pack, geometry->pack_nr, sizeof(*geometry->pack),
+	      geometry_cmp);
+}
+
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint64_t total = 0;
+	uint32_t i;
+
+	/*
+	 * Find the largest packs that already make a progression; the
+	 * pack below the first pair that does not goes into the roll-up,
+	 * together with all the smaller ones.
+	 */
+	for (i = geometry->pack_nr; i > 1; i--) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i - 1]);
+		uint64_t prev = geometry_pack_weight(geometry->pack[i - 2]);
+
+		if (ours < factor * prev)
+			break;
+	}
+	geometry->split = i > 1 ? i - 1 : 0;
+
+	/*
+	 * The new pack may be big enough to break the progression of the
+	 * packs above it; if so, roll those up too.
+	 */
+	for (i = 0; i < geometry->split; i++)
+		total += geometry_pack_weight(geometry->pack[i]);
+	for (i = geometry->split; i < geometry->pack_nr; i++) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i]);
+
+		if (ours >= factor * total)
+			break;
+		total += ours;
+		geometry->split++;
+	}
+}
+
+static int has_loose_objects(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		if (odb_loose_cache(NULL, i)->nr)
+			return 1;
+	return 0;
+}
+
+/*
+ * With --cruft, pack the objects of the existing packs that did not
+ * make it into the new ones, together with the loose objects, into a
+ * cruft pack.  As the packs it replaces are all still there, it is
+ * written straight into place; its name is added to names.
+ */
+static int write_cruft_pack(const char *cruft_expiration, int quiet,
+			    struct string_list *names,
+			    struct string_list *existing_packs)
+{
+	struct child_process cmd;
+	struct argv_array args = ARGV_ARRAY_INIT;
+	struct string_list_item *item;
+	struct strbuf line = STRBUF_INIT;
+	FILE *in, *out;
+	int ret;
+
+	argv_array_push(&args, "pack-objects");
+	argv_array_push(&args, "--cruft");
+	if (cruft_expiration)
+		argv_array_pushf(&args, "--cruft-expiration=%s",
+				 cruft_expiration);
+	argv_array_push(&args, "--non-empty");
+	if (quiet)
+		argv_array_push(&args, "--quiet");
+	if (delta_base_offset)
+		argv_array_push(&args, "--delta-base-offset");
+	argv_array_pushf(&args, "%s/pack", packdir);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.argv = args.argv;
+	cmd.git_cmd = 1;
+	cmd.in = -1;
+	cmd.out = -1;
+	ret = start_command(&cmd);
+	if (ret) {
+		argv_array_clear(&args);
+		return ret;
+	}
+
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "^pack-%s.pack\n", item->string);
+	for_each_string_list_item(item, existing_packs) {
+		size_t len = strlen(item->string);
+
+		if (len >= 40 &&
+		    unsorted_string_list_has_string(names,
+						    item->string + len - 40))
+			continue;
+		fprintf(in, "%s.pack\n", item->string);
+	}
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline(&line, out, '\n') != EOF) {
+		if (line.len != 40)
+			die("repack: Expecting 40 character sha1 lines only from pack-objects.");
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+	ret = finish_command(&cmd);
+	argv_array_clear(&args);
+	return ret;
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -132,6 +298,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		{".pack"},
 		{".idx"},
 		{".bitmap", 1},
+		{".rev", 1},
 	};
 	struct child_process cmd;
 	struct string_list_item *item;
@@ -154,6 +321,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int no_update_server_info = 0;
 	int quiet = 0;
 	int local = 0;
+	int write_midx = 0;
+	int geometric_factor = 0;
+	struct pack_geometry geometry;
+	int cruft = 0;
+	const char *cruft_expiration = NULL;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -161,6 +333,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BOOL(0, "cruft", &cruft,
+				N_("same as -a, and pack unreachable objects into a cruft pack")),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &no_reuse_delta,
@@ -174,6 +350,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('m', "write-midx", &write_midx,
+				N_("write a multi-pack index of the resulting packs")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_STRING(0, "window", &window, N_("n"),
@@ -186,6 +364,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("maximum size of each packfile")),
 		OPT_BOOL(0, "pack-kept-objects", &pack_kept_objects,
 				N_("repack objects in packs marked with .keep")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -197,6 +377,29 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
+	if (cruft) {
+		if (pack_everything & LOOSEN_UNREACHABLE)
+			die(_("--cruft is incompatible with -A"));
+		pack_everything |= ALL_INTO_ONE;
+	}
+
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -A, -a, --cruft"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+		init_pack_geometry(&geometry);
+		split_pack_geometry(&geometry, geometric_factor);
+		/* rolling up a single pack alone would only rewrite it */
+		if (geometry.split <= 1 && !has_loose_objects()) {
+			if (!quiet)
+				printf("Nothing new to pack.\n");
+			if (write_midx)
+				write_multi_pack_index(get_object_directory());
+			return 0;
+		}
+	}
+
 	packdir = mkpathdup("%s/pack", get_object_directory());
 	packtmp = mkpathdup("%s/.tmp-%d-pack", packdir, (int)getpid());
 
@@ -207,8 +410,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (!pack_kept_objects)
 		argv_array_push(&cmd_args, "--honor-pack-keep");
 	argv_array_push(&cmd_args, "--non-empty");
-	argv_array_push(&cmd_args, "--all");
-	argv_array_push(&cmd_args, "--reflog");
+	if (geometric_factor) {
+		argv_array_push(&cmd_args, "--stdin-packs");
+		argv_array_push(&cmd_args, "--unpacked");
+	} else {
+		argv_array_push(&cmd_args, "--all");
+		argv_array_push(&cmd_args, "--reflog");
+	}
 	if (window)
 		argv_array_pushf(&cmd_args, "--window=%s", window);
 	if (window_memory)
@@ -224,10 +432,21 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (write_bitmaps)
 		argv_array_push(&cmd_args, "--write-bitmap-index");
 
-	if (pack_everything & ALL_INTO_ONE) {
+	if (geometric_factor) {
+		uint32_t i;
+
+		for (i = 0; i < geometry.split; i++) {
+			const char *name = pack_basename(geometry.pack[i]);
+			size_t len;
+
+			if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
+	} else if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
 
-		if (existing_packs.nr && delete_redundant) {
+		if (existing_packs.nr && delete_redundant && !cruft) {
 			if (unpack_unreachable)
 				argv_array_pushf(&cmd_args,
 						"--unpack-unreachable=%s",
@@ -254,12 +473,25 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	cmd.argv = cmd_args.argv;
 	cmd.git_cmd = 1;
 	cmd.out = -1;
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+		uint32_t i;
+
+		for (i = 0; i < geometry.pack_nr; i++)
+			fprintf(in, "%s%s\n", i < geometry.split ? "" : "^",
+				pack_basename(geometry.pack[i]));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline(&line, out, '\n') != EOF) {
 		if (line.len != 40)
@@ -377,7 +609,22 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	/* End of pack replacement. */
 
+	if (cruft && delete_redundant) {
+		ret = write_cruft_pack(cruft_expiration, quiet, &names,
+				       &existing_packs);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * A multi-pack index pointing into a pack we replaced or
+	 * removed would be stale.
+	 */
+	if (rollback.nr)
+		clear_midx_file(get_object_directory());
+
 	if (delete_redundant) {
+		int midx_cleared = 0;
 		sort_string_list(&names);
 		for_each_string_list_item(item, &existing_packs) {
 			char *sha1;
@@ -385,8 +632,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (len < 40)
 				continue;
 			sha1 = item->string + len - 40;
-			if (!string_list_has_string(&names, sha1))
-				remove_redundant_pack(packdir, item->string);
+			if (string_list_has_string(&names, sha1))
+				continue;
+			if (!midx_cleared) {
+				clear_midx_file(get_object_directory());
+				midx_cleared = 1;
+			}
+			remove_redundant_pack(packdir, item->string);
 		}
 		argv_array_push(&cmd_args, "prune-packed");
 		if (quiet)
@@ -399,6 +651,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_clear(&cmd_args);
 	}
 
+	if (write_midx)
+		write_multi_pack_index(get_object_directory());
+
 	if (!no_update_server_info) {
 		argv_array_push(&cmd_args, "update-server-info");
 		memset(&cmd, 0, sizeof(cmd));
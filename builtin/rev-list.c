@@ -106,7 +106,7 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
-	if (revs->verbose_header && get_cached_commit_buffer(commit, NULL)) {
+	if (revs->verbose_header) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
 		ctx.abbrev = revs->abbrev;
@@ -270,6 +270,18 @@ static int show_object_fast(
 	return 1;
 }
 
+static void show_count(struct rev_info *revs)
+{
+	if (revs->left_right && revs->cherry_mark)
+		printf("%d\t%d\t%d\n", revs->count_left, revs->count_right, revs->count_same);
+	else if (revs->left_right)
+		printf("%d\t%d\n", revs->count_left, revs->count_right);
+	else if (revs->cherry_mark)
+		printf("%d\t%d\n", revs->count_left + revs->count_right, revs->count_same);
+	else
+		printf("%d\n", revs->count_left + revs->count_right);
+}
+
 int cmd_rev_list(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
@@ -371,6 +383,12 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	if (revs.count && !bisect_list &&
+	    !count_revisions_from_bitmaps(&revs)) {
+		show_count(&revs);
+		return 0;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -388,16 +406,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 
 	traverse_commit_list(&revs, show_commit, show_object, &info);
 
-	if (revs.count) {
-		if (revs.left_right && revs.cherry_mark)
-			printf("%d\t%d\t%d\n", revs.count_left, revs.count_right, revs.count_same);
-		else if (revs.left_right)
-			printf("%d\t%d\n", revs.count_left, revs.count_right);
-		else if (revs.cherry_mark)
-			printf("%d\t%d\n", revs.count_left + revs.count_right, revs.count_same);
-		else
-			printf("%d\n", revs.count_left + revs.count_right);
-	}
+	if (revs.count)
+		show_count(&revs);
 
 	return 0;
 }
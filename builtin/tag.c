@@ -17,6 +17,8 @@
 #include "gpg-interface.h"
 #include "sha1-array.h"
 #include "column.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 static const char * const git_tag_usage[] = {
 	N_("git tag [-a|-s|-u <key-id>] [-f] [-m <msg>|-F <file>] <tagname> [<head>]"),
@@ -93,7 +95,8 @@ enum contains_result {
  * Do not recurse to find out, though, but return -1 if inconclusive.
  */
 static enum contains_result contains_test(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	/* was it previously marked as containing a want commit? */
 	if (candidate->object.flags & TMP_MARK)
@@ -110,6 +113,10 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	/* nothing below the lowest generation can reach a want commit */
+	if (candidate->generation < cutoff)
+		return 0;
+
 	return -1;
 }
 
@@ -140,11 +147,25 @@ static enum contains_result contains(struct commit *candidate,
 		const struct commit_list *want)
 {
 	struct stack stack = { 0, 0, NULL };
-	int result = contains_test(candidate, want);
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	const struct commit_list *c;
+	int result;
+
+	for (c = want; c; c = c->next) {
+		parse_commit(c->item);
+		if (c->item->generation < cutoff)
+			cutoff = c->item->generation;
+	}
+
+	result = contains_test(candidate, want, cutoff);
 
 	if (result != CONTAINS_UNKNOWN)
 		return result;
 
+	result = bitmap_commit_contains(candidate, want);
+	if (result >= 0)
+		return result;
+
 	push_to_stack(candidate, &stack);
 	while (stack.nr) {
 		struct stack_entry *entry = &stack.stack[stack.nr - 1];
@@ -159,7 +180,7 @@ static enum contains_result contains(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful 0 or 1.
 		 */
-		else switch (contains_test(parents->item, want)) {
+		else switch (contains_test(parents->item, want, cutoff)) {
 		case CONTAINS_YES:
 			commit->object.flags |= TMP_MARK;
 			stack.nr--;
@@ -173,7 +194,7 @@ static enum contains_result contains(struct commit *candidate,
 		}
 	}
 	free(stack.stack);
-	return contains_test(candidate, want);
+	return contains_test(candidate, want, cutoff);
 }
 
 static void show_tag_lines(const unsigned char *sha1, int lines)
@@ -14,6 +14,7 @@
 #include "pathspec.h"
 #include "dir.h"
 #include "split-index.h"
+#include "bulk-checkin.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -906,6 +907,7 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 		struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
 		setup_work_tree();
+		plug_bulk_checkin();
 		while (strbuf_getline(&buf, stdin, line_termination) != EOF) {
 			const char *p;
 			if (line_termination && buf.buf[0] == '"') {
@@ -920,6 +922,7 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 				chmod_path(set_executable_bit, p);
 			free((char *)p);
 		}
+		unplug_bulk_checkin();
 		strbuf_release(&nbuf);
 		strbuf_release(&buf);
 	}
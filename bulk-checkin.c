@@ -5,9 +5,15 @@
 #include "csum-file.h"
 #include "pack.h"
 #include "strbuf.h"
+#include "hashmap.h"
 
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 
+struct written_object {
+	struct hashmap_entry ent;
+	struct pack_idx_entry idx;
+};
+
 static struct bulk_checkin_state {
 	unsigned plugged:1;
 
@@ -16,15 +22,31 @@ static struct bulk_checkin_state {
 	off_t offset;
 	struct pack_idx_option pack_idx_opts;
 
+	/* each of these is the idx member of a struct written_object */
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct hashmap written_map;
 } state;
 
+static struct written_object *written_object(struct pack_idx_entry *idx)
+{
+	return (struct written_object *)
+		((char *)idx - offsetof(struct written_object, idx));
+}
+
+static int written_object_cmp(const struct written_object *a,
+			      const struct written_object *b,
+			      const unsigned char *sha1)
+{
+	return hashcmp(a->idx.sha1, sha1 ? sha1 : b->idx.sha1);
+}
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	unsigned char sha1[20];
 	struct strbuf packname = STRBUF_INIT;
+	unsigned plugged;
 	int i;
 
 	if (!state->f)
@@ -49,11 +71,14 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 			    state->written, state->nr_written,
 			    &state->pack_idx_opts, sha1);
 	for (i = 0; i < state->nr_written; i++)
-		free(state->written[i]);
+		free(written_object(state->written[i]));
 
 clear_exit:
 	free(state->written);
+	hashmap_free(&state->written_map, 0);
+	plugged = state->plugged;
 	memset(state, 0, sizeof(*state));
+	state->plugged = plugged;
 
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
@@ -62,21 +87,28 @@ clear_exit:
 
 static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
 {
-	int i;
-
 	/* The object may already exist in the repository */
-	if (has_sha1_file(sha1))
+	if (has_sha1_file_with_flags(sha1, HAS_SHA1_QUICK))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (!hashcmp(state->written[i]->sha1, sha1))
-			return 1;
+	if (hashmap_get_from_hash(&state->written_map, sha1hash(sha1), sha1))
+		return 1;
 
 	/* This is a new object we need to keep */
 	return 0;
 }
 
+static void record_written(struct bulk_checkin_state *state,
+			   struct written_object *obj)
+{
+	hashmap_entry_init(obj, sha1hash(obj->idx.sha1));
+	hashmap_add(&state->written_map, obj);
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = &obj->idx;
+}
+
 /*
  * Read the contents from fd for size bytes, streaming it to the
  * packfile in state while updating the hash in ctx. Signal a failure
@@ -176,6 +208,8 @@ static void prepare_to_stream(struct bulk_checkin_state *state,
 
 	state->f = create_tmp_packfile(&state->pack_tmp_name);
 	reset_pack_idx_option(&state->pack_idx_opts);
+	hashmap_init(&state->written_map,
+		     (hashmap_cmp_fn)written_object_cmp, 0);
 
 	/* Pretend we are going to write only one object */
 	state->offset = write_pack_header(state->f, 1);
@@ -194,6 +228,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct sha1file_checkpoint checkpoint;
+	struct written_object *obj = NULL;
 	struct pack_idx_entry *idx = NULL;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
@@ -206,8 +241,10 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	git_SHA1_Update(&ctx, obuf, header_len);
 
 	/* Note: idx is non-NULL when we are writing */
-	if ((flags & HASH_WRITE_OBJECT) != 0)
-		idx = xcalloc(1, sizeof(*idx));
+	if ((flags & HASH_WRITE_OBJECT) != 0) {
+		obj = xcalloc(1, sizeof(*obj));
+		idx = &obj->idx;
+	}
 
 	already_hashed_to = 0;
 
@@ -242,17 +279,65 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	if (already_written(state, result_sha1)) {
 		sha1file_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
-		free(idx);
+		free(obj);
 	} else {
 		hashcpy(idx->sha1, result_sha1);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		record_written(state, obj);
 	}
 	return 0;
 }
 
+static int deflate_buf_to_pack(struct bulk_checkin_state *state,
+			       unsigned char *result_sha1,
+			       const void *buf, size_t size,
+			       enum object_type type)
+{
+	struct written_object *obj;
+	unsigned char hdr[10];
+	unsigned hdrlen;
+	unsigned char *out;
+	unsigned long outlen;
+	git_zstream s;
+
+	if (hash_sha1_file(buf, size, typename(type), result_sha1))
+		return -1;
+	if (state->f ? already_written(state, result_sha1)
+		     : has_sha1_file_with_flags(result_sha1, HAS_SHA1_QUICK))
+		return 0;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, pack_compression_level);
+	outlen = git_deflate_bound(&s, size);
+	out = xmalloc(outlen);
+	s.next_in = (void *)buf;
+	s.avail_in = size;
+	s.next_out = out;
+	s.avail_out = outlen;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	outlen = s.total_out;
+
+	hdrlen = encode_in_pack_object_header(type, size, hdr);
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + outlen)
+		finish_bulk_checkin(state);
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+
+	obj = xcalloc(1, sizeof(*obj));
+	hashcpy(obj->idx.sha1, result_sha1);
+	obj->idx.offset = state->offset;
+	crc32_begin(state->f);
+	sha1write(state->f, hdr, hdrlen);
+	sha1write(state->f, out, outlen);
+	obj->idx.crc32 = crc32_end(state->f);
+	state->offset += hdrlen + outlen;
+	record_written(state, obj);
+
+	free(out);
+	return 0;
+}
+
 int index_bulk_checkin(unsigned char *sha1,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -264,6 +349,21 @@ int index_bulk_checkin(unsigned char *sha1,
 	return status;
 }
 
+int index_bulk_checkin_mem(unsigned char *sha1,
+			   const void *buf, size_t size,
+			   enum object_type type)
+{
+	int status = deflate_buf_to_pack(&state, sha1, buf, size, type);
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+	return status;
+}
+
+int bulk_checkin_plugged(void)
+{
+	return state.plugged;
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
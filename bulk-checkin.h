@@ -10,6 +10,15 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * Like index_bulk_checkin(), but for an object that is already in
+ * memory (and, for blobs, already converted to git format).
+ */
+extern int index_bulk_checkin_mem(unsigned char sha1[],
+				  const void *buf, size_t size,
+				  enum object_type type);
+
+extern int bulk_checkin_plugged(void);
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
@@ -632,6 +632,10 @@ extern int check_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+extern int core_multi_pack_index;
+extern int core_commit_graph;
+extern int core_loose_object_cache;
+extern int core_bulk_checkin;
 extern int precomposed_unicode;
 
 /*
@@ -917,8 +921,18 @@ extern int has_sha1_pack(const unsigned char *sha1);
  * Return true iff we have an object named sha1, whether local or in
  * an alternate object database, and whether packed or loose.  This
  * function does not respect replace references.
+ *
+ * Unless HAS_SHA1_QUICK is given, a miss makes us look for packs that
+ * may have appeared since we started before giving up.  Callers that
+ * can cope with the rare false negative due to a concurrent repack
+ * should pass it to avoid rescanning the pack directory.
  */
-extern int has_sha1_file(const unsigned char *sha1);
+#define HAS_SHA1_QUICK 0x1
+extern int has_sha1_file_with_flags(const unsigned char *sha1, int flags);
+static inline int has_sha1_file(const unsigned char *sha1)
+{
+	return has_sha1_file_with_flags(sha1, 0);
+}
 
 /*
  * Return true iff an alternate object database has a loose object
@@ -1143,6 +1157,7 @@ extern void remove_scheduled_dirs(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_cache;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -1152,6 +1167,19 @@ extern void add_to_alternates_file(const char *reference);
 typedef int alt_odb_fn(struct alternate_object_database *, void *);
 extern void foreach_alt_odb(alt_odb_fn, void*);
 
+/*
+ * With core.looseObjectCache, each objects/xx directory is read once
+ * into a sorted list that answers the existence checks above and
+ * abbreviated name lookups.  Return that list for the subdirectory
+ * subdir_nr (the first byte of the names) of the object database alt,
+ * or of our own object database if alt is NULL.  The lists are thrown
+ * away by reprepare_packed_git().
+ */
+struct sha1_array;
+extern struct sha1_array *odb_loose_cache(struct alternate_object_database *alt,
+					  int subdir_nr);
+extern void odb_clear_loose_cache(void);
+
 struct pack_window {
 	struct pack_window *next;
 	unsigned char *base;
@@ -1175,7 +1203,13 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1,
+		 is_cruft:1;
+	unsigned int pack_idx;	/* for packing_data.in_pack_by_idx */
+	/* the .mtimes file of a cruft pack, see pack-mtimes.h */
+	const void *mtimes_map;
+	size_t mtimes_size;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -1185,6 +1219,7 @@ struct pack_entry {
 	off_t offset;
 	unsigned char sha1[20];
 	struct packed_git *p;
+	uint32_t nth; /* position in the .idx, or -1 if not known */
 };
 
 extern struct packed_git *parse_pack_index(unsigned char *sha1, const char *idx_path);
@@ -1199,6 +1234,9 @@ extern void install_packed_git(struct packed_git *pack);
 extern struct packed_git *find_sha1_pack(const unsigned char *sha1,
 					 struct packed_git *packs);
 
+/* The file name of the pack, without its directory */
+extern const char *pack_basename(struct packed_git *p);
+
 extern void pack_report(void);
 
 /*
@@ -1218,6 +1256,25 @@ extern void close_pack_windows(struct packed_git *);
 extern void unuse_pack(struct pack_window **);
 extern void free_pack_by_name(const char *);
 extern void clear_delta_base_cache(void);
+
+/*
+ * Call enable_obj_read_lock() before starting threads that read
+ * objects with read_sha1_file() or sha1_object_info_extended(), and
+ * disable_obj_read_lock() once they are done.  Other code that looks
+ * at pack windows or the delta base cache from such a thread has to
+ * hold obj_read_lock().
+ */
+#ifndef NO_PTHREADS
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+#else
+static inline void enable_obj_read_lock(void) {}
+static inline void disable_obj_read_lock(void) {}
+static inline void obj_read_lock(void) {}
+static inline void obj_read_unlock(void) {}
+#endif
 extern struct packed_git *add_packed_git(const char *, int, int);
 
 /*
@@ -1234,18 +1291,43 @@ extern const unsigned char *nth_packed_object_sha1(struct packed_git *, uint32_t
  */
 extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t n);
 
+/*
+ * Return the type of the nth object within the specified packfile and
+ * store its size and whether it is stored as a delta, as recorded in a
+ * version 3 index.  Return OBJ_BAD if the index does not have them.
+ * The index must already be opened.
+ */
+extern int nth_packed_object_info(const struct packed_git *, uint32_t n,
+				  unsigned long *sizep, int *is_delta);
+
 /*
  * If the object named sha1 is present in the specified packfile,
  * return its offset within the packfile; otherwise, return 0.
  */
 extern off_t find_pack_entry_one(const unsigned char *sha1, struct packed_git *);
 
+/*
+ * If the object named sha1 is present in the specified packfile,
+ * store its position within the index and return 1.
+ */
+extern int find_pack_entry_pos(const unsigned char *sha1, struct packed_git *, uint32_t *pos);
+
 extern int is_pack_valid(struct packed_git *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Given the type and offset of a delta found at *curpos (just past its
+ * object header), return the offset of its base in the same pack and
+ * advance *curpos to the delta data.  Returns 0 if the base is not in
+ * this pack or the entry is corrupt.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 struct object_info {
 	/* Request */
 	enum object_type *typep;
@@ -1278,6 +1360,25 @@ struct object_info {
 };
 extern int sha1_object_info_extended(const unsigned char *, struct object_info *, unsigned flags);
 
+/*
+ * Look up the nr objects in sha1[] like sha1_object_info_extended(),
+ * but visit the packed ones sorted by pack and offset, so that a large
+ * batch reads each pack front to back instead of seeking all over it.
+ *
+ * oi names what to look up, as for sha1_object_info_extended().  For
+ * every object, its answers are stored where oi points and fn is called
+ * with the position of the object in sha1[] and the value that
+ * sha1_object_info_extended() would have returned (0 or -1).  The
+ * calls come in the order of sha1[] or, if "unordered" is set, as soon
+ * as each object has been looked up.  A non-zero return from fn stops
+ * the batch and is returned.
+ */
+typedef int (*object_info_batch_fn)(int nr, int ret, void *data);
+extern int sha1_object_info_batch(const unsigned char (*sha1)[20], int nr,
+				  struct object_info *oi, unsigned flags,
+				  int unordered, object_info_batch_fn fn,
+				  void *data);
+
 /* Dumb servers support */
 extern int update_server_info(int);
 
@@ -1415,6 +1516,19 @@ extern void *alloc_object_node(void);
 extern void alloc_report(void);
 extern unsigned int alloc_commit_index(void);
 
+/*
+ * Objects looked up or parsed while an object pool is pushed are
+ * allocated from it.  Popping the pool (innermost first) drops them
+ * from the object hash and frees them, along with their parsed
+ * buffers and parent lists; surviving objects that were parsed to point
+ * at them are marked unparsed again.  The caller must not hold on to
+ * pool objects elsewhere (object arrays, decorations, commit slabs)
+ * past the pop.
+ */
+struct object_pool;
+extern struct object_pool *push_object_pool(const char *name);
+extern void pop_object_pool(struct object_pool *);
+
 /* pkt-line.c */
 void packet_trace_identity(const char *prog);
 
@@ -0,0 +1,708 @@
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "commit-graph.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
+#define GRAPH_MAX_CHUNKS 4
+#define GRAPH_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
+#define GRAPH_DATA_WIDTH (20 + 16)
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+/* Remember to update object flag allocation in object.h */
+#define GRAPH_ADDED (1u<<15)
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+char *get_commit_graph_filename(const char *object_dir)
+{
+	return xstrfmt("%s/info/commit-graph", object_dir);
+}
+
+static uint64_t get_be64_at(const unsigned char *p)
+{
+	return (((uint64_t)get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+/*
+ * Open and mmap a commit-graph file and check that it is one we can
+ * use.  A missing file is not an error; NULL is returned quietly in
+ * that case.
+ */
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *g = NULL;
+	const unsigned char *map = NULL, *chunk_table;
+	size_t graph_size = 0, chunk_start[GRAPH_MAX_CHUNKS + 1];
+	uint32_t chunk_id[GRAPH_MAX_CHUNKS + 1];
+	uint32_t i, nr, num_chunks;
+	struct stat st;
+	int fd;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+	if (graph_size < GRAPH_HEADER_SIZE + GRAPH_CHUNKLOOKUP_WIDTH + 20) {
+		close(fd);
+		error("commit-graph %s is too small", graph_file);
+		return NULL;
+	}
+	map = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = map;
+	g->data_len = graph_size;
+
+	if (get_be32(map) != GRAPH_SIGNATURE) {
+		error("commit-graph %s has bad signature", graph_file);
+		goto cleanup_fail;
+	}
+	if (map[4] != GRAPH_VERSION) {
+		error("commit-graph %s is version %d and is not supported"
+		      " by this binary", graph_file, map[4]);
+		goto cleanup_fail;
+	}
+	if (map[5] != GRAPH_HASH_VERSION) {
+		error("commit-graph %s uses unknown hash version %d",
+		      graph_file, map[5]);
+		goto cleanup_fail;
+	}
+	num_chunks = map[6];
+	if (map[7]) {
+		error("commit-graph %s has base files, which are not"
+		      " supported", graph_file);
+		goto cleanup_fail;
+	}
+
+	if (num_chunks > GRAPH_MAX_CHUNKS ||
+	    graph_size < GRAPH_HEADER_SIZE +
+			 (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH + 20) {
+		error("commit-graph %s has a bad chunk table", graph_file);
+		goto cleanup_fail;
+	}
+
+	chunk_table = map + GRAPH_HEADER_SIZE;
+	for (i = 0; i <= num_chunks; i++) {
+		uint64_t ofs = get_be64_at(chunk_table + 4);
+
+		chunk_id[i] = get_be32(chunk_table);
+		if (ofs > graph_size - 20 ||
+		    (i && ofs < chunk_start[i - 1])) {
+			error("commit-graph %s has a bad chunk offset",
+			      graph_file);
+			goto cleanup_fail;
+		}
+		chunk_start[i] = (size_t)ofs;
+		chunk_table += GRAPH_CHUNKLOOKUP_WIDTH;
+	}
+	if (chunk_id[num_chunks]) {
+		error("commit-graph %s has an unterminated chunk table",
+		      graph_file);
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *start = map + chunk_start[i];
+		size_t len = chunk_start[i + 1] - chunk_start[i];
+
+		switch (chunk_id[i]) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (len != GRAPH_CHUNK_FANOUT_SIZE) {
+				error("commit-graph %s has a bad fanout",
+				      graph_file);
+				goto cleanup_fail;
+			}
+			g->chunk_oid_fanout = (const uint32_t *)start;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = start;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = start;
+			break;
+		case GRAPH_CHUNKID_EXTRAEDGES:
+			g->chunk_extra_edges = start;
+			g->num_extra_edges = len / sizeof(uint32_t);
+			break;
+		default:
+			/* unknown chunks are ignored */
+			break;
+		}
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup ||
+	    !g->chunk_commit_data) {
+		error("commit-graph %s is missing a required chunk",
+		      graph_file);
+		goto cleanup_fail;
+	}
+
+	nr = 0;
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(g->chunk_oid_fanout[i]);
+		if (n < nr) {
+			error("non-monotonic commit-graph %s", graph_file);
+			goto cleanup_fail;
+		}
+		nr = n;
+	}
+	g->num_commits = nr;
+
+	for (i = 0; i < num_chunks; i++) {
+		size_t len = chunk_start[i + 1] - chunk_start[i];
+		size_t want;
+
+		if (chunk_id[i] == GRAPH_CHUNKID_OIDLOOKUP)
+			want = (size_t)nr * 20;
+		else if (chunk_id[i] == GRAPH_CHUNKID_DATA)
+			want = (size_t)nr * GRAPH_DATA_WIDTH;
+		else
+			continue;
+		if (len != want) {
+			error("wrong chunk size in commit-graph %s",
+			      graph_file);
+			goto cleanup_fail;
+		}
+	}
+
+	return g;
+
+cleanup_fail:
+	free(g);
+	munmap((void *)map, graph_size);
+	return NULL;
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	munmap((void *)g->data, g->data_len);
+	free(g);
+}
+
+static int has_commit_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The file records the parents as they are written in the commit
+ * objects; anything that makes us see different parents rules it out.
+ */
+static int commit_graph_compatible(void)
+{
+	if (check_replace_refs) {
+		/* this reads the replace refs, and drops the flag if none */
+		lookup_replace_object(null_sha1);
+		if (check_replace_refs)
+			return 0;
+	}
+	/* this reads the grafts file and the shallow file */
+	lookup_commit_graft(null_sha1);
+	if (for_each_commit_graft(has_commit_graft, NULL))
+		return 0;
+	return 1;
+}
+
+int prepare_commit_graph(void)
+{
+	char *graph_name;
+
+	if (commit_graph_prepared)
+		return !!commit_graph;
+	commit_graph_prepared = 1;
+
+	if (!core_commit_graph)
+		return 0;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+
+	if (commit_graph && !commit_graph_compatible()) {
+		free_commit_graph(commit_graph);
+		commit_graph = NULL;
+	}
+	return !!commit_graph;
+}
+
+void close_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+	commit_graph_prepared = 0;
+}
+
+void disable_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+	commit_graph_prepared = 1;
+}
+
+int generation_numbers_enabled(void)
+{
+	return prepare_commit_graph();
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(g->chunk_oid_fanout[*sha1]);
+	lo = *sha1 ? ntohl(g->chunk_oid_fanout[*sha1 - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(g->chunk_oid_lookup + 20 * mi, sha1);
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+	c = lookup_commit(g->chunk_oid_lookup + 20 * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + 20 * pos));
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item,
+				   struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data =
+		g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_data + 28) >> 2;
+}
+
+static int fill_commit_in_graph(struct commit *item,
+				struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data =
+		g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	struct commit_list **pptr;
+	uint32_t edge_value;
+	uint64_t date_high, date_low;
+
+	item->object.parsed = 1;
+	fill_commit_graph_info(item, g, pos);
+
+	item->tree = lookup_tree(commit_data);
+
+	date_high = get_be32(commit_data + 28) & 0x3;
+	date_low = get_be32(commit_data + 32);
+	item->date = (unsigned long)((date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + 20);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + 24);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	/* octopus merge: the remaining parents live in the edge list */
+	edge_value &= GRAPH_EDGE_LAST_MASK;
+	do {
+		uint32_t parent;
+
+		if (edge_value >= g->num_extra_edges)
+			die("invalid extra edge in commit-graph");
+		parent = get_be32(g->chunk_extra_edges +
+				  sizeof(uint32_t) * edge_value++);
+		pptr = insert_parent_or_die(g, parent & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		if (parent & GRAPH_LAST_EDGE)
+			break;
+	} while (1);
+
+	return 1;
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph())
+		return 0;
+	if (item->object.parsed)
+		return 1;
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return fill_commit_in_graph(item, commit_graph, item->graph_pos);
+	if (!bsearch_graph(commit_graph, item->object.sha1, &pos))
+		return 0;
+	return fill_commit_in_graph(item, commit_graph, pos);
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return;
+	if (!prepare_commit_graph())
+		return;
+	if (bsearch_graph(commit_graph, item->object.sha1, &pos))
+		fill_commit_graph_info(item, commit_graph, pos);
+}
+
+/* Writing */
+
+struct packed_commit_list {
+	struct commit **list;
+	uint32_t nr, alloc;
+};
+
+static void add_graph_commit(struct packed_commit_list *commits,
+			     struct commit *c)
+{
+	if (c->object.flags & GRAPH_ADDED)
+		return;
+	c->object.flags |= GRAPH_ADDED;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = c;
+}
+
+static void add_packed_commits(struct packed_commit_list *commits)
+{
+	struct packed_git *p;
+	uint32_t i;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (open_pack_index(p)) {
+			warning("failed to open pack-index for '%s'",
+				p->pack_name);
+			continue;
+		}
+		for (i = 0; i < p->num_objects; i++) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, i);
+			struct commit *c;
+
+			if (sha1_object_info(sha1, NULL) != OBJ_COMMIT)
+				continue;
+			c = lookup_commit(sha1);
+			if (c)
+				add_graph_commit(commits, c);
+		}
+	}
+}
+
+static int add_ref_to_graph(const char *refname, const unsigned char *sha1,
+			    int flags, void *cb_data)
+{
+	struct commit *c = lookup_commit_reference_gently(sha1, 1);
+
+	if (c)
+		add_graph_commit(cb_data, c);
+	return 0;
+}
+
+/*
+ * Add the ancestors of everything in the list; the list is traversed
+ * as it grows, so that the file is closed under taking parents.
+ */
+static void close_reachable(struct packed_commit_list *commits)
+{
+	uint32_t i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent;
+
+		if (parse_commit(c))
+			die("unable to parse commit %s",
+			    sha1_to_hex(c->object.sha1));
+		for (parent = c->parents; parent; parent = parent->next)
+			add_graph_commit(commits, parent->item);
+	}
+}
+
+/*
+ * Assign generation numbers bottom-up without recursing: a commit gets
+ * its number once all of its parents have one.  Commits read from an
+ * existing commit-graph already carry theirs.
+ */
+static void compute_generation_numbers(struct packed_commit_list *commits)
+{
+	uint32_t i;
+	struct commit_list *stack = NULL;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (commits->list[i]->generation != GENERATION_NUMBER_INFINITY)
+			continue;
+
+		commit_list_insert(commits->list[i], &stack);
+		while (stack) {
+			struct commit *c = stack->item;
+			struct commit_list *parent;
+			uint32_t max_generation = 0;
+			int all_parents_computed = 1;
+
+			for (parent = c->parents; parent; parent = parent->next) {
+				struct commit *p = parent->item;
+				if (p->generation == GENERATION_NUMBER_INFINITY) {
+					all_parents_computed = 0;
+					commit_list_insert(p, &stack);
+					break;
+				}
+				if (p->generation > max_generation)
+					max_generation = p->generation;
+			}
+
+			if (all_parents_computed) {
+				if (max_generation >= GENERATION_NUMBER_MAX)
+					c->generation = GENERATION_NUMBER_MAX;
+				else
+					c->generation = max_generation + 1;
+				pop_commit(&stack);
+			}
+		}
+	}
+}
+
+static int commit_pos_cmp(const void *a_, const void *b_)
+{
+	struct commit *a = *(struct commit **)a_;
+	struct commit *b = *(struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static uint32_t graph_pos_of(struct packed_commit_list *commits,
+			     struct commit *c)
+{
+	uint32_t lo = 0, hi = commits->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(commits->list[mi]->object.sha1,
+				  c->object.sha1);
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	die("BUG: commit %s missing from commit-graph",
+	    sha1_to_hex(c->object.sha1));
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, sizeof(v));
+}
+
+static void write_be64(struct sha1file *f, uint64_t v)
+{
+	write_be32(f, (uint32_t)(v >> 32));
+	write_be32(f, (uint32_t)(v & 0xffffffff));
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	uint32_t i, num_extra_edges = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent = c->parents;
+		uint64_t date = c->date;
+
+		sha1write(f, c->tree->object.sha1, 20);
+
+		if (!parent)
+			write_be32(f, GRAPH_PARENT_NONE);
+		else {
+			write_be32(f, graph_pos_of(commits, parent->item));
+			parent = parent->next;
+		}
+
+		if (!parent)
+			write_be32(f, GRAPH_PARENT_NONE);
+		else if (!parent->next)
+			write_be32(f, graph_pos_of(commits, parent->item));
+		else {
+			write_be32(f, GRAPH_EXTRA_EDGES_NEEDED | num_extra_edges);
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		}
+
+		write_be32(f, (c->generation << 2) | ((date >> 32) & 0x3));
+		write_be32(f, (uint32_t)date);
+	}
+}
+
+static void write_graph_chunk_extra_edges(struct sha1file *f,
+					  struct packed_commit_list *commits)
+{
+	uint32_t i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+
+		/* only octopus merges spill into the edge list */
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t pos = graph_pos_of(commits, parent->item);
+			if (!parent->next)
+				pos |= GRAPH_LAST_EDGE;
+			write_be32(f, pos);
+		}
+	}
+}
+
+int write_commit_graph(int reachable)
+{
+	struct packed_commit_list commits = { NULL, 0, 0 };
+	struct lock_file *lock;
+	struct sha1file *f;
+	uint32_t i, j, nr_chunks, num_extra_edges = 0;
+	uint32_t chunk_ids[GRAPH_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[GRAPH_MAX_CHUNKS + 1];
+	char *graph_name;
+
+	if (!commit_graph_compatible()) {
+		warning("not writing a commit-graph in a repository with"
+			" grafts, replace refs or a shallow history");
+		return 0;
+	}
+
+	if (reachable) {
+		head_ref(add_ref_to_graph, &commits);
+		for_each_ref(add_ref_to_graph, &commits);
+	} else
+		add_packed_commits(&commits);
+	close_reachable(&commits);
+
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_pos_cmp);
+	compute_generation_numbers(&commits);
+
+	for (i = 0; i < commits.nr; i++) {
+		unsigned nr_parents = commit_list_count(commits.list[i]->parents);
+		if (nr_parents > 2)
+			num_extra_edges += nr_parents - 1;
+	}
+
+	nr_chunks = 0;
+	chunk_ids[nr_chunks++] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[nr_chunks++] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[nr_chunks++] = GRAPH_CHUNKID_DATA;
+	if (num_extra_edges)
+		chunk_ids[nr_chunks++] = GRAPH_CHUNKID_EXTRAEDGES;
+	chunk_ids[nr_chunks] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE +
+		(nr_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 0; i < nr_chunks; i++) {
+		uint64_t len;
+		switch (chunk_ids[i]) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			len = GRAPH_CHUNK_FANOUT_SIZE;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			len = (uint64_t)commits.nr * 20;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			len = (uint64_t)commits.nr * GRAPH_DATA_WIDTH;
+			break;
+		default: /* GRAPH_CHUNKID_EXTRAEDGES */
+			len = (uint64_t)num_extra_edges * sizeof(uint32_t);
+			break;
+		}
+		chunk_offsets[i + 1] = chunk_offsets[i] + len;
+	}
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	if (safe_create_leading_directories(graph_name))
+		die_errno("unable to create leading directories of %s",
+			  graph_name);
+	lock = xcalloc(1, sizeof(*lock));
+	hold_lock_file_for_update(lock, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lock->fd, lock->filename);
+
+	/* header */
+	write_be32(f, GRAPH_SIGNATURE);
+	{
+		unsigned char hdr[4];
+		hdr[0] = GRAPH_VERSION;
+		hdr[1] = GRAPH_HASH_VERSION;
+		hdr[2] = nr_chunks;
+		hdr[3] = 0; /* no base commit-graph */
+		sha1write(f, hdr, sizeof(hdr));
+	}
+
+	/* chunk lookup table */
+	for (i = 0; i <= nr_chunks; i++) {
+		write_be32(f, chunk_ids[i]);
+		write_be64(f, chunk_offsets[i]);
+	}
+
+	/* fanout */
+	for (i = j = 0; i < 256; i++) {
+		while (j < commits.nr && commits.list[j]->object.sha1[0] == i)
+			j++;
+		write_be32(f, j);
+	}
+
+	/* commit names */
+	for (i = 0; i < commits.nr; i++)
+		sha1write(f, commits.list[i]->object.sha1, 20);
+
+	write_graph_chunk_data(f, &commits);
+	write_graph_chunk_extra_edges(f, &commits);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock->fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(lock))
+		die_errno("unable to write commit-graph '%s'", graph_name);
+
+	for (i = 0; i < commits.nr; i++)
+		commits.list[i]->object.flags &= ~GRAPH_ADDED;
+	free(commits.list);
+	free(graph_name);
+	return 0;
+}
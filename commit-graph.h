@@ -0,0 +1,79 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+struct commit;
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_VERSION 1 /* SHA-1 */
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+
+/*
+ * A commit-graph file records, for every commit it covers, the root
+ * tree, the positions of the parents, the commit date and the
+ * generation number, so that history walks can parse commits without
+ * inflating them.
+ */
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_commits;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_extra_edges;
+	size_t num_extra_edges;
+};
+
+extern char *get_commit_graph_filename(const char *object_dir);
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * Load the commit-graph of the repository, unless core.commitGraph is
+ * off or grafts, replace refs or a shallow file would make its idea of
+ * the parents disagree with ours.  Returns 1 if there is one to use.
+ */
+extern int prepare_commit_graph(void);
+extern void close_commit_graph(void);
+
+/*
+ * Stop using the commit-graph for the rest of the process, e.g.
+ * because a graft or shallow entry has just been registered.  Commits
+ * already parsed from it keep the parents they were given.
+ */
+extern void disable_commit_graph(void);
+
+/*
+ * Fill item from the commit-graph if it covers it.  Returns 1 when
+ * item has been parsed that way, 0 if the caller has to read the
+ * object itself.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the graph position and generation number of a commit that
+ * has been parsed from its object.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * True if the commits we parse may come with generation numbers,
+ * i.e. if walks can use them to stop early.
+ */
+extern int generation_numbers_enabled(void);
+
+/*
+ * Write the commit-graph of the repository, covering the commits found
+ * in local packs or, with "reachable", those reachable from any ref,
+ * together with all of their ancestors.
+ */
+extern int write_commit_graph(int reachable);
+
+#endif
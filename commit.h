@@ -13,6 +13,14 @@ struct commit_list {
 	struct commit_list *next;
 };
 
+/*
+ * Commits that are not described by a commit-graph file have neither a
+ * position in it nor a known generation number.
+ */
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
 struct commit {
 	struct object object;
 	void *util;
@@ -20,6 +28,8 @@ struct commit {
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
+	uint32_t graph_pos;
+	uint32_t generation;
 };
 
 extern int save_commit_buffer;
@@ -349,6 +359,7 @@ extern void print_commit_list(struct commit_list *list,
 extern void check_commit_signature(const struct commit* commit, struct signature_check *sigc);
 
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
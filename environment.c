@@ -59,6 +59,10 @@ enum object_creation_mode object_creation_mode = OBJECT_CREATION_MODE;
 char *notes_ref_name;
 int grafts_replace_parents = 1;
 int core_apply_sparse_checkout;
+int core_multi_pack_index = 1;
+int core_commit_graph = 1;
+int core_loose_object_cache;
+int core_bulk_checkin;
 int merge_log_config = -1;
 int precomposed_unicode = -1; /* see probe_utf8_pathname_composition() */
 struct startup_info *startup_info;
@@ -118,19 +118,15 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 	const size_t count = (self->word_alloc < other->word_alloc) ?
 		self->word_alloc : other->word_alloc;
 
-	size_t i;
-
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	ewah_words_and_not(self->words, self->words, other->words, count);
 }
 
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_WORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	struct ewah_block_iterator it;
+	struct ewah_block block;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -140,10 +136,34 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
+	ewah_block_iterator_init(&it, other);
+
+	while (ewah_block_next(&block, &it)) {
+		eword_t *dst = self->words + block.pos;
+
+		if (block.pos + block.len > self->word_alloc)
+			break;
+
+		if (block.literal)
+			ewah_words_or(dst, dst, block.literal, block.len);
+		else if (block.fill)
+			memset(dst, 0xff, block.len * sizeof(eword_t));
+	}
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	if (self->word_alloc < other->word_alloc) {
+		size_t original_size = self->word_alloc;
+
+		self->word_alloc = other->word_alloc;
+		self->words = ewah_realloc(self->words,
+			self->word_alloc * sizeof(eword_t));
+		memset(self->words + original_size, 0x0,
+			(self->word_alloc - original_size) * sizeof(eword_t));
+	}
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	ewah_words_or(self->words, self->words, other->words, other->word_alloc);
 }
 
 void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
@@ -172,12 +192,7 @@ void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return ewah_words_popcount(self->words, self->word_alloc);
 }
 
 int bitmap_equals(struct bitmap *self, struct bitmap *other)
@@ -381,6 +381,56 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 		read_new_rlw(it);
 }
 
+void ewah_block_iterator_init(struct ewah_block_iterator *it,
+			      struct ewah_bitmap *parent)
+{
+	it->buffer = parent->buffer;
+	it->buffer_size = parent->buffer_size;
+	it->pointer = 0;
+	it->pos = 0;
+	it->in_literals = 0;
+}
+
+int ewah_block_next(struct ewah_block *block, struct ewah_block_iterator *it)
+{
+	while (it->pointer < it->buffer_size) {
+		const eword_t *rlw = &it->buffer[it->pointer];
+		size_t len;
+
+		if (!it->in_literals) {
+			it->in_literals = 1;
+			len = rlw_get_running_len(rlw);
+			if (len) {
+				block->pos = it->pos;
+				block->len = len;
+				block->literal = NULL;
+				block->fill = rlw_get_run_bit(rlw) ? (eword_t)(~0) : 0;
+				it->pos += len;
+				return 1;
+			}
+		}
+
+		it->in_literals = 0;
+		len = rlw_get_literal_words(rlw);
+		it->pointer++;
+
+		/* do not read past a truncated buffer */
+		len = min_size(len, it->buffer_size - it->pointer);
+		it->pointer += len;
+
+		if (len) {
+			block->pos = it->pos;
+			block->len = len;
+			block->literal = rlw + 1;
+			block->fill = 0;
+			it->pos += len;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 void ewah_not(struct ewah_bitmap *self)
 {
 	size_t pointer = 0;
@@ -400,6 +450,41 @@ void ewah_not(struct ewah_bitmap *self)
 	}
 }
 
+/*
+ * Append `nr` words combined from two literal runs. Words that come out
+ * all zeroes or all ones still go through ewah_add() so that they are
+ * compressed into runs; the others are added in bulk.
+ */
+static void add_combined_literals(struct ewah_bitmap *out,
+	void (*op)(eword_t *, const eword_t *, const eword_t *, size_t),
+	const eword_t *a, const eword_t *b, size_t nr)
+{
+	eword_t chunk[64];
+
+	while (nr) {
+		size_t n = min_size(nr, ARRAY_SIZE(chunk));
+		size_t k, start = 0;
+
+		op(chunk, a, b, n);
+
+		for (k = 0; k < n; ++k) {
+			if (chunk[k] != 0 && chunk[k] != (eword_t)(~0))
+				continue;
+			if (k > start)
+				ewah_add_dirty_words(out, chunk + start,
+						     k - start, 0);
+			ewah_add(out, chunk[k]);
+			start = k + 1;
+		}
+		if (n > start)
+			ewah_add_dirty_words(out, chunk + start, n - start, 0);
+
+		a += n;
+		b += n;
+		nr -= n;
+	}
+}
+
 void ewah_xor(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
@@ -442,15 +527,10 @@ void ewah_xor(
 			rlw_j.rlw.literal_words);
 
 		if (literals) {
-			size_t k;
-
-			for (k = 0; k < literals; ++k) {
-				ewah_add(out,
-					rlw_i.buffer[rlw_i.literal_word_start + k] ^
-					rlw_j.buffer[rlw_j.literal_word_start + k]
-				);
-			}
-
+			add_combined_literals(out, ewah_words_xor,
+				rlw_i.buffer + rlw_i.literal_word_start,
+				rlw_j.buffer + rlw_j.literal_word_start,
+				literals);
 			rlwit_discard_first_words(&rlw_i, literals);
 			rlwit_discard_first_words(&rlw_j, literals);
 		}
@@ -510,15 +590,10 @@ void ewah_and(
 			rlw_j.rlw.literal_words);
 
 		if (literals) {
-			size_t k;
-
-			for (k = 0; k < literals; ++k) {
-				ewah_add(out,
-					rlw_i.buffer[rlw_i.literal_word_start + k] &
-					rlw_j.buffer[rlw_j.literal_word_start + k]
-				);
-			}
-
+			add_combined_literals(out, ewah_words_and,
+				rlw_i.buffer + rlw_i.literal_word_start,
+				rlw_j.buffer + rlw_j.literal_word_start,
+				literals);
 			rlwit_discard_first_words(&rlw_i, literals);
 			rlwit_discard_first_words(&rlw_j, literals);
 		}
@@ -583,15 +658,10 @@ void ewah_and_not(
 			rlw_j.rlw.literal_words);
 
 		if (literals) {
-			size_t k;
-
-			for (k = 0; k < literals; ++k) {
-				ewah_add(out,
-					rlw_i.buffer[rlw_i.literal_word_start + k] &
-					~(rlw_j.buffer[rlw_j.literal_word_start + k])
-				);
-			}
-
+			add_combined_literals(out, ewah_words_and_not,
+				rlw_i.buffer + rlw_i.literal_word_start,
+				rlw_j.buffer + rlw_j.literal_word_start,
+				literals);
 			rlwit_discard_first_words(&rlw_i, literals);
 			rlwit_discard_first_words(&rlw_j, literals);
 		}
@@ -630,7 +700,7 @@ void ewah_or(
 			}
 
 			if (predator->rlw.running_bit) {
-				ewah_add_empty_words(out, 0,
+				ewah_add_empty_words(out, 1,
 					predator->rlw.running_len);
 				rlwit_discard_first_words(prey,
 					predator->rlw.running_len);
@@ -651,15 +721,10 @@ void ewah_or(
 			rlw_j.rlw.literal_words);
 
 		if (literals) {
-			size_t k;
-
-			for (k = 0; k < literals; ++k) {
-				ewah_add(out,
-					rlw_i.buffer[rlw_i.literal_word_start + k] |
-					rlw_j.buffer[rlw_j.literal_word_start + k]
-				);
-			}
-
+			add_combined_literals(out, ewah_words_or,
+				rlw_i.buffer + rlw_i.literal_word_start,
+				rlw_j.buffer + rlw_j.literal_word_start,
+				literals);
 			rlwit_discard_first_words(&rlw_i, literals);
 			rlwit_discard_first_words(&rlw_j, literals);
 		}
@@ -0,0 +1,301 @@
+/*
+ * Set operations and population counts over runs of uncompressed
+ * words.  Both sides of a bitmap operation are mostly long literal
+ * runs on big repositories, so combining them a vector at a time is
+ * where the time goes; the run-length bookkeeping stays in the
+ * callers.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "git-compat-util.h"
+#include "ewok.h"
+
+#define WORDS_OP(name, expr) \
+static void name(eword_t *dst, const eword_t *a, const eword_t *b, size_t n) \
+{ \
+	size_t i; \
+	for (i = 0; i < n; i++) { \
+		eword_t x = a[i], y = b[i]; \
+		dst[i] = expr; \
+	} \
+}
+
+WORDS_OP(words_or_scalar, x | y)
+WORDS_OP(words_and_scalar, x & y)
+WORDS_OP(words_and_not_scalar, x & ~y)
+WORDS_OP(words_xor_scalar, x ^ y)
+
+static size_t words_popcount_scalar(const eword_t *a, size_t n)
+{
+	size_t i, count = 0;
+	for (i = 0; i < n; i++)
+		count += ewah_bit_popcount64(a[i]);
+	return count;
+}
+
+static size_t words_and_popcount_scalar(const eword_t *a, const eword_t *b,
+					size_t n)
+{
+	size_t i, count = 0;
+	for (i = 0; i < n; i++)
+		count += ewah_bit_popcount64(a[i] & b[i]);
+	return count;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EWAH_SIMD_X86
+
+typedef eword_t ewah_v2 __attribute__((vector_size(16)));
+typedef eword_t ewah_v4 __attribute__((vector_size(32)));
+
+/*
+ * "expr" combines x and y; it is used both on whole vectors and on the
+ * words left over at the end.  The memcpy()s are unaligned loads and
+ * stores; "dst" may be the same array as "a".
+ */
+#define VEC_WORDS_OP(name, vec, isa, expr) \
+static void __attribute__((target(isa))) \
+name(eword_t *dst, const eword_t *a, const eword_t *b, size_t n) \
+{ \
+	const size_t lanes = sizeof(vec) / sizeof(eword_t); \
+	size_t i = 0; \
+\
+	for (; i + lanes <= n; i += lanes) { \
+		vec x, y; \
+		memcpy(&x, a + i, sizeof(vec)); \
+		memcpy(&y, b + i, sizeof(vec)); \
+		x = expr; \
+		memcpy(dst + i, &x, sizeof(vec)); \
+	} \
+	for (; i < n; i++) { \
+		eword_t x = a[i], y = b[i]; \
+		dst[i] = expr; \
+	} \
+}
+
+VEC_WORDS_OP(words_or_sse2, ewah_v2, "sse2", x | y)
+VEC_WORDS_OP(words_and_sse2, ewah_v2, "sse2", x & y)
+VEC_WORDS_OP(words_and_not_sse2, ewah_v2, "sse2", x & ~y)
+VEC_WORDS_OP(words_xor_sse2, ewah_v2, "sse2", x ^ y)
+
+VEC_WORDS_OP(words_or_avx2, ewah_v4, "avx2", x | y)
+VEC_WORDS_OP(words_and_avx2, ewah_v4, "avx2", x & y)
+VEC_WORDS_OP(words_and_not_avx2, ewah_v4, "avx2", x & ~y)
+VEC_WORDS_OP(words_xor_avx2, ewah_v4, "avx2", x ^ y)
+
+/*
+ * SSE2 has no population count; do ewah_bit_popcount64() two words at
+ * a time, summing the bytes with shifts instead of the multiply (there
+ * is no 64-bit vector multiply either).
+ */
+static inline ewah_v2 __attribute__((target("sse2")))
+popcount_v2(ewah_v2 x)
+{
+	const ewah_v2 m1 = { 0x5555555555555555ULL, 0x5555555555555555ULL };
+	const ewah_v2 m2 = { 0x3333333333333333ULL, 0x3333333333333333ULL };
+	const ewah_v2 m4 = { 0x0F0F0F0F0F0F0F0FULL, 0x0F0F0F0F0F0F0F0FULL };
+	const ewah_v2 m7 = { 0x7f, 0x7f };
+
+	x = (x & m1) + ((x >> 1) & m1);
+	x = (x & m2) + ((x >> 2) & m2);
+	x = (x & m4) + ((x >> 4) & m4);
+	x += x >> 8;
+	x += x >> 16;
+	x += x >> 32;
+	return x & m7;
+}
+
+static size_t __attribute__((target("sse2")))
+words_popcount_sse2(const eword_t *a, size_t n)
+{
+	ewah_v2 acc = { 0, 0 };
+	size_t i = 0, count;
+
+	for (; i + 2 <= n; i += 2) {
+		ewah_v2 x;
+		memcpy(&x, a + i, sizeof(x));
+		acc += popcount_v2(x);
+	}
+	count = acc[0] + acc[1];
+	for (; i < n; i++)
+		count += ewah_bit_popcount64(a[i]);
+	return count;
+}
+
+static size_t __attribute__((target("sse2")))
+words_and_popcount_sse2(const eword_t *a, const eword_t *b, size_t n)
+{
+	ewah_v2 acc = { 0, 0 };
+	size_t i = 0, count;
+
+	for (; i + 2 <= n; i += 2) {
+		ewah_v2 x, y;
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		acc += popcount_v2(x & y);
+	}
+	count = acc[0] + acc[1];
+	for (; i < n; i++)
+		count += ewah_bit_popcount64(a[i] & b[i]);
+	return count;
+}
+
+/*
+ * Every CPU with AVX2 has POPCNT, and __builtin_popcountll() is a
+ * single instruction when the compiler may use it (the warning in
+ * ewok.h is about the generic fallback).  Four independent counters
+ * keep the instruction's latency out of the way.
+ */
+static size_t __attribute__((target("avx2,popcnt")))
+words_popcount_avx2(const eword_t *a, size_t n)
+{
+	size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		c0 += __builtin_popcountll(a[i]);
+		c1 += __builtin_popcountll(a[i + 1]);
+		c2 += __builtin_popcountll(a[i + 2]);
+		c3 += __builtin_popcountll(a[i + 3]);
+	}
+	for (; i < n; i++)
+		c0 += __builtin_popcountll(a[i]);
+	return c0 + c1 + c2 + c3;
+}
+
+static size_t __attribute__((target("avx2,popcnt")))
+words_and_popcount_avx2(const eword_t *a, const eword_t *b, size_t n)
+{
+	size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		c0 += __builtin_popcountll(a[i] & b[i]);
+		c1 += __builtin_popcountll(a[i + 1] & b[i + 1]);
+		c2 += __builtin_popcountll(a[i + 2] & b[i + 2]);
+		c3 += __builtin_popcountll(a[i + 3] & b[i + 3]);
+	}
+	for (; i < n; i++)
+		c0 += __builtin_popcountll(a[i] & b[i]);
+	return c0 + c1 + c2 + c3;
+}
+
+#endif
+
+typedef void (*words_op_fn)(eword_t *, const eword_t *, const eword_t *, size_t);
+
+static struct ewah_simd_impl {
+	const char *name;
+	words_op_fn words_or, words_and, words_and_not, words_xor;
+	size_t (*popcount)(const eword_t *, size_t);
+	size_t (*and_popcount)(const eword_t *, const eword_t *, size_t);
+} impls[] = {
+#ifdef EWAH_SIMD_X86
+	{ "avx2", words_or_avx2, words_and_avx2, words_and_not_avx2,
+	  words_xor_avx2, words_popcount_avx2, words_and_popcount_avx2 },
+	{ "sse2", words_or_sse2, words_and_sse2, words_and_not_sse2,
+	  words_xor_sse2, words_popcount_sse2, words_and_popcount_sse2 },
+#endif
+	{ "scalar", words_or_scalar, words_and_scalar, words_and_not_scalar,
+	  words_xor_scalar, words_popcount_scalar, words_and_popcount_scalar },
+};
+
+static struct ewah_simd_impl *impl;
+
+static int impl_supported(const struct ewah_simd_impl *i)
+{
+#ifdef EWAH_SIMD_X86
+	if (!strcmp(i->name, "avx2")) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") &&
+			__builtin_cpu_supports("popcnt");
+	}
+	if (!strcmp(i->name, "sse2")) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	return 1;
+}
+
+int ewah_simd_select(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(impls); i++) {
+		if (name && strcmp(name, impls[i].name))
+			continue;
+		if (!impl_supported(&impls[i]))
+			continue;
+		impl = &impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+/* GIT_TEST_EWAH_SIMD forces an implementation, for the tests */
+static struct ewah_simd_impl *get_impl(void)
+{
+	if (!impl && ewah_simd_select(getenv("GIT_TEST_EWAH_SIMD")))
+		ewah_simd_select(NULL);
+	return impl;
+}
+
+const char *ewah_simd_name(void)
+{
+	return get_impl()->name;
+}
+
+/*
+ * Most literal runs in a bitmap are a word or two long; those are not
+ * worth an indirect call.
+ */
+#define SHORT_RUN 4
+
+void ewah_words_or(eword_t *dst, const eword_t *a, const eword_t *b, size_t n)
+{
+	if (n < SHORT_RUN)
+		words_or_scalar(dst, a, b, n);
+	else
+		get_impl()->words_or(dst, a, b, n);
+}
+
+void ewah_words_and(eword_t *dst, const eword_t *a, const eword_t *b, size_t n)
+{
+	if (n < SHORT_RUN)
+		words_and_scalar(dst, a, b, n);
+	else
+		get_impl()->words_and(dst, a, b, n);
+}
+
+void ewah_words_and_not(eword_t *dst, const eword_t *a, const eword_t *b,
+			size_t n)
+{
+	if (n < SHORT_RUN)
+		words_and_not_scalar(dst, a, b, n);
+	else
+		get_impl()->words_and_not(dst, a, b, n);
+}
+
+void ewah_words_xor(eword_t *dst, const eword_t *a, const eword_t *b, size_t n)
+{
+	if (n < SHORT_RUN)
+		words_xor_scalar(dst, a, b, n);
+	else
+		get_impl()->words_xor(dst, a, b, n);
+}
+
+size_t ewah_words_popcount(const eword_t *a, size_t n)
+{
+	if (n < SHORT_RUN)
+		return words_popcount_scalar(a, n);
+	return get_impl()->popcount(a, n);
+}
+
+size_t ewah_words_and_popcount(const eword_t *a, const eword_t *b, size_t n)
+{
+	if (n < SHORT_RUN)
+		return words_and_popcount_scalar(a, b, n);
+	return get_impl()->and_popcount(a, b, n);
+}
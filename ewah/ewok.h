@@ -172,6 +172,45 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Walk the bitmap a run at a time instead of a word at a time. Each
+ * block covers `len` words of the uncompressed bitmap starting at word
+ * `pos`: either a run of identical words (`literal` is NULL and every
+ * word is `fill`), or literal words that can be read from `literal`.
+ *
+ * E.g.
+ *
+ *		struct ewah_block_iterator it;
+ *		struct ewah_block block;
+ *
+ *		ewah_block_iterator_init(&it, bitmap);
+ *		while (ewah_block_next(&block, &it)) {
+ *			if (block.literal)
+ *				ewah_words_or(dst + block.pos, dst + block.pos,
+ *					      block.literal, block.len);
+ *			else if (block.fill)
+ *				memset(dst + block.pos, 0xff,
+ *				       block.len * sizeof(eword_t));
+ *		}
+ */
+struct ewah_block {
+	size_t pos, len;
+	const eword_t *literal;
+	eword_t fill;
+};
+
+struct ewah_block_iterator {
+	const eword_t *buffer;
+	size_t buffer_size;
+
+	size_t pointer, pos;
+	int in_literals;
+};
+
+void ewah_block_iterator_init(struct ewah_block_iterator *it,
+			      struct ewah_bitmap *parent);
+int ewah_block_next(struct ewah_block *block, struct ewah_block_iterator *it);
+
 void ewah_or(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
@@ -200,6 +239,27 @@ void ewah_add_dirty_words(
 	struct ewah_bitmap *self, const eword_t *buffer, size_t number, int negate);
 size_t ewah_add(struct ewah_bitmap *self, eword_t word);
 
+/**
+ * Word-array kernels used by the set operations, vectorized where the
+ * CPU allows: `dst[i] = a[i] OP b[i]` for `n` words (`dst` may be `a`),
+ * and the number of bits set in `a[i]` or `a[i] & b[i]`.
+ *
+ * The fastest implementation the CPU supports is picked on first use;
+ * `ewah_simd_select()` picks one by name instead ("avx2", "sse2" or
+ * "scalar"; NULL for the default) and returns -1 if it is not
+ * available.
+ */
+void ewah_words_or(eword_t *dst, const eword_t *a, const eword_t *b, size_t n);
+void ewah_words_and(eword_t *dst, const eword_t *a, const eword_t *b, size_t n);
+void ewah_words_and_not(eword_t *dst, const eword_t *a, const eword_t *b,
+			size_t n);
+void ewah_words_xor(eword_t *dst, const eword_t *a, const eword_t *b, size_t n);
+size_t ewah_words_popcount(const eword_t *a, size_t n);
+size_t ewah_words_and_popcount(const eword_t *a, const eword_t *b, size_t n);
+
+int ewah_simd_select(const char *name);
+const char *ewah_simd_name(void);
+
 
 /**
  * Uncompressed, old-school bitmap that can be efficiently compressed
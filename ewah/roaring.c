@@ -0,0 +1,415 @@
+#include "git-compat-util.h"
+#include "ewok.h"
+#include "roaring.h"
+
+/*
+ * On disk:
+ *
+ *	4-byte number of bits of the uncompressed bitmap
+ *	4-byte number of containers
+ *	N x 12-byte index entries: 2-byte key, 2-byte type, 4-byte count,
+ *		4-byte offset of the container in the data
+ *	4-byte size of the container data
+ *	the container data
+ *
+ * all in network byte order.
+ */
+#define INDEX_ENTRY_SIZE 12
+
+static uint16_t entry_key(const struct roaring_bitmap *self, uint32_t i)
+{
+	return get_be16(self->index + i * INDEX_ENTRY_SIZE);
+}
+
+static uint16_t entry_type(const struct roaring_bitmap *self, uint32_t i)
+{
+	return get_be16(self->index + i * INDEX_ENTRY_SIZE + 2);
+}
+
+static uint32_t entry_count(const struct roaring_bitmap *self, uint32_t i)
+{
+	return get_be32(self->index + i * INDEX_ENTRY_SIZE + 4);
+}
+
+static const unsigned char *entry_data(const struct roaring_bitmap *self,
+				       uint32_t i)
+{
+	return self->data + get_be32(self->index + i * INDEX_ENTRY_SIZE + 8);
+}
+
+/*
+ * The number of words in chunk `key` of a bitmap of `bit_size` bits:
+ * all of them but in the last chunk.
+ */
+static size_t chunk_words(size_t bit_size, size_t key)
+{
+	size_t nr_words = DIV_ROUND_UP(bit_size, BITS_IN_WORD);
+	size_t start = key * ROARING_CHUNK_WORDS;
+
+	if (start >= nr_words)
+		return 0;
+	nr_words -= start;
+	return nr_words < ROARING_CHUNK_WORDS ? nr_words : ROARING_CHUNK_WORDS;
+}
+
+/*
+ * The size of a container of `type` holding `count` values or runs,
+ * in a chunk of `nr_words` words.
+ */
+static size_t container_size(int type, uint32_t count, size_t nr_words)
+{
+	switch (type) {
+	case ROARING_ARRAY:
+		return (size_t)count * 2;
+	case ROARING_BITMAP:
+		return nr_words * sizeof(eword_t);
+	case ROARING_RUN:
+		return (size_t)count * 4;
+	}
+	return 0;
+}
+
+/* The next position from `pos` on whose bit is `bit`, or `nr_bits` */
+static size_t next_bit(const eword_t *words, size_t nr_bits, size_t pos,
+		       int bit)
+{
+	while (pos < nr_bits) {
+		eword_t w = words[pos / BITS_IN_WORD];
+
+		if (!bit)
+			w = ~w;
+		w >>= pos % BITS_IN_WORD;
+		if (w) {
+			pos += ewah_bit_ctz64(w);
+			return pos < nr_bits ? pos : nr_bits;
+		}
+		pos = (pos / BITS_IN_WORD + 1) * BITS_IN_WORD;
+	}
+	return nr_bits;
+}
+
+static uint32_t count_runs(const eword_t *words, size_t nr)
+{
+	uint32_t runs = 0;
+	eword_t carry = 0;
+	size_t i;
+
+	/* a run starts at every set bit whose predecessor is clear */
+	for (i = 0; i < nr; i++) {
+		runs += ewah_bit_popcount64(words[i] & ~((words[i] << 1) | carry));
+		carry = words[i] >> (BITS_IN_WORD - 1);
+	}
+	return runs;
+}
+
+struct container {
+	uint16_t key, type;
+	uint32_t count;
+	uint32_t offset;
+};
+
+static void choose_container(struct container *c, const eword_t *words,
+			     size_t nr)
+{
+	uint32_t card = ewah_words_popcount(words, nr);
+	uint32_t runs = count_runs(words, nr);
+
+	c->type = ROARING_BITMAP;
+	c->count = card;
+	if (container_size(ROARING_ARRAY, card, nr) <
+	    container_size(c->type, c->count, nr)) {
+		c->type = ROARING_ARRAY;
+		c->count = card;
+	}
+	if (container_size(ROARING_RUN, runs, nr) <
+	    container_size(c->type, c->count, nr)) {
+		c->type = ROARING_RUN;
+		c->count = runs;
+	}
+}
+
+static void encode_container(const struct container *c, const eword_t *words,
+			     size_t nr, unsigned char *out)
+{
+	size_t nr_bits = nr * BITS_IN_WORD, pos, i;
+
+	switch (c->type) {
+	case ROARING_ARRAY:
+		for (pos = next_bit(words, nr_bits, 0, 1); pos < nr_bits;
+		     pos = next_bit(words, nr_bits, pos + 1, 1)) {
+			uint16_t v = htons(pos);
+			memcpy(out, &v, 2);
+			out += 2;
+		}
+		break;
+	case ROARING_BITMAP:
+		for (i = 0; i < nr; i++) {
+			eword_t w = htonll(words[i]);
+			memcpy(out + i * sizeof(w), &w, sizeof(w));
+		}
+		break;
+	case ROARING_RUN:
+		for (pos = next_bit(words, nr_bits, 0, 1); pos < nr_bits;) {
+			size_t end = next_bit(words, nr_bits, pos, 0);
+			uint16_t v[2];
+
+			v[0] = htons(pos);
+			v[1] = htons(end - pos - 1);
+			memcpy(out, v, 4);
+			out += 4;
+			pos = next_bit(words, nr_bits, end, 1);
+		}
+		break;
+	}
+}
+
+int roaring_serialize_to(struct ewah_bitmap *bitmap,
+			 int (*write_fun)(void *, const void *, size_t),
+			 void *out)
+{
+	struct bitmap *words = ewah_to_bitmap(bitmap);
+	size_t nr_chunks = DIV_ROUND_UP(bitmap->bit_size, ROARING_CHUNK_BITS);
+	struct container *c = xcalloc(nr_chunks ? nr_chunks : 1, sizeof(*c));
+	unsigned char *buf = xmalloc(ROARING_CHUNK_WORDS * sizeof(eword_t));
+	uint32_t nr = 0, data_size = 0, be32;
+	size_t i;
+	int ret = -1;
+
+	/* words past the end of the bitmap are treated as empty */
+	if (words->word_alloc < DIV_ROUND_UP(bitmap->bit_size, BITS_IN_WORD)) {
+		size_t old = words->word_alloc;
+
+		words->word_alloc = DIV_ROUND_UP(bitmap->bit_size, BITS_IN_WORD);
+		words->words = ewah_realloc(words->words,
+			words->word_alloc * sizeof(eword_t));
+		memset(words->words + old, 0,
+		       (words->word_alloc - old) * sizeof(eword_t));
+	}
+
+	for (i = 0; i < nr_chunks; i++) {
+		size_t len = chunk_words(bitmap->bit_size, i);
+
+		choose_container(&c[nr], words->words + i * ROARING_CHUNK_WORDS,
+				 len);
+		if (c[nr].type != ROARING_BITMAP && !c[nr].count)
+			continue;
+		c[nr].key = i;
+		c[nr].offset = data_size;
+		data_size += container_size(c[nr].type, c[nr].count, len);
+		nr++;
+	}
+
+	be32 = htonl((uint32_t)bitmap->bit_size);
+	if (write_fun(out, &be32, 4) != 4)
+		goto out;
+	be32 = htonl(nr);
+	if (write_fun(out, &be32, 4) != 4)
+		goto out;
+	for (i = 0; i < nr; i++) {
+		unsigned char entry[INDEX_ENTRY_SIZE];
+		uint16_t be16;
+
+		be16 = htons(c[i].key);
+		memcpy(entry, &be16, 2);
+		be16 = htons(c[i].type);
+		memcpy(entry + 2, &be16, 2);
+		put_be32(entry + 4, c[i].count);
+		put_be32(entry + 8, c[i].offset);
+		if (write_fun(out, entry, sizeof(entry)) != sizeof(entry))
+			goto out;
+	}
+	be32 = htonl(data_size);
+	if (write_fun(out, &be32, 4) != 4)
+		goto out;
+	for (i = 0; i < nr; i++) {
+		size_t len = chunk_words(bitmap->bit_size, c[i].key);
+		size_t size = container_size(c[i].type, c[i].count, len);
+
+		encode_container(&c[i], words->words +
+				 (size_t)c[i].key * ROARING_CHUNK_WORDS, len, buf);
+		if (write_fun(out, buf, size) != size)
+			goto out;
+	}
+	ret = 12 + nr * INDEX_ENTRY_SIZE + data_size;
+
+out:
+	free(buf);
+	free(c);
+	bitmap_free(words);
+	return ret;
+}
+
+int roaring_read_mmap(struct roaring_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	size_t header, data_size;
+	uint32_t i;
+
+	if (len < 12)
+		return -1;
+	self->bit_size = get_be32(ptr);
+	self->nr = get_be32(ptr + 4);
+	if (self->nr > (len - 12) / INDEX_ENTRY_SIZE)
+		return -1;
+	header = 8 + (size_t)self->nr * INDEX_ENTRY_SIZE;
+	self->index = ptr + 8;
+	data_size = get_be32(ptr + header);
+	if (data_size > len - header - 4)
+		return -1;
+	self->data = ptr + header + 4;
+
+	for (i = 0; i < self->nr; i++) {
+		int type = entry_type(self, i);
+		uint32_t count = entry_count(self, i);
+		size_t offset = entry_data(self, i) - self->data;
+
+		if (i && entry_key(self, i) <= entry_key(self, i - 1))
+			return -1;
+		if (type != ROARING_ARRAY && type != ROARING_BITMAP &&
+		    type != ROARING_RUN)
+			return -1;
+		if (count > ROARING_CHUNK_BITS)
+			return -1;
+		if (offset > data_size ||
+		    container_size(type, count,
+				   chunk_words(self->bit_size, entry_key(self, i))) >
+		    data_size - offset)
+			return -1;
+	}
+	return header + 4 + data_size;
+}
+
+/* Set the bits of container `i` in the (zeroed) chunk `words` */
+static void expand_container(const struct roaring_bitmap *self, uint32_t i,
+			     eword_t *words)
+{
+	const unsigned char *data = entry_data(self, i);
+	uint32_t count = entry_count(self, i), k;
+
+	switch (entry_type(self, i)) {
+	case ROARING_ARRAY:
+		for (k = 0; k < count; k++) {
+			uint16_t v = get_be16(data + 2 * k);
+			words[v / BITS_IN_WORD] |= (eword_t)1 << (v % BITS_IN_WORD);
+		}
+		break;
+	case ROARING_BITMAP:
+		count = chunk_words(self->bit_size, entry_key(self, i));
+		memcpy(words, data, count * sizeof(eword_t));
+		for (k = 0; k < count; k++)
+			words[k] = ntohll(words[k]);
+		break;
+	case ROARING_RUN:
+		for (k = 0; k < count; k++) {
+			size_t pos = get_be16(data + 4 * k);
+			size_t end = pos + get_be16(data + 4 * k + 2) + 1;
+
+			if (end > ROARING_CHUNK_BITS)
+				end = ROARING_CHUNK_BITS;
+			for (; pos < end && pos % BITS_IN_WORD; pos++)
+				words[pos / BITS_IN_WORD] |=
+					(eword_t)1 << (pos % BITS_IN_WORD);
+			for (; pos + BITS_IN_WORD <= end; pos += BITS_IN_WORD)
+				words[pos / BITS_IN_WORD] = (eword_t)~0;
+			for (; pos < end; pos++)
+				words[pos / BITS_IN_WORD] |=
+					(eword_t)1 << (pos % BITS_IN_WORD);
+		}
+		break;
+	}
+}
+
+int roaring_get(const struct roaring_bitmap *self, size_t pos)
+{
+	uint32_t lo = 0, hi = self->nr, key = pos / ROARING_CHUNK_BITS;
+	uint16_t low = pos % ROARING_CHUNK_BITS;
+
+	if (pos >= self->bit_size)
+		return 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *data = entry_data(self, mi);
+		uint32_t count = entry_count(self, mi);
+		uint32_t l = 0, h;
+
+		if (entry_key(self, mi) < key) {
+			lo = mi + 1;
+			continue;
+		}
+		if (entry_key(self, mi) > key) {
+			hi = mi;
+			continue;
+		}
+
+		switch (entry_type(self, mi)) {
+		case ROARING_BITMAP: {
+			eword_t w;
+			memcpy(&w, data + (low / BITS_IN_WORD) * sizeof(w),
+			       sizeof(w));
+			return (ntohll(w) >> (low % BITS_IN_WORD)) & 1;
+		}
+		case ROARING_ARRAY:
+			for (h = count; l < h;) {
+				uint32_t m = l + (h - l) / 2;
+				uint16_t v = get_be16(data + 2 * m);
+
+				if (v == low)
+					return 1;
+				if (v < low)
+					l = m + 1;
+				else
+					h = m;
+			}
+			return 0;
+		case ROARING_RUN:
+			/* find the last run starting at or before `low` */
+			for (h = count; l < h;) {
+				uint32_t m = l + (h - l) / 2;
+
+				if (get_be16(data + 4 * m) <= low)
+					l = m + 1;
+				else
+					h = m;
+			}
+			if (!l)
+				return 0;
+			l--;
+			return low - get_be16(data + 4 * l) <=
+				get_be16(data + 4 * l + 2);
+		}
+		return 0;
+	}
+	return 0;
+}
+
+void roaring_to_ewah(const struct roaring_bitmap *self,
+		     struct ewah_bitmap *out)
+{
+	size_t nr_words = DIV_ROUND_UP(self->bit_size, BITS_IN_WORD);
+	size_t done = 0;
+	eword_t *words = xmalloc(ROARING_CHUNK_WORDS * sizeof(eword_t));
+	uint32_t i;
+
+	for (i = 0; i < self->nr; i++) {
+		size_t start = (size_t)entry_key(self, i) * ROARING_CHUNK_WORDS;
+		size_t k, len;
+
+		if (start >= nr_words)
+			break;
+		len = nr_words - start;
+		if (len > ROARING_CHUNK_WORDS)
+			len = ROARING_CHUNK_WORDS;
+
+		ewah_add_empty_words(out, 0, start - done);
+		memset(words, 0, ROARING_CHUNK_WORDS * sizeof(eword_t));
+		expand_container(self, i, words);
+		for (k = 0; k < len; k++)
+			ewah_add(out, words[k]);
+		done = start + len;
+	}
+	ewah_add_empty_words(out, 0, nr_words - done);
+	out->bit_size = self->bit_size;
+
+	free(words);
+}
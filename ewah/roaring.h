@@ -0,0 +1,71 @@
+#ifndef __EWOK_ROARING_H__
+#define __EWOK_ROARING_H__
+
+/**
+ * Roaring-style encoding of a bitmap: the bit positions are split into
+ * chunks of 65536 by their upper 16 bits, and each chunk that has any
+ * bit set is stored in whichever container is smallest for it:
+ *
+ *	- an array of the (lower 16 bits of the) positions that are set,
+ *	- a plain bitmap of 1024 words,
+ *	- or a list of runs of set bits.
+ *
+ * An index of the chunks comes first, so single bits can be tested
+ * without reading the rest. Bitmaps with bits scattered too sparsely
+ * for the run-length encoding of EWAH are much smaller this way.
+ *
+ * The serialization format is described in
+ * Documentation/technical/bitmap-format.txt.
+ */
+
+#define ROARING_CHUNK_BITS 65536
+#define ROARING_CHUNK_WORDS (ROARING_CHUNK_BITS / BITS_IN_WORD)
+
+enum roaring_container_type {
+	ROARING_ARRAY = 0,
+	ROARING_BITMAP = 1,
+	ROARING_RUN = 2,
+};
+
+/**
+ * A serialized bitmap; it points into the buffer it was read from,
+ * which must stay around while it is used.
+ */
+struct roaring_bitmap {
+	size_t bit_size;
+	uint32_t nr;
+	const unsigned char *index;
+	const unsigned char *data;
+};
+
+/**
+ * Write `bitmap` in the roaring encoding through `write_fun`.
+ *
+ * Return: the number of bytes written, or -1 on error
+ */
+int roaring_serialize_to(struct ewah_bitmap *bitmap,
+			 int (*write_fun)(void *out, const void *buf, size_t len),
+			 void *out);
+
+/**
+ * Point `self` at the serialized bitmap at the beginning of `map`,
+ * checking that all of it fits in `len` bytes.
+ *
+ * Return: the size of the serialized bitmap, or -1 if it is corrupt
+ */
+int roaring_read_mmap(struct roaring_bitmap *self, const void *map, size_t len);
+
+/**
+ * Return true if the bit at position `pos` is set; this only reads the
+ * container the bit falls into.
+ */
+int roaring_get(const struct roaring_bitmap *self, size_t pos);
+
+/**
+ * Append the bits of `self` to the empty EWAH bitmap `out`, so that
+ * it can be used with all the EWAH operations.
+ */
+void roaring_to_ewah(const struct roaring_bitmap *self,
+		     struct ewah_bitmap *out);
+
+#endif
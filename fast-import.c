@@ -3294,9 +3294,12 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
-		if (pack_idx_opts.version > 2)
+		if (pack_idx_opts.version > 3)
 			die("bad pack.indexversion=%"PRIu32,
 			    pack_idx_opts.version);
+		/* we do not keep the object sizes version 3 records */
+		if (pack_idx_opts.version == 3)
+			pack_idx_opts.version = 2;
 		return 0;
 	}
 	if (!strcmp(k, "pack.packsizelimit")) {
@@ -576,7 +576,7 @@ static int everything_local(struct fetch_pack_args *args,
 	for (ref = *refs; ref; ref = ref->next) {
 		struct object *o;
 
-		if (!has_sha1_file(ref->old_sha1))
+		if (!has_sha1_file_with_flags(ref->old_sha1, HAS_SHA1_QUICK))
 			continue;
 
 		o = parse_object(ref->old_sha1);
@@ -0,0 +1,612 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "midx.h"
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
+#define MIDX_MAX_CHUNKS 5
+#define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
+#define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
+#define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct multi_pack_index *multi_pack_index;
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+static uint64_t get_be64_at(const unsigned char *p)
+{
+	return (((uint64_t)get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+static int parse_pack_names(struct multi_pack_index *m, size_t len,
+			    const char *path)
+{
+	const char *cur = (const char *)m->chunk_pack_names;
+	const char *end = cur + len;
+	uint32_t i;
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	for (i = 0; i < m->num_packs; i++) {
+		const char *nul = memchr(cur, '\0', end - cur);
+		if (!nul)
+			return error("multi-pack index %s has truncated pack names",
+				     path);
+		if (i && strcmp(m->pack_names[i - 1], cur) >= 0)
+			return error("multi-pack index %s pack names out of order:"
+				     " '%s' before '%s'",
+				     path, m->pack_names[i - 1], cur);
+		m->pack_names[i] = cur;
+		cur = nul + 1;
+	}
+	return 0;
+}
+
+/*
+ * Open and mmap the multi-pack index of object_dir, perform a couple
+ * of consistency checks, and return it.  A missing file is not an
+ * error; NULL is returned quietly in that case.
+ */
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m = NULL;
+	char *midx_name = get_midx_filename(object_dir);
+	const unsigned char *map = NULL, *chunk_table;
+	size_t midx_size = 0, chunk_start[MIDX_MAX_CHUNKS + 1];
+	uint32_t chunk_id[MIDX_MAX_CHUNKS + 1];
+	uint32_t i, nr, num_chunks;
+	struct stat st;
+	int fd;
+
+	fd = git_open_noatime(midx_name);
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto cleanup_fail;
+	}
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_HEADER_SIZE + MIDX_CHUNKLOOKUP_WIDTH + 20) {
+		close(fd);
+		error("multi-pack index %s is too small", midx_name);
+		goto cleanup_fail;
+	}
+	map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = xcalloc(1, sizeof(*m) + strlen(object_dir) + 1);
+	strcpy(m->object_dir, object_dir);
+	m->data = map;
+	m->data_len = midx_size;
+	m->local = local;
+
+	if (get_be32(map) != MIDX_SIGNATURE) {
+		error("multi-pack index %s has bad signature", midx_name);
+		goto cleanup_fail;
+	}
+	if (map[4] != MIDX_VERSION) {
+		error("multi-pack index %s is version %d and is not supported"
+		      " by this binary", midx_name, map[4]);
+		goto cleanup_fail;
+	}
+	if (map[5] != MIDX_HASH_VERSION) {
+		error("multi-pack index %s uses unknown hash version %d",
+		      midx_name, map[5]);
+		goto cleanup_fail;
+	}
+	num_chunks = map[6];
+	if (map[7]) {
+		error("multi-pack index %s has base files, which are not"
+		      " supported", midx_name);
+		goto cleanup_fail;
+	}
+	m->num_packs = get_be32(map + 8);
+
+	if (num_chunks > MIDX_MAX_CHUNKS ||
+	    midx_size < MIDX_HEADER_SIZE +
+			(num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH + 20) {
+		error("multi-pack index %s has a bad chunk table", midx_name);
+		goto cleanup_fail;
+	}
+
+	chunk_table = map + MIDX_HEADER_SIZE;
+	for (i = 0; i <= num_chunks; i++) {
+		uint64_t ofs = get_be64_at(chunk_table + 4);
+
+		chunk_id[i] = get_be32(chunk_table);
+		if (ofs > midx_size - 20 ||
+		    (i && ofs < chunk_start[i - 1])) {
+			error("multi-pack index %s has a bad chunk offset",
+			      midx_name);
+			goto cleanup_fail;
+		}
+		chunk_start[i] = (size_t)ofs;
+		chunk_table += MIDX_CHUNKLOOKUP_WIDTH;
+	}
+	if (chunk_id[num_chunks]) {
+		error("multi-pack index %s has an unterminated chunk table",
+		      midx_name);
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *start = map + chunk_start[i];
+		size_t len = chunk_start[i + 1] - chunk_start[i];
+
+		switch (chunk_id[i]) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = start;
+			if (parse_pack_names(m, len, midx_name))
+				goto cleanup_fail;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (len != MIDX_CHUNK_FANOUT_SIZE) {
+				error("multi-pack index %s has a bad fanout",
+				      midx_name);
+				goto cleanup_fail;
+			}
+			m->chunk_oid_fanout = (const uint32_t *)start;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = start;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = start;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = start;
+			m->num_large_offsets = len / MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+			break;
+		default:
+			/* unknown chunks are ignored */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack index %s is missing a required chunk",
+		      midx_name);
+		goto cleanup_fail;
+	}
+
+	nr = 0;
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(m->chunk_oid_fanout[i]);
+		if (n < nr) {
+			error("non-monotonic multi-pack index %s", midx_name);
+			goto cleanup_fail;
+		}
+		nr = n;
+	}
+	m->num_objects = nr;
+
+	for (i = 0; i < num_chunks; i++) {
+		size_t len = chunk_start[i + 1] - chunk_start[i];
+		size_t want;
+
+		if (chunk_id[i] == MIDX_CHUNKID_OIDLOOKUP)
+			want = (size_t)nr * 20;
+		else if (chunk_id[i] == MIDX_CHUNKID_OBJECTOFFSETS)
+			want = (size_t)nr * MIDX_CHUNK_OFFSET_WIDTH;
+		else
+			continue;
+		if (len != want) {
+			error("wrong chunk size in multi-pack index %s",
+			      midx_name);
+			goto cleanup_fail;
+		}
+	}
+
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	free(midx_name);
+	if (m) {
+		free(m->pack_names);
+		free(m);
+	}
+	if (map)
+		munmap((void *)map, midx_size);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	uint32_t i;
+
+	if (!m)
+		return;
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 0;
+	munmap((void *)m->data, m->data_len);
+	free(m->packs);
+	free(m->pack_names);
+	free(m);
+}
+
+struct multi_pack_index *prepare_multi_pack_index_one(const char *object_dir,
+						      int local)
+{
+	struct multi_pack_index *m;
+
+	if (!core_multi_pack_index)
+		return NULL;
+
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(object_dir, m->object_dir))
+			return m;
+
+	m = load_multi_pack_index(object_dir, local);
+	if (m) {
+		m->next = multi_pack_index;
+		multi_pack_index = m;
+	}
+	return m;
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, const char *idx_name)
+{
+	uint32_t lo = 0, hi = m->num_packs;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mi]);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+int midx_claim_pack(struct multi_pack_index *m, struct packed_git *p,
+		    const char *idx_name)
+{
+	int pos = midx_pack_pos(m, idx_name);
+
+	if (pos < 0)
+		return 0;
+	m->packs[pos] = p;
+	p->multi_pack_index = 1;
+	return 1;
+}
+
+void midx_release_pack(struct packed_git *p)
+{
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	for (m = multi_pack_index; m; m = m->next)
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i] == p)
+				m->packs[i] = NULL;
+	p->multi_pack_index = 0;
+}
+
+static int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+			uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(m->chunk_oid_fanout[*sha1]);
+	lo = *sha1 ? ntohl(m->chunk_oid_fanout[*sha1 - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->chunk_oid_lookup + 20 * mi, sha1);
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+off_t find_midx_entry_one(const unsigned char *sha1,
+			  struct multi_pack_index *m,
+			  struct packed_git **pp)
+{
+	const unsigned char *entry;
+	uint32_t pos, pack_int_id;
+	off_t offset;
+
+	if (!bsearch_midx(sha1, m, &pos))
+		return 0;
+
+	entry = m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH;
+	pack_int_id = get_be32(entry);
+	offset = get_be32(entry + sizeof(uint32_t));
+
+	if (pack_int_id >= m->num_packs) {
+		error("bad pack-int-id %"PRIu32" in multi-pack index %s",
+		      pack_int_id, m->object_dir);
+		return 0;
+	}
+	if (offset & MIDX_LARGE_OFFSET_NEEDED) {
+		uint32_t ofs = offset & ~MIDX_LARGE_OFFSET_NEEDED;
+		if (sizeof(off_t) <= 4 || ofs >= m->num_large_offsets) {
+			error("bad large offset in multi-pack index %s",
+			      m->object_dir);
+			return 0;
+		}
+		offset = get_be64_at(m->chunk_large_offsets +
+				     ofs * MIDX_CHUNK_LARGE_OFFSET_WIDTH);
+	}
+
+	*pp = m->packs[pack_int_id];
+	return offset;
+}
+
+struct pack_info {
+	char *idx_name;
+	struct packed_git *p;
+};
+
+struct pack_midx_entry {
+	const unsigned char *sha1;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int pack_info_cmp(const void *a_, const void *b_)
+{
+	const struct pack_info *a = a_, *b = b_;
+	return strcmp(a->idx_name, b->idx_name);
+}
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	/*
+	 * Prefer the copy in the youngest pack, just like the order
+	 * in which find_pack_entry() would have looked at the packs.
+	 */
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	return 0;
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, sizeof(v));
+}
+
+static void write_be64(struct sha1file *f, uint64_t v)
+{
+	write_be32(f, (uint32_t)(v >> 32));
+	write_be32(f, (uint32_t)(v & 0xffffffff));
+}
+
+static void add_pack_dir(struct strbuf *path, struct pack_info **packs,
+			 uint32_t *nr, uint32_t *alloc)
+{
+	size_t dirnamelen;
+	struct dirent *de;
+	DIR *dir = opendir(path->buf);
+
+	if (!dir) {
+		if (errno != ENOENT)
+			error("unable to open object pack directory: %s: %s",
+			      path->buf, strerror(errno));
+		return;
+	}
+	strbuf_addch(path, '/');
+	dirnamelen = path->len;
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		strbuf_setlen(path, dirnamelen);
+		strbuf_addstr(path, de->d_name);
+
+		p = add_packed_git(path->buf, path->len, 1);
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			warning("failed to open pack-index '%s'", path->buf);
+			free(p);
+			continue;
+		}
+		ALLOC_GROW(*packs, *nr + 1, *alloc);
+		(*packs)[*nr].idx_name = xstrdup(de->d_name);
+		(*packs)[*nr].p = p;
+		(*nr)++;
+	}
+	closedir(dir);
+}
+
+int write_multi_pack_index(const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct lock_file *lock;
+	struct sha1file *f;
+	struct pack_info *packs = NULL;
+	struct pack_midx_entry *entries;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr_entries = 0, nr_objects;
+	uint32_t nr_large = 0, nr_chunks, i, j;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	size_t pack_name_len = 0;
+	char *midx_name;
+	static const char padding[4];
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	add_pack_dir(&path, &packs, &nr_packs, &alloc_packs);
+	strbuf_release(&path);
+
+	qsort(packs, nr_packs, sizeof(*packs), pack_info_cmp);
+
+	nr_objects = 0;
+	for (i = 0; i < nr_packs; i++) {
+		nr_objects += packs[i].p->num_objects;
+		pack_name_len += strlen(packs[i].idx_name) + 1;
+	}
+
+	entries = xmalloc((size_t)nr_objects * sizeof(*entries));
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[nr_entries++];
+			e->sha1 = nth_packed_object_sha1(p, j);
+			e->offset = nth_packed_object_offset(p, j);
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), midx_entry_cmp);
+
+	/* drop duplicates, keeping the preferred copy sorted first */
+	for (i = j = 0; i < nr_entries; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+	}
+	nr_entries = j;
+
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset > 0x7fffffff)
+			nr_large++;
+
+	nr_chunks = 0;
+	chunk_ids[nr_chunks++] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[nr_chunks++] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[nr_chunks++] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[nr_chunks++] = MIDX_CHUNKID_OBJECTOFFSETS;
+	if (nr_large)
+		chunk_ids[nr_chunks++] = MIDX_CHUNKID_LARGEOFFSETS;
+	chunk_ids[nr_chunks] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+		(nr_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	for (i = 0; i < nr_chunks; i++) {
+		uint64_t len;
+		switch (chunk_ids[i]) {
+		case MIDX_CHUNKID_PACKNAMES:
+			len = (pack_name_len + 3) & ~3;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			len = MIDX_CHUNK_FANOUT_SIZE;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			len = (uint64_t)nr_entries * 20;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			len = (uint64_t)nr_entries * MIDX_CHUNK_OFFSET_WIDTH;
+			break;
+		default: /* MIDX_CHUNKID_LARGEOFFSETS */
+			len = (uint64_t)nr_large * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+			break;
+		}
+		chunk_offsets[i + 1] = chunk_offsets[i] + len;
+	}
+
+	midx_name = get_midx_filename(object_dir);
+	lock = xcalloc(1, sizeof(*lock));
+	hold_lock_file_for_update(lock, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lock->fd, lock->filename);
+
+	/* header */
+	write_be32(f, MIDX_SIGNATURE);
+	{
+		unsigned char hdr[4];
+		hdr[0] = MIDX_VERSION;
+		hdr[1] = MIDX_HASH_VERSION;
+		hdr[2] = nr_chunks;
+		hdr[3] = 0; /* no base multi-pack index */
+		sha1write(f, hdr, sizeof(hdr));
+	}
+	write_be32(f, nr_packs);
+
+	/* chunk lookup table */
+	for (i = 0; i <= nr_chunks; i++) {
+		write_be32(f, chunk_ids[i]);
+		write_be64(f, chunk_offsets[i]);
+	}
+
+	/* pack names */
+	for (i = 0; i < nr_packs; i++)
+		sha1write(f, packs[i].idx_name, strlen(packs[i].idx_name) + 1);
+	if (pack_name_len & 3)
+		sha1write(f, padding, 4 - (pack_name_len & 3));
+
+	/* fanout */
+	for (i = j = 0; i < 256; i++) {
+		while (j < nr_entries && entries[j].sha1[0] == i)
+			j++;
+		write_be32(f, j);
+	}
+
+	/* object names */
+	for (i = 0; i < nr_entries; i++)
+		sha1write(f, entries[i].sha1, 20);
+
+	/* pack-int-id and offsets */
+	for (i = j = 0; i < nr_entries; i++) {
+		write_be32(f, entries[i].pack_int_id);
+		if (entries[i].offset > 0x7fffffff)
+			write_be32(f, MIDX_LARGE_OFFSET_NEEDED | j++);
+		else
+			write_be32(f, (uint32_t)entries[i].offset);
+	}
+
+	/* large offsets */
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset > 0x7fffffff)
+			write_be64(f, entries[i].offset);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock->fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(lock))
+		die_errno("unable to write multi-pack index '%s'", midx_name);
+
+	free(midx_name);
+	free(entries);
+	for (i = 0; i < nr_packs; i++) {
+		close_pack_index(packs[i].p);
+		free(packs[i].p);
+		free(packs[i].idx_name);
+	}
+	free(packs);
+	return 0;
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index **mp = &multi_pack_index;
+
+	while (*mp) {
+		struct multi_pack_index *m = *mp;
+		if (!strcmp(m->object_dir, object_dir)) {
+			*mp = m->next;
+			close_midx(m);
+			continue;
+		}
+		mp = &m->next;
+	}
+
+	unlink_or_warn(midx_name);
+	free(midx_name);
+}
@@ -0,0 +1,79 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1 /* SHA-1 */
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+/*
+ * A multi-pack index covers every pack in one object directory with
+ * a single sorted table of object names, so that looking up an
+ * object costs one binary search no matter how many packs exist.
+ */
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	size_t num_large_offsets;
+
+	/* names of the .idx files covered, sorted */
+	const char **pack_names;
+	/* the packs themselves, as claimed by prepare_packed_git() */
+	struct packed_git **packs;
+
+	int local;
+	char object_dir[FLEX_ARRAY];
+};
+
+extern struct multi_pack_index *multi_pack_index;
+
+extern char *get_midx_filename(const char *object_dir);
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Load the multi-pack index of object_dir (if any) and link it into
+ * the multi_pack_index list.  Calling it again for the same directory
+ * returns the already loaded index.
+ */
+extern struct multi_pack_index *prepare_multi_pack_index_one(const char *object_dir, int local);
+
+/*
+ * Record that the pack p, whose index file is called idx_name inside
+ * the pack directory, is covered by m.  Returns 1 if m lists the pack.
+ */
+extern int midx_claim_pack(struct multi_pack_index *m, struct packed_git *p,
+			   const char *idx_name);
+
+/* Forget about a pack that is about to be freed. */
+extern void midx_release_pack(struct packed_git *p);
+
+/*
+ * If the object named sha1 is covered by the multi-pack index m,
+ * return its offset and store the pack containing it to *pp (which is
+ * NULL if that pack has not been claimed); otherwise, return 0.
+ */
+extern off_t find_midx_entry_one(const unsigned char *sha1,
+				 struct multi_pack_index *m,
+				 struct packed_git **pp);
+
+extern int write_multi_pack_index(const char *object_dir);
+extern void clear_midx_file(const char *object_dir);
+
+#endif
@@ -5,7 +5,17 @@
 #include "commit.h"
 #include "tag.h"
 
-static struct object **obj_hash;
+/*
+ * Each slot of the object hash carries a few more bits of the object
+ * name next to the pointer, so that a probe can skip a slot that holds
+ * some other object without touching that object at all.
+ */
+struct obj_hash_entry {
+	struct object *obj;
+	unsigned int tag;
+};
+
+static struct obj_hash_entry *obj_hash;
 static int nr_objs, obj_hash_size;
 
 unsigned int get_max_object_index(void)
@@ -15,7 +25,7 @@ unsigned int get_max_object_index(void)
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return obj_hash[idx];
+	return obj_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -53,21 +63,34 @@ static unsigned int hash_obj(const unsigned char *sha1, unsigned int n)
 	return sha1hash(sha1) & (n - 1);
 }
 
+/*
+ * The tag stored next to an object in the hash.  It comes from other
+ * bytes of the name than hash_obj() uses, so that objects which collide
+ * on a bucket are still told apart.
+ */
+static inline unsigned int obj_hash_tag(const unsigned char *sha1)
+{
+	unsigned int tag;
+	memcpy(&tag, sha1 + sizeof(unsigned int), sizeof(tag));
+	return tag;
+}
+
 /*
  * Insert obj into the hash table hash, which has length size (which
  * must be a power of 2).  On collisions, simply overflow to the next
  * empty bucket.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(struct object *obj, struct obj_hash_entry *hash, unsigned int size)
 {
 	unsigned int j = hash_obj(obj->sha1, size);
 
-	while (hash[j]) {
+	while (hash[j].obj) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
-	hash[j] = obj;
+	hash[j].obj = obj;
+	hash[j].tag = obj_hash_tag(obj->sha1);
 }
 
 /*
@@ -76,15 +99,16 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i, first;
+	unsigned int i, first, tag;
 	struct object *obj;
 
 	if (!obj_hash)
 		return NULL;
 
+	tag = obj_hash_tag(sha1);
 	first = i = hash_obj(sha1, obj_hash_size);
-	while ((obj = obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->sha1))
+	while ((obj = obj_hash[i].obj) != NULL) {
+		if (obj_hash[i].tag == tag && !hashcmp(sha1, obj->sha1))
 			break;
 		i++;
 		if (i == obj_hash_size)
@@ -96,7 +120,7 @@ struct object *lookup_object(const unsigned char *sha1)
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		struct object *tmp = obj_hash[i];
+		struct obj_hash_entry tmp = obj_hash[i];
 		obj_hash[i] = obj_hash[first];
 		obj_hash[first] = tmp;
 	}
@@ -116,11 +140,11 @@ static void grow_object_hash(void)
 	 * above.
 	 */
 	int new_hash_size = obj_hash_size < 32 ? 32 : 2 * obj_hash_size;
-	struct object **new_hash;
+	struct obj_hash_entry *new_hash;
 
-	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	new_hash = xcalloc(new_hash_size, sizeof(*new_hash));
 	for (i = 0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+		struct object *obj = obj_hash[i].obj;
 		if (!obj)
 			continue;
 		insert_obj_hash(obj, new_hash, new_hash_size);
@@ -130,6 +154,29 @@ static void grow_object_hash(void)
 	obj_hash_size = new_hash_size;
 }
 
+void object_hash_filter(object_hash_each_func_t want, void *cb_data)
+{
+	struct obj_hash_entry *new_hash;
+	int i, nr = 0, new_hash_size = 32;
+
+	/* compact the objects we keep to the front, then rehash them */
+	for (i = 0; i < obj_hash_size; i++) {
+		struct object *obj = obj_hash[i].obj;
+		if (obj && want(obj, cb_data))
+			obj_hash[nr++].obj = obj;
+	}
+	while (new_hash_size - 1 <= nr * 2)
+		new_hash_size *= 2;
+
+	new_hash = xcalloc(new_hash_size, sizeof(*new_hash));
+	for (i = 0; i < nr; i++)
+		insert_obj_hash(obj_hash[i].obj, new_hash, new_hash_size);
+	free(obj_hash);
+	obj_hash = new_hash;
+	obj_hash_size = new_hash_size;
+	nr_objs = nr;
+}
+
 void *create_object(const unsigned char *sha1, void *o)
 {
 	struct object *obj = o;
@@ -152,8 +199,12 @@ void *object_as_type(struct object *obj, enum object_type type, int quiet)
 	if (obj->type == type)
 		return obj;
 	else if (obj->type == OBJ_NONE) {
-		if (type == OBJ_COMMIT)
-			((struct commit *)obj)->index = alloc_commit_index();
+		if (type == OBJ_COMMIT) {
+			struct commit *c = (struct commit *)obj;
+			c->index = alloc_commit_index();
+			c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+			c->generation = GENERATION_NUMBER_INFINITY;
+		}
 		obj->type = type;
 		return obj;
 	}
@@ -404,7 +455,7 @@ void clear_object_flags(unsigned flags)
 	int i;
 
 	for (i=0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+		struct object *obj = obj_hash[i].obj;
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -32,6 +32,7 @@ struct object_array {
  * fetch-pack.c:    0---4
  * walker.c:        0-2
  * upload-pack.c:               11----------------19
+ * commit-graph.c:                        15
  * builtin/blame.c:               12-13
  * bisect.c:                               16
  * bundle.c:                               16
@@ -134,4 +135,13 @@ void object_array_remove_duplicates(struct object_array *array);
 
 void clear_object_flags(unsigned flags);
 
+typedef int (*object_hash_each_func_t)(struct object *, void *);
+
+/*
+ * Apply want to each object in the object hash, dropping from the hash
+ * those for which it returns false.  The dropped objects themselves are
+ * not freed.
+ */
+void object_hash_filter(object_hash_each_func_t want, void *cb_data);
+
 #endif /* OBJECT_H */
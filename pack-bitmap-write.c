@@ -3,11 +3,13 @@
 #include "tag.h"
 #include "diff.h"
 #include "revision.h"
-#include "list-objects.h"
+#include "tree-walk.h"
+#include "thread-utils.h"
 #include "progress.h"
 #include "pack-revindex.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "ewah/roaring.h"
 #include "sha1-lookup.h"
 #include "pack-objects.h"
 
@@ -18,6 +20,7 @@ struct bitmapped_commit {
 	int flags;
 	int xor_offset;
 	uint32_t commit_pos;
+	off_t offset;	/* of the entry in the .bitmap file */
 };
 
 struct bitmap_writer {
@@ -36,6 +39,8 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[20];
+	enum bitmap_format format;
+	int threads;
 };
 
 static struct bitmap_writer writer;
@@ -64,12 +69,12 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 
 		entry->in_pack_pos = i;
 
-		switch (entry->type) {
+		switch (oe_type(entry)) {
 		case OBJ_COMMIT:
 		case OBJ_TREE:
 		case OBJ_BLOB:
 		case OBJ_TAG:
-			real_type = entry->type;
+			real_type = oe_type(entry);
 			break;
 
 		default:
@@ -96,7 +101,7 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 
 		default:
 			die("Missing type information for %s (%d/%d)",
-			    sha1_to_hex(entry->idx.sha1), real_type, entry->type);
+			    sha1_to_hex(entry->idx.sha1), real_type, oe_type(entry));
 		}
 	}
 }
@@ -104,9 +109,6 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 /**
  * Compute the actual bitmaps
  */
-static struct object **seen_objects;
-static unsigned int seen_objects_nr, seen_objects_alloc;
-
 static inline void push_bitmapped_commit(struct commit *commit, struct ewah_bitmap *reused)
 {
 	if (writer.selected_nr >= writer.selected_alloc) {
@@ -122,21 +124,6 @@ static inline void push_bitmapped_commit(struct commit *commit, struct ewah_bitm
 	writer.selected_nr++;
 }
 
-static inline void mark_as_seen(struct object *object)
-{
-	ALLOC_GROW(seen_objects, seen_objects_nr + 1, seen_objects_alloc);
-	seen_objects[seen_objects_nr++] = object;
-}
-
-static inline void reset_all_seen(void)
-{
-	unsigned int i;
-	for (i = 0; i < seen_objects_nr; ++i) {
-		seen_objects[i]->flags &= ~(SEEN | ADDED | SHOWN);
-	}
-	seen_objects_nr = 0;
-}
-
 static uint32_t find_object_pos(const unsigned char *sha1)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, sha1, NULL);
@@ -149,59 +136,195 @@ static uint32_t find_object_pos(const unsigned char *sha1)
 	return entry->in_pack_pos;
 }
 
-static void show_object(struct object *object, const struct name_path *path,
-			const char *last, void *data)
+/*
+ * The selected commits that need a bitmap, taken oldest first, are cut
+ * into chains in which every commit descends from the one before it;
+ * the bitmap of each commit in a chain is the one of the previous
+ * commit plus what is new.  Chains do not depend on each other and are
+ * built by as many threads as we are allowed.
+ *
+ * The walk marks what it has seen in the bitmap being built instead of
+ * in the object flags, so that threads walking different chains do not
+ * step on each other.  A set bit for a commit or a tree means that all
+ * that is reachable from it is set too.  Everything that touches the
+ * parsed objects (and the bitmaps already built) is done under
+ * build_lock(); trees are read with read_sha1_file(), which can be
+ * called from many threads at once.
+ */
+struct bitmap_chain {
+	int first, last;	/* indices into writer.selected, first >= last */
+};
+
+static struct bitmap_chain *chains;
+static int chains_nr, chains_alloc, next_chain;
+static unsigned int bitmaps_done;
+
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t build_mutex;
+#define build_lock()		pthread_mutex_lock(&build_mutex)
+#define build_unlock()		pthread_mutex_unlock(&build_mutex)
+
+#else
+
+#define build_lock()		(void)0
+#define build_unlock()		(void)0
+
+#endif
+
+/* the caller holds build_lock() */
+static struct ewah_bitmap *find_built_bitmap(const unsigned char *sha1)
 {
-	struct bitmap *base = data;
-	bitmap_set(base, find_object_pos(object->sha1));
-	mark_as_seen(object);
+	khiter_t hash_pos = kh_get_sha1(writer.bitmaps, sha1);
+	struct bitmapped_commit *bc;
+
+	if (hash_pos >= kh_end(writer.bitmaps))
+		return NULL;
+	bc = kh_value(writer.bitmaps, hash_pos);
+	return bc->bitmap;
 }
 
-static void show_commit(struct commit *commit, void *data)
+static void fill_bitmap_tree(struct bitmap *base, const unsigned char *sha1)
 {
-	mark_as_seen((struct object *)commit);
+	uint32_t pos = find_object_pos(sha1);
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if (bitmap_get(base, pos))
+		return;
+	bitmap_set(base, pos);
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s", sha1_to_hex(sha1));
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		switch (object_type(entry.mode)) {
+		case OBJ_TREE:
+			fill_bitmap_tree(base, entry.sha1);
+			break;
+		case OBJ_BLOB:
+			bitmap_set(base, find_object_pos(entry.sha1));
+			break;
+		default:
+			/* gitlinks are not in the pack */
+			break;
+		}
+	}
+	free(buf);
 }
 
-static int
-add_to_include_set(struct bitmap *base, struct commit *commit)
+static void fill_bitmap_commit(struct bitmap *base, struct commit *commit,
+			       struct commit ***stack, int *stack_alloc)
 {
-	khiter_t hash_pos;
-	uint32_t bitmap_pos = find_object_pos(commit->object.sha1);
+	int nr = 0;
+
+	ALLOC_GROW(*stack, nr + 1, *stack_alloc);
+	(*stack)[nr++] = commit;
+
+	while (nr) {
+		uint32_t pos;
+		struct ewah_bitmap *built;
+		struct commit_list *parent;
+
+		commit = (*stack)[--nr];
+		pos = find_object_pos(commit->object.sha1);
+		if (bitmap_get(base, pos))
+			continue;
+
+		build_lock();
+		built = find_built_bitmap(commit->object.sha1);
+		if (!built && parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		build_unlock();
+
+		if (built) {
+			bitmap_or_ewah(base, built);
+			continue;
+		}
 
-	if (bitmap_get(base, bitmap_pos))
-		return 0;
+		bitmap_set(base, pos);
+		fill_bitmap_tree(base, commit->tree->object.sha1);
 
-	hash_pos = kh_get_sha1(writer.bitmaps, commit->object.sha1);
-	if (hash_pos < kh_end(writer.bitmaps)) {
-		struct bitmapped_commit *bc = kh_value(writer.bitmaps, hash_pos);
-		bitmap_or_ewah(base, bc->bitmap);
-		return 0;
+		for (parent = commit->parents; parent; parent = parent->next) {
+			ALLOC_GROW(*stack, nr + 1, *stack_alloc);
+			(*stack)[nr++] = parent->item;
+		}
 	}
-
-	bitmap_set(base, bitmap_pos);
-	return 1;
 }
 
-static int
-should_include(struct commit *commit, void *_data)
+static void *build_bitmaps_worker(void *unused)
 {
-	struct bitmap *base = _data;
+	struct bitmap *base = bitmap_new();
+	struct commit **stack = NULL;
+	int stack_alloc = 0;
 
-	if (!add_to_include_set(base, commit)) {
-		struct commit_list *parent = commit->parents;
+	for (;;) {
+		struct bitmap_chain *chain;
+		int i;
 
-		mark_as_seen((struct object *)commit);
+		build_lock();
+		chain = next_chain < chains_nr ? &chains[next_chain++] : NULL;
+		build_unlock();
+		if (!chain)
+			break;
 
-		while (parent) {
-			parent->item->object.flags |= SEEN;
-			mark_as_seen((struct object *)parent->item);
-			parent = parent->next;
-		}
+		bitmap_reset(base);
+		for (i = chain->first; i >= chain->last; i--) {
+			struct bitmapped_commit *stored = &writer.selected[i];
+			struct ewah_bitmap *bitmap;
 
-		return 0;
+			fill_bitmap_commit(base, stored->commit,
+					   &stack, &stack_alloc);
+			bitmap = bitmap_to_ewah(base);
+
+			build_lock();
+			stored->bitmap = bitmap;
+			display_progress(writer.progress, ++bitmaps_done);
+			build_unlock();
+		}
 	}
 
-	return 1;
+	free(stack);
+	bitmap_free(base);
+	return NULL;
+}
+
+static void build_bitmaps(void)
+{
+	int nr_threads = writer.threads;
+
+#ifndef NO_PTHREADS
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > chains_nr)
+		nr_threads = chains_nr;
+	if (nr_threads > 1) {
+		pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+		int i, ret;
+
+		enable_obj_read_lock();
+		pthread_mutex_init(&build_mutex, NULL);
+		for (i = 0; i < nr_threads; i++) {
+			ret = pthread_create(&threads[i], NULL,
+					     build_bitmaps_worker, NULL);
+			if (ret)
+				die("unable to create thread: %s", strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&build_mutex);
+		disable_obj_read_lock();
+		free(threads);
+		return;
+	}
+#endif
+	build_bitmaps_worker(NULL);
 }
 
 static void compute_xor_offsets(void)
@@ -248,9 +371,7 @@ void bitmap_writer_build(struct packing_data *to_pack)
 {
 	static const double REUSE_BITMAP_THRESHOLD = 0.2;
 
-	int i, reuse_after, need_reset;
-	struct bitmap *base = bitmap_new();
-	struct rev_info revs;
+	int i, reuse_after;
 
 	writer.bitmaps = kh_init_sha1();
 	writer.to_pack = to_pack;
@@ -258,17 +379,9 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	if (writer.show_progress)
 		writer.progress = start_progress("Building bitmaps", writer.selected_nr);
 
-	init_revisions(&revs, NULL);
-	revs.tag_objects = 1;
-	revs.tree_objects = 1;
-	revs.blob_objects = 1;
-	revs.no_walk = 0;
-
-	revs.include_check = should_include;
-	reset_revision_walk();
-
 	reuse_after = writer.selected_nr * REUSE_BITMAP_THRESHOLD;
-	need_reset = 0;
+	chains_nr = next_chain = 0;
+	bitmaps_done = 0;
 
 	for (i = writer.selected_nr - 1; i >= 0; --i) {
 		struct bitmapped_commit *stored;
@@ -281,30 +394,19 @@ void bitmap_writer_build(struct packing_data *to_pack)
 		object = (struct object *)stored->commit;
 
 		if (stored->bitmap == NULL) {
-			if (i < writer.selected_nr - 1 &&
-			    (need_reset ||
-			     !in_merge_bases(writer.selected[i + 1].commit,
-					     stored->commit))) {
-			    bitmap_reset(base);
-			    reset_all_seen();
-			}
-
-			add_pending_object(&revs, object, "");
-			revs.include_check_data = base;
-
-			if (prepare_revision_walk(&revs))
-				die("revision walk setup failed");
-
-			traverse_commit_list(&revs, show_commit, show_object, base);
-
-			revs.pending.nr = 0;
-			revs.pending.alloc = 0;
-			revs.pending.objects = NULL;
+			struct bitmap_chain *last = chains_nr ? &chains[chains_nr - 1] : NULL;
 
-			stored->bitmap = bitmap_to_ewah(base);
-			need_reset = 0;
+			if (last && last->last == i + 1 &&
+			    in_merge_bases(writer.selected[i + 1].commit,
+					   stored->commit)) {
+				last->last = i;
+			} else {
+				ALLOC_GROW(chains, chains_nr + 1, chains_alloc);
+				chains[chains_nr].first = chains[chains_nr].last = i;
+				chains_nr++;
+			}
 		} else
-			need_reset = 1;
+			bitmaps_done++;
 
 		if (i >= reuse_after)
 			stored->flags |= BITMAP_FLAG_REUSE;
@@ -315,10 +417,10 @@ void bitmap_writer_build(struct packing_data *to_pack)
 			    sha1_to_hex(object->sha1));
 
 		kh_value(writer.bitmaps, hash_pos) = stored;
-		display_progress(writer.progress, writer.selected_nr - i);
 	}
 
-	bitmap_free(base);
+	display_progress(writer.progress, bitmaps_done);
+	build_bitmaps();
 	stop_progress(&writer.progress);
 
 	compute_xor_offsets();
@@ -455,7 +557,13 @@ static int sha1write_ewah_helper(void *f, const void *buf, size_t len)
  */
 static inline void dump_bitmap(struct sha1file *f, struct ewah_bitmap *bitmap)
 {
-	if (ewah_serialize_to(bitmap, sha1write_ewah_helper, f) < 0)
+	int ret;
+
+	if (writer.format == BITMAP_FORMAT_ROARING)
+		ret = roaring_serialize_to(bitmap, sha1write_ewah_helper, f);
+	else
+		ret = ewah_serialize_to(bitmap, sha1write_ewah_helper, f);
+	if (ret < 0)
 		die("Failed to write bitmap index");
 }
 
@@ -480,6 +588,8 @@ static void write_selected_commits_v1(struct sha1file *f,
 
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
+		stored->commit_pos = commit_pos;
+		stored->offset = f->total + f->offset;
 
 		on_disk.object_pos = htonl(commit_pos);
 		on_disk.xor_offset = stored->xor_offset;
@@ -490,6 +600,50 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+static int lookup_table_cmp(const void *_a, const void *_b)
+{
+	uint32_t a = writer.selected[*(uint32_t *)_a].commit_pos;
+	uint32_t b = writer.selected[*(uint32_t *)_b].commit_pos;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * One row per selected commit, sorted by the position of the commit
+ * in the pack index: where its entry is, and which row holds the
+ * bitmap it is xor'ed with.
+ */
+static void write_lookup_table(struct sha1file *f)
+{
+	uint32_t *table, *row_of;
+	uint32_t i;
+
+	table = xmalloc(writer.selected_nr * sizeof(*table));
+	row_of = xmalloc(writer.selected_nr * sizeof(*row_of));
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	qsort(table, writer.selected_nr, sizeof(*table), lookup_table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		row_of[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[table[i]];
+		struct bitmap_lookup_entry on_disk;
+		uint32_t xor_row = BITMAP_LOOKUP_NO_XOR;
+
+		if (stored->xor_offset)
+			xor_row = row_of[table[i] - stored->xor_offset];
+		on_disk.commit_pos = htonl(stored->commit_pos);
+		on_disk.offset_hi = htonl((uint64_t)stored->offset >> 32);
+		on_disk.offset_lo = htonl(stored->offset & 0xffffffff);
+		on_disk.xor_row = htonl(xor_row);
+		sha1write(f, &on_disk, sizeof(on_disk));
+	}
+
+	free(table);
+	free(row_of);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -508,13 +662,22 @@ void bitmap_writer_set_checksum(unsigned char *sha1)
 	hashcpy(writer.pack_checksum, sha1);
 }
 
+void bitmap_writer_set_format(enum bitmap_format format)
+{
+	writer.format = format;
+}
+
+void bitmap_writer_set_threads(int nr_threads)
+{
+	writer.threads = nr_threads;
+}
+
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
 			  const char *filename,
 			  uint16_t options)
 {
 	static char tmp_file[PATH_MAX];
-	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct sha1file *f;
 
@@ -526,8 +689,11 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 		die_errno("unable to create '%s'", tmp_file);
 	f = sha1fd(fd, tmp_file);
 
+	if (!writer.format)
+		writer.format = BITMAP_FORMAT_EWAH;
+
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(writer.format);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(writer.selected_nr);
 	hashcpy(header.checksum, writer.pack_checksum);
@@ -539,6 +705,9 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.tags);
 	write_selected_commits_v1(f, index, index_nr);
 
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f);
+
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
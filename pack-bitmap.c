@@ -7,6 +7,7 @@
 #include "list-objects.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "ewah/roaring.h"
 #include "pack-revindex.h"
 #include "pack-objects.h"
 
@@ -60,9 +61,15 @@ static struct bitmap_index {
 	struct ewah_bitmap *blobs;
 	struct ewah_bitmap *tags;
 
-	/* Map from SHA1 -> `stored_bitmap` for all the bitmapped comits */
+	/*
+	 * Map from SHA1 -> `stored_bitmap` for all the bitmapped comits,
+	 * or only for those looked up so far if there is a lookup table
+	 */
 	khash_sha1 *bitmaps;
 
+	/* Commit lookup table (or NULL if not present) */
+	const struct bitmap_lookup_entry *table;
+
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
@@ -114,15 +121,27 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 
 /*
  * Read a bitmap from the current read position on the mmaped
- * index, and increase the read position accordingly
+ * index, and increase the read position accordingly.  Bitmaps in the
+ * roaring format are converted to EWAH as they are read.
  */
 static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 {
 	struct ewah_bitmap *b = ewah_pool_new();
+	int bitmap_size;
+
+	if (index->version == BITMAP_FORMAT_ROARING) {
+		struct roaring_bitmap r;
 
-	int bitmap_size = ewah_read_mmap(b,
-		index->map + index->map_pos,
-		index->map_size - index->map_pos);
+		bitmap_size = roaring_read_mmap(&r,
+			index->map + index->map_pos,
+			index->map_size - index->map_pos);
+		if (bitmap_size >= 0)
+			roaring_to_ewah(&r, b);
+	} else {
+		bitmap_size = ewah_read_mmap(b,
+			index->map + index->map_pos,
+			index->map_size - index->map_pos);
+	}
 
 	if (bitmap_size < 0) {
 		error("Failed to load bitmap index (corrupted?)");
@@ -145,7 +164,8 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error("Corrupted bitmap index file (wrong header)");
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != BITMAP_FORMAT_EWAH &&
+	    index->version != BITMAP_FORMAT_ROARING)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
 	/* Parse known bitmap format options */
@@ -158,12 +178,31 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
+			size_t cache_size = (size_t)index->pack->num_objects * 4;
+
+			if (end - (index->map + sizeof(*header)) < cache_size)
+				return error("Corrupted bitmap index "
+					     "(hash cache out of bounds)");
 			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
 		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
+
+	if (ntohs(header->options) & BITMAP_OPT_LOOKUP_TABLE) {
+		unsigned char *end = index->hashes ?
+			(unsigned char *)index->hashes :
+			index->map + index->map_size - 20;
+		size_t table_size = (size_t)index->entry_count *
+			sizeof(struct bitmap_lookup_entry);
+
+		if (end < index->map + index->map_pos ||
+		    end - (index->map + index->map_pos) < table_size)
+			return error("Corrupted bitmap index "
+				     "(lookup table out of bounds)");
+		index->table = (void *)(end - table_size);
+	}
 	return 0;
 }
 
@@ -244,6 +283,151 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+static uint32_t table_commit_pos(struct bitmap_index *index, uint32_t row)
+{
+	return ntohl(index->table[row].commit_pos);
+}
+
+static size_t table_offset(struct bitmap_index *index, uint32_t row)
+{
+	const struct bitmap_lookup_entry *e = &index->table[row];
+
+	return ((uint64_t)ntohl(e->offset_hi) << 32) | ntohl(e->offset_lo);
+}
+
+/*
+ * Load the bitmap in the given row of the lookup table, and first those
+ * it is xor'ed with if they are not loaded yet.
+ */
+static struct stored_bitmap *load_table_row(struct bitmap_index *index,
+					    uint32_t row)
+{
+	struct stored_bitmap *xor_bitmap = NULL;
+	uint32_t *stack = NULL;
+	size_t nr = 0, alloc = 0;
+	size_t entries_pos = index->map_pos; /* just past the type bitmaps */
+
+	for (;;) {
+		const unsigned char *sha1;
+		uint32_t xor_row;
+		khiter_t pos;
+
+		sha1 = nth_packed_object_sha1(index->pack,
+					      table_commit_pos(index, row));
+		if (!sha1) {
+			error("Corrupted bitmap index (bad commit position)");
+			goto out;
+		}
+		pos = kh_get_sha1(index->bitmaps, sha1);
+		if (pos < kh_end(index->bitmaps)) {
+			xor_bitmap = kh_value(index->bitmaps, pos);
+			break;
+		}
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = row;
+
+		xor_row = ntohl(index->table[row].xor_row);
+		if (xor_row == BITMAP_LOOKUP_NO_XOR)
+			break;
+		/* bases come earlier in the file, which ends the chain */
+		if (xor_row >= index->entry_count ||
+		    table_offset(index, xor_row) >= table_offset(index, row)) {
+			error("Invalid XOR row in bitmap lookup table");
+			goto out;
+		}
+		row = xor_row;
+	}
+
+	while (nr) {
+		struct bitmap_disk_entry *entry;
+		struct ewah_bitmap *bitmap;
+		size_t offset;
+		uint32_t commit_pos;
+
+		row = stack[--nr];
+		offset = table_offset(index, row);
+		commit_pos = table_commit_pos(index, row);
+		if (offset < entries_pos ||
+		    offset + sizeof(*entry) > index->map_size) {
+			error("Corrupted bitmap index (bad entry offset)");
+			xor_bitmap = NULL;
+			goto out;
+		}
+		entry = (struct bitmap_disk_entry *)(index->map + offset);
+		if (ntohl(entry->object_pos) != commit_pos) {
+			error("Corrupted bitmap index (entry does not match lookup table)");
+			xor_bitmap = NULL;
+			goto out;
+		}
+
+		index->map_pos = offset + sizeof(*entry);
+		bitmap = read_bitmap_1(index);
+		index->map_pos = entries_pos;
+		if (!bitmap) {
+			xor_bitmap = NULL;
+			goto out;
+		}
+		xor_bitmap = store_bitmap(index, bitmap,
+				nth_packed_object_sha1(index->pack, commit_pos),
+				xor_bitmap, entry->flags);
+		if (!xor_bitmap)
+			goto out;
+	}
+
+out:
+	free(stack);
+	return xor_bitmap;
+}
+
+/*
+ * The bitmap for the given commit, or NULL if it has none.  With a
+ * lookup table, this is where the bitmaps are read from the file.
+ */
+static struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *index,
+					     const unsigned char *sha1)
+{
+	khiter_t pos = kh_get_sha1(index->bitmaps, sha1);
+	struct stored_bitmap *stored;
+	uint32_t commit_pos, lo, hi;
+
+	if (pos < kh_end(index->bitmaps))
+		return lookup_stored_bitmap(kh_value(index->bitmaps, pos));
+	if (!index->table)
+		return NULL;
+
+	if (!find_pack_entry_pos(sha1, index->pack, &commit_pos))
+		return NULL;
+	lo = 0;
+	hi = index->entry_count;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t mi_pos = table_commit_pos(index, mi);
+
+		if (mi_pos == commit_pos) {
+			stored = load_table_row(index, mi);
+			return stored ? lookup_stored_bitmap(stored) : NULL;
+		}
+		if (mi_pos < commit_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+/* Load every bitmap, e.g. to go through all of them */
+static int load_all_table_rows(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	if (!index->table)
+		return 0;
+	for (i = 0; i < index->entry_count; i++)
+		if (!load_table_row(index, i))
+			return -1;
+	return 0;
+}
+
 static int open_pack_bitmap_1(struct packed_git *packfile)
 {
 	int fd;
@@ -301,7 +485,8 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	/* with a lookup table, bitmaps are read when asked for */
+	if (!bitmap_git.table && load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -349,7 +534,8 @@ int prepare_bitmap_git(void)
 	if (bitmap_git.loaded)
 		return 0;
 
-	if (!open_pack_bitmap())
+	/* prepare_bitmap_walk() may have opened it without loading it */
+	if (bitmap_git.map || !open_pack_bitmap())
 		return load_pack_bitmap();
 
 	return -1;
@@ -443,7 +629,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *bitmap;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -451,10 +637,9 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	bitmap = bitmap_for_commit(&bitmap_git, sha1);
+	if (bitmap) {
+		bitmap_or_ewah(data->base, bitmap);
 		return 0;
 	}
 
@@ -507,12 +692,10 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->sha1);
-
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with;
 
+			or_with = bitmap_for_commit(&bitmap_git, object->sha1);
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -620,7 +803,7 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_WORD; ++offset) {
 			const unsigned char *sha1;
-			struct revindex_entry *entry;
+			uint32_t nr;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -631,13 +814,14 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git.reuse_objects)
 				continue;
 
-			entry = &bitmap_git.reverse_index->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+			nr = pack_pos_to_index(bitmap_git.reverse_index, pos + offset);
+			sha1 = nth_packed_object_sha1(bitmap_git.pack, nr);
 
 			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
+				hash = ntohl(bitmap_git.hashes[nr]);
 
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(sha1, object_type, 0, hash, bitmap_git.pack,
+				   pack_pos_to_offset(bitmap_git.reverse_index, pos + offset));
 		}
 
 		pos += BITS_IN_WORD;
@@ -778,10 +962,10 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 #ifdef GIT_BITMAP_DEBUG
 	{
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		uint32_t nr;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		nr = pack_pos_to_index(bitmap_git.reverse_index, reuse_objects);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack, nr);
 
 		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
 			reuse_objects, result->words[i]);
@@ -805,7 +989,7 @@ int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 		return -1;
 
 	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.reverse_index->revindex[reuse_objects].offset;
+	*up_to = pack_pos_to_offset(bitmap_git.reverse_index, reuse_objects);
 	*packfile = bitmap_git.pack;
 
 	return 0;
@@ -835,34 +1019,42 @@ static uint32_t count_object_type(struct bitmap *objects,
 {
 	struct eindex *eindex = &bitmap_git.ext_index;
 
-	uint32_t i = 0, count = 0;
-	struct ewah_iterator it;
-	eword_t filter;
+	uint32_t i, count = 0;
+	struct ewah_block_iterator it;
+	struct ewah_block block;
 
 	switch (type) {
 	case OBJ_COMMIT:
-		ewah_iterator_init(&it, bitmap_git.commits);
+		ewah_block_iterator_init(&it, bitmap_git.commits);
 		break;
 
 	case OBJ_TREE:
-		ewah_iterator_init(&it, bitmap_git.trees);
+		ewah_block_iterator_init(&it, bitmap_git.trees);
 		break;
 
 	case OBJ_BLOB:
-		ewah_iterator_init(&it, bitmap_git.blobs);
+		ewah_block_iterator_init(&it, bitmap_git.blobs);
 		break;
 
 	case OBJ_TAG:
-		ewah_iterator_init(&it, bitmap_git.tags);
+		ewah_block_iterator_init(&it, bitmap_git.tags);
 		break;
 
 	default:
 		return 0;
 	}
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
+	while (ewah_block_next(&block, &it) && block.pos < objects->word_alloc) {
+		const eword_t *words = objects->words + block.pos;
+		size_t len = block.len;
+
+		if (len > objects->word_alloc - block.pos)
+			len = objects->word_alloc - block.pos;
+
+		if (block.literal)
+			count += ewah_words_and_popcount(words, block.literal, len);
+		else if (block.fill)
+			count += ewah_words_popcount(words, len);
 	}
 
 	for (i = 0; i < eindex->count; ++i) {
@@ -892,6 +1084,164 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
 		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
 }
 
+static int graft_found(const struct commit_graft *graft, void *data)
+{
+	return 1;
+}
+
+/*
+ * The bitmaps record the parents written in the commits, so they cannot
+ * answer for a history that is rewritten by grafts, replace refs or a
+ * shallow clone.
+ *
+ * Callers may ask once per ref, so remember the answer instead of
+ * looking for a bitmap file again each time.
+ */
+static int prepare_bitmap_reachability(void)
+{
+	static int prepared, ret;
+
+	if (prepared)
+		return ret;
+	prepared = 1;
+
+	ret = -1;
+	if (is_repository_shallow())
+		return ret;
+	lookup_commit_graft(null_sha1);
+	if (for_each_commit_graft(graft_found, NULL))
+		return ret;
+	lookup_replace_object(null_sha1);
+	if (check_replace_refs)
+		return ret;
+	ret = prepare_bitmap_git();
+	return ret;
+}
+
+/*
+ * Set in `base` everything that is reachable from the commits in `tips`.
+ *
+ * Commits are only parsed down to the first ones with a stored bitmap.
+ * This is not a revision walk, so the object flags of the caller are
+ * left alone, and the same commits can be asked about again.
+ */
+static int add_reachable_commits(struct bitmap *base,
+				 const struct commit_list *tips)
+{
+	struct commit **stack = NULL;
+	int nr = 0, alloc = 0, ret = 0;
+
+	for (; tips; tips = tips->next) {
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = tips->item;
+	}
+
+	while (nr) {
+		struct commit *commit = stack[--nr];
+		struct commit_list *parent;
+		struct ewah_bitmap *bitmap;
+		int pos;
+
+		pos = bitmap_position(commit->object.sha1);
+		if (pos < 0)
+			pos = ext_index_add_object((struct object *)commit, NULL);
+		if (bitmap_get(base, pos))
+			continue;
+
+		bitmap = bitmap_for_commit(&bitmap_git, commit->object.sha1);
+		if (bitmap) {
+			bitmap_or_ewah(base, bitmap);
+			continue;
+		}
+
+		bitmap_set(base, pos);
+		if (parse_commit(commit)) {
+			ret = -1;
+			break;
+		}
+		for (parent = commit->parents; parent; parent = parent->next) {
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr++] = parent->item;
+		}
+	}
+
+	free(stack);
+	return ret;
+}
+
+int bitmap_count_commits(const struct commit_list *left,
+			 const struct commit_list *right,
+			 const struct commit_list *haves,
+			 uint32_t *num_left, uint32_t *num_right)
+{
+	struct bitmap *left_only = bitmap_new();
+	struct bitmap *right_only = bitmap_new();
+	struct bitmap *reach_left = bitmap_new();
+	struct bitmap *reach_haves = bitmap_new();
+	int ret = -1;
+
+	if (prepare_bitmap_reachability() < 0 ||
+	    add_reachable_commits(reach_left, left) < 0 ||
+	    add_reachable_commits(right_only, right) < 0 ||
+	    add_reachable_commits(reach_haves, haves) < 0)
+		goto out;
+
+	bitmap_or(left_only, reach_left);
+	bitmap_and_not(left_only, right_only);
+	bitmap_and_not(left_only, reach_haves);
+	bitmap_and_not(right_only, reach_left);
+	bitmap_and_not(right_only, reach_haves);
+
+	*num_left = count_object_type(left_only, OBJ_COMMIT);
+	*num_right = count_object_type(right_only, OBJ_COMMIT);
+	ret = 0;
+
+out:
+	bitmap_free(left_only);
+	bitmap_free(right_only);
+	bitmap_free(reach_left);
+	bitmap_free(reach_haves);
+	return ret;
+}
+
+struct bitmap *bitmap_reachable_from(struct commit *commit)
+{
+	struct commit_list tip;
+	struct bitmap *reach;
+
+	if (prepare_bitmap_reachability() < 0)
+		return NULL;
+
+	tip.item = commit;
+	tip.next = NULL;
+	reach = bitmap_new();
+	if (add_reachable_commits(reach, &tip) < 0) {
+		bitmap_free(reach);
+		return NULL;
+	}
+	return reach;
+}
+
+int bitmap_has_commit(struct bitmap *reach, struct commit *commit)
+{
+	int pos = bitmap_position(commit->object.sha1);
+	return pos >= 0 && bitmap_get(reach, pos);
+}
+
+int bitmap_commit_contains(struct commit *commit,
+			   const struct commit_list *want)
+{
+	struct bitmap *reach = bitmap_reachable_from(commit);
+	int ret = 0;
+
+	if (!reach)
+		return -1;
+	for (; want && !ret; want = want->next)
+		ret = bitmap_has_commit(reach, want->item);
+	bitmap_free(reach);
+	return ret;
+}
+
 struct bitmap_test_data {
 	struct bitmap *base;
 	struct progress *prg;
@@ -930,7 +1280,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -944,12 +1294,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->sha1);
-
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = bitmap_for_commit(&bitmap_git, root->sha1);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			sha1_to_hex(root->sha1), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1029,16 +1376,18 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
+	if (load_all_table_rows(&bitmap_git) < 0)
+		return -1;
+
 	num_objects = bitmap_git.pack->num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git.reverse_index->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+			pack_pos_to_index(bitmap_git.reverse_index, i));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
@@ -11,6 +11,16 @@ struct bitmap_disk_entry {
 	uint8_t flags;
 } __attribute__((packed));
 
+/* A row of the optional commit lookup table */
+struct bitmap_lookup_entry {
+	uint32_t commit_pos;
+	uint32_t offset_hi;
+	uint32_t offset_lo;
+	uint32_t xor_row;
+};
+
+#define BITMAP_LOOKUP_NO_XOR 0xffffffff
+
 struct bitmap_disk_header {
 	char magic[4];
 	uint16_t version;
@@ -26,6 +36,13 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 0x10,
+};
+
+/* How the bitmaps are encoded; this is the version of the file */
+enum bitmap_format {
+	BITMAP_FORMAT_EWAH = 1,
+	BITMAP_FORMAT_ROARING = 2,
 };
 
 enum pack_bitmap_flags {
@@ -47,10 +64,38 @@ void test_bitmap_walk(struct rev_info *revs);
 char *pack_bitmap_filename(struct packed_git *p);
 int prepare_bitmap_walk(struct rev_info *revs);
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
+
+/*
+ * Reachability between commits, answered from the bitmap index. Both
+ * return -1 if the bitmaps cannot answer (there is no bitmap index, or
+ * the history is rewritten by grafts or replace refs), and the caller
+ * then has to walk the history itself.
+ *
+ * bitmap_count_commits() counts the commits reachable from `left` but
+ * not from `right` or `haves`, and those reachable from `right` but not
+ * from `left` or `haves`. Either list may be empty.
+ *
+ * bitmap_commit_contains() returns 1 if any commit in `want` is
+ * reachable from `commit`, and 0 if none is.
+ *
+ * bitmap_reachable_from() returns a bitmap of everything reachable from
+ * `commit` (or NULL instead of -1), which bitmap_has_commit() can then
+ * be asked about many times. The caller frees it with bitmap_free().
+ */
+int bitmap_count_commits(const struct commit_list *left,
+			 const struct commit_list *right,
+			 const struct commit_list *haves,
+			 uint32_t *num_left, uint32_t *num_right);
+int bitmap_commit_contains(struct commit *commit,
+			   const struct commit_list *want);
+struct bitmap *bitmap_reachable_from(struct commit *commit);
+int bitmap_has_commit(struct bitmap *reach, struct commit *commit);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
 void bitmap_writer_show_progress(int show);
 void bitmap_writer_set_checksum(unsigned char *sha1);
+void bitmap_writer_set_format(enum bitmap_format format);
+void bitmap_writer_set_threads(int nr_threads);
 void bitmap_writer_build_type_index(struct pack_idx_entry **index, uint32_t index_nr);
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
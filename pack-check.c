@@ -42,6 +42,24 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/* Does the type and size recorded in a version 3 index match the pack? */
+static int check_index_object_info(struct packed_git *p,
+				   struct pack_window **w_curs,
+				   struct idx_entry *entry,
+				   enum object_type type, unsigned long size)
+{
+	unsigned long idx_size, in_pack_size;
+	int idx_type, idx_is_delta, in_pack_type;
+	off_t curpos = entry->offset;
+
+	idx_type = nth_packed_object_info(p, entry->nr, &idx_size, &idx_is_delta);
+	in_pack_type = unpack_object_header(p, w_curs, &curpos, &in_pack_size);
+	unuse_pack(w_curs);
+	return idx_type != type || idx_size != size ||
+		idx_is_delta != (in_pack_type == OBJ_OFS_DELTA ||
+				 in_pack_type == OBJ_REF_DELTA);
+}
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
@@ -124,6 +142,10 @@ static int verify_packfile(struct packed_git *p,
 		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
 			err = error("packed %s from %s is corrupt",
 				    sha1_to_hex(entries[i].sha1), p->pack_name);
+		else if (p->index_version >= 3 &&
+			 check_index_object_info(p, w_curs, &entries[i], type, size))
+			err = error("index has wrong type or size for %s from %s",
+				    sha1_to_hex(entries[i].sha1), p->pack_name);
 		else if (fn) {
 			int eaten = 0;
 			fn(entries[i].sha1, type, size, data, &eaten);
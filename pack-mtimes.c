@@ -0,0 +1,64 @@
+#include "cache.h"
+#include "pack-mtimes.h"
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	const unsigned char *map, *pack_checksum;
+	char *mtimes_name;
+	size_t mtimes_size, len;
+	struct stat st;
+	int fd;
+
+	if (p->mtimes_map)
+		return 0;
+	if (!p->is_cruft)
+		return -1;
+	if (open_pack_index(p))
+		return -1;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		return -1;
+	mtimes_name = xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+	fd = git_open_noatime(mtimes_name);
+	if (fd < 0) {
+		free(mtimes_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(mtimes_name);
+		return -1;
+	}
+	mtimes_size = xsize_t(st.st_size);
+	if (mtimes_size != MTIMES_HEADER_SIZE + (size_t)p->num_objects * 4 + 20 + 20) {
+		close(fd);
+		error("mtimes file %s has wrong size", mtimes_name);
+		free(mtimes_name);
+		return -1;
+	}
+	map = xmmap(NULL, mtimes_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	pack_checksum = (const unsigned char *)p->index_data +
+			p->index_size - 40;
+	if (get_be32(map) != MTIMES_SIGNATURE ||
+	    get_be32(map + 4) != MTIMES_VERSION ||
+	    get_be32(map + 8) != 1 /* SHA-1 */) {
+		error("mtimes file %s has unsupported format", mtimes_name);
+		goto fail;
+	}
+	if (hashcmp(map + mtimes_size - 40, pack_checksum)) {
+		error("mtimes file %s does not match its pack", mtimes_name);
+		goto fail;
+	}
+
+	free(mtimes_name);
+	p->mtimes_map = map;
+	p->mtimes_size = mtimes_size;
+	return 0;
+
+fail:
+	munmap((void *)map, mtimes_size);
+	free(mtimes_name);
+	return -1;
+}
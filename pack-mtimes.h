@@ -0,0 +1,33 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/*
+ * A cruft pack holds unreachable objects; instead of relying on the
+ * mtime of the pack, which is bumped every time the pack is rewritten,
+ * it records the time each object was last written (as a loose object
+ * or into a pack) in a .mtimes file next to its .idx.  See
+ * Documentation/technical/pack-format.txt.
+ */
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+#define MTIMES_HEADER_SIZE 12
+
+/*
+ * Open and mmap the .mtimes file of p, if it has not been yet, and
+ * check that it belongs to this very pack.  Return 0 if the mtimes
+ * can be used.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * Return the mtime of the object at position pos in the .idx of p,
+ * whose mtimes must have been loaded with load_pack_mtimes().
+ */
+static inline uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	return get_be32((const unsigned char *)p->mtimes_map +
+			MTIMES_HEADER_SIZE + (size_t)pos * 4);
+}
+
+#endif
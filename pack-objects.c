@@ -3,6 +3,38 @@
 #include "pack.h"
 #include "pack-objects.h"
 
+static size_t side_table_memory(const kh_oe_size_t *t)
+{
+	if (!t)
+		return 0;
+	return kh_n_buckets(t) * (sizeof(uint32_t) + sizeof(unsigned long)) +
+		__ac_fsize(kh_n_buckets(t)) * sizeof(khint32_t);
+}
+
+/*
+ * Count what the tables below take, and remember the largest amount
+ * for trace output.  Called with pdata->lock held if the delta search
+ * threads may be running.
+ */
+static void account_memory(struct packing_data *pdata)
+{
+	size_t mem = (size_t)pdata->nr_alloc * sizeof(*pdata->objects);
+
+	mem += (size_t)pdata->index_size * sizeof(*pdata->index);
+	if (pdata->in_pack_by_idx)
+		mem += sizeof(*pdata->in_pack_by_idx) << OE_IN_PACK_BITS;
+	if (pdata->in_pack)
+		mem += (size_t)pdata->nr_alloc * sizeof(*pdata->in_pack);
+	if (pdata->cruft_mtime)
+		mem += (size_t)pdata->nr_alloc * sizeof(*pdata->cruft_mtime);
+	mem += side_table_memory(pdata->big_size);
+	mem += side_table_memory(pdata->big_delta_size);
+
+	pdata->memory = mem;
+	if (pdata->peak_memory < mem)
+		pdata->peak_memory = mem;
+}
+
 static uint32_t locate_object_entry_hash(struct packing_data *pdata,
 					 const unsigned char *sha1,
 					 int *found)
@@ -61,6 +93,7 @@ static void rehash_objects(struct packing_data *pdata)
 		pdata->index[ix] = i + 1;
 		entry++;
 	}
+	account_memory(pdata);
 }
 
 struct object_entry *packlist_find(struct packing_data *pdata,
@@ -94,12 +127,23 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 		pdata->nr_alloc = (pdata->nr_alloc  + 1024) * 3 / 2;
 		pdata->objects = xrealloc(pdata->objects,
 					  pdata->nr_alloc * sizeof(*new_entry));
+		if (!pdata->in_pack_by_idx)
+			pdata->in_pack = xrealloc(pdata->in_pack,
+						  pdata->nr_alloc * sizeof(*pdata->in_pack));
+		if (pdata->cruft_mtime)
+			pdata->cruft_mtime = xrealloc(pdata->cruft_mtime,
+						      pdata->nr_alloc * sizeof(*pdata->cruft_mtime));
+		account_memory(pdata);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
 
 	memset(new_entry, 0, sizeof(*new_entry));
 	hashcpy(new_entry->idx.sha1, sha1);
+	if (!pdata->in_pack_by_idx)
+		pdata->in_pack[pdata->nr_objects - 1] = NULL;
+	if (pdata->cruft_mtime)
+		pdata->cruft_mtime[pdata->nr_objects - 1] = 0;
 
 	if (pdata->index_size * 3 <= pdata->nr_objects * 4)
 		rehash_objects(pdata);
@@ -108,3 +152,122 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 	return new_entry;
 }
+
+/*
+ * The GIT_TEST_* variables make the rare cases common enough for the
+ * test suite to see them.
+ */
+static unsigned long oe_limit_from_env(const char *name, unsigned long max)
+{
+	const char *v = getenv(name);
+	unsigned long limit;
+
+	if (!v)
+		return max;
+	limit = strtoul(v, NULL, 10);
+	return limit < max ? limit : max;
+}
+
+void prepare_packing_data(struct packing_data *pdata)
+{
+	struct packed_git *p;
+	unsigned int nr = 1; /* 0 is for objects not in a pack */
+
+	pdata->oe_size_limit = oe_limit_from_env("GIT_TEST_OE_SIZE",
+						 OE_SIZE_BIG);
+	pdata->oe_delta_size_limit = oe_limit_from_env("GIT_TEST_OE_DELTA_SIZE",
+						       OE_DELTA_SIZE_BIG);
+
+	for (p = packed_git; p; p = p->next)
+		nr++;
+	if (nr <= (1 << OE_IN_PACK_BITS) &&
+	    !getenv("GIT_TEST_FULL_IN_PACK_ARRAY")) {
+		pdata->in_pack_by_idx = xcalloc(1 << OE_IN_PACK_BITS,
+						sizeof(*pdata->in_pack_by_idx));
+		for (nr = 1, p = packed_git; p; p = p->next, nr++) {
+			p->pack_idx = nr;
+			pdata->in_pack_by_idx[nr] = p;
+		}
+	}
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&pdata->lock, NULL);
+#endif
+	account_memory(pdata);
+}
+
+/* Switch from in_pack_by_idx to a pointer for every object */
+static void map_in_pack(struct packing_data *pdata)
+{
+	uint32_t i;
+
+	pdata->in_pack = xcalloc(pdata->nr_alloc, sizeof(*pdata->in_pack));
+	for (i = 0; i < pdata->nr_objects; i++)
+		pdata->in_pack[i] = oe_in_pack(pdata, &pdata->objects[i]);
+	free(pdata->in_pack_by_idx);
+	pdata->in_pack_by_idx = NULL;
+	account_memory(pdata);
+}
+
+void oe_set_in_pack(struct packing_data *pdata, struct object_entry *e,
+		    struct packed_git *p)
+{
+	if (pdata->in_pack_by_idx) {
+		if (!p) {
+			e->in_pack_idx = 0;
+			return;
+		}
+		if (p->pack_idx < (1 << OE_IN_PACK_BITS) &&
+		    pdata->in_pack_by_idx[p->pack_idx] == p) {
+			e->in_pack_idx = p->pack_idx;
+			return;
+		}
+		map_in_pack(pdata);
+	}
+	pdata->in_pack[e - pdata->objects] = p;
+}
+
+#ifndef NO_PTHREADS
+#define packing_data_lock(pdata) pthread_mutex_lock(&(pdata)->lock)
+#define packing_data_unlock(pdata) pthread_mutex_unlock(&(pdata)->lock)
+#else
+#define packing_data_lock(pdata) (void)0
+#define packing_data_unlock(pdata) (void)0
+#endif
+
+unsigned long oe_get_big_size(struct packing_data *pdata,
+			      const struct object_entry *e, int delta)
+{
+	kh_oe_size_t *t;
+	khiter_t pos;
+	unsigned long size;
+
+	packing_data_lock(pdata);
+	t = delta ? pdata->big_delta_size : pdata->big_size;
+	if (!t || (pos = kh_get_oe_size(t, e - pdata->objects)) == kh_end(t))
+		die("BUG: no size recorded for %s", sha1_to_hex(e->idx.sha1));
+	size = kh_value(t, pos);
+	packing_data_unlock(pdata);
+	return size;
+}
+
+void oe_set_big_size(struct packing_data *pdata, struct object_entry *e,
+		     int delta, unsigned long size)
+{
+	kh_oe_size_t **t;
+	khiter_t pos;
+	int ret;
+
+	packing_data_lock(pdata);
+	t = delta ? &pdata->big_delta_size : &pdata->big_size;
+	if (!*t)
+		*t = kh_init_oe_size();
+	pos = kh_put_oe_size(*t, e - pdata->objects, &ret);
+	kh_value(*t, pos) = size;
+	account_memory(pdata);
+	packing_data_unlock(pdata);
+
+	if (delta)
+		e->delta_size_ = OE_DELTA_SIZE_BIG;
+	else
+		e->size_ = OE_SIZE_BIG;
+}
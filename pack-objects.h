@@ -1,24 +1,50 @@
 #ifndef PACK_OBJECTS_H
 #define PACK_OBJECTS_H
 
+#include "khash.h"
+#include "thread-utils.h"
+
+#define OE_IN_PACK_BITS 12
+#define OE_Z_DELTA_BITS 16
+#define OE_DELTA_SIZE_BITS 16
+
+/*
+ * Sizes that do not fit their field are kept in a side table of
+ * packing_data; the field then holds the all-ones value below.
+ */
+#define OE_SIZE_BIG ((uint32_t)-1)
+#define OE_DELTA_SIZE_BIG ((1U << OE_DELTA_SIZE_BITS) - 1)
+
+/*
+ * There can be millions of these, so keep them small: the delta
+ * links are positions in packing_data.objects (plus one, so that 0
+ * means none), the pack an object is in is a small number mapped by
+ * packing_data.in_pack_by_idx, and the rest is packed into bitfields.
+ * Use the accessors below rather than the fields ending in '_'.
+ *
+ * The delta search threads write the delta fields of the objects
+ * they work on; nothing else in an entry may be written while they
+ * run, as it could share a word with those fields.
+ */
 struct object_entry {
 	struct pack_idx_entry idx;
-	unsigned long size;	/* uncompressed size */
-	struct packed_git *in_pack;	/* already in pack */
-	off_t in_pack_offset;
-	struct object_entry *delta;	/* delta base object */
-	struct object_entry *delta_child; /* deltified objects who bases me */
-	struct object_entry *delta_sibling; /* other deltified objects who
-					     * uses the same base as me
-					     */
 	void *delta_data;	/* cached delta (uncompressed) */
-	unsigned long delta_size;	/* delta data size (uncompressed) */
-	unsigned long z_delta_size;	/* delta data size (compressed) */
-	enum object_type type;
-	enum object_type in_pack_type;	/* could be delta */
+	off_t in_pack_offset;
+	uint32_t delta_idx;	/* delta base object */
+	uint32_t delta_child_idx; /* deltified objects who bases me */
+	uint32_t delta_sibling_idx; /* other deltified objects who
+				     * uses the same base as me
+				     */
 	uint32_t hash;			/* name hint hash */
 	unsigned int in_pack_pos;
-	unsigned char in_pack_header_size;
+	uint32_t size_;	/* uncompressed size */
+	unsigned z_delta_size:OE_Z_DELTA_BITS; /* delta data size (compressed) */
+	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
+	unsigned type_:3;
+	unsigned type_bad:1;	/* type_ is meaningless */
+	unsigned in_pack_type:3;	/* could be delta */
+	unsigned in_pack_idx:OE_IN_PACK_BITS;	/* already in pack */
+	unsigned in_pack_header_size:8;
 	unsigned preferred_base:1; /*
 				    * we do not pack this, but is available
 				    * to be used as the base object to delta
@@ -27,16 +53,50 @@ struct object_entry {
 	unsigned no_try_delta:1;
 	unsigned tagged:1; /* near the very tip of refs */
 	unsigned filled:1; /* assigned write-order */
+	unsigned written_as_delta:1;
 };
 
+#define oe_pos_hash(pos) ((khint_t)(pos) * 2654435761U)
+#define oe_pos_equal(a, b) ((a) == (b))
+KHASH_INIT(oe_size, uint32_t, unsigned long, 1, oe_pos_hash, oe_pos_equal)
+
 struct packing_data {
 	struct object_entry *objects;
 	uint32_t nr_objects, nr_alloc;
 
 	int32_t *index;
 	uint32_t index_size;
+
+	/*
+	 * Packs by in_pack_idx.  If there are too many packs for that
+	 * field (or a pack shows up after prepare_packing_data()),
+	 * in_pack_by_idx is dropped and in_pack holds the pack of
+	 * every object instead.
+	 */
+	struct packed_git **in_pack_by_idx;
+	struct packed_git **in_pack;
+
+	/* sizes from these on go to the side tables */
+	unsigned long oe_size_limit, oe_delta_size_limit;
+	kh_oe_size_t *big_size;
+	kh_oe_size_t *big_delta_size;
+
+	/*
+	 * The mtime of every object, for the .mtimes file of a cruft
+	 * pack.  Whoever wants them allocates it before adding any
+	 * object; packlist_alloc() then grows it along with objects.
+	 */
+	uint32_t *cruft_mtime;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_t lock;	/* for the side tables */
+#endif
+
+	size_t memory, peak_memory;	/* used for the above */
 };
 
+void prepare_packing_data(struct packing_data *pdata);
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const unsigned char *sha1,
 				    uint32_t index_pos);
@@ -45,6 +105,141 @@ struct object_entry *packlist_find(struct packing_data *pdata,
 				   const unsigned char *sha1,
 				   uint32_t *index_pos);
 
+/* Positions in packing_data.objects, plus one so that 0 means none */
+static inline uint32_t oe_pos(const struct packing_data *pack,
+			      const struct object_entry *e)
+{
+	return e ? e - pack->objects + 1 : 0;
+}
+
+static inline struct object_entry *oe_at(const struct packing_data *pack,
+					 uint32_t pos)
+{
+	return pos ? &pack->objects[pos - 1] : NULL;
+}
+
+static inline enum object_type oe_type(const struct object_entry *e)
+{
+	return e->type_bad ? OBJ_BAD : e->type_;
+}
+
+static inline void oe_set_type(struct object_entry *e, enum object_type type)
+{
+	if (type >= OBJ_ANY)
+		die("BUG: cannot store object type %d", type);
+	e->type_bad = type < 0;
+	e->type_ = type < 0 ? 0 : type;
+}
+
+static inline struct packed_git *oe_in_pack(const struct packing_data *pack,
+					    const struct object_entry *e)
+{
+	if (pack->in_pack_by_idx)
+		return pack->in_pack_by_idx[e->in_pack_idx];
+	return pack->in_pack[e - pack->objects];
+}
+
+void oe_set_in_pack(struct packing_data *pack, struct object_entry *e,
+		    struct packed_git *p);
+
+static inline uint32_t oe_cruft_mtime(const struct packing_data *pack,
+				      const struct object_entry *e)
+{
+	return pack->cruft_mtime[e - pack->objects];
+}
+
+static inline void oe_set_cruft_mtime(struct packing_data *pack,
+				      struct object_entry *e, uint32_t mtime)
+{
+	pack->cruft_mtime[e - pack->objects] = mtime;
+}
+
+static inline struct object_entry *oe_delta(const struct packing_data *pack,
+					    const struct object_entry *e)
+{
+	return oe_at(pack, e->delta_idx);
+}
+
+static inline void oe_set_delta(const struct packing_data *pack,
+				struct object_entry *e,
+				struct object_entry *delta)
+{
+	e->delta_idx = oe_pos(pack, delta);
+}
+
+static inline struct object_entry *oe_delta_child(const struct packing_data *pack,
+						  const struct object_entry *e)
+{
+	return oe_at(pack, e->delta_child_idx);
+}
+
+static inline void oe_set_delta_child(const struct packing_data *pack,
+				      struct object_entry *e,
+				      struct object_entry *delta)
+{
+	e->delta_child_idx = oe_pos(pack, delta);
+}
+
+static inline struct object_entry *oe_delta_sibling(const struct packing_data *pack,
+						    const struct object_entry *e)
+{
+	return oe_at(pack, e->delta_sibling_idx);
+}
+
+static inline void oe_set_delta_sibling(const struct packing_data *pack,
+					struct object_entry *e,
+					struct object_entry *delta)
+{
+	e->delta_sibling_idx = oe_pos(pack, delta);
+}
+
+unsigned long oe_get_big_size(struct packing_data *pack,
+			      const struct object_entry *e, int delta);
+void oe_set_big_size(struct packing_data *pack, struct object_entry *e,
+		     int delta, unsigned long size);
+
+static inline unsigned long oe_size(struct packing_data *pack,
+				    const struct object_entry *e)
+{
+	if (e->size_ != OE_SIZE_BIG)
+		return e->size_;
+	return oe_get_big_size(pack, e, 0);
+}
+
+static inline void oe_set_size(struct packing_data *pack,
+			       struct object_entry *e,
+			       unsigned long size)
+{
+	if (size < pack->oe_size_limit)
+		e->size_ = size;
+	else
+		oe_set_big_size(pack, e, 0, size);
+}
+
+static inline unsigned long oe_delta_size(struct packing_data *pack,
+					  const struct object_entry *e)
+{
+	if (e->delta_size_ != OE_DELTA_SIZE_BIG)
+		return e->delta_size_;
+	return oe_get_big_size(pack, e, 1);
+}
+
+static inline void oe_set_delta_size(struct packing_data *pack,
+				     struct object_entry *e,
+				     unsigned long size)
+{
+	if (size < pack->oe_delta_size_limit)
+		e->delta_size_ = size;
+	else
+		oe_set_big_size(pack, e, 1, size);
+}
+
+/* A compressed delta too large for z_delta_size is not cached */
+static inline int oe_z_delta_size_fits(unsigned long size)
+{
+	return size < (1UL << OE_Z_DELTA_BITS);
+}
+
 static inline uint32_t pack_name_hash(const char *name)
 {
 	uint32_t c, hash = 0;
@@ -14,6 +14,9 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * When index-pack or pack-objects wrote a .rev file for the pack, the
+ * same order is read from there instead, without building anything.
  */
 
 static struct pack_revindex *pack_revindex;
@@ -196,6 +199,68 @@ static void create_pack_revindex(struct pack_revindex *rix)
 	sort_revindex(rix->revindex, num_ent, p->pack_size);
 }
 
+/*
+ * Open and mmap the .rev file written next to the pack index, if
+ * there is one, and check that it belongs to this very pack.  Return
+ * 0 if the reverse index can be used from the file.
+ */
+static int load_pack_revindex(struct pack_revindex *rix)
+{
+	struct packed_git *p = rix->p;
+	const unsigned char *map, *pack_checksum;
+	char *rev_name;
+	size_t rev_size, len;
+	struct stat st;
+	int fd;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		return -1;
+	rev_name = xstrfmt("%.*s.rev", (int)len, p->pack_name);
+	fd = git_open_noatime(rev_name);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+	rev_size = xsize_t(st.st_size);
+	if (rev_size != RIDX_HEADER_SIZE + (size_t)p->num_objects * 4 + 20 + 20) {
+		close(fd);
+		error("reverse index file %s has wrong size", rev_name);
+		free(rev_name);
+		return -1;
+	}
+	map = xmmap(NULL, rev_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	pack_checksum = (const unsigned char *)p->index_data +
+			p->index_size - 40;
+	if (get_be32(map) != RIDX_SIGNATURE ||
+	    get_be32(map + 4) != RIDX_VERSION ||
+	    get_be32(map + 8) != 1 /* SHA-1 */) {
+		error("reverse index file %s has unsupported format", rev_name);
+		goto fail;
+	}
+	if (hashcmp(map + rev_size - 40, pack_checksum)) {
+		error("reverse index file %s does not match its pack", rev_name);
+		goto fail;
+	}
+
+	free(rev_name);
+	rix->revindex_map = map;
+	rix->revindex_size = rev_size;
+	rix->revindex_data = (const uint32_t *)(map + RIDX_HEADER_SIZE);
+	return 0;
+
+fail:
+	munmap((void *)map, rev_size);
+	free(rev_name);
+	return -1;
+}
+
 struct pack_revindex *revindex_for_pack(struct packed_git *p)
 {
 	int num;
@@ -209,8 +274,12 @@ struct pack_revindex *revindex_for_pack(struct packed_git *p)
 		die("internal error: pack revindex fubar");
 
 	rix = &pack_revindex[num];
-	if (!rix->revindex)
-		create_pack_revindex(rix);
+	if (!rix->revindex && !rix->revindex_data) {
+		if (open_pack_index(p))
+			die("unable to open index for pack %s", p->pack_name);
+		if (load_pack_revindex(rix))
+			create_pack_revindex(rix);
+	}
 
 	return rix;
 }
@@ -219,13 +288,14 @@ int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
 {
 	int lo = 0;
 	int hi = pridx->p->num_objects + 1;
-	struct revindex_entry *revindex = pridx->revindex;
 
 	do {
 		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
+		off_t mi_ofs = pack_pos_to_offset(pridx, mi);
+
+		if (mi_ofs == ofs) {
 			return mi;
-		} else if (ofs < revindex[mi].offset)
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -235,13 +305,9 @@ int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+int find_pack_revindex(struct packed_git *p, off_t ofs,
+		       struct pack_revindex **pridx)
 {
-	struct pack_revindex *pridx = revindex_for_pack(p);
-	int pos = find_revindex_position(pridx, ofs);
-
-	if (pos < 0)
-		return NULL;
-
-	return pridx->revindex + pos;
+	*pridx = revindex_for_pack(p);
+	return find_revindex_position(*pridx, ofs);
 }
@@ -6,14 +6,60 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
+/*
+ * A reverse index is either built in memory (revindex) or, when the
+ * pack has a .rev file next to its .idx, used straight from the
+ * mmapped file (revindex_data), which lists the index position of
+ * each object in pack order.
+ */
 struct pack_revindex {
 	struct packed_git *p;
 	struct revindex_entry *revindex;
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
 };
 
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
 struct pack_revindex *revindex_for_pack(struct packed_git *p);
 int find_revindex_position(struct pack_revindex *pridx, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Return the position in the pack index of the object that is the
+ * pos-th one in pack order.
+ */
+static inline uint32_t pack_pos_to_index(struct pack_revindex *pridx,
+					 uint32_t pos)
+{
+	if (pridx->revindex)
+		return pridx->revindex[pos].nr;
+	return get_be32(pridx->revindex_data + pos);
+}
+
+/*
+ * Return the offset of the pos-th object in pack order.  Passing the
+ * number of objects in the pack gives the offset just past the last
+ * object, i.e. where the pack trailer starts.
+ */
+static inline off_t pack_pos_to_offset(struct pack_revindex *pridx,
+				       uint32_t pos)
+{
+	if (pridx->revindex)
+		return pridx->revindex[pos].offset;
+	if (pos == pridx->p->num_objects)
+		return pridx->p->pack_size - 20;
+	return nth_packed_object_offset(pridx->p,
+					get_be32(pridx->revindex_data + pos));
+}
+
+/*
+ * Find the object at offset ofs in p, returning its position in pack
+ * order, or -1 if there is no object starting there.
+ */
+int find_pack_revindex(struct packed_git *p, off_t ofs,
+		       struct pack_revindex **pridx);
 
 #endif
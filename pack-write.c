@@ -1,6 +1,8 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
+#include "pack-mtimes.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -37,6 +39,58 @@ static int need_large_offset(off_t offset, const struct pack_idx_option *opts)
 			 sizeof(ofsval), cmp_uint32);
 }
 
+/*
+ * The columns that version 3 adds after the v2 tables: a type byte
+ * per object (padded to a multiple of 4 bytes), the 4-byte sizes with
+ * large ones encoded as an index into the table of 8-byte sizes that
+ * follows, and the number of entries in that table.
+ */
+static void write_idx_object_info(struct sha1file *f,
+				  struct pack_idx_entry **list, int nr_objects,
+				  const struct pack_idx_option *opts)
+{
+	unsigned char *types = xcalloc(1, nr_objects + 3);
+	unsigned long *sizes = xmalloc(nr_objects * sizeof(*sizes));
+	uint32_t nr_large_size = 0, val;
+	int i;
+
+	for (i = 0; i < nr_objects; i++) {
+		enum object_type type;
+		int is_delta;
+
+		opts->object_info(list[i], &type, &sizes[i], &is_delta);
+		if (type < OBJ_COMMIT || type > OBJ_TAG)
+			die("BUG: bad type %d for %s in index", type,
+			    sha1_to_hex(list[i]->sha1));
+		types[i] = type | (is_delta ? PACK_IDX_TYPE_DELTA : 0);
+	}
+	sha1write(f, types, (nr_objects + 3) & ~3);
+
+	for (i = 0; i < nr_objects; i++) {
+		if (sizes[i] & ~0x7fffffffUL)
+			val = 0x80000000 | nr_large_size++;
+		else
+			val = sizes[i];
+		val = htonl(val);
+		sha1write(f, &val, 4);
+	}
+	for (i = 0; i < nr_objects; i++) {
+		uint64_t size = sizes[i];
+		uint32_t split[2];
+
+		if (!(sizes[i] & ~0x7fffffffUL))
+			continue;
+		split[0] = htonl(size >> 32);
+		split[1] = htonl(size & 0xffffffff);
+		sha1write(f, split, 8);
+	}
+	val = htonl(nr_large_size);
+	sha1write(f, &val, 4);
+
+	free(types);
+	free(sizes);
+}
+
 /*
  * On entry *sha1 contains the pack content SHA1 hash, on exit it is
  * the SHA1 hash of sorted object names. The objects array passed in
@@ -84,8 +138,12 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 		f = sha1fd(fd, index_name);
 	}
 
-	/* if last object's offset is >= 2^31 we should use index V2 */
-	index_version = need_large_offset(last_obj_offset, opts) ? 2 : opts->version;
+	/* if last object's offset is >= 2^31 we should use index V2 or later */
+	index_version = opts->version;
+	if (index_version < 2 && need_large_offset(last_obj_offset, opts))
+		index_version = 2;
+	if (index_version >= 3 && !opts->object_info)
+		die("BUG: index version %"PRIu32" needs object info", index_version);
 
 	/* index versions 2 and above need a header */
 	if (index_version >= 2) {
@@ -170,12 +228,116 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 		}
 	}
 
+	if (index_version >= 3)
+		write_idx_object_info(f, sorted_by_sha, nr_objects, opts);
+
 	sha1write(f, sha1, 20);
 	sha1close(f, NULL, ((opts->flags & WRITE_IDX_VERIFY)
 			    ? CSUM_CLOSE : CSUM_FSYNC));
 	return index_name;
 }
 
+static int pack_order_cmp(const void *a_, const void *b_)
+{
+	const struct revindex_entry *a = a_, *b = b_;
+
+	if (a->offset < b->offset)
+		return -1;
+	return a->offset > b->offset;
+}
+
+/*
+ * Write the reverse index of a pack: the position in the .idx of each
+ * object, listed in pack order.  The objects array must be sorted by
+ * SHA1 the way write_idx_file() leaves it, and sha1 is the pack
+ * content SHA1 hash, which the reader uses to tell that the file goes
+ * with the pack.
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, const unsigned char *sha1)
+{
+	struct sha1file *f;
+	struct revindex_entry *pack_order;
+	uint32_t i, hdr[3];
+	int fd;
+
+	if (!rev_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmp_file);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	hdr[0] = htonl(RIDX_SIGNATURE);
+	hdr[1] = htonl(RIDX_VERSION);
+	hdr[2] = htonl(1); /* SHA-1 */
+	sha1write(f, hdr, sizeof(hdr));
+
+	pack_order = xmalloc(sizeof(*pack_order) * (nr_objects ? nr_objects : 1));
+	for (i = 0; i < nr_objects; i++) {
+		pack_order[i].offset = objects[i]->offset;
+		pack_order[i].nr = i;
+	}
+	qsort(pack_order, nr_objects, sizeof(*pack_order), pack_order_cmp);
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t nr = htonl(pack_order[i].nr);
+		sha1write(f, &nr, sizeof(nr));
+	}
+	free(pack_order);
+
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	return rev_name;
+}
+
+/*
+ * Write the .mtimes file of a cruft pack: the modification time of
+ * each object, in the .idx order write_idx_file() leaves the objects
+ * array in, followed by the pack checksum sha1.
+ */
+const char *write_mtimes_file(const char *mtimes_name,
+			      struct pack_idx_entry **objects,
+			      uint32_t nr_objects,
+			      const struct pack_idx_option *opts,
+			      const unsigned char *sha1)
+{
+	struct sha1file *f;
+	uint32_t i, hdr[3];
+	int fd;
+
+	if (!mtimes_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_mtimes_XXXXXX");
+		mtimes_name = xstrdup(tmp_file);
+	} else {
+		unlink(mtimes_name);
+		fd = open(mtimes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", mtimes_name);
+	f = sha1fd(fd, mtimes_name);
+
+	hdr[0] = htonl(MTIMES_SIGNATURE);
+	hdr[1] = htonl(MTIMES_VERSION);
+	hdr[2] = htonl(1); /* SHA-1 */
+	sha1write(f, hdr, sizeof(hdr));
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t mtime = htonl(opts->object_mtime(objects[i]));
+		sha1write(f, &mtime, sizeof(mtime));
+	}
+
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	return mtimes_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -343,7 +505,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL, *mtimes_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -354,6 +516,21 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse index file readable");
+	}
+
+	if (pack_idx_opts->flags & WRITE_MTIMES) {
+		mtimes_tmp_name = write_mtimes_file(NULL, written_list,
+						    nr_written, pack_idx_opts,
+						    sha1);
+		if (adjust_shared_perm(mtimes_tmp_name))
+			die_errno("unable to make temporary mtimes file readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 	free_pack_by_name(name_buffer->buf);
 
@@ -362,6 +539,22 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse index file");
+		strbuf_setlen(name_buffer, basename_len);
+		free((void *)rev_tmp_name);
+	}
+
+	if (mtimes_tmp_name) {
+		strbuf_addf(name_buffer, "%s.mtimes", sha1_to_hex(sha1));
+		if (rename(mtimes_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary mtimes file");
+		strbuf_setlen(name_buffer, basename_len);
+		free((void *)mtimes_tmp_name);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
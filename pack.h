@@ -35,11 +35,22 @@ struct pack_header {
  */
 #define PACK_IDX_SIGNATURE 0xff744f63	/* "\377tOc" */
 
+/*
+ * An entry of the type column of a version 3 index: the object type
+ * in the low bits, and this bit if it is stored as a delta.
+ */
+#define PACK_IDX_TYPE_DELTA 0x80
+#define PACK_IDX_TYPE_MASK 0x07
+
+struct pack_idx_entry;
+
 struct pack_idx_option {
 	unsigned flags;
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a .rev reverse index */
+#define WRITE_MTIMES 010 /* also write a .mtimes file (cruft packs) */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -51,6 +62,19 @@ struct pack_idx_option {
 	 */
 	int anomaly_alloc, anomaly_nr;
 	uint32_t *anomaly;
+
+	/*
+	 * Version 3 records the type and size of each object; the
+	 * writer asks for them with this callback.
+	 */
+	void (*object_info)(struct pack_idx_entry *, enum object_type *type,
+			    unsigned long *size, int *is_delta);
+
+	/*
+	 * With WRITE_MTIMES, the modification time recorded for each
+	 * object of a cruft pack.
+	 */
+	uint32_t (*object_mtime)(struct pack_idx_entry *);
 };
 
 extern void reset_pack_idx_option(struct pack_idx_option *);
@@ -77,6 +101,8 @@ struct progress;
 typedef int (*verify_fn)(const unsigned char*, enum object_type, unsigned long, void*, int*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *sha1);
+extern const char *write_mtimes_file(const char *mtimes_name, struct pack_idx_entry **objects, uint32_t nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
 extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
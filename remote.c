@@ -8,6 +8,8 @@
 #include "tag.h"
 #include "string-list.h"
 #include "mergesort.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 enum map_direction { FROM_SRC, FROM_DST };
 
@@ -1838,6 +1840,23 @@ int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1)
 	return found;
 }
 
+static int stat_tracking_from_bitmaps(struct commit *ours, struct commit *theirs,
+				      int *num_ours, int *num_theirs)
+{
+	struct commit_list ours_list, theirs_list;
+	uint32_t left, right;
+
+	ours_list.item = ours;
+	ours_list.next = NULL;
+	theirs_list.item = theirs;
+	theirs_list.next = NULL;
+	if (bitmap_count_commits(&ours_list, &theirs_list, NULL, &left, &right))
+		return -1;
+	*num_ours = left;
+	*num_theirs = right;
+	return 0;
+}
+
 /*
  * Compare a branch with its upstream, and save their differences (number
  * of commits) in *num_ours and *num_theirs.
@@ -1879,6 +1898,9 @@ int stat_tracking_info(struct branch *branch, int *num_ours, int *num_theirs)
 		return 1;
 	}
 
+	if (!stat_tracking_from_bitmaps(ours, theirs, num_ours, num_theirs))
+		return 1;
+
 	/* Run "rev-list --left-right ours...theirs" internally... */
 	rev_argc = 0;
 	rev_argv[rev_argc++] = NULL;
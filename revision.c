@@ -16,7 +16,11 @@
 #include "line-log.h"
 #include "mailmap.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
+#include "prio-queue.h"
 #include "dir.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -803,7 +807,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 			if (p->object.flags & SEEN)
 				continue;
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (list)
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		return 0;
 	}
@@ -830,7 +835,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 		p->object.flags |= left_flag;
 		if (!(p->object.flags & SEEN)) {
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (list)
+				commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -2230,9 +2236,6 @@ int setup_revisions(int argc, const char **argv, struct rev_info *revs, struct s
 	    DIFF_OPT_TST(&revs->diffopt, FOLLOW_RENAMES))
 		revs->diff = 1;
 
-	if (revs->topo_order)
-		revs->limited = 1;
-
 	if (revs->prune_data.nr) {
 		copy_pathspec(&revs->pruning.pathspec, &revs->prune_data);
 		/* Can't prune commits with rename following: the paths change.. */
@@ -2654,6 +2657,229 @@ void reset_revision_walk(void)
 	clear_object_flags(SEEN | ADDED | SHOWN);
 }
 
+/*
+ * Incremental topological walk
+ *
+ * With generation numbers at hand, --topo-order does not need to walk
+ * the whole history before showing the first commit.  A commit whose
+ * generation number is g cannot be the parent of a commit whose
+ * generation number is at most g, so it can be shown as soon as the
+ * children of all commits down to generation g have been counted.
+ */
+
+/* 0 if never seen, otherwise 1 + the number of children not yet shown */
+define_commit_slab(indegree_slab, int);
+
+struct topo_walk_info {
+	uint32_t min_generation;
+	struct prio_queue indegree_queue;
+	struct prio_queue topo_queue;
+	struct indegree_slab indegree;
+};
+
+static int can_walk_topo_incrementally(struct rev_info *revs)
+{
+	/*
+	 * Anything that drops or rewrites parents while walking would
+	 * make the counted children disagree with the shown ones.  With
+	 * --first-parent, sort_in_topological_order() still orders by
+	 * all the edges between the commits shown, which we cannot know
+	 * without walking the side branches, too.
+	 */
+	if (revs->prune || revs->max_age != -1 || revs->reflog_info ||
+	    revs->first_parent_only ||
+	    revs->simplify_merges || revs->children.name ||
+	    revs->include_check || revs->line_level_traverse)
+		return 0;
+	if (revs->sort_order != REV_SORT_IN_GRAPH_ORDER &&
+	    revs->sort_order != REV_SORT_BY_COMMIT_DATE)
+		return 0;
+	return generation_numbers_enabled();
+}
+
+static void indegree_walk_step(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c = prio_queue_get(&info->indegree_queue);
+	struct commit_list *p;
+
+	for (p = c->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi = indegree_slab_at(&info->indegree, parent);
+
+		if (*pi)
+			(*pi)++;
+		else if (!parse_commit(parent)) {
+			*pi = 2;
+			prio_queue_put(&info->indegree_queue, parent);
+		}
+	}
+}
+
+static void compute_indegrees_to_depth(struct rev_info *revs,
+				       uint32_t gen_cutoff)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c;
+
+	while ((c = prio_queue_peek(&info->indegree_queue)) &&
+	       c->generation >= gen_cutoff)
+		indegree_walk_step(revs);
+}
+
+static void init_topo_walk(struct rev_info *revs)
+{
+	struct topo_walk_info *info;
+	struct commit_list *list;
+
+	info = revs->topo_walk_info = xcalloc(1, sizeof(*info));
+	init_indegree_slab(&info->indegree);
+	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
+	if (revs->sort_order == REV_SORT_BY_COMMIT_DATE)
+		info->topo_queue.compare = compare_commits_by_commit_date;
+	info->min_generation = GENERATION_NUMBER_INFINITY;
+
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		*(indegree_slab_at(&info->indegree, c)) = 1;
+		prio_queue_put(&info->indegree_queue, c);
+		if (c->generation < info->min_generation)
+			info->min_generation = c->generation;
+	}
+	compute_indegrees_to_depth(revs, info->min_generation);
+
+	/* the tips are the starting points nobody else leads to */
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+			prio_queue_put(&info->topo_queue, c);
+	}
+
+	/* show the tips in the order given, like sort_in_topological_order */
+	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER)
+		prio_queue_reverse(&info->topo_queue);
+
+	free_commit_list(revs->commits);
+	revs->commits = NULL;
+}
+
+static void release_topo_walk(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+
+	if (!info)
+		return;
+	clear_prio_queue(&info->indegree_queue);
+	clear_prio_queue(&info->topo_queue);
+	clear_indegree_slab(&info->indegree);
+	free(info);
+	revs->topo_walk_info = NULL;
+}
+
+static struct commit *next_topo_commit(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c = prio_queue_get(&info->topo_queue);
+
+	if (c)
+		*(indegree_slab_at(&info->indegree, c)) = 0;
+	return c;
+}
+
+static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *p;
+
+	if (add_parents_to_list(revs, commit, NULL, NULL) < 0) {
+		if (!revs->ignore_missing_links)
+			die("Failed to traverse parents of commit %s",
+			    sha1_to_hex(commit->object.sha1));
+	}
+
+	for (p = commit->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi;
+
+		if (parse_commit(parent) < 0)
+			continue;
+		if (parent->generation < info->min_generation) {
+			info->min_generation = parent->generation;
+			compute_indegrees_to_depth(revs, info->min_generation);
+		}
+
+		pi = indegree_slab_at(&info->indegree, parent);
+		if (*pi && --(*pi) == 1)
+			prio_queue_put(&info->topo_queue, parent);
+	}
+}
+
+int count_revisions_from_bitmaps(struct rev_info *revs)
+{
+	struct commit_list *left = NULL, *right = NULL, *haves = NULL;
+	uint32_t num_left, num_right;
+	int i, nr_left = 0, nr_right = 0, ret = -1;
+
+	/* Only plain reachability from the tips can be counted this way */
+	if (revs->prune || revs->no_walk || revs->boundary ||
+	    revs->cherry_pick || revs->cherry_mark ||
+	    revs->left_only || revs->right_only ||
+	    revs->bisect || revs->ancestry_path || revs->first_parent_only ||
+	    revs->simplify_by_decoration || revs->unpacked ||
+	    revs->reflog_info || revs->line_level_traverse || revs->show_all ||
+	    revs->tag_objects || revs->tree_objects || revs->blob_objects ||
+	    revs->include_check || revs->commits ||
+	    revs->grep_filter.pattern_list || revs->grep_filter.header_list ||
+	    revs->max_count >= 0 || revs->skip_count >= 0 ||
+	    revs->max_age != -1 || revs->min_age != -1 ||
+	    revs->min_parents || revs->max_parents >= 0)
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		unsigned flags = obj->flags;
+		struct commit *commit;
+
+		obj = deref_tag(obj, NULL, 0);
+		if (!obj)
+			goto out;
+		if (obj->type != OBJ_COMMIT)
+			continue;
+		commit = (struct commit *)obj;
+
+		if (flags & UNINTERESTING) {
+			commit_list_insert(commit, &haves);
+		} else if (revs->left_right && (flags & SYMMETRIC_LEFT)) {
+			commit_list_insert(commit, &left);
+			nr_left++;
+		} else {
+			commit_list_insert(commit, &right);
+			nr_right++;
+		}
+	}
+
+	/*
+	 * Commits that both sides reach are counted on neither side, which
+	 * is only what the walk does for a single "A...B".
+	 */
+	if (nr_left && (nr_left > 1 || nr_right != 1))
+		goto out;
+
+	if (!bitmap_count_commits(left, right, haves, &num_left, &num_right)) {
+		revs->count_left = num_left;
+		revs->count_right = num_right;
+		ret = 0;
+	}
+
+out:
+	free_commit_list(left);
+	free_commit_list(right);
+	free_commit_list(haves);
+	return ret;
+}
+
 int prepare_revision_walk(struct rev_info *revs)
 {
 	int nr = revs->pending.nr;
@@ -2677,6 +2903,10 @@ int prepare_revision_walk(struct rev_info *revs)
 	if (!revs->leak_pending)
 		free(list);
 
+	if (revs->topo_order && !revs->limited &&
+	    !can_walk_topo_incrementally(revs))
+		revs->limited = 1;
+
 	/* Signal whether we need per-parent treesame decoration */
 	if (revs->simplify_merges ||
 	    (revs->limited && limiting_can_increase_treesame(revs)))
@@ -2689,8 +2919,12 @@ int prepare_revision_walk(struct rev_info *revs)
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
-	if (revs->topo_order)
-		sort_in_topological_order(&revs->commits, revs->sort_order);
+	if (revs->topo_order) {
+		if (revs->limited)
+			sort_in_topological_order(&revs->commits, revs->sort_order);
+		else
+			init_topo_walk(revs);
+	}
 	if (revs->line_level_traverse)
 		line_log_filter(revs);
 	if (revs->simplify_merges)
@@ -2706,7 +2940,7 @@ static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp
 
 	for (;;) {
 		struct commit *p = *pp;
-		if (!revs->limited)
+		if (!revs->limited && !revs->topo_walk_info)
 			if (add_parents_to_list(revs, p, &revs->commits, &cache) < 0)
 				return rewrite_one_error;
 		if (p->object.flags & UNINTERESTING)
@@ -2945,15 +3179,20 @@ static void track_linear(struct rev_info *revs, struct commit *commit)
 
 static struct commit *get_revision_1(struct rev_info *revs)
 {
-	if (!revs->commits)
+	if (!revs->commits && !revs->topo_walk_info)
 		return NULL;
 
 	do {
-		struct commit_list *entry = revs->commits;
-		struct commit *commit = entry->item;
+		struct commit *commit;
 
-		revs->commits = entry->next;
-		free(entry);
+		if (revs->topo_walk_info) {
+			commit = next_topo_commit(revs);
+			if (!commit) {
+				release_topo_walk(revs);
+				continue;
+			}
+		} else
+			commit = pop_commit(&revs->commits);
 
 		if (revs->reflog_info) {
 			save_parents(revs, commit);
@@ -2970,7 +3209,9 @@ static struct commit *get_revision_1(struct rev_info *revs)
 			if (revs->max_age != -1 &&
 			    (commit->date < revs->max_age))
 				continue;
-			if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0) {
+			if (revs->topo_walk_info)
+				expand_topo_walk(revs, commit);
+			else if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0) {
 				if (!revs->ignore_missing_links)
 					die("Failed to traverse parents of commit %s",
 						sha1_to_hex(commit->object.sha1));
@@ -2988,7 +3229,7 @@ static struct commit *get_revision_1(struct rev_info *revs)
 				track_linear(revs, commit);
 			return commit;
 		}
-	} while (revs->commits);
+	} while (revs->commits || revs->topo_walk_info);
 	return NULL;
 }
 
@@ -3028,6 +3269,7 @@ static void create_boundary_commit_list(struct rev_info *revs)
 		free_commit_list(revs->commits);
 		revs->commits = NULL;
 	}
+	release_topo_walk(revs);
 
 	/*
 	 * Put all of the actual boundary commits from revs->boundary_commits
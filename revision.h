@@ -29,6 +29,7 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct topo_walk_info;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -73,6 +74,7 @@ struct rev_info {
 
 	/* topo-sort */
 	enum rev_sort_order sort_order;
+	struct topo_walk_info *topo_walk_info;
 
 	unsigned int	early_output:1,
 			ignore_missing:1,
@@ -244,6 +246,13 @@ extern int handle_revision_arg(const char *arg, struct rev_info *revs,
 
 extern void reset_revision_walk(void);
 extern int prepare_revision_walk(struct rev_info *revs);
+
+/*
+ * Fill in count_left and count_right from the bitmap index instead of
+ * walking, if the options only select commits by their reachability
+ * from the tips. Returns -1 if the walk has to be done after all.
+ */
+extern int count_revisions_from_bitmaps(struct rev_info *revs);
 extern struct commit *get_revision(struct rev_info *revs);
 extern char *get_revision_mark(const struct rev_info *revs,
 			       const struct commit *commit);
@@ -0,0 +1,254 @@
+/*
+ * Multi-buffer SHA-1: hash several independent messages in the lanes
+ * of a vector register.  Each lane works on its own message, one
+ * 64-byte block per step; a lane whose message is done picks up the
+ * next one, so messages of different sizes keep all lanes busy.
+ */
+#include "cache.h"
+#include "sha1-multi.h"
+
+#define SHA1_MULTI_MAX_LANES 8
+
+/*
+ * A long message would keep one lane busy after the others have run
+ * dry; such messages are cheaper to hash on their own.
+ */
+#define SHA1_MULTI_MAX_LEN (64 * 1024)
+
+typedef void (*sha1_multi_compress_fn)(uint32_t (*h)[SHA1_MULTI_MAX_LANES],
+				       const unsigned char **block);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_MULTI_X86
+
+typedef uint32_t sha1_v4 __attribute__((vector_size(16)));
+typedef uint32_t sha1_v8 __attribute__((vector_size(32)));
+
+#define VROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA1_ROUND(f, k) do { \
+	t = VROL(a, 5) + (f) + e + W[i & 15] + (k); \
+	e = d; \
+	d = c; \
+	c = VROL(b, 30); \
+	b = a; \
+	a = t; \
+} while (0)
+
+#define SHA1_MIX() \
+	(W[i & 15] = VROL(W[(i + 13) & 15] ^ W[(i + 8) & 15] ^ \
+			  W[(i + 2) & 15] ^ W[i & 15], 1))
+
+/*
+ * One compression step for every lane.  Defined once per vector width;
+ * "vec" holds one 32-bit word of each of "lanes" messages.
+ */
+#define DEFINE_SHA1_MULTI_COMPRESS(name, vec, lanes, isa) \
+static void __attribute__((target(isa))) \
+name(uint32_t (*h)[SHA1_MULTI_MAX_LANES], const unsigned char **block) \
+{ \
+	vec W[16], a, b, c, d, e, t; \
+	int i, l; \
+\
+	for (l = 0; l < lanes; l++) { \
+		a[l] = h[0][l]; \
+		b[l] = h[1][l]; \
+		c[l] = h[2][l]; \
+		d[l] = h[3][l]; \
+		e[l] = h[4][l]; \
+	} \
+	for (i = 0; i < 16; i++) \
+		for (l = 0; l < lanes; l++) \
+			W[i][l] = get_be32(block[l] + 4 * i); \
+\
+	for (i = 0; i < 16; i++) \
+		SHA1_ROUND(d ^ (b & (c ^ d)), 0x5a827999); \
+	for (; i < 20; i++) { \
+		SHA1_MIX(); \
+		SHA1_ROUND(d ^ (b & (c ^ d)), 0x5a827999); \
+	} \
+	for (; i < 40; i++) { \
+		SHA1_MIX(); \
+		SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1); \
+	} \
+	for (; i < 60; i++) { \
+		SHA1_MIX(); \
+		SHA1_ROUND((b & c) | (d & (b | c)), 0x8f1bbcdc); \
+	} \
+	for (; i < 80; i++) { \
+		SHA1_MIX(); \
+		SHA1_ROUND(b ^ c ^ d, 0xca62c1d6); \
+	} \
+\
+	for (l = 0; l < lanes; l++) { \
+		h[0][l] += a[l]; \
+		h[1][l] += b[l]; \
+		h[2][l] += c[l]; \
+		h[3][l] += d[l]; \
+		h[4][l] += e[l]; \
+	} \
+}
+
+DEFINE_SHA1_MULTI_COMPRESS(sha1_multi_compress_sse2, sha1_v4, 4, "sse2")
+DEFINE_SHA1_MULTI_COMPRESS(sha1_multi_compress_avx2, sha1_v8, 8, "avx2")
+
+#endif
+
+static struct sha1_multi_impl {
+	const char *name;
+	int lanes;
+	sha1_multi_compress_fn compress;
+} impls[] = {
+#ifdef SHA1_MULTI_X86
+	{ "avx2", 8, sha1_multi_compress_avx2 },
+	{ "sse2", 4, sha1_multi_compress_sse2 },
+#endif
+	{ "scalar", 1, NULL },
+};
+
+static struct sha1_multi_impl *impl;
+
+static int impl_supported(const struct sha1_multi_impl *i)
+{
+#ifdef SHA1_MULTI_X86
+	if (!strcmp(i->name, "avx2")) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+	if (!strcmp(i->name, "sse2")) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	return 1;
+}
+
+int sha1_multi_select(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(impls); i++) {
+		if (name && strcmp(name, impls[i].name))
+			continue;
+		if (!impl_supported(&impls[i]))
+			continue;
+		impl = &impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+const char *sha1_multi_name(void)
+{
+	if (!impl)
+		sha1_multi_select(NULL);
+	return impl->name;
+}
+
+/*
+ * Byte "pos" of the padded message: hdr, then buf, then 0x80, zeroes
+ * and the bit length in the last 8 bytes of the last block.
+ */
+static const unsigned char *msg_block(const struct sha1_multi_msg *m,
+				      size_t nr_blocks, size_t blk,
+				      unsigned char *tmp)
+{
+	size_t total = m->hdrlen + m->len;
+	size_t off = blk * 64, end = nr_blocks * 64;
+	uint64_t bits = (uint64_t)total << 3;
+	int j;
+
+	if (off + 64 <= m->hdrlen)
+		return (const unsigned char *)m->hdr + off;
+	if (m->hdrlen <= off && off + 64 <= total)
+		return (const unsigned char *)m->buf + (off - m->hdrlen);
+
+	for (j = 0; j < 64; j++) {
+		size_t pos = off + j;
+		if (pos < m->hdrlen)
+			tmp[j] = ((const unsigned char *)m->hdr)[pos];
+		else if (pos < total)
+			tmp[j] = ((const unsigned char *)m->buf)[pos - m->hdrlen];
+		else if (pos == total)
+			tmp[j] = 0x80;
+		else if (pos >= end - 8)
+			tmp[j] = bits >> (8 * (end - 1 - pos));
+		else
+			tmp[j] = 0;
+	}
+	return tmp;
+}
+
+static void sha1_multi_scalar(struct sha1_multi_msg *msg, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		git_SHA_CTX c;
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, msg[i].hdr, msg[i].hdrlen);
+		git_SHA1_Update(&c, msg[i].buf, msg[i].len);
+		git_SHA1_Final(msg[i].sha1, &c);
+	}
+}
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+void sha1_multi(struct sha1_multi_msg *msg, int nr)
+{
+	uint32_t h[5][SHA1_MULTI_MAX_LANES];
+	unsigned char tmp[SHA1_MULTI_MAX_LANES][64];
+	static const unsigned char idle[64];
+	const unsigned char *block[SHA1_MULTI_MAX_LANES];
+	struct sha1_multi_msg *lane[SHA1_MULTI_MAX_LANES];
+	size_t blk[SHA1_MULTI_MAX_LANES], nr_blocks[SHA1_MULTI_MAX_LANES];
+	int lanes, next = 0, active = 0, l, i;
+
+	if (!impl)
+		sha1_multi_select(NULL);
+	lanes = impl->lanes;
+	if (lanes == 1 || nr < 2) {
+		sha1_multi_scalar(msg, nr);
+		return;
+	}
+
+	for (l = 0; l < lanes; l++)
+		lane[l] = NULL;
+	do {
+		/* give idle lanes the next message */
+		for (l = 0; l < lanes && next < nr; l++) {
+			if (lane[l])
+				continue;
+			if (msg[next].hdrlen + msg[next].len > SHA1_MULTI_MAX_LEN) {
+				sha1_multi_scalar(&msg[next++], 1);
+				l--;
+				continue;
+			}
+			lane[l] = &msg[next++];
+			blk[l] = 0;
+			nr_blocks[l] = (lane[l]->hdrlen + lane[l]->len + 9 + 63) / 64;
+			for (i = 0; i < 5; i++)
+				h[i][l] = sha1_iv[i];
+			active++;
+		}
+		if (!active)
+			break;
+
+		for (l = 0; l < lanes; l++)
+			block[l] = lane[l] ?
+				msg_block(lane[l], nr_blocks[l], blk[l], tmp[l]) :
+				idle;
+		impl->compress(h, block);
+
+		for (l = 0; l < lanes; l++) {
+			if (!lane[l] || ++blk[l] < nr_blocks[l])
+				continue;
+			for (i = 0; i < 5; i++)
+				put_be32(lane[l]->sha1 + 4 * i, h[i][l]);
+			lane[l] = NULL;
+			active--;
+		}
+	} while (active || next < nr);
+}
@@ -0,0 +1,30 @@
+#ifndef SHA1_MULTI_H
+#define SHA1_MULTI_H
+
+/*
+ * Hash many independent messages at once.  Where the CPU allows it
+ * (SSE2 or AVX2 on x86), several messages are hashed in the lanes of
+ * one vector register; otherwise they are hashed one after another.
+ *
+ * Each message is "hdr" followed by "buf", so that an object can be
+ * hashed together with its "<type> <size>\0" header without copying.
+ */
+struct sha1_multi_msg {
+	const void *hdr;
+	size_t hdrlen;
+	const void *buf;
+	size_t len;
+	unsigned char *sha1; /* where the 20-byte digest goes */
+};
+
+extern void sha1_multi(struct sha1_multi_msg *msg, int nr);
+
+/*
+ * Choose the implementation by name ("scalar", "sse2" or "avx2"), or
+ * the best one available when name is NULL.  Returns -1 if the named
+ * one cannot be used here.  Mostly useful for tests and benchmarks.
+ */
+extern int sha1_multi_select(const char *name);
+extern const char *sha1_multi_name(void);
+
+#endif
@@ -22,6 +22,9 @@
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "midx.h"
+#include "sha1-array.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -295,6 +298,7 @@ static int link_alt_odb_entry(const char *entry, const char *relative_base,
 	memcpy(ent->base, pathbuf.buf, pfxlen);
 	strbuf_release(&pathbuf);
 
+	ent->loose_cache = NULL;
 	ent->name = ent->base + pfxlen + 1;
 	ent->base[pfxlen + 3] = '/';
 	ent->base[pfxlen] = ent->base[entlen-1] = 0;
@@ -438,8 +442,128 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+struct loose_object_cache {
+	uint32_t subdir_seen[8]; /* 256 bits */
+	struct sha1_array subdir[256];
+};
+
+static struct loose_object_cache *local_loose_cache;
+
+static void fill_loose_cache(struct sha1_array *array,
+			     const char *objdir, size_t objdir_len,
+			     int subdir_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	char hex[41];
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_add(&path, objdir, objdir_len);
+	strbuf_addf(&path, "%02x", subdir_nr);
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	if (!dir) {
+		if (errno != ENOENT)
+			error("unable to open %s/%02x: %s", objdir, subdir_nr,
+			      strerror(errno));
+		return;
+	}
+
+	sprintf(hex, "%02x", subdir_nr);
+	while ((de = readdir(dir)) != NULL) {
+		unsigned char sha1[20];
+
+		if (strlen(de->d_name) != 38)
+			continue;
+		memcpy(hex + 2, de->d_name, 38);
+		if (!get_sha1_hex(hex, sha1))
+			sha1_array_append(array, sha1);
+	}
+	closedir(dir);
+}
+
+struct sha1_array *odb_loose_cache(struct alternate_object_database *alt,
+				   int subdir_nr)
+{
+	struct loose_object_cache **cachep;
+	struct loose_object_cache *cache;
+	struct sha1_array *array;
+
+	cachep = alt ? &alt->loose_cache : &local_loose_cache;
+	if (!*cachep)
+		*cachep = xcalloc(1, sizeof(**cachep));
+	cache = *cachep;
+	array = &cache->subdir[subdir_nr];
+
+	if (!(cache->subdir_seen[subdir_nr / 32] & (1u << (subdir_nr % 32)))) {
+		if (alt)
+			fill_loose_cache(array, alt->base,
+					 alt->name - alt->base, subdir_nr);
+		else {
+			struct strbuf objdir = STRBUF_INIT;
+			strbuf_addf(&objdir, "%s/", get_object_directory());
+			fill_loose_cache(array, objdir.buf, objdir.len,
+					 subdir_nr);
+			strbuf_release(&objdir);
+		}
+		cache->subdir_seen[subdir_nr / 32] |= 1u << (subdir_nr % 32);
+	}
+	if (!array->sorted)
+		sha1_array_sort(array);
+	return array;
+}
+
+static void free_loose_cache(struct loose_object_cache **cachep)
+{
+	int i;
+
+	if (!*cachep)
+		return;
+	for (i = 0; i < ARRAY_SIZE((*cachep)->subdir); i++)
+		sha1_array_clear(&(*cachep)->subdir[i]);
+	free(*cachep);
+	*cachep = NULL;
+}
+
+void odb_clear_loose_cache(void)
+{
+	struct alternate_object_database *alt;
+
+	free_loose_cache(&local_loose_cache);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		free_loose_cache(&alt->loose_cache);
+}
+
+/*
+ * Remember an object we have just written, but only if its directory
+ * has been read already; otherwise we will find it when we do.  It is
+ * inserted in place, as appending would have the next lookup sort the
+ * whole directory again.
+ */
+static void add_to_loose_cache(const unsigned char *sha1)
+{
+	struct loose_object_cache *cache = local_loose_cache;
+	struct sha1_array *array;
+	int pos;
+
+	if (!cache || !(cache->subdir_seen[sha1[0] / 32] & (1u << (sha1[0] % 32))))
+		return;
+	array = &cache->subdir[sha1[0]];
+	pos = sha1_array_lookup(array, sha1);
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+	ALLOC_GROW(array->sha1, array->nr + 1, array->alloc);
+	memmove(array->sha1 + pos + 1, array->sha1 + pos,
+		(array->nr - pos) * sizeof(*array->sha1));
+	hashcpy(array->sha1[pos], sha1);
+	array->nr++;
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
+	if (core_loose_object_cache)
+		return sha1_array_lookup(odb_loose_cache(NULL, sha1[0]), sha1) >= 0;
 	return !access(sha1_file_name(sha1), F_OK);
 }
 
@@ -448,6 +572,12 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache) {
+			if (sha1_array_lookup(odb_loose_cache(alt, sha1[0]),
+					      sha1) >= 0)
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -523,7 +653,7 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 	hdr = idx_map;
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
 		version = ntohl(hdr->idx_version);
-		if (version < 2 || version > 2) {
+		if (version < 2 || version > 3) {
 			munmap(idx_map, idx_size);
 			return error("index file %s is version %"PRIu32
 				     " and is not supported by this binary"
@@ -590,6 +720,36 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 			munmap(idx_map, idx_size);
 			return error("pack too large for current definition of off_t in %s", path);
 		}
+	} else if (version == 3) {
+		/*
+		 * The v2 tables, followed by
+		 *  - 1-byte type entry * nr, padded to a multiple of 4
+		 *  - 4-byte size entry * nr
+		 *  - 8-byte size entries for sizes of 2^31 and above
+		 *  - 4-byte count of those 8-byte size entries
+		 * and the usual trailer.  The 8-byte offsets are
+		 * between the v2 and the v3 tables, and their number is
+		 * what is left after accounting for everything else.
+		 */
+		size_t min_size = 8 + 4*256 + nr*(20 + 4 + 4) +
+			((nr + 3) & ~3) + nr*4 + 4 + 20 + 20;
+		size_t extra, nr_large_size = 0;
+
+		if (idx_size >= min_size)
+			nr_large_size = ntohl(*(uint32_t *)((char *)idx_map +
+						idx_size - 20 - 20 - 4));
+		if (idx_size < min_size ||
+		    nr_large_size > nr ||
+		    (extra = idx_size - min_size) < nr_large_size * 8 ||
+		    (extra -= nr_large_size * 8) % 8 ||
+		    (nr && extra / 8 > nr - 1) || (!nr && extra)) {
+			munmap(idx_map, idx_size);
+			return error("wrong index v3 file size in %s", path);
+		}
+		if (extra && sizeof(off_t) <= 4) {
+			munmap(idx_map, idx_size);
+			return error("pack too large for current definition of off_t in %s", path);
+		}
 	}
 
 	p->index_version = version;
@@ -786,6 +946,10 @@ void close_pack_index(struct packed_git *p)
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
 	}
+	if (p->mtimes_map) {
+		munmap((void *)p->mtimes_map, p->mtimes_size);
+		p->mtimes_map = NULL;
+	}
 }
 
 /*
@@ -813,6 +977,8 @@ void free_pack_by_name(const char *pack_name)
 			}
 			close_pack_index(p);
 			free(p->bad_object_sha1);
+			if (p->multi_pack_index)
+				midx_release_pack(p);
 			*pp = p->next;
 			if (last_found_pack == p)
 				last_found_pack = NULL;
@@ -1051,14 +1217,17 @@ static struct packed_git *alloc_packed_git(int extra)
 
 static void try_to_free_pack_memory(size_t size)
 {
+	obj_read_lock();
 	release_pack_memory(size);
+	obj_read_unlock();
 }
 
 struct packed_git *add_packed_git(const char *path, int path_len, int local)
 {
 	static int have_set_try_to_free_routine;
 	struct stat st;
-	struct packed_git *p = alloc_packed_git(path_len + 2);
+	/* room to replace ".idx" with ".mtimes" */
+	struct packed_git *p = alloc_packed_git(path_len + 4);
 
 	if (!have_set_try_to_free_routine) {
 		have_set_try_to_free_routine = 1;
@@ -1080,6 +1249,10 @@ struct packed_git *add_packed_git(const char *path, int path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_keep = 1;
 
+	strcpy(p->pack_name + path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	strcpy(p->pack_name + path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -1097,6 +1270,12 @@ struct packed_git *add_packed_git(const char *path, int path_len, int local)
 	return p;
 }
 
+const char *pack_basename(struct packed_git *p)
+{
+	const char *slash = strrchr(p->pack_name, '/');
+	return slash ? slash + 1 : p->pack_name;
+}
+
 struct packed_git *parse_pack_index(unsigned char *sha1, const char *idx_path)
 {
 	const char *path = sha1_pack_name(sha1);
@@ -1185,6 +1364,7 @@ static void prepare_packed_git_one(char *objdir, int local)
 	DIR *dir;
 	struct dirent *de;
 	struct string_list garbage = STRING_LIST_INIT_DUP;
+	struct multi_pack_index *m = prepare_multi_pack_index_one(objdir, local);
 
 	strbuf_addstr(&path, objdir);
 	strbuf_addstr(&path, "/pack");
@@ -1223,16 +1403,24 @@ static void prepare_packed_git_one(char *objdir, int local)
 			     * See if it really is a valid .idx file with
 			     * corresponding .pack file that we can map.
 			     */
-			    (p = add_packed_git(path.buf, path.len, local)) != NULL)
+			    (p = add_packed_git(path.buf, path.len, local)) != NULL) {
 				install_packed_git(p);
+				if (m)
+					midx_claim_pack(m, p, de->d_name);
+			}
 		}
 
 		if (!report_garbage)
 			continue;
 
+		if (!strcmp(de->d_name, "multi-pack-index"))
+			continue;
+
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
+		    ends_with(de->d_name, ".rev") ||
+		    ends_with(de->d_name, ".mtimes") ||
 		    ends_with(de->d_name, ".keep"))
 			string_list_append(&garbage, path.buf);
 		else
@@ -1318,6 +1506,7 @@ void prepare_packed_git(void)
 
 void reprepare_packed_git(void)
 {
+	odb_clear_loose_cache();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1665,11 +1854,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1720,18 +1909,19 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		struct pack_revindex *rix;
+		int pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		pos = find_pack_revindex(p, base_offset, &rix);
+		if (pos < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(rix, pos));
 	} else
 		return NULL;
 }
@@ -1764,13 +1954,13 @@ int unpack_object_header(struct packed_git *p,
 
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
-	int type;
-	struct revindex_entry *revidx;
+	int type, pos;
+	struct pack_revindex *rix;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	pos = find_pack_revindex(p, obj_offset, &rix);
+	if (pos < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(rix, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1881,8 +2071,13 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		struct pack_revindex *rix;
+		int pos = find_pack_revindex(p, obj_offset, &rix);
+		if (pos < 0) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(rix, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep) {
@@ -1914,6 +2109,46 @@ out:
 	return type;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * Serializes the bookkeeping of the object read path (pack windows,
+ * open packs, the delta base cache, ...) while enable_obj_read_lock()
+ * is in effect.  It is recursive, as reading an object may need to
+ * read another one, and it is dropped while inflating and applying
+ * deltas so that those can run in parallel.
+ */
+static int obj_read_use_lock;
+static pthread_mutex_t obj_read_mutex;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		die("BUG: disable_obj_read_lock() without enable_obj_read_lock()");
+	if (--obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#endif
+
 static void *unpack_compressed_entry(struct packed_git *p,
 				    struct pack_window **w_curs,
 				    off_t curpos,
@@ -1932,7 +2167,10 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* the window is ours as long as w_curs holds it */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1946,59 +2184,154 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
+/*
+ * Recently used delta bases, keyed by pack and offset, so that reading
+ * several objects that delta against the same base (or against each
+ * other, as in a long chain) does not inflate and patch it again every
+ * time.  Entries are kept in a hashmap that grows with the number of
+ * bases we hold; delta_base_cache_limit bounds the bytes they use, and
+ * the least recently used ones (blobs first) are dropped to stay below
+ * it.
+ */
 static size_t delta_base_cached;
 
-static struct delta_base_cache_lru_list {
+struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
+};
 
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
-	void *data;
+/* blobs are less likely to be reused and go first, so keep them apart */
+static struct delta_base_cache_lru_list delta_base_cache_blob_lru = {
+	&delta_base_cache_blob_lru, &delta_base_cache_blob_lru
+};
+static struct delta_base_cache_lru_list delta_base_cache_lru = {
+	&delta_base_cache_lru, &delta_base_cache_lru
+};
+
+struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
+};
+
+struct delta_base_cache_entry {
+	struct hashmap_entry ent;
+	struct delta_base_cache_key key;
+	struct delta_base_cache_lru_list lru;
+	void *data;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct hashmap delta_base_cache;
+static int delta_base_cache_initialized;
+
+static struct delta_base_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t peak;
+} delta_base_cache_stats;
+
+static struct trace_key trace_delta_base_cache = TRACE_KEY_INIT(PERFORMANCE);
+
+static void print_delta_base_cache_stats(void)
+{
+	struct delta_base_cache_stats *st = &delta_base_cache_stats;
+
+	trace_printf_key(&trace_delta_base_cache,
+			 "delta base cache: %lu hits, %lu misses, "
+			 "%lu evictions, %lu bytes peak (limit %lu)\n",
+			 st->hits, st->misses, st->evictions,
+			 (unsigned long)st->peak,
+			 (unsigned long)delta_base_cache_limit);
+}
+
+static int delta_base_cache_cmp(const struct delta_base_cache_entry *a,
+				const struct delta_base_cache_entry *b,
+				const struct delta_base_cache_key *key)
+{
+	if (!key)
+		key = &b->key;
+	return a->key.p != key->p || a->key.base_offset != key->base_offset;
+}
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash;
+	unsigned int hash;
 
-	hash = (unsigned long)p + (unsigned long)base_offset;
+	hash = (unsigned int)(intptr_t)p + (unsigned int)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
 }
 
 static struct delta_base_cache_entry *
 get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	return delta_base_cache + hash;
+	struct delta_base_cache_key key;
+
+	if (!delta_base_cache_initialized) {
+		hashmap_init(&delta_base_cache,
+			     (hashmap_cmp_fn)delta_base_cache_cmp, 0);
+		if (trace_want(&trace_delta_base_cache))
+			atexit(print_delta_base_cache_stats);
+		delta_base_cache_initialized = 1;
+	}
+
+	key.p = p;
+	key.base_offset = base_offset;
+	return hashmap_get_from_hash(&delta_base_cache,
+				     pack_entry_hash(p, base_offset), &key);
 }
 
-static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
-				     struct packed_git *p, off_t base_offset)
+static inline struct delta_base_cache_entry *
+lru_to_delta_base_cache_entry(struct delta_base_cache_lru_list *lru)
 {
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return (struct delta_base_cache_entry *)
+		((char *)lru - offsetof(struct delta_base_cache_entry, lru));
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	struct delta_base_cache_entry *ent;
-	ent = get_delta_base_cache_entry(p, base_offset);
-	return eq_delta_base_cache_entry(ent, p, base_offset);
+	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
-static void clear_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+/* Remove the entry from the cache, without freeing the data it holds. */
+static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 {
-	ent->data = NULL;
+	hashmap_remove(&delta_base_cache, ent, NULL);
 	ent->lru.next->prev = ent->lru.prev;
 	ent->lru.prev->next = ent->lru.next;
 	delta_base_cached -= ent->size;
+	free(ent);
+}
+
+static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+{
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
+}
+
+/*
+ * Take the base at base_offset of p out of the cache, if it is there,
+ * and hand its data over to the caller.
+ */
+static void *take_delta_base_cache(struct packed_git *p, off_t base_offset,
+				   unsigned long *base_size,
+				   enum object_type *type)
+{
+	struct delta_base_cache_entry *ent;
+	void *ret = NULL;
+
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent) {
+		ret = ent->data;
+		*type = ent->type;
+		*base_size = ent->size;
+		detach_delta_base_cache_entry(ent);
+		delta_base_cache_stats.hits++;
+	} else
+		delta_base_cache_stats.misses++;
+	return ret;
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
@@ -2007,83 +2340,82 @@ static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	struct delta_base_cache_entry *ent;
 	void *ret;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-
-	if (!eq_delta_base_cache_entry(ent, p, base_offset))
+	/* unpack_entry() takes the base out of the cache if it is there */
+	if (!keep_cache)
 		return unpack_entry(p, base_offset, type, base_size);
 
-	ret = ent->data;
-
-	if (!keep_cache)
-		clear_delta_base_cache_entry(ent);
-	else
-		ret = xmemdupz(ent->data, ent->size);
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent)
+		return unpack_entry(p, base_offset, type, base_size);
+	delta_base_cache_stats.hits++;
+	ret = xmemdupz(ent->data, ent->size);
 	*type = ent->type;
 	*base_size = ent->size;
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+/*
+ * Drop entries from the head of the list, i.e. the least recently
+ * used ones, until the cache fits into delta_base_cache_limit, or
+ * until the list is empty if "all" is set.
+ */
+static void prune_delta_base_cache(struct delta_base_cache_lru_list *list,
+				   int all)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+	while (list->next != list &&
+	       (all || delta_base_cached > delta_base_cache_limit)) {
+		release_delta_base_cache(lru_to_delta_base_cache_entry(list->next));
+		if (!all)
+			delta_base_cache_stats.evictions++;
 	}
 }
 
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	prune_delta_base_cache(&delta_base_cache_blob_lru, 1);
+	prune_delta_base_cache(&delta_base_cache_lru, 1);
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
+	struct delta_base_cache_entry *ent;
 	struct delta_base_cache_lru_list *lru;
 
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	/* another reader may have cached the same base meanwhile */
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent)
+		release_delta_base_cache(ent);
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
-	}
+	delta_base_cached += base_size;
+	prune_delta_base_cache(&delta_base_cache_blob_lru, 0);
+	prune_delta_base_cache(&delta_base_cache_lru, 0);
 
-	ent->p = p;
-	ent->base_offset = base_offset;
+	ent = xmalloc(sizeof(*ent));
+	hashmap_entry_init(ent, pack_entry_hash(p, base_offset));
+	ent->key.p = p;
+	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	lru = type == OBJ_BLOB ? &delta_base_cache_blob_lru : &delta_base_cache_lru;
+	ent->lru.next = lru;
+	ent->lru.prev = lru->prev;
+	lru->prev->next = &ent->lru;
+	lru->prev = &ent->lru;
+	hashmap_add(&delta_base_cache, ent);
+
+	if (delta_base_cached > delta_base_cache_stats.peak)
+		delta_base_cache_stats.peak = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
 			 unsigned long *size);
 
+static struct trace_key pack_access = TRACE_KEY_INIT(PACK_ACCESS);
+
 static void write_pack_access_log(struct packed_git *p, off_t obj_offset)
 {
-	static struct trace_key pack_access = TRACE_KEY_INIT(PACK_ACCESS);
 	trace_printf_key(&pack_access, "%s %"PRIuMAX"\n",
 			 p->pack_name, (uintmax_t)obj_offset);
 }
@@ -2116,24 +2448,21 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (eq_delta_base_cache_entry(ent, p, curpos)) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			clear_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache(p, curpos, &size, &type);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			unsigned long len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			struct pack_revindex *rix;
+			int pos = find_pack_revindex(p, obj_offset, &rix);
+			uint32_t nr = pack_pos_to_index(rix, pos);
+			unsigned long len = pack_pos_to_offset(rix, pos + 1) - obj_offset;
+			if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, nr);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -2202,14 +2531,13 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	while (delta_stack_nr) {
 		void *delta_data;
 		void *base = data;
+		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
+		off_t base_offset = obj_offset;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2217,17 +2545,19 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			struct pack_revindex *rix;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			int pos = find_pack_revindex(p, obj_offset, &rix);
+			if (pos >= 0) {
+				base_sha1 = nth_packed_object_sha1(p,
+						pack_pos_to_index(rix, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
 				      p->pack_name);
 				mark_bad_packed_object(p, base_sha1);
 				base = read_object(base_sha1, &type, &base_size);
+				external_base = base;
 			}
 		}
 
@@ -2241,17 +2571,29 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 
 		delta_data = unpack_compressed_entry(p, &w_curs, curpos, delta_size);
 
-		if (!delta_data) {
+		if (delta_data) {
+			/* nobody else can see base or delta_data */
+			obj_read_unlock();
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+			obj_read_lock();
+		} else
 			error("failed to unpack compressed delta "
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
-			data = NULL;
-			continue;
-		}
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+		/*
+		 * Only now that we are done with the base can it go to the
+		 * cache, where another reader may evict and free it.
+		 */
+		if (external_base)
+			free(external_base);
+		else
+			add_delta_base_cache(p, base_offset, base, base_size, type);
+
+		if (!delta_data)
+			continue;
 
 		/*
 		 * We could not apply the delta; warn the user, but keep going.
@@ -2316,8 +2658,45 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+int nth_packed_object_info(const struct packed_git *p, uint32_t n,
+			   unsigned long *sizep, int *is_delta)
+{
+	const unsigned char *end, *types;
+	const uint32_t *sizes;
+	uint32_t nr_large_size, size;
+	int type;
+
+	if (p->index_version < 3 || n >= p->num_objects)
+		return OBJ_BAD;
+	end = (const unsigned char *)p->index_data + p->index_size - 20 - 20 - 4;
+	nr_large_size = get_be32(end);
+	sizes = (const uint32_t *)(end - nr_large_size * 8) - p->num_objects;
+	types = (const unsigned char *)sizes - ((p->num_objects + 3) & ~3);
+
+	type = types[n] & PACK_IDX_TYPE_MASK;
+	if (type < OBJ_COMMIT || type > OBJ_TAG)
+		return error("bad type %d for object %"PRIu32" in %s",
+			     type, n, p->pack_name);
+	*is_delta = !!(types[n] & PACK_IDX_TYPE_DELTA);
+
+	size = ntohl(sizes[n]);
+	if (!(size & 0x80000000)) {
+		*sizep = size;
+	} else {
+		const unsigned char *large = end - nr_large_size * 8;
+
+		size &= 0x7fffffff;
+		if (size >= nr_large_size)
+			return error("bad size for object %"PRIu32" in %s",
+				     n, p->pack_name);
+		large += size * 8;
+		*sizep = ((uint64_t)get_be32(large) << 32) | get_be32(large + 4);
+	}
+	return type;
+}
+
+int find_pack_entry_pos(const unsigned char *sha1,
+			struct packed_git *p, uint32_t *pos)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -2355,11 +2734,12 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	if (use_lookup < 0)
 		use_lookup = !!getenv("GIT_USE_LOOKUP");
 	if (use_lookup) {
-		int pos = sha1_entry_pos(index, stride, 0,
-					 lo, hi, p->num_objects, sha1);
-		if (pos < 0)
+		int found = sha1_entry_pos(index, stride, 0,
+					   lo, hi, p->num_objects, sha1);
+		if (found < 0)
 			return 0;
-		return nth_packed_object_offset(p, pos);
+		*pos = found;
+		return 1;
 	}
 
 	do {
@@ -2369,8 +2749,10 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 		if (debug_lookup)
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
-		if (!cmp)
-			return nth_packed_object_offset(p, mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
 		if (cmp > 0)
 			hi = mi;
 		else
@@ -2379,6 +2761,16 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	return 0;
 }
 
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	uint32_t pos;
+
+	if (!find_pack_entry_pos(sha1, p, &pos))
+		return 0;
+	return nth_packed_object_offset(p, pos);
+}
+
 int is_pack_valid(struct packed_git *p)
 {
 	/* An already open pack is known to be valid. */
@@ -2400,12 +2792,11 @@ int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
-static int fill_pack_entry(const unsigned char *sha1,
-			   struct pack_entry *e,
-			   struct packed_git *p)
+static int fill_pack_entry_at(const unsigned char *sha1,
+			      struct pack_entry *e,
+			      struct packed_git *p,
+			      off_t offset, uint32_t nth)
 {
-	off_t offset;
-
 	if (p->num_bad_objects) {
 		unsigned i;
 		for (i = 0; i < p->num_bad_objects; i++)
@@ -2413,10 +2804,6 @@ static int fill_pack_entry(const unsigned char *sha1,
 				return 0;
 	}
 
-	offset = find_pack_entry_one(sha1, p);
-	if (!offset)
-		return 0;
-
 	/*
 	 * We are about to tell the caller where they can locate the
 	 * requested object.  We better make sure the packfile is
@@ -2430,10 +2817,48 @@ static int fill_pack_entry(const unsigned char *sha1,
 	}
 	e->offset = offset;
 	e->p = p;
+	e->nth = nth;
 	hashcpy(e->sha1, sha1);
 	return 1;
 }
 
+static int fill_pack_entry(const unsigned char *sha1,
+			   struct pack_entry *e,
+			   struct packed_git *p)
+{
+	uint32_t pos;
+
+	if (!find_pack_entry_pos(sha1, p, &pos))
+		return 0;
+	return fill_pack_entry_at(sha1, e, p,
+				  nth_packed_object_offset(p, pos), pos);
+}
+
+/*
+ * Look the object up in the multi-pack indexes.  Return 1 if found,
+ * or -1 if an index lists it in a pack that we could not use, in
+ * which case the caller has to look at every pack after all.
+ */
+static int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct multi_pack_index *m;
+	int ret = 0;
+
+	for (m = multi_pack_index; m; m = m->next) {
+		struct packed_git *p = NULL;
+		off_t offset = find_midx_entry_one(sha1, m, &p);
+
+		if (!offset)
+			continue;
+		if (p && fill_pack_entry_at(sha1, e, p, offset, -1)) {
+			last_found_pack = p;
+			return 1;
+		}
+		ret = -1;
+	}
+	return ret;
+}
+
 /*
  * Iff a pack file contains the object named by sha1, return true and
  * store its location to e.
@@ -2441,6 +2866,7 @@ static int fill_pack_entry(const unsigned char *sha1,
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int midx_status;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2449,9 +2875,15 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	midx_status = fill_midx_entry(sha1, e);
+	if (midx_status > 0)
+		return 1;
+
 	for (p = packed_git; p; p = p->next) {
 		if (p == last_found_pack)
 			continue; /* we already checked this one */
+		if (p->multi_pack_index && !midx_status)
+			continue; /* the multi-pack index knows it is not there */
 
 		if (fill_pack_entry(sha1, e, p)) {
 			last_found_pack = p;
@@ -2522,11 +2954,92 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	return 0;
 }
 
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+static int do_sha1_object_info_extended(const unsigned char *sha1,
+					struct object_info *oi, unsigned flags);
+
+/*
+ * Can the index of the pack answer oi without looking at the pack?
+ * Objects found through a multi-pack index may come from a pack whose
+ * own index has not been opened yet.
+ */
+static int index_has_object_info(struct packed_git *p,
+				 const struct object_info *oi)
+{
+	if (oi->delta_base_sha1)
+		return 0;
+	if (!p->index_data && open_pack_index(p))
+		return 0;
+	return p->index_version >= 3;
+}
+
+/*
+ * Fill oi from the type and size columns of a version 3 index.
+ * Return 0 on success, or -1 if the pack has to be looked at.
+ */
+static int index_object_info(struct pack_entry *e, struct object_info *oi,
+			     int *is_delta)
+{
+	struct packed_git *p = e->p;
+	unsigned long size;
+	int type;
+
+	if (!index_has_object_info(p, oi))
+		return -1;
+	if (e->nth == (uint32_t)-1 && !find_pack_entry_pos(e->sha1, p, &e->nth))
+		return -1;
+	type = nth_packed_object_info(p, e->nth, &size, is_delta);
+	if (type < 0)
+		return -1;
+
+	if (oi->disk_sizep) {
+		struct pack_revindex *rix;
+		int pos = find_pack_revindex(p, e->offset, &rix);
+		if (pos < 0)
+			return -1;
+		*oi->disk_sizep = pack_pos_to_offset(rix, pos + 1) - e->offset;
+	}
+	if (oi->typep)
+		*oi->typep = type;
+	if (oi->sizep)
+		*oi->sizep = size;
+	return 0;
+}
+
+static int packed_entry_object_info(const unsigned char *real,
+				    struct pack_entry *e,
+				    struct object_info *oi)
+{
+	int is_delta;
+
+	if (index_object_info(e, oi, &is_delta)) {
+		int rtype;
+
+		write_pack_access_log(e->p, e->offset);
+		rtype = packed_object_info(e->p, e->offset, oi);
+		if (rtype < 0) {
+			mark_bad_packed_object(e->p, real);
+			return do_sha1_object_info_extended(real, oi, 0);
+		}
+		is_delta = (rtype == OBJ_REF_DELTA || rtype == OBJ_OFS_DELTA);
+	}
+
+	if (in_delta_base_cache(e->p, e->offset)) {
+		oi->whence = OI_DBCACHED;
+	} else {
+		oi->whence = OI_PACKED;
+		oi->u.packed.offset = e->offset;
+		oi->u.packed.pack = e->p;
+		oi->u.packed.is_delta = is_delta;
+	}
+
+	return 0;
+}
+
+static int do_sha1_object_info_extended(const unsigned char *sha1,
+					struct object_info *oi, unsigned flags)
 {
 	struct cached_object *co;
 	struct pack_entry e;
-	int rtype;
 	const unsigned char *real = lookup_replace_object_extended(sha1, flags);
 
 	co = find_cached_object(real);
@@ -2556,23 +3069,173 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 			return -1;
 	}
 
-	rtype = packed_object_info(e.p, e.offset, oi);
-	if (rtype < 0) {
-		mark_bad_packed_object(e.p, real);
-		return sha1_object_info_extended(real, oi, 0);
-	} else if (in_delta_base_cache(e.p, e.offset)) {
-		oi->whence = OI_DBCACHED;
-	} else {
-		oi->whence = OI_PACKED;
-		oi->u.packed.offset = e.offset;
-		oi->u.packed.pack = e.p;
-		oi->u.packed.is_delta = (rtype == OBJ_REF_DELTA ||
-					 rtype == OBJ_OFS_DELTA);
-	}
+	return packed_entry_object_info(real, &e, oi);
+}
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_sha1_object_info_extended(sha1, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
+struct object_info_batch_entry {
+	const unsigned char *real;
+	struct pack_entry e; /* e.p is NULL unless packed */
+	int nr;
+
+	/* the answers, kept until they can be handed out in order */
+	int ret;
+	enum object_type type;
+	unsigned long size;
+	unsigned long disk_size;
+	unsigned char delta_base_sha1[20];
+	struct object_info oi;
+};
+
+static int object_info_batch_cmp(const void *va, const void *vb)
+{
+	const struct object_info_batch_entry *a = va, *b = vb;
+
+	/* loose (or missing) objects go last, in the order of their names */
+	if (!a->e.p || !b->e.p) {
+		if (a->e.p || b->e.p)
+			return a->e.p ? -1 : 1;
+		return hashcmp(a->real, b->real);
+	}
+	if (a->e.p != b->e.p)
+		return (uintptr_t)a->e.p < (uintptr_t)b->e.p ? -1 : 1;
+	if (a->e.offset != b->e.offset)
+		return a->e.offset < b->e.offset ? -1 : 1;
 	return 0;
 }
 
+/* How many of the upcoming objects of a pack to announce to the kernel. */
+#define OBJECT_INFO_READAHEAD 64
+
+/*
+ * Tell the kernel that we are about to read the part of the pack that
+ * holds the objects ent[0..nr-1], as our reads are sparse enough that
+ * its own readahead will not catch them.  Returns the offset up to
+ * which we have asked.
+ */
+static off_t advise_object_info_readahead(struct object_info_batch_entry *ent,
+					  int nr)
+{
+	struct packed_git *p = ent->e.p;
+	off_t from = ent->e.offset, to = from;
+	int i;
+
+	for (i = 1; i < nr && i < OBJECT_INFO_READAHEAD; i++) {
+		if (ent[i].e.p != p ||
+		    ent[i].e.offset - from > packed_git_window_size)
+			break;
+		to = ent[i].e.offset;
+	}
+	trace_printf_key(&pack_access, "%s %"PRIuMAX"-%"PRIuMAX" readahead\n",
+			 p->pack_name, (uintmax_t)from, (uintmax_t)to);
+#ifdef POSIX_FADV_WILLNEED
+	/* object headers are small; a page past the last one is plenty */
+	if (p->pack_fd >= 0)
+		posix_fadvise(p->pack_fd, from, to - from + 4096,
+			      POSIX_FADV_WILLNEED);
+#endif
+	return to;
+}
+
+static void object_info_batch_answer(struct object_info *dst,
+				     const struct object_info_batch_entry *ent)
+{
+	if (dst->typep)
+		*dst->typep = ent->type;
+	if (dst->sizep)
+		*dst->sizep = ent->size;
+	if (dst->disk_sizep)
+		*dst->disk_sizep = ent->disk_size;
+	if (dst->delta_base_sha1)
+		hashcpy(dst->delta_base_sha1, ent->delta_base_sha1);
+	dst->whence = ent->oi.whence;
+	dst->u = ent->oi.u;
+}
+
+int sha1_object_info_batch(const unsigned char (*sha1)[20], int nr,
+			   struct object_info *oi, unsigned flags,
+			   int unordered, object_info_batch_fn fn, void *data)
+{
+	struct object_info_batch_entry *ent;
+	struct packed_git *advised_pack = NULL;
+	off_t advised_to = 0;
+	int i, ret = 0;
+
+	ent = xcalloc(nr, sizeof(*ent));
+
+	obj_read_lock();
+	for (i = 0; i < nr; i++) {
+		ent[i].nr = i;
+		ent[i].real = lookup_replace_object_extended(sha1[i], flags);
+		if (find_cached_object(ent[i].real) ||
+		    !find_pack_entry(ent[i].real, &ent[i].e))
+			ent[i].e.p = NULL;
+	}
+	qsort(ent, nr, sizeof(*ent), object_info_batch_cmp);
+
+	for (i = 0; i < nr; i++) {
+		struct object_info_batch_entry *e = &ent[i];
+
+		if (oi->typep)
+			e->oi.typep = &e->type;
+		if (oi->sizep)
+			e->oi.sizep = &e->size;
+		if (oi->disk_sizep)
+			e->oi.disk_sizep = &e->disk_size;
+		if (oi->delta_base_sha1)
+			e->oi.delta_base_sha1 = e->delta_base_sha1;
+
+		if (e->e.p) {
+			/*
+			 * Announce the run before reading its first object;
+			 * no need to read ahead if the .idx has the answer.
+			 */
+			if (!index_has_object_info(e->e.p, oi) &&
+			    (e->e.p != advised_pack || e->e.offset > advised_to)) {
+				advised_pack = e->e.p;
+				advised_to = advise_object_info_readahead(e, nr - i);
+			}
+			e->ret = packed_entry_object_info(e->real, &e->e, &e->oi);
+		} else
+			e->ret = do_sha1_object_info_extended(e->real, &e->oi, 0);
+
+		if (unordered) {
+			object_info_batch_answer(oi, e);
+			obj_read_unlock();
+			ret = fn(e->nr, e->ret, data);
+			obj_read_lock();
+			if (ret)
+				break;
+		}
+	}
+	obj_read_unlock();
+
+	if (!unordered) {
+		struct object_info_batch_entry **by_nr;
+
+		by_nr = xmalloc(nr * sizeof(*by_nr));
+		for (i = 0; i < nr; i++)
+			by_nr[ent[i].nr] = &ent[i];
+		for (i = 0; !ret && i < nr; i++) {
+			object_info_batch_answer(oi, by_nr[i]);
+			ret = fn(i, by_nr[i]->ret, data);
+		}
+		free(by_nr);
+	}
+
+	free(ent);
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -2647,8 +3310,10 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	map = map_sha1_file(sha1, &mapsize);
 	if (map) {
+		obj_read_unlock();
 		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
 		munmap(map, mapsize);
+		obj_read_lock();
 		return buf;
 	}
 	reprepare_packed_git();
@@ -2667,10 +3332,13 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 {
 	void *data;
 	const struct packed_git *p;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
+	obj_read_lock();
+	repl = lookup_replace_object_extended(sha1, flag);
 	errno = 0;
 	data = read_object(repl, type, size);
+	obj_read_unlock();
 	if (data)
 		return data;
 
@@ -2940,7 +3608,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	add_to_loose_cache(sha1);
+	return 0;
 }
 
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *returnsha1)
@@ -2955,7 +3626,7 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	write_sha1_file_prepare(buf, len, type, sha1, hdr, &hdrlen);
 	if (returnsha1)
 		hashcpy(returnsha1, sha1);
-	if (has_sha1_file(sha1))
+	if (has_sha1_file_with_flags(sha1, HAS_SHA1_QUICK))
 		return 0;
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
@@ -2995,7 +3666,7 @@ int has_sha1_pack(const unsigned char *sha1)
 	return find_pack_entry(sha1, &e);
 }
 
-int has_sha1_file(const unsigned char *sha1)
+int has_sha1_file_with_flags(const unsigned char *sha1, int flags)
 {
 	struct pack_entry e;
 
@@ -3003,8 +3674,13 @@ int has_sha1_file(const unsigned char *sha1)
 		return 1;
 	if (has_loose_object(sha1))
 		return 1;
+	if (flags & HAS_SHA1_QUICK)
+		return 0;
 	reprepare_packed_git();
-	return find_pack_entry(sha1, &e);
+	if (find_pack_entry(sha1, &e))
+		return 1;
+	/* a stale cache may have hidden an object written meanwhile */
+	return core_loose_object_cache && has_loose_object(sha1);
 }
 
 static void check_tree(const void *buf, size_t size)
@@ -3065,7 +3741,9 @@ static int index_mem(unsigned char *sha1, void *buf, size_t size,
 			check_tag(buf, size);
 	}
 
-	if (write_object)
+	if (write_object && core_bulk_checkin && bulk_checkin_plugged())
+		ret = index_bulk_checkin_mem(sha1, buf, size, type);
+	else if (write_object)
 		ret = write_sha1_file(buf, size, typename(type), sha1);
 	else
 		ret = hash_sha1_file(buf, size, typename(type), sha1);
@@ -6,6 +6,7 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "remote.h"
+#include "sha1-array.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -71,12 +72,61 @@ static void update_candidates(struct disambiguate_state *ds, const unsigned char
 	/* otherwise, current can be discarded and candidate is still good */
 }
 
-static void find_short_object_filename(int len, const char *hex_pfx, struct disambiguate_state *ds)
+static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
+{
+	do {
+		if (*a != *b)
+			return 0;
+		a++;
+		b++;
+		len -= 2;
+	} while (len > 1);
+	if (len)
+		if ((*a ^ *b) & 0xf0)
+			return 0;
+	return 1;
+}
+
+static void find_short_object_cached(int len, const unsigned char *bin_pfx,
+				     struct sha1_array *loose,
+				     struct disambiguate_state *ds)
+{
+	int lo = 0, hi = loose->nr;
+
+	/* bin_pfx is zero-padded, so this finds the first possible match */
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (hashcmp(loose->sha1[mi], bin_pfx) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	for (; lo < loose->nr && !ds->ambiguous; lo++) {
+		if (!match_sha(len, bin_pfx, loose->sha1[lo]))
+			break;
+		update_candidates(ds, loose->sha1[lo]);
+	}
+}
+
+static void find_short_object_filename(int len, const char *hex_pfx,
+				       const unsigned char *bin_pfx,
+				       struct disambiguate_state *ds)
 {
 	struct alternate_object_database *alt;
 	char hex[40];
 	static struct alternate_object_database *fakeent;
 
+	if (core_loose_object_cache) {
+		find_short_object_cached(len, bin_pfx,
+					 odb_loose_cache(NULL, bin_pfx[0]), ds);
+		prepare_alt_odb();
+		for (alt = alt_odb_list; alt && !ds->ambiguous; alt = alt->next)
+			find_short_object_cached(len, bin_pfx,
+						 odb_loose_cache(alt, bin_pfx[0]),
+						 ds);
+		return;
+	}
+
 	if (!fakeent) {
 		/*
 		 * Create a "fake" alternate object database that
@@ -119,21 +169,6 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 	}
 }
 
-static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
-{
-	do {
-		if (*a != *b)
-			return 0;
-		a++;
-		b++;
-		len -= 2;
-	} while (len > 1);
-	if (len)
-		if ((*a ^ *b) & 0xf0)
-			return 0;
-	return 1;
-}
-
 static void unique_in_pack(int len,
 			  const unsigned char *bin_pfx,
 			   struct packed_git *p,
@@ -334,7 +369,7 @@ static int get_short_sha1(const char *name, int len, unsigned char *sha1,
 	else if (flags & GET_SHA1_BLOB)
 		ds.fn = disambiguate_blob_only;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	status = finish_object_disambiguation(&ds, sha1);
 
@@ -362,7 +397,7 @@ int for_each_abbrev(const char *prefix, each_abbrev_fn fn, void *cb_data)
 	ds.cb_data = cb_data;
 	ds.fn = fn;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	return ds.ambiguous;
 }
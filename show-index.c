@@ -19,7 +19,7 @@ int main(int argc, char **argv)
 		die("unable to read header");
 	if (top_index[0] == htonl(PACK_IDX_SIGNATURE)) {
 		version = ntohl(top_index[1]);
-		if (version < 2 || version > 2)
+		if (version < 2 || version > 3)
 			die("unknown index version");
 		if (fread(top_index, 256 * 4, 1, stdin) != 1)
 			die("unable to read index");
@@ -45,11 +45,14 @@ int main(int argc, char **argv)
 			printf("%u %s\n", offset, sha1_to_hex((void *)(entry+1)));
 		}
 	} else {
-		unsigned off64_nr = 0;
+		unsigned off64_nr = 0, size64_nr = 0;
 		struct {
 			unsigned char sha1[20];
 			uint32_t crc;
 			uint32_t off;
+			uint64_t offset;
+			unsigned char type;
+			uint32_t size;
 		} *entries = xmalloc(nr * sizeof(entries[0]));
 		for (i = 0; i < nr; i++)
 			if (fread(entries[i].sha1, 20, 1, stdin) != 1)
@@ -75,10 +78,46 @@ int main(int argc, char **argv)
 						     ntohl(off64[1]);
 				off64_nr++;
 			}
-			printf("%" PRIuMAX " %s (%08"PRIx32")\n",
-			       (uintmax_t) offset,
+			entries[i].offset = offset;
+		}
+		if (version == 3) {
+			unsigned char pad[3];
+
+			for (i = 0; i < nr; i++)
+				if (fread(&entries[i].type, 1, 1, stdin) != 1)
+					die("unable to read type %u/%u", i, nr);
+			if ((nr & 3) && fread(pad, 4 - (nr & 3), 1, stdin) != 1)
+				die("unable to read type padding");
+			for (i = 0; i < nr; i++)
+				if (fread(&entries[i].size, 4, 1, stdin) != 1)
+					die("unable to read 32b size %u/%u", i, nr);
+		}
+		for (i = 0; i < nr; i++) {
+			printf("%" PRIuMAX " %s (%08"PRIx32")",
+			       (uintmax_t) entries[i].offset,
 			       sha1_to_hex(entries[i].sha1),
 			       ntohl(entries[i].crc));
+			if (version == 3) {
+				uint64_t size;
+				uint32_t sz = ntohl(entries[i].size);
+				if (!(sz & 0x80000000)) {
+					size = sz;
+				} else {
+					uint32_t size64[2];
+					if ((sz & 0x7fffffff) != size64_nr)
+						die("inconsistent 64b size index");
+					if (fread(size64, 8, 1, stdin) != 1)
+						die("unable to read 64b size %u", size64_nr);
+					size = (((uint64_t)ntohl(size64[0])) << 32) |
+							   ntohl(size64[1]);
+					size64_nr++;
+				}
+				printf(" %s %" PRIuMAX "%s",
+				       typename(entries[i].type & PACK_IDX_TYPE_MASK),
+				       (uintmax_t) size,
+				       (entries[i].type & PACK_IDX_TYPE_DELTA) ? " delta" : "");
+			}
+			putchar('\n');
 		}
 		free(entries);
 	}
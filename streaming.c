@@ -3,12 +3,14 @@
  */
 #include "cache.h"
 #include "streaming.h"
+#include "delta.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -63,6 +67,35 @@ struct filtered_istream {
 	int input_finished;
 };
 
+/* how much of a delta base we keep around to copy from */
+#define DELTA_BASE_WINDOW (1024*256)
+
+/*
+ * How often the base streams of one delta chain may be restarted in
+ * total before a base is read into core instead, if it is small enough;
+ * every restart rereads (and re-applies) the rest of the chain below it.
+ */
+#define DELTA_BASE_MAX_RESTARTS 8
+
+struct delta_istream {
+	struct packed_git *pack;
+	off_t base_offset;
+	unsigned long base_size;
+	struct git_istream *base; /* opened when first copied from */
+	unsigned long base_pos; /* how much of the base we have read */
+	char *window; /* base bytes [win_start, base_pos) */
+	unsigned long win_start;
+	int base_in_core; /* window holds the whole base */
+	int *restarts; /* budget shared by the whole chain */
+	int restarts_left; /* the budget, in the outermost stream */
+	unsigned char *delta; /* the inflated delta data */
+	const unsigned char *data, *top; /* instructions yet to run */
+	const unsigned char *insert; /* literal being copied, or NULL */
+	unsigned long copy_off; /* base offset being copied from */
+	unsigned long todo; /* bytes left in the current instruction */
+	unsigned long remaining; /* bytes left in the result */
+};
+
 struct git_istream {
 	const struct stream_vtbl *vtbl;
 	unsigned long size; /* inflated size of full object */
@@ -89,6 +122,7 @@ struct git_istream {
 		} in_pack;
 
 		struct filtered_istream filtered;
+		struct delta_istream delta;
 	} u;
 };
 
@@ -121,8 +155,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -452,6 +486,295 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta data itself is inflated in full, but the base is read
+ * through a stream of its own (which may again be a delta) and only
+ * a window of it is kept, so that the whole object never has to be
+ * in memory.  A copy from before the window restarts the base stream;
+ * once the chain has used up DELTA_BASE_MAX_RESTARTS, a base that is
+ * not larger than core.bigFileThreshold is read into core instead.
+ * Larger ones keep being restarted, so that memory stays bounded.
+ *
+ *****************************************************************/
+
+static struct trace_key trace_stream = TRACE_KEY_INIT(PERFORMANCE);
+
+static struct git_istream *open_istream_pack_entry(struct packed_git *p,
+						   off_t offset,
+						   int *restarts)
+{
+	struct git_istream *st = xmalloc(sizeof(*st));
+	struct object_info oi = {NULL};
+	enum object_type type;
+
+	oi.whence = OI_PACKED;
+	oi.u.packed.pack = p;
+	oi.u.packed.offset = offset;
+	if (!open_istream_pack_non_delta(st, &oi, NULL, &type))
+		return st;
+	if (!open_istream_pack_delta(st, &oi, NULL, &type)) {
+		st->u.delta.restarts = restarts;
+		return st;
+	}
+	free(st);
+	return NULL;
+}
+
+static int inflate_pack_data(struct packed_git *p, off_t pos,
+			     unsigned char *buf, unsigned long size)
+{
+	struct pack_window *window = NULL;
+	git_zstream z;
+	unsigned char *in;
+	int status;
+
+	memset(&z, 0, sizeof(z));
+	z.next_out = buf;
+	z.avail_out = size + 1;
+
+	git_inflate_init(&z);
+	do {
+		in = use_pack(p, &window, pos, &z.avail_in);
+		z.next_in = in;
+		status = git_inflate(&z, Z_FINISH);
+		if (!z.avail_out)
+			break; /* the payload is larger than it should be */
+		pos += z.next_in - in;
+	} while (status == Z_OK || status == Z_BUF_ERROR);
+	git_inflate_end(&z);
+	unuse_pack(&window);
+
+	if (status != Z_STREAM_END || z.total_out != size)
+		return -1;
+	return 0;
+}
+
+/* Replace the base stream with the whole base, read into core */
+static int read_delta_base_in_core(struct delta_istream *ds)
+{
+	enum object_type type;
+	unsigned long size;
+	void *base;
+
+	trace_printf_key(&trace_stream,
+			 "delta stream: reading base at %"PRIuMAX" into core\n",
+			 (uintmax_t)ds->base_offset);
+	base = unpack_entry(ds->pack, ds->base_offset, &type, &size);
+	if (!base)
+		return error("unable to read delta base");
+	if (size != ds->base_size) {
+		free(base);
+		return error("delta base size mismatch");
+	}
+	if (ds->base) {
+		close_istream(ds->base);
+		ds->base = NULL;
+	}
+	free(ds->window);
+	ds->window = base;
+	ds->win_start = 0;
+	ds->base_pos = size;
+	ds->base_in_core = 1;
+	return 0;
+}
+
+/* Make sure the window holds the base byte at offset "off" */
+static int fill_delta_window(struct delta_istream *ds, unsigned long off)
+{
+	if ((ds->base || ds->base_in_core) &&
+	    ds->win_start <= off && off < ds->base_pos)
+		return 0;
+
+	if (!ds->base || off < ds->win_start) {
+		if (ds->base) {
+			if (*ds->restarts) {
+				(*ds->restarts)--;
+				trace_printf_key(&trace_stream,
+						 "delta stream: restarting base at %"PRIuMAX"\n",
+						 (uintmax_t)ds->base_offset);
+			} else if (ds->base_size <= big_file_threshold) {
+				return read_delta_base_in_core(ds);
+			} else {
+				/* too big to hold; spend CPU, not memory */
+				trace_printf_key(&trace_stream,
+						 "delta stream: restarting base at %"PRIuMAX
+						 " over budget, as it is too large to hold\n",
+						 (uintmax_t)ds->base_offset);
+			}
+			close_istream(ds->base);
+		}
+		ds->base = open_istream_pack_entry(ds->pack, ds->base_offset,
+						   ds->restarts);
+		if (!ds->base)
+			return error("unable to stream delta base");
+		if (ds->base->size != ds->base_size)
+			return error("delta base size mismatch");
+		if (!ds->window)
+			ds->window = xmalloc(DELTA_BASE_WINDOW);
+		ds->win_start = ds->base_pos = 0;
+	}
+
+	while (ds->base_pos <= off) {
+		ssize_t got = read_istream(ds->base, ds->window,
+					   DELTA_BASE_WINDOW);
+		if (got <= 0)
+			return error("unable to read delta base");
+		ds->win_start = ds->base_pos;
+		ds->base_pos += got;
+	}
+	return 0;
+}
+
+/* Decode the next delta instruction into ds->insert/copy_off/todo */
+static int next_delta_op(struct delta_istream *ds)
+{
+	const unsigned char *data = ds->data, *top = ds->top;
+	unsigned char cmd;
+	int i;
+
+	if (data >= top)
+		goto bad;
+	cmd = *data++;
+	if (cmd & 0x80) {
+		unsigned long cp_off = 0, cp_size = 0;
+
+		for (i = 0; i < 4; i++) {
+			if (!(cmd & (0x01 << i)))
+				continue;
+			if (data >= top)
+				goto bad;
+			cp_off |= (unsigned long)*data++ << (i * 8);
+		}
+		for (i = 0; i < 3; i++) {
+			if (!(cmd & (0x10 << i)))
+				continue;
+			if (data >= top)
+				goto bad;
+			cp_size |= (unsigned long)*data++ << (i * 8);
+		}
+		if (cp_size == 0)
+			cp_size = 0x10000;
+		if (unsigned_add_overflows(cp_off, cp_size) ||
+		    cp_off + cp_size > ds->base_size ||
+		    cp_size > ds->remaining)
+			goto bad;
+		ds->insert = NULL;
+		ds->copy_off = cp_off;
+		ds->todo = cp_size;
+	} else if (cmd) {
+		if (cmd > ds->remaining || top - data < cmd)
+			goto bad;
+		ds->insert = data;
+		ds->todo = cmd;
+		data += cmd;
+	} else {
+		/* cmd == 0 is reserved, see patch_delta() */
+		return error("unexpected delta opcode 0");
+	}
+	ds->data = data;
+	return 0;
+
+bad:
+	return error("delta replay has gone wild");
+}
+
+static read_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &(st->u.delta);
+	size_t total_read = 0;
+
+	while (total_read < sz && ds->remaining) {
+		size_t n;
+
+		if (!ds->todo && next_delta_op(ds))
+			return -1;
+		n = sz - total_read;
+		if (ds->todo < n)
+			n = ds->todo;
+		if (ds->insert) {
+			memcpy(buf + total_read, ds->insert, n);
+			ds->insert += n;
+		} else {
+			if (fill_delta_window(ds, ds->copy_off))
+				return -1;
+			if (ds->base_pos - ds->copy_off < n)
+				n = ds->base_pos - ds->copy_off;
+			memcpy(buf + total_read,
+			       ds->window + (ds->copy_off - ds->win_start), n);
+			ds->copy_off += n;
+		}
+		ds->todo -= n;
+		ds->remaining -= n;
+		total_read += n;
+	}
+	if (!ds->remaining && ds->data != ds->top)
+		return error("delta replay has gone wild");
+	return total_read;
+}
+
+static close_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &(st->u.delta);
+
+	if (ds->base)
+		close_istream(ds->base);
+	free(ds->window);
+	free(ds->delta);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static open_method_decl(pack_delta)
+{
+	struct delta_istream *ds = &(st->u.delta);
+	struct pack_window *window = NULL;
+	off_t obj_offset = oi->u.packed.offset;
+	off_t pos = obj_offset;
+	enum object_type in_pack_type;
+	unsigned long delta_size;
+
+	memset(ds, 0, sizeof(*ds));
+	ds->pack = oi->u.packed.pack;
+	in_pack_type = unpack_object_header(ds->pack, &window, &pos,
+					    &delta_size);
+	switch (in_pack_type) {
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		ds->base_offset = get_delta_base(ds->pack, &window, &pos,
+						 in_pack_type, obj_offset);
+		break;
+	default:
+		break;
+	}
+	unuse_pack(&window);
+	if (!ds->base_offset || delta_size < DELTA_SIZE_MIN)
+		return -1;
+
+	ds->delta = xmallocz(delta_size);
+	if (inflate_pack_data(ds->pack, pos, ds->delta, delta_size)) {
+		free(ds->delta);
+		return -1;
+	}
+	ds->restarts_left = DELTA_BASE_MAX_RESTARTS;
+	ds->restarts = &ds->restarts_left;
+	ds->data = ds->delta;
+	ds->top = ds->delta + delta_size;
+	ds->base_size = get_delta_hdr_size(&ds->data, ds->top);
+	st->size = get_delta_hdr_size(&ds->data, ds->top);
+	ds->remaining = st->size;
+
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+test_description="Tests performance of adding many small files with core.bulkCheckin"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup' '
+	git init --bare many-packs.git &&
+	for i in $(test_seq 100)
+	do
+		echo "pack $i" |
+		git --git-dir=many-packs.git hash-object -w --stdin |
+		git --git-dir=many-packs.git pack-objects -q \
+			many-packs.git/objects/pack/pack >/dev/null || return 1
+	done &&
+	mkdir files &&
+	for i in $(test_seq 5000)
+	do
+		echo "file $i" >files/$i || return 1
+	done &&
+	ls files/* >paths
+'
+
+# every run writes into an empty object directory that borrows the
+# hundred packs, so that none of the files are known yet
+add_files () {
+	rm -rf objects idx &&
+	mkdir -p objects/pack &&
+	GIT_OBJECT_DIRECTORY=objects \
+	GIT_ALTERNATE_OBJECT_DIRECTORIES="$(pwd)/many-packs.git/objects" \
+	GIT_INDEX_FILE=idx \
+		git -c core.bulkCheckin=$1 update-index --add --stdin <paths
+}
+
+test_perf 'add 5000 files loose, 100 packs' '
+	add_files false
+'
+
+test_perf 'add 5000 files with bulkCheckin, 100 packs' '
+	add_files true
+'
+
+test_done
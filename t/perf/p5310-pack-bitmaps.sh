@@ -32,6 +32,37 @@ test_perf 'simulated fetch' '
 	} | git pack-objects --revs --stdout >/dev/null
 '
 
+# Compare the encodings of the bitmaps; sizes are reported as we go.
+for format in ewah roaring
+do
+	test_perf "repack with $format bitmaps" "
+		git -c pack.bitmapFormat=$format repack -ad
+	"
+
+	say "$format bitmap size: $(cat .git/objects/pack/*.bitmap | wc -c) bytes"
+
+	test_perf "simulated clone with $format bitmaps" '
+		git pack-objects --stdout --all </dev/null >/dev/null
+	'
+
+	test_perf "count commits with $format bitmaps" '
+		git rev-list --count --all --use-bitmap-index >/dev/null
+	'
+
+	test_perf "test-bitmap with $format bitmaps" '
+		git rev-list --test-bitmap HEAD >/dev/null 2>&1
+	'
+done
+
+# Build the bitmaps from scratch, without reusing the existing ones.
+for threads in 1 0
+do
+	test_perf "build bitmaps with pack.bitmapThreads=$threads" "
+		rm -f .git/objects/pack/*.bitmap &&
+		git -c pack.bitmapThreads=$threads repack -ad
+	"
+done
+
 test_expect_success 'create partial bitmap state' '
 	# pick a commit to represent the repo tip in the past
 	cutoff=$(git rev-list HEAD~100 -1) &&
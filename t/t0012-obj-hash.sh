@@ -0,0 +1,20 @@
+#!/bin/sh
+
+test_description='test the in-core object hash'
+. ./test-lib.sh
+
+test_expect_success 'objects are found, missing names are not' '
+	test-obj-hash verify 1000
+'
+
+test_expect_success 'lookups survive growing a large table' '
+	test-obj-hash verify 200000
+'
+
+test_expect_success 'perf mode runs' '
+	test-obj-hash perf 1000 >out &&
+	grep "^tagged hit:" out &&
+	grep "^plain hit:" out
+'
+
+test_done
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='hashing many messages at once'
+. ./test-lib.sh
+
+# test-sha1 --multi dies if any implementation gets a digest wrong
+test_expect_success 'short messages around the block boundaries' '
+	test-sha1 --multi 500 60 >out &&
+	grep "^scalar" out
+'
+
+test_expect_success 'empty messages' '
+	test-sha1 --multi 20 0
+'
+
+test_expect_success 'messages spanning many blocks' '
+	test-sha1 --multi 100 5000
+'
+
+test_expect_success 'long messages are hashed one by one' '
+	test-sha1 --multi 10 200000
+'
+
+test_expect_success 'hash-object --stdin-paths hashes in batches' '
+	for i in $(test_seq 1 100)
+	do
+		test-genrandom $i $(($i * 37)) >file-$i || return 1
+	done &&
+	test-genrandom big 100000 >file-big &&
+	ls file-* >paths &&
+	for f in $(cat paths)
+	do
+		git hash-object $f || return 1
+	done >expect &&
+	git hash-object --stdin-paths <paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack computes the same names' '
+	git add file-* &&
+	git commit -q -m files &&
+	git repack -a -d &&
+	idx=$(ls .git/objects/pack/pack-*.idx) &&
+	pack=${idx%.idx}.pack &&
+	git show-index <"$idx" | cut -d" " -f2 | sort >expect &&
+	git index-pack -o tmp.idx "$pack" &&
+	git show-index <tmp.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
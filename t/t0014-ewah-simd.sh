@@ -0,0 +1,53 @@
+#!/bin/sh
+
+test_description='vectorized EWAH bitmap operations'
+. ./test-lib.sh
+
+# test-ewah --bench dies if any implementation gets a result wrong
+test_expect_success 'mostly literal words' '
+	test-ewah --bench 5000 2 3 >out &&
+	grep "^scalar" out
+'
+
+test_expect_success 'mostly runs' '
+	test-ewah --bench 5000 2 1000
+'
+
+test_expect_success 'bitmaps shorter than a vector' '
+	for i in 1 2 3 4 5 7 9
+	do
+		test-ewah --bench $i 1 3 || return 1
+	done
+'
+
+test_expect_success 'long runs of literals' '
+	test-ewah --bench 200000 1 1000000
+'
+
+test_expect_success 'bitmap walks give the same answers with each kernel' '
+	for i in $(test_seq 1 40)
+	do
+		test_commit c-$i || return 1
+	done &&
+	git checkout -b side HEAD~20 &&
+	for i in $(test_seq 1 10)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git checkout master &&
+	git repack -adb &&
+	git rev-list --objects --all --use-bitmap-index | sort >expect &&
+	git rev-list --count --all --use-bitmap-index >expect.count &&
+	for impl in scalar sse2 avx2
+	do
+		GIT_TEST_EWAH_SIMD=$impl \
+			git rev-list --objects --all --use-bitmap-index |
+			sort >actual &&
+		test_cmp expect actual &&
+		GIT_TEST_EWAH_SIMD=$impl \
+			git rev-list --count --all --use-bitmap-index >actual &&
+		test_cmp expect.count actual || return 1
+	done
+'
+
+test_done
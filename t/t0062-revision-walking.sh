@@ -30,4 +30,30 @@ test_expect_success 'revision walking can be done twice' '
 	test_cmp run_twice_expected run_twice_actual
 '
 
+test_expect_success 'objects of a popped pool are gone' '
+	cat >expect <<-\EOF &&
+	 > add b
+	 > add a
+	objects left: 0
+	 > add b
+	 > add a
+	objects left: 0
+	EOF
+	test-revision-walking pooled-walks >actual 2>report &&
+	test_cmp expect actual &&
+	grep "^walk pool:" report &&
+	grep "^global pool:" report &&
+	grep "commit: *2 " report
+'
+
+test_expect_success 'objects parsed into a pool are unparsed when it goes' '
+	cat >expect <<-\EOF &&
+	 > add a
+	parsed: 0, objects left: 1
+	 > add a
+	EOF
+	test-revision-walking outer-commit >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -296,4 +296,55 @@ test_expect_success '%(deltabase) reports packed delta bases' '
 	}
 '
 
+test_expect_success 'setup objects for --unordered' '
+	echo loose >loose &&
+	git add loose &&
+	git commit -m loose &&
+	git rev-list --objects --all >all-objects &&
+	{
+		echo does-not-exist &&
+		sed "s/ .*//" all-objects &&
+		echo $_z40
+	} >unordered-input
+'
+
+test_expect_success '--batch-check --unordered shows the same objects' '
+	git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" \
+		<all-objects | sort >expect &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(rest)" \
+		--unordered <all-objects | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-check --unordered reports missing objects' '
+	git cat-file --batch-check --unordered <unordered-input >actual &&
+	grep "^does-not-exist missing$" actual &&
+	grep "^$_z40 missing$" actual &&
+	test_line_count = $(wc -l <unordered-input) actual
+'
+
+test_expect_success '--batch --unordered shows the same contents' '
+	git cat-file --batch <unordered-input >expect &&
+	git cat-file --batch --unordered <unordered-input >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success '--unordered without --batch is an error' '
+	test_must_fail git cat-file --unordered -t HEAD
+'
+
+test_expect_success '--unordered reads ahead before reading a pack' '
+	git -c pack.indexVersion=2 repack -adq &&
+	rm -f trace &&
+	GIT_TRACE_PACK_ACCESS="$(pwd)/trace" git cat-file --unordered \
+		--batch-check="%(objectname) %(deltabase)" <all-objects >actual &&
+	test_line_count = $(wc -l <all-objects) actual &&
+	grep " readahead$" trace &&
+	awk "/ readahead\$/ { split(\$2, r, \"-\"); to[\$1] = r[2]; next }
+	     !(\$1 in to) || \$2 + 0 > to[\$1] + 0 { print }" trace >unannounced &&
+	test_must_be_empty unannounced
+'
+
 test_done
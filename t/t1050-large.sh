@@ -163,4 +163,143 @@ test_expect_success 'zip achiving, deflate' '
 	git archive --format=zip HEAD >/dev/null
 '
 
+test_expect_success 'setup deltified large blobs' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		test-genrandom seed 2000000 >file &&
+		git add file &&
+		git commit -q -m 1 &&
+		for i in 2 3 4
+		do
+			{
+				head -c $(($i * 100000)) file &&
+				test-genrandom $i 5000 &&
+				tail -c +$(($i * 150000)) file &&
+				head -c 70000 file
+			} >file.new &&
+			mv file.new file &&
+			git commit -q -a -m $i &&
+			git cat-file blob HEAD:file >expect.$i || return 1
+		done &&
+		git -c core.bigfilethreshold=10m repack -adf &&
+		git verify-pack -v .git/objects/pack/*.idx >verify &&
+		grep "blob.* 3 [0-9a-f]*$" verify
+	)
+'
+
+test_expect_success 'cat-file streams deltified large blobs' '
+	(
+		cd delta &&
+		for i in 2 3 4
+		do
+			git cat-file blob HEAD~$((4 - $i)):file >actual &&
+			cmp expect.$i actual || return 1
+		done
+	)
+'
+
+test_expect_success 'checkout streams deltified large blobs' '
+	(
+		cd delta &&
+		rm file &&
+		git checkout HEAD~1 -- file &&
+		cmp expect.3 file
+	)
+'
+
+test_expect_success 'setup delta chain with backward copies' '
+	test_create_repo swapped &&
+	(
+		cd swapped &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		test-genrandom swapped 2000000 >file &&
+		git add file &&
+		git commit -q -m 1 &&
+		for i in 2 3 4 5 6
+		do
+			{
+				tail -c +1000001 file &&
+				test-genrandom $i 3000 &&
+				head -c 1000000 file
+			} >file.new &&
+			mv file.new file &&
+			git commit -q -a -m $i &&
+			git cat-file blob HEAD:file >expect.$i || return 1
+		done &&
+		git -c core.bigfilethreshold=10m repack -adf &&
+		git verify-pack -v .git/objects/pack/*.idx >verify &&
+		grep "blob.* 4 [0-9a-f]*$" verify
+	)
+'
+
+# GIT_ALLOC_LIMIT is still in effect, so no base may be read into core
+test_expect_success 'backward copies over large bases keep restarting the stream' '
+	(
+		cd swapped &&
+		for i in 5 4 3 2
+		do
+			rm -f trace &&
+			GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+				git cat-file blob HEAD~$((6 - $i)):file >actual &&
+			cmp expect.$i actual &&
+			grep "restarting base" trace &&
+			! grep "reading base at .* into core" trace || return 1
+		done &&
+		# the deepest one runs out of restarts
+		grep "over budget" trace
+	)
+'
+
+# fast-import deltifies every blob against the one before it, so the
+# bases of this chain are smaller than the objects built from them
+test_expect_success 'setup delta chain with backward copies over smaller bases' '
+	test_create_repo growing &&
+	(
+		cd growing &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		test-genrandom growing 2000000 >file &&
+		for i in 1 2 3 4 5 6
+		do
+			if test $i -gt 1
+			then
+				{
+					tail -c +1000001 file &&
+					test-genrandom $i 3000 &&
+					head -c 1000000 file
+				} >file.new &&
+				mv file.new file
+			fi &&
+			echo blob &&
+			echo "data $(wc -c <file)" &&
+			cat file &&
+			echo || return 1
+		done >stream &&
+		cp file expect &&
+		git -c core.bigfilethreshold=10m fast-import \
+			--big-file-threshold=10m <stream &&
+		git verify-pack -v .git/objects/pack/*.idx >verify &&
+		grep "blob.* 5 [0-9a-f]*$" verify
+	)
+'
+
+test_expect_success 'backward copies over small bases read them into core' '
+	(
+		cd growing &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		blob=$(git hash-object expect) &&
+		test $(wc -c <expect) = 2015000 &&
+		rm -f trace &&
+		GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+			git -c core.bigfilethreshold=2014000 \
+			cat-file blob $blob >actual &&
+		cmp expect actual &&
+		grep "restarting base" trace >restarts &&
+		test_line_count = 8 restarts &&
+		grep "reading base at .* into core" trace &&
+		! grep "over budget" trace
+	)
+'
+
 test_done
@@ -0,0 +1,92 @@
+#!/bin/sh
+
+test_description='writing many small objects into one pack'
+
+. ./test-lib.sh
+
+count_loose () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+count_packs () {
+	ls .git/objects/pack/pack-*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success 'setup' '
+	git config core.bulkCheckin true &&
+	mkdir files &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "content $i" >files/$i &&
+		echo "content $i" >files/copy-$i || return 1
+	done &&
+	git hash-object files/* | sort -u >expect-objects
+'
+
+test_expect_success 'add writes small files into a single pack' '
+	git add files &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	idx=$(ls .git/objects/pack/pack-*.idx) &&
+	git show-index <"$idx" >index &&
+	cut -d" " -f2 index | sort >actual-objects &&
+	test_cmp expect-objects actual-objects &&
+	git fsck
+'
+
+test_expect_success 'objects already present are not written again' '
+	echo "content 1" >files/again &&
+	git add files/again &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1
+'
+
+test_expect_success 'update-index --stdin writes into a single pack' '
+	for i in 1 2 3
+	do
+		echo "update-index $i" >files/ui-$i || return 1
+	done &&
+	ls files/ui-* | git update-index --add --stdin &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 2 &&
+	for i in 1 2 3
+	do
+		git cat-file blob :files/ui-$i >actual &&
+		test_cmp files/ui-$i actual || return 1
+	done
+'
+
+test_expect_success 'hash-object -w --stdin-paths writes into a single pack' '
+	for i in 1 2 3
+	do
+		echo "hash-object $i" >files/ho-$i || return 1
+	done &&
+	ls files/ho-* >paths &&
+	git hash-object --stdin-paths <paths >expect &&
+	git hash-object -w --stdin-paths <paths >actual &&
+	test_cmp expect actual &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 3 &&
+	git cat-file --batch-check <actual >info &&
+	! grep missing info
+'
+
+test_expect_success 'pack.packSizeLimit splits the pack' '
+	packs=$(count_packs) &&
+	for i in $(test_seq 1 50)
+	do
+		test-genrandom $i 4096 >files/random-$i || return 1
+	done &&
+	git -c pack.packSizeLimit=100k add files &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) -gt $(($packs + 1)) &&
+	git fsck
+'
+
+test_expect_success 'without core.bulkCheckin, small objects stay loose' '
+	echo loose >files/loose &&
+	git -c core.bulkCheckin=false add files/loose &&
+	test $(count_loose) = 1
+'
+
+test_done
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='core.looseObjectCache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1000)
+	do
+		echo $i >blob$i || return 1
+	done &&
+	git hash-object -w blob* >objects &&
+	rm -f blob* &&
+	test_commit one &&
+	test_commit two &&
+	git rev-list --objects --all | cut -c1-40 >>objects &&
+	sort -u objects >sorted &&
+	mv sorted objects
+'
+
+test_expect_success 'existence checks see loose objects' '
+	for obj in $(head -n 10 objects)
+	do
+		git -c core.looseObjectCache=true cat-file -e $obj || return 1
+	done &&
+	git -c core.looseObjectCache=true cat-file --batch-check <objects >actual &&
+	git cat-file --batch-check <objects >batch-expect &&
+	test_cmp batch-expect actual
+'
+
+test_expect_success 'missing objects are reported as missing' '
+	test_must_fail git -c core.looseObjectCache=true \
+		cat-file -e 0123456789012345678901234567890123456789
+'
+
+test_expect_success 'abbreviations are the same with and without cache' '
+	while read obj
+	do
+		git rev-parse --short=4 $obj &&
+		git -c core.looseObjectCache=true rev-parse --short=4 $obj ||
+		return 1
+	done <objects >abbrevs &&
+	sed -n "p;n" abbrevs >expect &&
+	sed -n "n;p" abbrevs >actual &&
+	test_cmp expect actual &&
+	grep "^.....$" expect
+'
+
+test_expect_success 'ambiguous prefixes are detected' '
+	cut -c1-4 objects | uniq -d >ambiguous &&
+	test -s ambiguous &&
+	while read prefix
+	do
+		test_must_fail git -c core.looseObjectCache=true \
+			rev-parse --verify --quiet $prefix || return 1
+	done <ambiguous
+'
+
+test_expect_success 'objects written by the same process are found' '
+	git config core.looseObjectCache true &&
+	echo three >three.t &&
+	git add three.t &&
+	git commit -m three &&
+	git rev-parse --short HEAD >abbrev &&
+	git cat-file -e $(cat abbrev)^{tree} &&
+	git fsck
+'
+
+test_expect_success 'write-tree checks existence through the cache' '
+	git cat-file --batch-check <objects |
+	sed -n "s/^\([0-9a-f]*\) blob .*/100644 \1	path-\1/p" >index-info &&
+	GIT_INDEX_FILE=tmp-index git update-index --index-info <index-info &&
+	GIT_INDEX_FILE=tmp-index git write-tree >expect &&
+	rm -f tmp-index &&
+	GIT_INDEX_FILE=tmp-index git update-index --index-info <index-info &&
+	GIT_INDEX_FILE=tmp-index \
+		git -c core.looseObjectCache=true write-tree >actual &&
+	test_cmp expect actual &&
+	echo "100644 0123456789012345678901234567890123456789	missing" |
+	GIT_INDEX_FILE=tmp-index git update-index --index-info &&
+	GIT_INDEX_FILE=tmp-index \
+		test_must_fail git -c core.looseObjectCache=true write-tree &&
+	rm -f tmp-index
+'
+
+test_expect_success 'many objects written by the same process are found' '
+	for i in $(test_seq 300)
+	do
+		echo $i >file$i || return 1
+	done &&
+	git add file* &&
+	git commit -q -m files &&
+	for i in $(test_seq 300)
+	do
+		echo changed $i >file$i || return 1
+	done &&
+	git -c core.looseObjectCache=true commit -q -a -m changed &&
+	git ls-tree HEAD | grep file | cut -f1 | cut -d" " -f3 >written &&
+	test_line_count = 300 written &&
+	while read obj
+	do
+		git -c core.looseObjectCache=true rev-parse --short $obj ||
+		return 1
+	done <written >abbrevs &&
+	git -c core.looseObjectCache=true rev-parse $(cat abbrevs) >actual &&
+	test_cmp written actual &&
+	git fsck
+'
+
+test_expect_success 'loose objects in alternates are found' '
+	git clone -s . clone &&
+	(
+		cd clone &&
+		git config core.looseObjectCache true &&
+		git cat-file --batch-check <../objects >actual &&
+		test_cmp ../batch-expect actual
+	)
+'
+
+test_done
@@ -18,8 +18,7 @@ test_expect_success 'setup repo with moderate-sized history' '
 	git checkout master &&
 	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
 	git tag tagged-blob $blob &&
-	git config repack.writebitmaps true &&
-	git config pack.writebitmaphashcache true
+	git config repack.writebitmaps true
 '
 
 test_expect_success 'full repack creates bitmaps' '
@@ -28,6 +27,14 @@ test_expect_success 'full repack creates bitmaps' '
 	test_line_count = 1 output
 '
 
+test_expect_success 'bitmaps carry a name-hash cache by default' '
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	# the options are the two bytes after the magic and version
+	printf "\\000\\005" >expect &&
+	dd if=$bitmap bs=1 skip=6 count=2 2>/dev/null >actual &&
+	cmp expect actual
+'
+
 test_expect_success 'rev-list --test-bitmap verifies bitmaps' '
 	git rev-list --test-bitmap HEAD
 '
@@ -146,6 +153,47 @@ test_expect_success 'pack with missing parent' '
 	git pack-objects --stdout --revs <revs >/dev/null
 '
 
+test_expect_success 'setup history with deltas between same-named files' '
+	git init deltas &&
+	(
+		cd deltas &&
+		for i in $(test_seq 1 8)
+		do
+			for f in $(test_seq 1 10)
+			do
+				test_seq $(($f * 1000)) $(($f * 1000 + 100 + $i * 3)) |
+				sed "s/^/line $f /" >file$f || return 1
+			done &&
+			git add . &&
+			test_tick &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		echo HEAD >revs &&
+		git -c pack.useBitmaps=false pack-objects --revs --threads=1 \
+			--no-reuse-delta --stdout <revs >expect.pack
+	)
+'
+
+test_expect_success 'pack from bitmaps finds the same deltas as a traversal' '
+	(
+		cd deltas &&
+		git repack -adb &&
+		git pack-objects --revs --threads=1 --no-reuse-delta \
+			--stdout <revs >actual.pack &&
+		test $(wc -c <expect.pack) = $(wc -c <actual.pack)
+	)
+'
+
+test_expect_success 'pack from bitmaps without the hash cache is worse' '
+	(
+		cd deltas &&
+		git -c pack.writeBitmapHashCache=false repack -adbf &&
+		git pack-objects --revs --threads=1 --no-reuse-delta \
+			--stdout <revs >actual.pack &&
+		test $(wc -c <expect.pack) -lt $(wc -c <actual.pack)
+	)
+'
+
 test_lazy_prereq JGIT '
 	type jgit
 '
@@ -164,7 +212,7 @@ test_expect_success JGIT 'jgit can read our bitmaps' '
 	git clone . compat-us &&
 	(
 		cd compat-us &&
-		git repack -adb &&
+		git -c pack.writeBitmapHashCache=false repack -adb &&
 		# jgit gc will barf if it does not like our bitmaps
 		jgit gc
 	)
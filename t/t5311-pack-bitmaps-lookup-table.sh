@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='bitmap index with a commit lookup table'
+. ./test-lib.sh
+
+bitmap_options () {
+	od -An -tx1 -j6 -N2 "$1" | tr -d " "
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 40)
+	do
+		test_commit $i || return 1
+	done &&
+	git checkout -b other HEAD~20 &&
+	for i in $(test_seq 1 20)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git checkout master &&
+	git config repack.writebitmaps true &&
+	git config pack.writebitmaphashcache true
+'
+
+test_expect_success 'repack without a lookup table' '
+	git repack -ad &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test "$(bitmap_options $bitmap)" = 0005 &&
+	for rev in HEAD HEAD~3 other other~7 HEAD~20
+	do
+		git rev-list --use-bitmap-index --objects $rev >tmp &&
+		sort tmp >expect-$(git rev-parse $rev) &&
+		git rev-list --use-bitmap-index --count master..$rev \
+			>>expect-counts || return 1
+	done
+'
+
+test_expect_success 'pack.writeBitmapLookupTable writes the table' '
+	git config pack.writeBitmapLookupTable true &&
+	git repack -ad &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test "$(bitmap_options $bitmap)" = 0015
+'
+
+test_expect_success 'bitmaps read through the table are the same' '
+	for rev in HEAD HEAD~3 other other~7 HEAD~20
+	do
+		git rev-list --test-bitmap $rev &&
+		git rev-list --use-bitmap-index --objects $rev >tmp &&
+		sort tmp >actual &&
+		test_cmp expect-$(git rev-parse $rev) actual &&
+		git rev-list --use-bitmap-index --count master..$rev \
+			>>actual-counts || return 1
+	done &&
+	test_cmp expect-counts actual-counts
+'
+
+test_expect_success 'clone using bitmaps read through the table' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD other >expect &&
+	git --git-dir=clone.git rev-parse HEAD other >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental fetch using the table' '
+	git checkout other &&
+	test_commit side-more &&
+	git checkout master &&
+	git repack -ad &&
+	git --git-dir=clone.git fetch --no-tags . other:other &&
+	test "$(git --git-dir=clone.git rev-parse other)" = \
+		"$(git rev-parse other)"
+'
+
+test_expect_success 'bitmaps are reused when repacking with a table' '
+	test_commit more &&
+	git repack -ad &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other
+'
+
+test_expect_success 'a corrupt table row is noticed' '
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod +w $bitmap &&
+	nr_objects=$(git rev-list --objects --all | wc -l) &&
+	size=$(wc -c <$bitmap) &&
+	# point the first row at the start of the file
+	row=$(($size - 20 - 4 * $nr_objects - 16 * $(git rev-list --all | wc -l))) &&
+	printf "\\0\\0\\0\\0\\0\\0\\0\\0" |
+	dd of=$bitmap bs=1 seek=$(($row + 4)) conv=notrunc 2>/dev/null &&
+	git rev-list --use-bitmap-index --count --all >actual 2>err &&
+	git rev-list --count --all >expect &&
+	test_cmp expect actual &&
+	grep "bad entry offset" err
+'
+
+test_done
@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='commit reachability answered from bitmaps'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in $(test_seq 1 15)
+	do
+		test_commit master-$i || return 1
+	done &&
+	git tag -a -m annotated annotated HEAD~10 &&
+	git checkout -b topic HEAD~8 &&
+	for i in $(test_seq 1 12)
+	do
+		test_commit topic-$i || return 1
+	done &&
+	git merge -m merge master~3 &&
+	test_commit topic-after-merge &&
+	git checkout -b tracking --track master &&
+	git reset --hard master~6 &&
+	test_commit tracking-1 &&
+	git checkout -b other --track topic &&
+	git reset --hard topic~5 &&
+	git checkout master
+'
+
+# Run the queries of interest, writing their results to "$1".
+queries () {
+	for range in master topic master..topic topic..master \
+		master~2..topic~4 "topic ^master~5 ^annotated" annotated..master
+	do
+		git rev-list --count $range || return 1
+	done >"$1" &&
+	git rev-list --count --left-right master...topic >>"$1" &&
+	git rev-list --count --left-right topic...tracking >>"$1" &&
+	git rev-list --count --left-right master topic >>"$1" &&
+	git for-each-ref --format="%(refname) %(upstream:track)" \
+		refs/heads >>"$1" &&
+	git branch -vv | sed "s/[0-9a-f]\{7\}//" >>"$1" &&
+	git tag --contains master~12 >>"$1" &&
+	git tag --contains topic~3 >>"$1" &&
+	git tag --contains annotated >>"$1" &&
+	git branch --contains master~3 >>"$1" &&
+	git branch --contains topic~6 >>"$1"
+}
+
+test_expect_success 'answers without bitmaps' '
+	queries expect &&
+	# make sure the queries look at something interesting
+	grep "ahead 1, behind 6" expect &&
+	grep "^topic-after-merge$" expect
+'
+
+test_expect_success 'same answers with bitmaps' '
+	git repack -adb &&
+	ls .git/objects/pack/*.bitmap &&
+	queries actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'same answers with commits the bitmaps do not cover' '
+	git checkout topic &&
+	test_commit topic-unpacked &&
+	git checkout tracking &&
+	test_commit tracking-unpacked &&
+	git checkout master &&
+	test_commit master-unpacked &&
+	rm -f .git/objects/pack/*.bitmap &&
+	queries expect &&
+	git repack -adb &&
+	git checkout topic &&
+	test_commit topic-loose &&
+	git checkout master &&
+	test_commit master-loose &&
+	git pack-refs --all &&
+	mv .git/objects/pack/*.bitmap . &&
+	queries expect &&
+	mv *.bitmap .git/objects/pack/ &&
+	queries actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmaps are not used with grafts' '
+	echo $(git rev-parse master~2 master~5) >.git/info/grafts &&
+	mv .git/objects/pack/*.bitmap . &&
+	queries expect &&
+	mv *.bitmap .git/objects/pack/ &&
+	queries actual &&
+	test_cmp expect actual &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'bitmaps are not used with replace refs' '
+	git replace master~2 master~5 &&
+	mv .git/objects/pack/*.bitmap . &&
+	queries expect &&
+	mv *.bitmap .git/objects/pack/ &&
+	queries actual &&
+	test_cmp expect actual &&
+	git replace -d master~2
+'
+
+test_expect_success 'limited walks still give the same counts' '
+	git rev-list --count --max-count=3 master >actual &&
+	echo 3 >expect &&
+	test_cmp expect actual &&
+	git rev-list --count --no-merges topic >actual &&
+	git rev-list --no-merges topic | wc -l | tr -d " " >expect &&
+	test_cmp expect actual &&
+	git rev-list --count topic -- master-1.t >actual &&
+	echo 1 >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,92 @@
+#!/bin/sh
+
+test_description='upload-pack negotiation using bitmaps'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git clone --no-local . client &&
+	# the client sends "base" first, and then haves we do not have
+	(
+		cd client &&
+		for i in $(test_seq 10 50)
+		do
+			echo $i >client-$i &&
+			git add client-$i &&
+			GIT_COMMITTER_DATE="@10000$i +0000" \
+			git commit -q -m client-$i || return 1
+		done
+	) &&
+	# commits dated before "base", so that walking back from the wants
+	# by date gives up before finding it
+	for i in $(test_seq 1 5)
+	do
+		echo $i >old-$i &&
+		git add old-$i &&
+		GIT_COMMITTER_DATE="@1000000$i +0000" \
+		git commit -q -m old-$i || return 1
+	done &&
+	git checkout -b side base &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git checkout master &&
+	git repack -adb
+'
+
+fetch_trace () {
+	rm -rf "$1" &&
+	cp -R client "$1" &&
+	(
+		cd "$1" &&
+		GIT_TRACE_PACKET="$(pwd)/../$1.trace" git fetch origin &&
+		git fsck &&
+		git rev-parse origin/master origin/side >../$1.refs
+	)
+}
+
+test_expect_success 'fetch with bitmaps says ready as soon as it can' '
+	fetch_trace bitmap &&
+	git rev-parse master side >expect &&
+	test_cmp expect bitmap.refs &&
+	grep "fetch< ACK $(git rev-parse base) common" bitmap.trace &&
+	grep "fetch< ACK [0-9a-f]* ready" bitmap.trace
+'
+
+test_expect_success 'fetch without bitmaps gives the same refs' '
+	mv .git/objects/pack/*.bitmap . &&
+	fetch_trace walk &&
+	mv *.bitmap .git/objects/pack/ &&
+	test_cmp bitmap.refs walk.refs &&
+	# the walk by date cannot tell that "base" is enough
+	! grep "fetch< ACK [0-9a-f]* ready" walk.trace
+'
+
+test_expect_success 'haves outside the bitmapped pack are found' '
+	git checkout master &&
+	test_commit loose-1 &&
+	(
+		cd bitmap &&
+		git fetch origin &&
+		git checkout -q -b more origin/master &&
+		for i in $(test_seq 1 20)
+		do
+			test_commit more-$i || return 1
+		done
+	) &&
+	git checkout -b unpacked loose-1 &&
+	test_commit unpacked-1 &&
+	git checkout master &&
+	(
+		cd bitmap &&
+		GIT_TRACE_PACKET="$(pwd)/../more.trace" git fetch origin &&
+		git fsck &&
+		git rev-parse origin/unpacked >../actual
+	) &&
+	git rev-parse unpacked >expect &&
+	test_cmp expect actual &&
+	grep "fetch< ACK [0-9a-f]* ready" more.trace
+'
+
+test_done
@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='bitmap index in the roaring encoding'
+. ./test-lib.sh
+
+bitmap_version () {
+	od -An -tx1 -j4 -N2 "$1" | tr -d " "
+}
+
+# test-ewah --roaring dies if the bitmap does not come back the same
+test_expect_success 'roaring encoding round trip' '
+	test-ewah --roaring 100 3 0 &&
+	test-ewah --roaring 65536 1 0 &&
+	test-ewah --roaring 70000 0 3 &&
+	test-ewah --roaring 300000 30000 5 &&
+	test-ewah --roaring 1000000 200000 0
+'
+
+test_expect_success 'scattered bits take less space than with EWAH' '
+	test-ewah --roaring 1000000 2000 0 >sizes &&
+	ewah=$(sed -n "s/^ewah //p" sizes) &&
+	roaring=$(sed -n "s/^roaring //p" sizes) &&
+	test $roaring -lt $(($ewah / 4))
+'
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 40)
+	do
+		test_commit $i || return 1
+	done &&
+	git tag -a -m annotated annotated HEAD~5 &&
+	git checkout -b other HEAD~20 &&
+	for i in $(test_seq 1 20)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git checkout master &&
+	git repack -adb &&
+	test "$(bitmap_version .git/objects/pack/*.bitmap)" = 0001 &&
+	for rev in 40 37 side-20 side-13 20 annotated
+	do
+		git rev-list --use-bitmap-index --objects $rev >tmp &&
+		sort tmp >expect-$rev &&
+		git rev-list --use-bitmap-index --count 40..$rev \
+			>>expect-counts || return 1
+	done
+'
+
+check_bitmaps () {
+	git rev-list --test-bitmap 40 &&
+	git rev-list --test-bitmap side-20 &&
+	for rev in 40 37 side-20 side-13 20 annotated
+	do
+		git rev-list --use-bitmap-index --objects $rev >tmp &&
+		sort tmp >actual &&
+		test_cmp expect-$rev actual &&
+		git rev-list --use-bitmap-index --count 40..$rev \
+			>>actual-counts || return 1
+	done &&
+	test_cmp expect-counts actual-counts &&
+	rm actual-counts
+}
+
+test_expect_success 'pack.bitmapFormat=roaring writes version 2' '
+	git config pack.bitmapFormat roaring &&
+	git repack -adb &&
+	test "$(bitmap_version .git/objects/pack/*.bitmap)" = 0002
+'
+
+test_expect_success 'roaring bitmaps give the same answers' '
+	check_bitmaps
+'
+
+test_expect_success 'roaring bitmaps with a lookup table' '
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	check_bitmaps
+'
+
+test_expect_success 'clone from roaring bitmaps' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD other >expect &&
+	git --git-dir=clone.git rev-parse HEAD other >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'repack from roaring to EWAH bitmaps and back' '
+	test_commit more &&
+	git -c pack.bitmapFormat=ewah repack -adb &&
+	test "$(bitmap_version .git/objects/pack/*.bitmap)" = 0001 &&
+	check_bitmaps &&
+	test_commit even-more &&
+	git repack -adb &&
+	test "$(bitmap_version .git/objects/pack/*.bitmap)" = 0002 &&
+	check_bitmaps
+'
+
+test_expect_success 'unknown bitmap formats are rejected' '
+	test_must_fail git -c pack.bitmapFormat=bogus repack -adb
+'
+
+test_expect_success 'corrupt roaring bitmaps are noticed' '
+	git repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod +w $bitmap &&
+	# the number of containers of the commit type bitmap
+	printf "\377\377\377\377" |
+		dd of=$bitmap bs=1 seek=36 conv=notrunc &&
+	git rev-list --use-bitmap-index --count HEAD >actual 2>err &&
+	grep "corrupted" err &&
+	git rev-list --count HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='building bitmaps with several threads'
+. ./test-lib.sh
+
+# Several branches whose commits alternate in time, so that the selected
+# commits do not all descend from each other and make several chains.
+test_expect_success 'setup' '
+	test_commit base &&
+	for b in one two three four
+	do
+		git branch $b || return 1
+	done &&
+	for i in $(test_seq 1 15)
+	do
+		for b in master one two three four
+		do
+			git checkout -q $b &&
+			test_commit $b-$i || return 1
+		done
+	done &&
+	git checkout -q master &&
+	git merge -q -m merge one two &&
+	git config pack.threads 1 &&
+	# the order of the objects in the pack, and so the bitmaps, only
+	# settles once they are all packed
+	git repack -ad &&
+	git repack -ad
+'
+
+build_bitmap () {
+	rm -f .git/objects/pack/*.bitmap &&
+	git -c pack.bitmapThreads=$1 repack -adb &&
+	cp .git/objects/pack/*.bitmap $1.bitmap
+}
+
+test_expect_success 'build bitmaps with one thread' '
+	build_bitmap 1 &&
+	git rev-list --test-bitmap master
+'
+
+test_expect_success 'build bitmaps with four threads' '
+	build_bitmap 4 &&
+	git rev-list --test-bitmap master &&
+	test_cmp 1.bitmap 4.bitmap
+'
+
+test_expect_success 'build bitmaps with as many threads as CPUs' '
+	build_bitmap 0 &&
+	test_cmp 1.bitmap 0.bitmap
+'
+
+# Repack reusing the bitmaps of the current pack, then put the pack back.
+reuse_bitmap () {
+	rm -rf saved &&
+	cp -R .git/objects/pack saved &&
+	git -c pack.bitmapThreads=$1 repack -adb &&
+	cp .git/objects/pack/*.bitmap reuse-$1.bitmap &&
+	rm -rf .git/objects/pack &&
+	mv saved .git/objects/pack
+}
+
+test_expect_success 'reused bitmaps give the same result' '
+	reuse_bitmap 1 &&
+	reuse_bitmap 4 &&
+	test_cmp reuse-1.bitmap reuse-4.bitmap
+'
+
+test_expect_success 'new history on every branch' '
+	for b in master one two three four
+	do
+		git checkout -q $b &&
+		test_commit $b-new || return 1
+	done &&
+	git checkout -q master &&
+	git repack -adb &&
+	reuse_bitmap 1 &&
+	reuse_bitmap 4 &&
+	test_cmp reuse-1.bitmap reuse-4.bitmap &&
+	build_bitmap 1 &&
+	build_bitmap 4 &&
+	test_cmp 1.bitmap 4.bitmap &&
+	for b in master one two three four
+	do
+		git rev-list --objects $b >list &&
+		cut -d" " -f1 list | sort >expect &&
+		git rev-list --objects --use-bitmap-index $b >list &&
+		cut -d" " -f1 list | sort >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'pack.bitmapThreads must not be negative' '
+	test_must_fail git -c pack.bitmapThreads=-1 repack -adb 2>err &&
+	grep "invalid number of threads" err
+'
+
+test_done
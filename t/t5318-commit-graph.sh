@@ -0,0 +1,180 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+. ./test-lib.sh
+
+graph_read_expect () {
+	NUM_COMMITS=$1
+	CHUNKS=$2
+	cat >expect <<-EOF &&
+	header: 43475048 1 1 $3 0
+	num_commits: $NUM_COMMITS
+	chunks: oid-fanout oid-lookup commit-metadata$CHUNKS
+	EOF
+	test-read-graph >actual &&
+	test_cmp expect actual
+}
+
+graph_git_two_modes () {
+	git -c core.commitGraph=true $1 >output &&
+	git -c core.commitGraph=false $1 >expect &&
+	test_cmp expect output
+}
+
+graph_git_behavior () {
+	graph_git_two_modes "log --format=%H --topo-order --all" &&
+	graph_git_two_modes "log --format=%H --graph --all" &&
+	graph_git_two_modes "log --format=%H --date-order --all" &&
+	graph_git_two_modes "log --format=%H --topo-order -3 side" &&
+	graph_git_two_modes "log --format=%H --topo-order side..master" &&
+	graph_git_two_modes "merge-base --all side master" &&
+	graph_git_two_modes "merge-base --octopus side other master" &&
+	graph_git_two_modes "tag --contains first" &&
+	graph_git_two_modes "branch --contains side~1" &&
+	for a in first side other master
+	do
+		for b in first side other master
+		do
+			git -c core.commitGraph=true merge-base --is-ancestor $a $b
+			with=$?
+			git -c core.commitGraph=false merge-base --is-ancestor $a $b
+			test $with = $? || return 1
+		done
+	done
+}
+
+test_expect_success 'write graph with no commits' '
+	git commit-graph write &&
+	test_path_is_file .git/objects/info/commit-graph &&
+	graph_read_expect 0 "" 3
+'
+
+test_expect_success 'create history with merges' '
+	test_commit first &&
+	git branch side &&
+	git branch other &&
+	test_commit two &&
+	git checkout side &&
+	test_commit side-1 &&
+	test_commit side-2 &&
+	git checkout other &&
+	test_commit other-1 &&
+	git checkout master &&
+	test_tick &&
+	git merge -m "merge side" side &&
+	test_commit three &&
+	git checkout side &&
+	test_commit side-3 &&
+	git checkout master &&
+	test_tick &&
+	git merge -m octopus side other &&
+	test_commit four &&
+	git repack -a -d -q
+'
+
+test_expect_success 'write graph from packed commits' '
+	git commit-graph write &&
+	graph_read_expect 10 " extra-edges" 4
+'
+
+test_expect_success 'walks give the same results with the graph' '
+	graph_git_behavior
+'
+
+test_expect_success 'commits made later are not covered, but still found' '
+	git checkout side &&
+	test_commit side-4 &&
+	git checkout master &&
+	test_tick &&
+	git merge -m "merge side again" side &&
+	graph_read_expect 10 " extra-edges" 4 &&
+	graph_git_behavior
+'
+
+test_expect_success 'write graph from refs, including loose commits' '
+	git commit-graph write --reachable &&
+	graph_read_expect 12 " extra-edges" 4 &&
+	graph_git_behavior
+'
+
+test_expect_success 'parents are read from the graph' '
+	git checkout -b loose &&
+	test_commit loose-1 &&
+	test_commit loose-2 &&
+	git commit-graph write --reachable &&
+	commit=$(git rev-parse loose-1) &&
+	file=.git/objects/$(echo $commit | sed "s/^../&\//") &&
+	mv $file loose-1.obj &&
+	git rev-list loose >actual &&
+	grep $commit actual &&
+	test_must_fail git -c core.commitGraph=false rev-list loose &&
+	mv loose-1.obj $file
+'
+
+test_expect_success 'graph is ignored with grafts' '
+	test_when_finished "rm -f .git/info/grafts" &&
+	echo "$(git rev-parse four) $(git rev-parse first)" >.git/info/grafts &&
+	git rev-list master >actual &&
+	git -c core.commitGraph=false rev-list master >expect &&
+	test_cmp expect actual &&
+	git log --format=%H -2 four >actual &&
+	git rev-parse four first >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'graph is ignored with replace refs' '
+	test_when_finished "git replace -d $(git rev-parse two)" &&
+	git replace two side-1 &&
+	git log --format=%s -3 three >actual &&
+	git -c core.commitGraph=false log --format=%s -3 three >expect &&
+	test_cmp expect actual &&
+	git --no-replace-objects log --format=%s --topo-order three >actual &&
+	git -c core.commitGraph=false --no-replace-objects \
+		log --format=%s --topo-order three >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'shallow fetch and deepen from a repository with a graph' '
+	test_when_finished "rm -rf with-graph without-graph" &&
+	git commit-graph write --reachable &&
+	git clone -q --no-local --depth 2 --branch master . with-graph &&
+	git clone -q --no-local --depth 2 --branch master \
+		--upload-pack="git -c core.commitGraph=false upload-pack" . without-graph &&
+	git -C with-graph rev-list --all >actual &&
+	git -C without-graph rev-list --all >expect &&
+	test_cmp expect actual &&
+	test_cmp without-graph/.git/shallow with-graph/.git/shallow &&
+	git -C with-graph fetch -q --depth 4 origin master &&
+	git -C without-graph fetch -q --depth 4 \
+		--upload-pack="git -c core.commitGraph=false upload-pack" origin master &&
+	git -C with-graph rev-list --all >actual &&
+	git -C without-graph rev-list --all >expect &&
+	test_cmp expect actual &&
+	test_cmp without-graph/.git/shallow with-graph/.git/shallow &&
+	git -C with-graph fsck
+'
+
+test_expect_success 'pack-objects honours --shallow lines after the graph is loaded' '
+	test_when_finished "rm -f in *.pack *.idx" &&
+	printf "%s\n--shallow %s\n" $(git rev-parse master master~1) >in &&
+	git pack-objects --revs --stdout <in >with.pack &&
+	git -c core.commitGraph=false pack-objects --revs --stdout \
+		<in >without.pack &&
+	git index-pack -o with.idx with.pack &&
+	git index-pack -o without.idx without.pack &&
+	git show-index <with.idx | cut -d" " -f2 | sort >actual &&
+	git show-index <without.idx | cut -d" " -f2 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt graph is ignored' '
+	cp .git/objects/info/commit-graph graph.bak &&
+	test_when_finished "mv graph.bak .git/objects/info/commit-graph" &&
+	printf XXXX | dd of=.git/objects/info/commit-graph bs=1 conv=notrunc 2>/dev/null &&
+	git rev-list --all >actual 2>err &&
+	git -c core.commitGraph=false rev-list --all >expect &&
+	test_cmp expect actual &&
+	grep "bad signature" err
+'
+
+test_done
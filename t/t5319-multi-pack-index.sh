@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='multi-pack-indexes'
+. ./test-lib.sh
+
+midx_read_expect () {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	{
+		cat <<-EOF &&
+		header: 4d494458 1 1 4
+		chunks: pack-names oid-fanout oid-lookup object-offsets
+		num_packs: $NUM_PACKS
+		num_objects: $NUM_OBJECTS
+		packs:
+		EOF
+		ls .git/objects/pack/ | grep idx | sort &&
+		echo "object-dir: .git/objects"
+	} >expect &&
+	test-read-midx .git/objects >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'write midx with no packs' '
+	git multi-pack-index --object-dir=.git/objects write &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	midx_read_expect 0 0
+'
+
+test_expect_success 'create objects and packs' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i &&
+		git repack -q || return 1
+	done &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	test_line_count = 15 objects
+'
+
+test_expect_success 'write midx with five packs' '
+	git multi-pack-index write &&
+	midx_read_expect 5 15
+'
+
+test_expect_success 'objects are readable through the midx' '
+	git rev-list --objects --all | cut -d" " -f1 >actual &&
+	test_cmp objects actual &&
+	git cat-file --batch-check <objects >expect &&
+	git -c core.multiPackIndex=false cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'objects in packs added later are still found' '
+	test_commit 6 &&
+	git repack -q &&
+	git rev-list --objects --all | cut -d" " -f1 >all &&
+	test_line_count = 18 all &&
+	git cat-file --batch-check <all >actual &&
+	! grep missing actual
+'
+
+test_expect_success 'duplicate objects are listed once' '
+	git repack -q -a &&
+	git multi-pack-index write &&
+	midx_read_expect 7 18
+'
+
+test_expect_success 'midx is not reported as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'repack -d removes a stale midx' '
+	git repack -a -d -q &&
+	test_path_is_missing .git/objects/pack/multi-pack-index &&
+	git cat-file --batch-check <all >actual &&
+	! grep missing actual
+'
+
+test_expect_success 'repack --write-midx writes a fresh midx' '
+	test_commit 7 &&
+	git repack -q --write-midx &&
+	midx_read_expect 2 21 &&
+	git rev-list --objects --all | cut -d" " -f1 >all &&
+	git cat-file --batch-check <all >actual &&
+	! grep missing actual
+'
+
+test_expect_success 'corrupt midx is ignored' '
+	midx=.git/objects/pack/multi-pack-index &&
+	chmod u+w $midx &&
+	printf "XXXX" | dd of=$midx bs=1 conv=notrunc 2>/dev/null &&
+	git cat-file --batch-check <all >actual 2>err &&
+	! grep missing actual &&
+	grep "bad signature" err
+'
+
+test_done
@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit $i &&
+		echo "$i$i$i" >>file &&
+		git add file &&
+		git commit -q -m "file $i" || return 1
+	done &&
+	git repack -ad &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk) %(deltabase)" \
+		<objects >expect.disk &&
+	git pack-objects --stdout --delta-base-offset <objects >expect.pack
+'
+
+test_expect_success 'index-pack does not write a .rev by default' '
+	rm -f $packdir/*.idx &&
+	git index-pack $pack &&
+	test_path_is_missing $rev
+'
+
+test_expect_success 'index-pack --rev-index writes a .rev' '
+	rm -f $packdir/*.idx &&
+	git index-pack --rev-index $pack &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'pack.writeReverseIndex makes index-pack write a .rev' '
+	rm -f $packdir/*.idx $rev &&
+	git -c pack.writeReverseIndex=true index-pack $pack &&
+	test_path_is_file $rev
+'
+
+test_expect_success '--no-rev-index overrides the configuration' '
+	rm -f $packdir/*.idx $rev &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index $pack &&
+	test_path_is_missing $rev &&
+	git index-pack --rev-index $pack
+'
+
+test_expect_success 'disk sizes and delta bases agree with the .rev' '
+	git cat-file --batch-check="%(objectname) %(objectsize:disk) %(deltabase)" \
+		<objects >actual &&
+	test_cmp expect.disk actual
+'
+
+test_expect_success 'pack-objects output is unchanged with a .rev' '
+	git pack-objects --stdout --delta-base-offset <objects >actual.pack &&
+	test_cmp expect.pack actual.pack
+'
+
+test_expect_success 'repack writes a .rev with pack.writeReverseIndex' '
+	rm -f $rev &&
+	git -c pack.writeReverseIndex=true repack -adf &&
+	newpack=$(ls $packdir/pack-*.pack) &&
+	test_path_is_file ${newpack%.pack}.rev &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual &&
+	git -c pack.writeReverseIndex=false repack -adf &&
+	ls $packdir >files &&
+	! grep "\.rev$" files &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a .rev that does not match its pack is ignored' '
+	git repack -adf &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	git index-pack --rev-index $pack &&
+	chmod u+w $rev &&
+	printf "XXXXXXXXXXXXXXXXXXXX" |
+		dd of=$rev bs=1 seek=$(($(wc -c <$rev) - 40)) conv=notrunc 2>/dev/null &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual 2>err &&
+	grep "does not match its pack" err &&
+	rm -f $rev &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '.rev is not reported as garbage' '
+	git index-pack --rev-index $pack 2>/dev/null &&
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_done
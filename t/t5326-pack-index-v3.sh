@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='pack index version 3 with object types and sizes'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+idx_version () {
+	# the signature, then the version in the next 4 bytes
+	od -An -tx1 -j7 -N1 "$1" | tr -d " "
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		test_seq 1 $(($i * 50)) >file$(($i % 3)) &&
+		git add . &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git tag -a -m tag v1 &&
+	git branch old HEAD~5 &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git -c pack.indexVersion=2 repack -adf &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >expect
+'
+
+test_expect_success 'pack.indexVersion=3 writes a version 3 index' '
+	git -c pack.indexVersion=3 repack -adf &&
+	idx=$(ls $packdir/pack-*.idx) &&
+	test "$(idx_version $idx)" = 03 &&
+	git verify-pack $idx
+'
+
+test_expect_success 'object info is the same as with version 2' '
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect actual &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		--unordered <objects >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'show-index lists types and sizes' '
+	idx=$(ls $packdir/pack-*.idx) &&
+	git show-index <$idx >show &&
+	cut -d" " -f2,4,5 show | sort >actual &&
+	cut -d" " -f1-3 expect | sort >expect.show &&
+	test_cmp expect.show actual &&
+	grep " delta\$" show
+'
+
+test_expect_success 'reused deltas get the type and size of the object' '
+	git -c pack.indexVersion=3 repack -ad &&
+	idx=$(ls $packdir/pack-*.idx) &&
+	test "$(idx_version $idx)" = 03 &&
+	git verify-pack $idx &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize)" \
+		<objects >actual &&
+	cut -d" " -f1-3 expect >expect.info &&
+	test_cmp expect.info actual
+'
+
+test_expect_success 'index-pack writes the same version 3 index' '
+	pack=$(ls $packdir/pack-*.pack) &&
+	idx=${pack%.pack}.idx &&
+	git index-pack --index-version=3 -o tmp.idx $pack &&
+	test_cmp $idx tmp.idx &&
+	git index-pack --verify $pack
+'
+
+test_expect_success 'fetching a thin pack writes a version 3 index' '
+	git init clone &&
+	git -C clone fetch -q .. old:refs/heads/old &&
+	(
+		cd clone &&
+		git config pack.indexVersion 3 &&
+		git config fetch.unpackLimit 1 &&
+		git fetch -q .. v1:refs/tags/v1 &&
+		for idx in $packdir/pack-*.idx
+		do
+			git verify-pack $idx &&
+			idx_version $idx >>versions || return 1
+		done &&
+		grep 03 versions &&
+		test "$(git cat-file -t v1)" = tag &&
+		test "$(git cat-file -s v1^{}:file1)" = \
+			"$(cd .. && git cat-file -s v1^{}:file1)"
+	)
+'
+
+test_expect_success 'object info is read from the index' '
+	blob=$(echo content | git hash-object -w --stdin) &&
+	echo $blob | git pack-objects --index-version=3 one >/dev/null &&
+	pack=$(ls one-*.pack) &&
+	git show-index <${pack%.pack}.idx >show &&
+	grep " blob 8\$" show &&
+	# turn the blob into a tree in the one-byte type column, which
+	# comes right after the v2 tables (8 + 4*256 + 28 bytes)
+	printf "\\002" |
+	dd of=${pack%.pack}.idx bs=1 seek=1060 conv=notrunc 2>/dev/null &&
+	git show-index <${pack%.pack}.idx >show &&
+	grep " tree 8\$" show &&
+	mkdir alt &&
+	git init --bare alt/repo.git &&
+	mv one-* alt/repo.git/objects/pack/ &&
+	test "$(git --git-dir=alt/repo.git cat-file -t $blob)" = tree &&
+	test_must_fail git --git-dir=alt/repo.git fsck 2>err &&
+	grep "wrong type or size for $blob" err
+'
+
+test_expect_success 'object info is read from the index with a multi-pack index' '
+	git --git-dir=alt/repo.git multi-pack-index write &&
+	test_path_is_file alt/repo.git/objects/pack/multi-pack-index &&
+	test "$(git --git-dir=alt/repo.git cat-file -t $blob)" = tree &&
+	echo $blob >one-object &&
+	git --git-dir=alt/repo.git cat-file --batch-check --unordered \
+		<one-object >actual &&
+	echo "$blob tree 8" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown index versions are rejected' '
+	test_must_fail git -c pack.indexVersion=4 repack -adf &&
+	test_must_fail git index-pack --index-version=4 $(ls $packdir/pack-*.pack)
+'
+
+test_done
@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='pack-objects compressing objects ahead of the writer'
+. ./test-lib.sh
+
+# Pack the objects in "objects" with the given options, once with
+# the writer doing all the compression and once with threads helping,
+# and make sure both give the same pack.
+pack_both () {
+	git -c pack.deflateAheadLimit=0 pack-objects --threads=4 "$@" \
+		--stdout <objects >expect.pack &&
+	git pack-objects --threads=4 "$@" --stdout <objects >actual.pack &&
+	cmp expect.pack actual.pack
+}
+
+test_expect_success 'setup' '
+	git config pack.compression 9 &&
+	for i in $(test_seq 1 30)
+	do
+		test_seq 1 $(($i * 40)) >file$(($i % 4)) &&
+		git add . &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	test_seq 1 5000 >large &&
+	git add large &&
+	test_tick &&
+	git commit -q -m large &&
+	git rev-list --objects --all >objects
+'
+
+test_expect_success 'same pack with objects compressed afresh' '
+	pack_both --no-reuse-object --window=0 &&
+	git index-pack -o actual.idx actual.pack
+'
+
+test_expect_success 'same pack with deltas computed again while writing' '
+	# the window keeps the delta search in one thread, so that
+	# it finds the same deltas each time
+	test_config pack.deltaCacheSize 1 &&
+	pack_both --no-reuse-object --window=50 &&
+	git index-pack -o actual.idx actual.pack &&
+	git verify-pack -v actual.idx >verify &&
+	grep chain verify
+'
+
+test_expect_success 'same pack with deltas taken from the delta cache' '
+	pack_both --no-reuse-object --window=50
+'
+
+test_expect_success 'same pack when reusing some objects' '
+	git repack -ad --window=0 &&
+	pack_both --window=50 &&
+	pack_both --no-reuse-delta --window=50
+'
+
+test_expect_success 'same pack with large blobs streamed' '
+	test_config core.bigFileThreshold 2k &&
+	pack_both --no-reuse-object --window=0
+'
+
+test_expect_success 'a small limit still gives the same pack' '
+	test_config pack.deflateAheadLimit 100 &&
+	git pack-objects --threads=4 --no-reuse-object --window=0 \
+		--stdout <objects >actual.pack &&
+	cmp expect.pack actual.pack
+'
+
+test_expect_success 'same pack and index written to a file' '
+	git -c pack.deflateAheadLimit=0 pack-objects --threads=4 \
+		--no-reuse-object --window=50 expect <objects >expect.name &&
+	git pack-objects --threads=4 --no-reuse-object --window=50 actual \
+		<objects >actual.name &&
+	test_cmp expect.name actual.name &&
+	cmp expect-$(cat expect.name).pack actual-$(cat actual.name).pack &&
+	cmp expect-$(cat expect.name).idx actual-$(cat actual.name).idx &&
+	git verify-pack actual-$(cat actual.name).idx
+'
+
+test_done
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='pack-objects with sizes and packs that do not fit an entry'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		test_seq 1 $(($i * 300)) >file$(($i % 3)) &&
+		git add . &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+		if test $(($i % 5)) = 0
+		then
+			git repack -d -q || return 1
+		fi
+	done &&
+	test $(ls .git/objects/pack/*.pack | wc -l) = 4 &&
+	git rev-list --objects --all >objects
+'
+
+# Pack "objects" as usual and with the variables in "$@" set, and
+# make sure both give the same pack.
+pack_both () {
+	git pack-objects --threads=1 --stdout <objects >expect.pack &&
+	env "$@" git pack-objects --threads=1 --stdout <objects >actual.pack &&
+	cmp expect.pack actual.pack
+}
+
+test_expect_success 'same pack with sizes in the side tables' '
+	pack_both GIT_TEST_OE_SIZE=10 GIT_TEST_OE_DELTA_SIZE=10
+'
+
+test_expect_success 'same pack with new deltas in the side tables' '
+	git -c pack.deltaCacheSize=1 pack-objects --no-reuse-delta \
+		--threads=1 --stdout <objects >expect.pack &&
+	GIT_TEST_OE_SIZE=10 GIT_TEST_OE_DELTA_SIZE=10 \
+		git -c pack.deltaCacheSize=1 pack-objects --no-reuse-delta \
+		--threads=1 --stdout <objects >actual.pack &&
+	cmp expect.pack actual.pack
+'
+
+test_expect_success 'same pack with the pack of every object recorded' '
+	pack_both GIT_TEST_FULL_IN_PACK_ARRAY=1
+'
+
+test_expect_success 'threaded delta search with the side tables' '
+	GIT_TEST_OE_SIZE=10 GIT_TEST_OE_DELTA_SIZE=10 \
+		git pack-objects --threads=4 --no-reuse-delta side <objects \
+		>name &&
+	git verify-pack -v side-$(cat name).idx >verify &&
+	grep chain verify
+'
+
+test_expect_success 'peak memory of the object list is traced' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git pack-objects --stdout <objects >/dev/null &&
+	grep "to_pack: $(wc -l <objects | tr -d " ") objects, [0-9]* bytes each, [0-9]* bytes peak" trace
+'
+
+test_done
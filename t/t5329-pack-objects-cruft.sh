@@ -0,0 +1,233 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects and their mtimes'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+loose_path () {
+	echo .git/objects/$(echo $1 | cut -c1-2)/$(echo $1 | cut -c3-)
+}
+
+loose_objects () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l | tr -d " "
+}
+
+# the basename of the one cruft pack
+cruft_pack () {
+	for m in $packdir/*.mtimes
+	do
+		test -f "$m" &&
+		basename ${m%.mtimes}.pack
+	done
+}
+
+cruft_objects () {
+	test-pack-mtimes $(cruft_pack) | cut -d" " -f1 | sort
+}
+
+pack_objects () {
+	git show-index <$packdir/${1%.pack}.idx | cut -d" " -f2 | sort
+}
+
+test_expect_success 'pack-objects --cruft rejects a pack on stdout' '
+	test_must_fail git pack-objects --cruft --stdout </dev/null &&
+	test_must_fail git pack-objects --cruft --revs pack </dev/null
+'
+
+test_expect_success 'setup unreachable objects, packed and loose' '
+	test_commit base &&
+	git checkout -b gone &&
+	test_commit gone-1 &&
+	test_commit gone-2 &&
+	git checkout master &&
+	one=$(git rev-parse gone-1) &&
+	two=$(git rev-parse gone-2) &&
+	git rev-list --objects base..gone | cut -c1-40 >unreachable &&
+	git repack -adq &&
+	test-chmtime =1000000000 $packdir/*.pack &&
+	blob=$(echo loose cruft | git hash-object -w --stdin) &&
+	test-chmtime =1100000000 $(loose_path $blob) &&
+	echo $blob >>unreachable &&
+	sort -o unreachable unreachable &&
+	git tag -d gone-1 gone-2 &&
+	git branch -D gone &&
+	git reflog expire --expire=all --all
+'
+
+test_expect_success 'repack --cruft packs them with their mtimes' '
+	git repack --cruft -d -q &&
+	test 0 = $(loose_objects) &&
+	cruft_objects >actual &&
+	test_cmp unreachable actual &&
+	test-pack-mtimes $(cruft_pack) >mtimes &&
+	grep "^$blob 1100000000\$" mtimes &&
+	grep -v $blob mtimes | cut -d" " -f2 | sort -u >actual &&
+	echo 1000000000 >expect &&
+	test_cmp expect actual &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	for p in $packdir/*.pack
+	do
+		test $(basename $p) = $(cruft_pack) ||
+		pack_objects $(basename $p) >actual || return 1
+	done &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'the mtimes are carried over, not taken from the pack' '
+	test-pack-mtimes $(cruft_pack) >expect &&
+	test-chmtime =+0 $packdir/*.pack &&
+	git repack --cruft -d -q &&
+	test-pack-mtimes $(cruft_pack) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects made reachable again leave the cruft pack' '
+	git branch back $one &&
+	git repack --cruft -d -q &&
+	cruft_objects >actual &&
+	git rev-list --objects $one..$two | cut -c1-40 >expect &&
+	echo $blob >>expect &&
+	sort -o expect expect &&
+	test_cmp expect actual &&
+	git branch -D back &&
+	git reflog expire --expire=all --all
+'
+
+test_expect_success 'gc --cruft --prune expires by the recorded mtimes' '
+	test-chmtime =1000000000 $packdir/*.pack &&
+	git gc --cruft --prune=1050000000 &&
+	test 0 = $(loose_objects) &&
+	cruft_objects >actual &&
+	echo $blob >expect &&
+	test_cmp expect actual &&
+	git gc --cruft --prune=1200000000 &&
+	test -z "$(cruft_pack)" &&
+	test_must_fail git cat-file -e $blob
+'
+
+test_expect_success 'setup old objects referred to by recent ones' '
+	git init rescue &&
+	(
+		cd rescue &&
+		test_commit base &&
+		git checkout -b gone &&
+		test_commit old &&
+		git rev-list --objects base..gone | cut -c1-40 >old &&
+		for obj in $(cat old)
+		do
+			test-chmtime =1000000000 $(loose_path $obj) || return 1
+		done &&
+		test_commit recent &&
+		expired=$(echo expired | git hash-object -w --stdin) &&
+		test-chmtime =1000000000 $(loose_path $expired) &&
+		git rev-list --objects base..gone | cut -c1-40 |
+			sort >../rescue.expect &&
+		echo $expired >../rescue.expired &&
+		git tag -d old recent &&
+		git checkout master &&
+		git branch -D gone &&
+		git reflog expire --expire=all --all
+	)
+'
+
+test_expect_success 'cruft expiration keeps what recent objects refer to' '
+	(
+		cd rescue &&
+		git repack --cruft --cruft-expiration=2.weeks.ago -d -q &&
+		cruft_objects >actual &&
+		test_cmp ../rescue.expect actual &&
+		expired=$(cat ../rescue.expired) &&
+		test_path_is_file $(loose_path $expired) &&
+		git prune --expire=2.weeks.ago &&
+		test_must_fail git cat-file -e $expired &&
+		git fsck
+	)
+'
+
+test_expect_success 'gc.cruftPacks writes a cruft pack' '
+	git init config &&
+	(
+		cd config &&
+		test_commit base &&
+		blob=$(echo unreachable | git hash-object -w --stdin) &&
+		git config gc.cruftPacks true &&
+		git gc &&
+		test 0 = $(loose_objects) &&
+		cruft_objects >actual &&
+		echo $blob >expect &&
+		test_cmp expect actual &&
+		git gc --no-cruft &&
+		test -z "$(cruft_pack)" &&
+		test_path_is_file $(loose_path $blob)
+	)
+'
+
+test_expect_success 'prune keeps loose objects that recent cruft objects refer to' '
+	git init prune &&
+	(
+		cd prune &&
+		test_commit base &&
+		git checkout -b gone &&
+		test_commit gone &&
+		blob=$(git rev-parse gone:gone.t) &&
+		git tag -d gone &&
+		git checkout master &&
+		git branch -D gone &&
+		git reflog expire --expire=all --all &&
+		git cat-file blob $blob >content &&
+		keep=$(echo $blob | git pack-objects $packdir/pack) &&
+		>$packdir/pack-$keep.keep &&
+		git repack --cruft -d -q &&
+		cruft_objects >actual &&
+		! grep $blob actual &&
+		rm $packdir/pack-$keep.* &&
+		git hash-object -w content &&
+		test-chmtime =1000000000 $(loose_path $blob) &&
+		git prune --expire=2.weeks.ago &&
+		git cat-file -e $blob &&
+		git prune --expire=now &&
+		test_must_fail git cat-file -e $blob
+	)
+'
+
+test_expect_success 'repack --geometric leaves the cruft pack alone' '
+	git init geometric &&
+	(
+		cd geometric &&
+		test_commit base &&
+		git checkout -b gone &&
+		test_commit gone-1 &&
+		test_commit gone-2 &&
+		git checkout master &&
+		git tag -d gone-1 gone-2 &&
+		git branch -D gone &&
+		git reflog expire --expire=all --all &&
+		git repack --cruft -d -q &&
+		cruft=$(cruft_pack) &&
+		test -n "$cruft" &&
+		test-pack-mtimes $cruft >expect &&
+		cruft_objects >cruft &&
+		test_commit small-1 &&
+		git repack -d -q &&
+		test_commit small-2 &&
+		git repack -d -q &&
+		git repack --geometric=2 -d &&
+		test "$(cruft_pack)" = "$cruft" &&
+		test-pack-mtimes $cruft >actual &&
+		test_cmp expect actual &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 2 packs &&
+		for p in $packdir/*.pack
+		do
+			test $(basename $p) = $cruft ||
+			pack_objects $(basename $p) >objects || return 1
+		done &&
+		comm -12 cruft objects >both &&
+		test_must_be_empty both &&
+		git fsck
+	)
+'
+
+test_done
@@ -0,0 +1,151 @@
+#!/bin/sh
+
+test_description='upload-pack serves identical requests from its pack cache'
+. ./test-lib.sh
+
+cache=.git/pack-cache
+
+cache_entries () {
+	ls $cache/*.pack 2>/dev/null | wc -l | tr -d " "
+}
+
+# clone into $1, recording in $1.trace whether pack-objects was run
+traced_clone () {
+	rm -rf "$1" "$1.trace" &&
+	GIT_TRACE="$(pwd)/$1.trace" git clone -q --no-local . "$1" &&
+	(
+		cd "$1" &&
+		git fsck &&
+		git rev-parse origin/master >../$1.refs
+	)
+}
+
+ran_pack_objects () {
+	grep "run_command: .pack-objects. .--revs" "$1.trace" >/dev/null
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		test_commit commit-$i || return 1
+	done &&
+	git config pack.threads 1 &&
+	git config uploadpack.packCache pack-cache
+'
+
+test_expect_success 'the first clone fills the cache' '
+	traced_clone first &&
+	ran_pack_objects first &&
+	test 1 = $(cache_entries)
+'
+
+test_expect_success 'an identical clone is served from the cache' '
+	traced_clone second &&
+	! ran_pack_objects second &&
+	test_cmp first.refs second.refs &&
+	test 1 = $(cache_entries)
+'
+
+test_expect_success 'a ref update makes a new entry' '
+	test_commit more &&
+	traced_clone third &&
+	ran_pack_objects third &&
+	git rev-parse master >expect &&
+	test_cmp expect third.refs &&
+	test 2 = $(cache_entries)
+'
+
+test_expect_success 'a fetch with haves is a request of its own' '
+	test_commit fetched &&
+	(
+		cd first &&
+		GIT_TRACE="$(pwd)/../fetch.trace" git fetch -q origin &&
+		git fsck
+	) &&
+	ran_pack_objects fetch &&
+	test 3 = $(cache_entries)
+'
+
+test_expect_success 'a hit marks the entry as recently used' '
+	rm -f $cache/*.pack &&
+	traced_clone fill &&
+	entry=$(ls $cache/*.pack) &&
+	test-chmtime =1000000000 $entry &&
+	traced_clone hit &&
+	! ran_pack_objects hit &&
+	test $(test-chmtime -v +0 $entry | cut -f1) -gt 1000000000
+'
+
+test_expect_success 'a broken entry is replaced' '
+	entry=$(ls $cache/*.pack) &&
+	cp $entry pack.good &&
+	echo garbage >$entry &&
+	traced_clone broken &&
+	ran_pack_objects broken &&
+	test_cmp pack.good $entry
+'
+
+test_expect_success 'the least recently used entries are evicted' '
+	entry=$(ls $cache/*.pack) &&
+	size=$(wc -c <$entry) &&
+	rm -f $entry &&
+	a=$cache/$_z40.pack &&
+	b=$cache/$(echo $_z40 | tr 0 b).pack &&
+	c=$cache/$(echo $_z40 | tr 0 c).pack &&
+	for old in $a $b $c
+	do
+		printf "%01000d" 0 >$old || return 1
+	done &&
+	test-chmtime =-300 $a &&
+	test-chmtime =-200 $b &&
+	test-chmtime =-100 $c &&
+	git config uploadpack.packCacheSize $(($size + 1500)) &&
+	traced_clone evict &&
+	ran_pack_objects evict &&
+	test_path_is_file $entry &&
+	test_path_is_missing $a &&
+	test_path_is_missing $b &&
+	test_path_is_file $c
+'
+
+test_expect_success 'files that are not cache entries are left alone' '
+	rm -f $cache/*.pack &&
+	other=$cache/pack-$(echo $_z40 | tr 0 a).pack &&
+	printf "%01000d" 0 >$other &&
+	printf "%01000d" 0 >$cache/other.pack &&
+	test-chmtime =-300 $other $cache/other.pack &&
+	git config uploadpack.packCacheSize 1500 &&
+	test_commit not-entries &&
+	traced_clone foreign &&
+	ran_pack_objects foreign &&
+	test_path_is_file $other &&
+	test_path_is_file $cache/other.pack &&
+	rm -f $other $cache/other.pack
+'
+
+test_expect_success 'stale locks are removed' '
+	git config --unset uploadpack.packCacheSize &&
+	test_commit stale-lock &&
+	traced_clone locked &&
+	entry=$(ls -t $cache/*.pack | head -n 1) &&
+	mv $entry $entry.lock &&
+	test-chmtime =-86400 $entry.lock &&
+	traced_clone unlocked &&
+	ran_pack_objects unlocked &&
+	test_path_is_missing $entry.lock &&
+	test_path_is_file $entry &&
+	traced_clone relocked &&
+	! ran_pack_objects relocked
+'
+
+test_expect_success 'packs larger than the cache are not cached' '
+	rm -f $cache/*.pack &&
+	git config uploadpack.packCacheSize 100 &&
+	traced_clone big &&
+	ran_pack_objects big &&
+	test 0 = $(cache_entries) &&
+	ls $cache >actual &&
+	test_must_be_empty actual
+'
+
+test_done
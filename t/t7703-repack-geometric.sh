@@ -0,0 +1,202 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# the number of objects in each pack, smallest first
+pack_sizes () {
+	for idx in $packdir/*.idx
+	do
+		git show-index <$idx | wc -l || return 1
+	done | sort -n | tr -d " "
+}
+
+# pack what is loose into a pack of its own; each commit makes three
+# objects (the commit, its tree and a new blob)
+commits_in_pack () {
+	for i in $(test_seq 1 $2)
+	do
+		test_commit $1-$i || return 1
+	done &&
+	git repack -d -q
+}
+
+# the basename of the pack that has the object $1
+pack_of () {
+	for idx in $packdir/*.idx
+	do
+		if git show-index <$idx | grep -q $1
+		then
+			basename ${idx%.idx}.pack
+		fi
+	done
+}
+
+loose_objects () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l | tr -d " "
+}
+
+test_expect_success '--geometric with only loose objects' '
+	test_commit loose &&
+	git repack --geometric=2 -d &&
+	echo 3 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	test "$(loose_objects)" = 0
+'
+
+test_expect_success '--geometric leaves a progression alone' '
+	commits_in_pack big 3 &&
+	git repack -adq &&
+	commits_in_pack small 1 &&
+	ls $packdir/*.pack >before &&
+	git repack --geometric=2 -d >out &&
+	grep "Nothing new to pack" out &&
+	ls $packdir/*.pack >after &&
+	test_cmp before after
+'
+
+test_expect_success '--geometric does not rewrite a single pack' '
+	test_create_repo single &&
+	(
+		cd single &&
+		test_commit one &&
+		git repack -adq &&
+		test "$(loose_objects)" = 0 &&
+		ls $packdir/*.pack >before &&
+		GIT_TRACE="$(pwd)/trace" git repack --geometric=2 -d >out &&
+		grep "Nothing new to pack" out &&
+		! grep "pack-objects" trace &&
+		ls $packdir/*.pack >after &&
+		test_cmp before after
+	)
+'
+
+test_expect_success '--geometric rolls up the smallest packs' '
+	commits_in_pack smaller 1 &&
+	big=$(ls -S $packdir/*.pack | head -n 1) &&
+	cat >expect <<-\EOF &&
+	3
+	3
+	12
+	EOF
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	git repack --geometric=2 -d &&
+	cat >expect <<-\EOF &&
+	6
+	12
+	EOF
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	test -f $big &&
+	git fsck
+'
+
+test_expect_success '--geometric rolls up larger packs the new pack outgrows' '
+	commits_in_pack a 1 &&
+	git repack --geometric=2 -d &&
+	cat >expect <<-\EOF &&
+	3
+	6
+	12
+	EOF
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	commits_in_pack b 1 &&
+	git repack --geometric=2 -d &&
+	echo 24 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success '--geometric packs loose objects and keeps unreachable ones' '
+	one=$(echo unreachable one | git hash-object -w --stdin) &&
+	two=$(echo unreachable two | git hash-object -w --stdin) &&
+	pack_one=$(echo $one | git pack-objects $packdir/pack) &&
+	pack_two=$(echo $two | git pack-objects $packdir/pack) &&
+	loose=$(echo unreachable and loose | git hash-object -w --stdin) &&
+	git repack --geometric=2 -d &&
+	test "$(loose_objects)" = 0 &&
+	! test -f $packdir/pack-$pack_one.pack &&
+	! test -f $packdir/pack-$pack_two.pack &&
+	git cat-file -e $one &&
+	git cat-file -e $two &&
+	git cat-file -e $loose &&
+	cat >expect <<-\EOF &&
+	3
+	24
+	EOF
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric leaves packs with a .keep file alone' '
+	git repack -adq &&
+	big=$(pack_sizes) &&
+	commits_in_pack kept 1 &&
+	kept=$(pack_of $(git rev-parse kept-1)) &&
+	>$packdir/${kept%.pack}.keep &&
+	commits_in_pack unkept 1 &&
+	commits_in_pack unkept-too 1 &&
+	git repack --geometric=2 -d &&
+	test -f $packdir/$kept &&
+	cat >expect <<-EOF &&
+	3
+	6
+	$big
+	EOF
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric with --write-midx' '
+	rm -f $packdir/*.keep &&
+	commits_in_pack midx 1 &&
+	git repack --geometric=2 -d -m &&
+	test -f $packdir/multi-pack-index &&
+	git fsck
+'
+
+test_expect_success '--geometric cannot be used with -a, -A or a small factor' '
+	test_must_fail git repack --geometric=2 -a 2>err &&
+	grep "incompatible" err &&
+	test_must_fail git repack --geometric=2 -A 2>err &&
+	grep "incompatible" err &&
+	test_must_fail git repack --geometric=1 2>err &&
+	grep "at least 2" err
+'
+
+test_expect_success 'pack-objects --stdin-packs leaves out excluded packs' '
+	git repack -adq &&
+	commits_in_pack one 1 &&
+	commits_in_pack two 1 &&
+	one=$(pack_of $(git rev-parse one-1)) &&
+	{
+		echo $one &&
+		for p in $packdir/*.pack
+		do
+			test $(basename $p) = $one || echo "^$(basename $p)" || return 1
+		done
+	} >in &&
+	out=$(git pack-objects --stdin-packs out <in) &&
+	git show-index <out-$out.idx >objects &&
+	grep $(git rev-parse one-1) objects &&
+	! grep $(git rev-parse two-1) objects &&
+	test_line_count = 3 objects &&
+	echo "^$one" >>in &&
+	git pack-objects --stdin-packs --non-empty empty <in >out &&
+	test_must_be_empty out
+'
+
+test_expect_success 'pack-objects --stdin-packs with an unknown pack' '
+	echo pack-0000000000000000000000000000000000000000.pack |
+	test_must_fail git pack-objects --stdin-packs out 2>err &&
+	grep "could not find pack" err
+'
+
+test_done
@@ -0,0 +1,286 @@
+#include "cache.h"
+#include "ewah/ewok.h"
+#include "ewah/roaring.h"
+
+static uint32_t next_rand(uint64_t *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 33;
+}
+
+/*
+ * A bitmap of "nr" words shaped like the ones in a .bitmap file: runs
+ * of empty and full words between stretches of literal words.  About
+ * one word in "sparse" comes from a run.
+ */
+static struct bitmap *random_bitmap(uint64_t *seed, size_t nr, int sparse)
+{
+	struct bitmap *b = bitmap_new();
+	size_t i = 0;
+
+	b->words = xrealloc(b->words, nr * sizeof(eword_t));
+	b->word_alloc = nr;
+
+	while (i < nr) {
+		size_t len = 1 + next_rand(seed) % 64;
+		int kind = next_rand(seed) % sparse;
+
+		if (len > nr - i)
+			len = nr - i;
+		for (; len; len--, i++) {
+			if (kind == 0)
+				b->words[i] = 0;
+			else if (kind == 1)
+				b->words[i] = ~(eword_t)0;
+			else
+				b->words[i] = ((eword_t)next_rand(seed) << 32) |
+					next_rand(seed);
+		}
+	}
+	return b;
+}
+
+static int ewah_same(struct ewah_bitmap *a, struct ewah_bitmap *b)
+{
+	return a->buffer_size == b->buffer_size &&
+		a->bit_size == b->bit_size &&
+		!memcmp(a->buffer, b->buffer, a->buffer_size * sizeof(eword_t));
+}
+
+static eword_t op_or(eword_t x, eword_t y) { return x | y; }
+static eword_t op_and(eword_t x, eword_t y) { return x & y; }
+static eword_t op_and_not(eword_t x, eword_t y) { return x & ~y; }
+static eword_t op_xor(eword_t x, eword_t y) { return x ^ y; }
+
+static struct ewah_op {
+	const char *name;
+	void (*fn)(struct ewah_bitmap *, struct ewah_bitmap *,
+		   struct ewah_bitmap *);
+	eword_t (*word)(eword_t, eword_t);
+} ops[] = {
+	{ "or", ewah_or, op_or },
+	{ "and", ewah_and, op_and },
+	{ "and-not", ewah_and_not, op_and_not },
+	{ "xor", ewah_xor, op_xor },
+};
+
+/* check "out" word by word against the uncompressed inputs */
+static void verify_op(struct ewah_op *op, struct bitmap *a, struct bitmap *b,
+		      struct ewah_bitmap *out)
+{
+	struct bitmap *got = ewah_to_bitmap(out);
+	size_t i;
+
+	for (i = 0; i < a->word_alloc; i++) {
+		eword_t want = op->word(a->words[i], b->words[i]);
+		if ((i < got->word_alloc ? got->words[i] : 0) != want)
+			die("%s: wrong word %lu", op->name, (unsigned long)i);
+	}
+	bitmap_free(got);
+}
+
+static void report(const char *impl, const char *what, size_t bytes,
+		   uint64_t start)
+{
+	printf("%-8s %-10s %10.1f MB/s\n", impl, what,
+	       bytes * 1e3 / (getnanotime() - start + 1));
+}
+
+/*
+ * Usage: test-ewah --bench <words> <rounds> <sparse> [<impl>...]
+ *
+ * Run the EWAH and uncompressed set operations on random bitmaps of
+ * <words> words with every named implementation of the word kernels
+ * (all available ones by default), check the results against the
+ * scalar code and report the throughput.
+ */
+static int bench(int ac, char **av)
+{
+	static const char *all[] = { "scalar", "sse2", "avx2" };
+	size_t nr = strtoul(av[0], NULL, 10);
+	int rounds = strtol(av[1], NULL, 10);
+	int sparse = strtol(av[2], NULL, 10);
+	const char **impls = ac > 3 ? (const char **)av + 3 : all;
+	int nr_impls = ac > 3 ? ac - 3 : ARRAY_SIZE(all);
+	uint64_t seed = 1, start;
+	struct bitmap *a, *b, *tmp;
+	struct ewah_bitmap *ea, *eb, *expect[ARRAY_SIZE(ops)];
+	size_t expect_count = 0, expect_and_count = 0;
+	size_t bytes = nr * sizeof(eword_t) * rounds;
+	int i, j, r;
+
+	if (sparse < 3)
+		sparse = 3;
+	a = random_bitmap(&seed, nr, sparse);
+	b = random_bitmap(&seed, nr, sparse);
+	ea = bitmap_to_ewah(a);
+	eb = bitmap_to_ewah(b);
+	tmp = bitmap_new();
+
+	if (ewah_simd_select("scalar"))
+		die("no scalar implementation?");
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		expect[i] = ewah_new();
+		ops[i].fn(ea, eb, expect[i]);
+		verify_op(&ops[i], a, b, expect[i]);
+	}
+	for (i = 0; i < nr; i++) {
+		expect_count += ewah_bit_popcount64(a->words[i]);
+		expect_and_count += ewah_bit_popcount64(a->words[i] & b->words[i]);
+	}
+
+	for (j = 0; j < nr_impls; j++) {
+		struct ewah_block_iterator it;
+		struct ewah_block block;
+		size_t count = 0;
+
+		if (ewah_simd_select(impls[j])) {
+			printf("%-8s %-10s %10s\n", impls[j], "", "n/a");
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(ops); i++) {
+			struct ewah_bitmap *out = ewah_new();
+
+			start = getnanotime();
+			for (r = 0; r < rounds; r++) {
+				ewah_clear(out);
+				ops[i].fn(ea, eb, out);
+			}
+			report(impls[j], ops[i].name, bytes, start);
+			if (!ewah_same(out, expect[i]))
+				die("%s: ewah %s differs", impls[j], ops[i].name);
+			ewah_free(out);
+		}
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++) {
+			bitmap_reset(tmp);
+			bitmap_or_ewah(tmp, ea);
+			bitmap_or_ewah(tmp, eb);
+		}
+		report(impls[j], "or-ewah", 2 * bytes, start);
+		for (i = 0; i < nr; i++)
+			if (tmp->words[i] != (a->words[i] | b->words[i]))
+				die("%s: bitmap_or_ewah wrong at %d", impls[j], i);
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++) {
+			bitmap_reset(tmp);
+			bitmap_or(tmp, a);
+			bitmap_and_not(tmp, b);
+		}
+		report(impls[j], "or/and-not", 2 * bytes, start);
+		for (i = 0; i < nr; i++)
+			if (tmp->words[i] != (a->words[i] & ~b->words[i]))
+				die("%s: bitmap_and_not wrong at %d", impls[j], i);
+
+		start = getnanotime();
+		for (r = 0; r < rounds; r++)
+			count = bitmap_popcount(a);
+		report(impls[j], "popcount", bytes, start);
+		if (count != expect_count)
+			die("%s: bitmap_popcount gave %lu, not %lu", impls[j],
+			    (unsigned long)count, (unsigned long)expect_count);
+
+		/* the way count_object_type() filters by type */
+		start = getnanotime();
+		for (r = 0; r < rounds; r++) {
+			count = 0;
+			ewah_block_iterator_init(&it, eb);
+			while (ewah_block_next(&block, &it)) {
+				if (block.literal)
+					count += ewah_words_and_popcount(
+						a->words + block.pos,
+						block.literal, block.len);
+				else if (block.fill)
+					count += ewah_words_popcount(
+						a->words + block.pos, block.len);
+			}
+		}
+		report(impls[j], "and-count", bytes, start);
+		if (count != expect_and_count)
+			die("%s: filtered count gave %lu, not %lu", impls[j],
+			    (unsigned long)count, (unsigned long)expect_and_count);
+	}
+	return 0;
+}
+
+static int strbuf_write(void *sb, const void *buf, size_t len)
+{
+	strbuf_add(sb, buf, len);
+	return len;
+}
+
+/*
+ * Usage: test-ewah --roaring <bits> <scattered> <runs>
+ *
+ * Set <scattered> random bits and <runs> random runs of bits in a
+ * bitmap of <bits> bits, check that it comes back the same from the
+ * roaring encoding, both whole and bit by bit, and report the size of
+ * both encodings.
+ */
+static int roaring(int ac, char **av)
+{
+	size_t nr_bits = strtoul(av[0], NULL, 10);
+	int scattered = strtol(av[1], NULL, 10);
+	int runs = strtol(av[2], NULL, 10);
+	uint64_t seed = 1;
+	struct bitmap *b = bitmap_new(), *back;
+	struct ewah_bitmap *ewah, *decoded = ewah_new();
+	struct roaring_bitmap r;
+	struct strbuf ewah_buf = STRBUF_INIT, roaring_buf = STRBUF_INIT;
+	size_t i;
+	int len;
+
+	if (!nr_bits)
+		die("need at least one bit");
+	for (i = 0; i < scattered; i++)
+		bitmap_set(b, next_rand(&seed) % nr_bits);
+	for (i = 0; i < runs; i++) {
+		size_t pos = next_rand(&seed) % nr_bits;
+		size_t end = pos + next_rand(&seed) % 100000;
+
+		for (; pos < end && pos < nr_bits; pos++)
+			bitmap_set(b, pos);
+	}
+	/* make the bitmap cover all <bits> bits */
+	bitmap_set(b, nr_bits - 1);
+
+	ewah = bitmap_to_ewah(b);
+	if (ewah_serialize_to(ewah, strbuf_write, &ewah_buf) < 0 ||
+	    roaring_serialize_to(ewah, strbuf_write, &roaring_buf) < 0)
+		die("unable to serialize");
+	len = roaring_read_mmap(&r, roaring_buf.buf, roaring_buf.len);
+	if (len != roaring_buf.len)
+		die("roaring_read_mmap read %d bytes of %lu", len,
+		    (unsigned long)roaring_buf.len);
+	for (i = 0; i < roaring_buf.len; i++)
+		if (roaring_read_mmap(&r, roaring_buf.buf, i) >= 0)
+			die("roaring_read_mmap accepted %lu bytes of %lu",
+			    (unsigned long)i, (unsigned long)roaring_buf.len);
+	roaring_read_mmap(&r, roaring_buf.buf, roaring_buf.len);
+
+	roaring_to_ewah(&r, decoded);
+	back = ewah_to_bitmap(decoded);
+	if (!bitmap_equals(b, back))
+		die("bitmap differs after the round trip");
+	for (i = 0; i < nr_bits + BITS_IN_WORD; i++)
+		if (roaring_get(&r, i) != bitmap_get(b, i))
+			die("roaring_get(%lu) is wrong", (unsigned long)i);
+
+	printf("ewah %lu\n", (unsigned long)ewah_buf.len);
+	printf("roaring %lu\n", (unsigned long)roaring_buf.len);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 5 && !strcmp(argv[1], "--bench"))
+		return bench(argc - 2, argv + 2);
+	if (argc == 5 && !strcmp(argv[1], "--roaring"))
+		return roaring(argc - 2, argv + 2);
+
+	usage("test-ewah --bench <words> <rounds> <sparse> [<impl>...]\n"
+	      "   or: test-ewah --roaring <bits> <scattered> <runs>");
+}
@@ -0,0 +1,179 @@
+#include "cache.h"
+#include "object.h"
+
+/*
+ * The object hash as it was before slots carried a tag: a plain array
+ * of pointers, every probe comparing against the object itself.  Kept
+ * here so that "perf" can compare the two on the same objects.
+ */
+static struct object **plain_hash;
+static unsigned int plain_hash_size;
+
+static void plain_insert(struct object *obj)
+{
+	unsigned int j = sha1hash(obj->sha1) & (plain_hash_size - 1);
+
+	while (plain_hash[j]) {
+		j++;
+		if (j >= plain_hash_size)
+			j = 0;
+	}
+	plain_hash[j] = obj;
+}
+
+static struct object *plain_lookup(const unsigned char *sha1)
+{
+	unsigned int i, first;
+	struct object *obj;
+
+	first = i = sha1hash(sha1) & (plain_hash_size - 1);
+	while ((obj = plain_hash[i]) != NULL) {
+		if (!hashcmp(sha1, obj->sha1))
+			break;
+		i++;
+		if (i == plain_hash_size)
+			i = 0;
+	}
+	if (obj && i != first) {
+		struct object *tmp = plain_hash[i];
+		plain_hash[i] = plain_hash[first];
+		plain_hash[first] = tmp;
+	}
+	return obj;
+}
+
+static void plain_fill(void)
+{
+	unsigned int i, nr = get_max_object_index();
+
+	/* same load factor as the real table */
+	plain_hash_size = nr;
+	plain_hash = xcalloc(plain_hash_size, sizeof(*plain_hash));
+	for (i = 0; i < nr; i++) {
+		struct object *obj = get_indexed_object(i);
+		if (obj)
+			plain_insert(obj);
+	}
+}
+
+/* Cheap, reproducible, uniformly distributed object names */
+static unsigned char (*make_names(unsigned int nr, uint64_t seed))[20]
+{
+	unsigned char (*names)[20] = xmalloc((size_t)nr * 20);
+	unsigned int i, j;
+
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < 20; j++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			names[i][j] = seed >> 24;
+		}
+	}
+	return names;
+}
+
+static double rate(unsigned int nr, unsigned int rounds, uint64_t ns)
+{
+	return (double)nr * rounds / (ns ? ns : 1) * 1e9;
+}
+
+/*
+ * Usage: test-obj-hash perf <nr> [<rounds>]
+ *
+ * Create <nr> objects, then look each of them up, and <nr> names that
+ * are not there, <rounds> times, both in the object hash and in the
+ * plain pointer table above.  Prints lookups per second.
+ */
+static int perf(unsigned int nr, unsigned int rounds)
+{
+	unsigned char (*hit)[20] = make_names(nr, 0x9e3779b97f4a7c15ULL);
+	unsigned char (*miss)[20] = make_names(nr, 0xd1b54a32d192ed03ULL);
+	uint64_t start, tagged_hit, tagged_miss, plain_hit, plain_miss;
+	unsigned int i, j, found = 0;
+
+	for (i = 0; i < nr; i++)
+		lookup_unknown_object(hit[i]);
+	plain_fill();
+
+	start = getnanotime();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < nr; i++)
+			found += !!lookup_object(hit[i]);
+	tagged_hit = getnanotime() - start;
+
+	start = getnanotime();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < nr; i++)
+			found += !!lookup_object(miss[i]);
+	tagged_miss = getnanotime() - start;
+
+	start = getnanotime();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < nr; i++)
+			found += !!plain_lookup(hit[i]);
+	plain_hit = getnanotime() - start;
+
+	start = getnanotime();
+	for (j = 0; j < rounds; j++)
+		for (i = 0; i < nr; i++)
+			found += !!plain_lookup(miss[i]);
+	plain_miss = getnanotime() - start;
+
+	if (found != 2 * nr * rounds)
+		die("found %u objects, expected %u", found, 2 * nr * rounds);
+
+	printf("objects: %u, table size: %u\n", nr, get_max_object_index());
+	printf("tagged hit:  %12.0f lookups/s\n", rate(nr, rounds, tagged_hit));
+	printf("tagged miss: %12.0f lookups/s\n", rate(nr, rounds, tagged_miss));
+	printf("plain hit:   %12.0f lookups/s\n", rate(nr, rounds, plain_hit));
+	printf("plain miss:  %12.0f lookups/s\n", rate(nr, rounds, plain_miss));
+	return 0;
+}
+
+/*
+ * Usage: test-obj-hash verify <nr>
+ *
+ * Check that every one of <nr> created objects is found, that names
+ * we did not create are not, and that the table enumerates each object
+ * exactly once.
+ */
+static int verify(unsigned int nr)
+{
+	unsigned char (*hit)[20] = make_names(nr, 0x9e3779b97f4a7c15ULL);
+	unsigned char (*miss)[20] = make_names(nr, 0xd1b54a32d192ed03ULL);
+	unsigned int i, seen = 0;
+
+	for (i = 0; i < nr; i++)
+		lookup_unknown_object(hit[i])->flags = 1;
+	for (i = 0; i < nr; i++) {
+		struct object *obj = lookup_object(hit[i]);
+		if (!obj || hashcmp(obj->sha1, hit[i]))
+			die("lost object %s", sha1_to_hex(hit[i]));
+		if (lookup_object(miss[i]))
+			die("found object %s", sha1_to_hex(miss[i]));
+	}
+	for (i = 0; i < get_max_object_index(); i++) {
+		struct object *obj = get_indexed_object(i);
+		if (!obj)
+			continue;
+		if (obj->flags != 1)
+			die("object %s seen twice", sha1_to_hex(obj->sha1));
+		obj->flags = 0;
+		seen++;
+	}
+	if (seen != nr)
+		die("enumerated %u objects, expected %u", seen, nr);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 3 && !strcmp(argv[1], "verify"))
+		return verify(strtoul(argv[2], NULL, 10));
+	if ((argc == 3 || argc == 4) && !strcmp(argv[1], "perf"))
+		return perf(strtoul(argv[2], NULL, 10),
+			    argc == 4 ? strtoul(argv[3], NULL, 10) : 1);
+	fprintf(stderr, "usage: test-obj-hash (verify <nr> | perf <nr> [<rounds>])\n");
+	return 1;
+}
@@ -0,0 +1,34 @@
+#include "cache.h"
+#include "pack-mtimes.h"
+
+/*
+ * Usage: test-pack-mtimes <pack>
+ *
+ * Print the SHA-1 and the recorded mtime of every object of the cruft
+ * pack <pack>, given by its file name in the pack directory.
+ */
+int main(int argc, char **argv)
+{
+	struct packed_git *p;
+	uint32_t i;
+
+	if (argc != 2)
+		die("usage: test-pack-mtimes <pack>");
+
+	setup_git_directory();
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		const char *slash = strrchr(p->pack_name, '/');
+		if (!strcmp(slash ? slash + 1 : p->pack_name, argv[1]))
+			break;
+	}
+	if (!p)
+		die("could not find pack '%s'", argv[1]);
+	if (load_pack_mtimes(p))
+		die("could not load the mtimes of pack '%s'", argv[1]);
+
+	for (i = 0; i < p->num_objects; i++)
+		printf("%s %"PRIu32"\n", sha1_to_hex(nth_packed_object_sha1(p, i)),
+		       nth_packed_mtime(p, i));
+	return 0;
+}
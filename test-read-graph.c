@@ -0,0 +1,35 @@
+#include "cache.h"
+#include "commit-graph.h"
+
+int main(int argc, char **argv)
+{
+	struct commit_graph *g;
+	char *graph_name;
+
+	if (argc != 1)
+		die("usage: test-read-graph");
+
+	setup_git_directory();
+	graph_name = get_commit_graph_filename(get_object_directory());
+	g = load_commit_graph_one(graph_name);
+	if (!g)
+		return 1;
+
+	printf("header: %08x %d %d %d %d\n",
+	       get_be32(g->data),
+	       g->data[4], g->data[5], g->data[6], g->data[7]);
+	printf("num_commits: %"PRIu32"\n", g->num_commits);
+	printf("chunks:");
+	if (g->chunk_oid_fanout)
+		printf(" oid-fanout");
+	if (g->chunk_oid_lookup)
+		printf(" oid-lookup");
+	if (g->chunk_commit_data)
+		printf(" commit-metadata");
+	if (g->chunk_extra_edges)
+		printf(" extra-edges");
+	printf("\n");
+	free_commit_graph(g);
+	free(graph_name);
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include "commit.h"
 #include "diff.h"
 #include "revision.h"
+#include "object.h"
 
 static void print_commit(struct commit *commit)
 {
@@ -45,6 +46,55 @@ static int run_revision_walk(void)
 	return got_revision;
 }
 
+static unsigned int count_objects(void)
+{
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < get_max_object_index(); i++)
+		if (get_indexed_object(i))
+			nr++;
+	return nr;
+}
+
+static int run_pooled_walks(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		struct object_pool *pool = push_object_pool("walk");
+		if (!run_revision_walk())
+			return 1;
+		alloc_report();
+		pop_object_pool(pool);
+		printf("objects left: %u\n", count_objects());
+	}
+	return 0;
+}
+
+static int parse_outer_commit_in_pool(void)
+{
+	unsigned char sha1[20];
+	struct commit *head;
+	struct object_pool *pool;
+
+	if (get_sha1("HEAD", sha1))
+		return 1;
+	head = lookup_commit(sha1);
+
+	pool = push_object_pool("parents");
+	if (parse_commit(head) || !head->parents)
+		return 1;
+	print_commit(head->parents->item);
+	pop_object_pool(pool);
+
+	printf("parsed: %d, objects left: %u\n",
+	       head->object.parsed, count_objects());
+	if (parse_commit(head) || !head->parents)
+		return 1;
+	print_commit(head->parents->item);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	if (argc < 2)
@@ -61,6 +111,12 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (!strcmp(argv[1], "pooled-walks"))
+		return run_pooled_walks();
+
+	if (!strcmp(argv[1], "outer-commit"))
+		return parse_outer_commit_in_pool();
+
 	fprintf(stderr, "check usage\n");
 	return 1;
 }
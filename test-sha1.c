@@ -1,4 +1,76 @@
 #include "cache.h"
+#include "sha1-multi.h"
+
+static uint32_t next_rand(uint64_t *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 33;
+}
+
+/*
+ * Usage: test-sha1 --multi <count> <size> [<impl>...]
+ *
+ * Hash <count> messages of about <size> bytes each with every named
+ * sha1_multi() implementation (all available ones by default), check
+ * the digests against git_SHA1_*() and report the throughput.
+ */
+static int multi(int ac, char **av)
+{
+	static const char *all[] = { "scalar", "sse2", "avx2" };
+	int count = strtol(av[0], NULL, 10);
+	size_t size = strtoul(av[1], NULL, 10);
+	const char **impls = ac > 2 ? (const char **)av + 2 : all;
+	int nr_impls = ac > 2 ? ac - 2 : ARRAY_SIZE(all);
+	struct sha1_multi_msg *msg = xcalloc(count, sizeof(*msg));
+	unsigned char (*expect)[20] = xmalloc(count * 20);
+	unsigned char (*actual)[20] = xmalloc(count * 20);
+	uint64_t seed = 1, total = 0, start;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		/* sizes between size/2 and 3*size/2, like a mix of objects */
+		size_t len = size / 2 + next_rand(&seed) % (size + 1);
+		char *buf = xmalloc(len + 1);
+		char *hdr = xmalloc(32);
+
+		for (j = 0; j < len; j++)
+			buf[j] = next_rand(&seed);
+		msg[i].hdrlen = sprintf(hdr, "blob %lu", (unsigned long)len) + 1;
+		msg[i].hdr = hdr;
+		msg[i].buf = buf;
+		msg[i].len = len;
+		total += msg[i].hdrlen + len;
+	}
+
+	start = getnanotime();
+	for (i = 0; i < count; i++) {
+		git_SHA_CTX ctx;
+		git_SHA1_Init(&ctx);
+		git_SHA1_Update(&ctx, msg[i].hdr, msg[i].hdrlen);
+		git_SHA1_Update(&ctx, msg[i].buf, msg[i].len);
+		git_SHA1_Final(expect[i], &ctx);
+	}
+	printf("%-8s %10.1f MB/s\n", "one-by-one",
+	       total * 1e3 / (getnanotime() - start + 1));
+
+	for (j = 0; j < nr_impls; j++) {
+		if (sha1_multi_select(impls[j])) {
+			printf("%-8s %10s\n", impls[j], "n/a");
+			continue;
+		}
+		memset(actual, 0, count * 20);
+		for (i = 0; i < count; i++)
+			msg[i].sha1 = actual[i];
+		start = getnanotime();
+		sha1_multi(msg, count);
+		printf("%-8s %10.1f MB/s\n", impls[j],
+		       total * 1e3 / (getnanotime() - start + 1));
+		for (i = 0; i < count; i++)
+			if (hashcmp(expect[i], actual[i]))
+				die("%s: wrong digest for message %d", impls[j], i);
+	}
+	return 0;
+}
 
 int main(int ac, char **av)
 {
@@ -8,6 +80,9 @@ int main(int ac, char **av)
 	int binary = 0;
 	char *buffer;
 
+	if (ac >= 4 && !strcmp(av[1], "--multi"))
+		return multi(ac - 2, av + 2);
+
 	if (ac == 2) {
 		if (!strcmp(av[1], "-b"))
 			binary = 1;
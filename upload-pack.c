@@ -14,6 +14,8 @@
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -49,6 +51,17 @@ static int use_sideband;
 static int advertise_refs;
 static int stateless_rpc;
 
+/*
+ * With uploadpack.packCache, the packs sent are kept in that directory,
+ * named after a digest of the request and of our refs, and sent again
+ * as they are to whoever makes the same request.
+ */
+static const char *pack_cache_dir;
+static unsigned long pack_cache_size = 1024 * 1024 * 1024;
+static struct lock_file pack_cache_lock;
+static int pack_cache_filling;
+static unsigned long pack_cache_filled;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -78,6 +91,198 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
+static int add_cache_key_shallow(const struct commit_graft *graft, void *cb_data)
+{
+	if (graft->nr_parent == -1)
+		string_list_append(cb_data, xstrfmt("shallow %s",
+					sha1_to_hex(graft->sha1)));
+	return 0;
+}
+
+static int add_cache_key_ref(const char *refname, const unsigned char *sha1,
+			     int flag, void *cb_data)
+{
+	string_list_append(cb_data, xstrfmt("ref %s %s", sha1_to_hex(sha1),
+					    refname));
+	return 0;
+}
+
+/*
+ * The cache entry for this request: everything that goes into the
+ * pack-objects command line and its input, and the refs, which
+ * --include-tag looks at.
+ */
+static void pack_cache_path(struct strbuf *path)
+{
+	struct string_list key = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	int i;
+
+	for (i = 0; i < want_obj.nr; i++)
+		string_list_append(&key, xstrfmt("want %s",
+				sha1_to_hex(want_obj.objects[i].item->sha1)));
+	for (i = 0; i < have_obj.nr; i++)
+		string_list_append(&key, xstrfmt("have %s",
+				sha1_to_hex(have_obj.objects[i].item->sha1)));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		string_list_append(&key, xstrfmt("edge %s",
+				sha1_to_hex(extra_edge_obj.objects[i].item->sha1)));
+	if (shallow_nr)
+		for_each_commit_graft(add_cache_key_shallow, &key);
+	head_ref(add_cache_key_ref, &key);
+	for_each_ref(add_cache_key_ref, &key);
+	if (use_thin_pack)
+		string_list_append(&key, xstrdup("thin-pack"));
+	if (use_ofs_delta)
+		string_list_append(&key, xstrdup("ofs-delta"));
+	if (use_include_tag)
+		string_list_append(&key, xstrdup("include-tag"));
+	sort_string_list(&key);
+
+	git_SHA1_Init(&ctx);
+	for_each_string_list_item(item, &key)
+		git_SHA1_Update(&ctx, item->string, strlen(item->string) + 1);
+	git_SHA1_Final(sha1, &ctx);
+	string_list_clear(&key, 0);
+
+	strbuf_addf(path, "%s/%s.pack", pack_cache_dir, sha1_to_hex(sha1));
+}
+
+/*
+ * Send the cached pack at path, if there is one.  Return 0 when it
+ * was sent, -1 when there is none (nothing has been sent then), and
+ * 1 when it could not be read after all.
+ */
+static int send_cached_pack(const char *path)
+{
+	char data[8192];
+	ssize_t sz;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	sz = read_in_full(fd, data, 4);
+	if (sz != 4 || memcmp(data, "PACK", 4)) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	/* the least recently used entries are evicted first */
+	utime(path, NULL);
+
+	do {
+		reset_timeout();
+		if (send_client_data(1, data, sz) < 0)
+			break;
+	} while ((sz = xread(fd, data, sizeof(data))) > 0);
+	close(fd);
+	if (sz)
+		return 1;
+	if (use_sideband)
+		packet_flush(1);
+	return 0;
+}
+
+/* Keep a copy of what is sent, unless it grows too big for the cache */
+static void fill_pack_cache(const char *data, ssize_t sz)
+{
+	if (!pack_cache_filling)
+		return;
+	pack_cache_filled += sz;
+	if (pack_cache_filled > pack_cache_size ||
+	    write_in_full(pack_cache_lock.fd, data, sz) != sz) {
+		rollback_lock_file(&pack_cache_lock);
+		pack_cache_filling = 0;
+	}
+}
+
+struct pack_cache_entry {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int pack_cache_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_cache_entry *a = a_, *b = b_;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+/* a lock this old was left behind by a process that died */
+#define PACK_CACHE_STALE_LOCK (12 * 3600)
+
+static int pack_cache_lock_is_stale(const struct stat *st)
+{
+	return time(NULL) - st->st_mtime > PACK_CACHE_STALE_LOCK;
+}
+
+/*
+ * Remove the least recently used entries until the cache fits its size,
+ * and any stale locks.  Only names of the form "<sha1>.pack" and
+ * "<sha1>.pack.lock" are ours; everything else in the directory is left
+ * alone.
+ */
+static void evict_pack_cache(void)
+{
+	struct pack_cache_entry *entry = NULL;
+	int nr = 0, alloc = 0, i;
+	uint64_t total = 0;
+	struct dirent *de;
+	DIR *dir = opendir(pack_cache_dir);
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		unsigned char sha1[20];
+		struct stat st;
+		char *path;
+		int is_lock;
+
+		if (get_sha1_hex(de->d_name, sha1))
+			continue;
+		if (!strcmp(de->d_name + 40, ".pack"))
+			is_lock = 0;
+		else if (!strcmp(de->d_name + 40, ".pack.lock"))
+			is_lock = 1;
+		else
+			continue;
+		path = xstrfmt("%s/%s", pack_cache_dir, de->d_name);
+		if (stat(path, &st)) {
+			free(path);
+			continue;
+		}
+		if (is_lock) {
+			/* a pack being written still counts against the size */
+			if (pack_cache_lock_is_stale(&st))
+				unlink(path);
+			else
+				total += st.st_size;
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entry, nr + 1, alloc);
+		entry[nr].path = path;
+		entry[nr].size = st.st_size;
+		entry[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(entry, nr, sizeof(*entry), pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_size && !unlink(entry[i].path))
+			total -= entry[i].size;
+		free(entry[i].path);
+	}
+	free(entry);
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects;
@@ -89,6 +294,30 @@ static void create_pack_file(void)
 	const char *argv[12];
 	int i, arg = 0;
 	FILE *pipe_fd;
+	struct strbuf cache_path = STRBUF_INIT;
+	struct strbuf lock_path = STRBUF_INIT;
+	struct stat st;
+
+	if (pack_cache_dir) {
+		pack_cache_path(&cache_path);
+		switch (send_cached_pack(cache_path.buf)) {
+		case 0:
+			strbuf_release(&cache_path);
+			return;
+		case 1:
+			goto fail;
+		}
+		mkdir(pack_cache_dir, 0777);
+		strbuf_addf(&lock_path, "%s.lock", cache_path.buf);
+		if (!stat(lock_path.buf, &st) && pack_cache_lock_is_stale(&st))
+			unlink(lock_path.buf);
+		strbuf_release(&lock_path);
+		if (hold_lock_file_for_update(&pack_cache_lock,
+					      cache_path.buf, 0) >= 0) {
+			pack_cache_filling = 1;
+			pack_cache_filled = 0;
+		}
+	}
 
 	if (shallow_nr) {
 		argv[arg++] = "--shallow-file";
@@ -229,6 +458,7 @@ static void create_pack_file(void)
 			sz = send_client_data(1, data, sz);
 			if (sz < 0)
 				goto fail;
+			fill_pack_cache(data, sz);
 		}
 
 		/*
@@ -258,13 +488,19 @@ static void create_pack_file(void)
 		sz = send_client_data(1, data, 1);
 		if (sz < 0)
 			goto fail;
+		fill_pack_cache(data, sz);
 		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	if (pack_cache_filling && !commit_lock_file(&pack_cache_lock))
+		evict_pack_cache();
+	strbuf_release(&cache_path);
 	return;
 
  fail:
+	if (pack_cache_filling)
+		rollback_lock_file(&pack_cache_lock);
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -303,9 +539,56 @@ static int got_sha1(char *hex, unsigned char *sha1)
 	return 0;
 }
 
+/*
+ * With a bitmap index, we keep what the first want not yet known to be
+ * common can reach, as ok_to_give_up() asks about that want again after
+ * every new have, and only test the new haves against it.
+ */
+static struct commit *reach_want;
+static struct bitmap *reach_bitmap;
+static int reach_haves_checked;
+
+static int reachable_from_bitmaps(struct commit *want)
+{
+	if (want != reach_want) {
+		bitmap_free(reach_bitmap);
+		reach_bitmap = bitmap_reachable_from(want);
+		reach_want = want;
+		reach_haves_checked = 0;
+	}
+	if (!reach_bitmap)
+		return -1;
+
+	for (; reach_haves_checked < have_obj.nr; reach_haves_checked++) {
+		struct object *o = have_obj.objects[reach_haves_checked].item;
+		struct commit_list *parents;
+
+		if (o->type != OBJ_COMMIT)
+			continue;
+		if (bitmap_has_commit(reach_bitmap, (struct commit *)o))
+			goto common;
+		/* got_sha1() marked the parents as THEY_HAVE, too */
+		for (parents = ((struct commit *)o)->parents;
+		     parents;
+		     parents = parents->next)
+			if (bitmap_has_commit(reach_bitmap, parents->item))
+				goto common;
+	}
+	return 0;
+
+common:
+	want->object.flags |= COMMON_KNOWN;
+	return 1;
+}
+
 static int reachable(struct commit *want)
 {
 	struct commit_list *work = NULL;
+	int ret;
+
+	ret = reachable_from_bitmaps(want);
+	if (ret >= 0)
+		return ret;
 
 	commit_list_insert_by_date(want, &work);
 	while (work) {
@@ -786,7 +1069,10 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
 			keepalive = -1;
-	}
+	} else if (!strcmp("uploadpack.packcache", var))
+		return git_config_pathname(&pack_cache_dir, var, value);
+	else if (!strcmp("uploadpack.packcachesize", var))
+		pack_cache_size = git_config_ulong(var, value);
 	return parse_hide_refs_config(var, value, "uploadpack");
 }
 